@@ -11,6 +11,8 @@ namespace std {
 %{
 /* Includes the header in the wrapper code */
 #include "libplump/hpyp_model.h"
+#include "libplump/frozen_hpyp_model.h"
+#include "libplump/streaming_session.h"
 #include "libplump/config.h"
 #include "libplump/utils.h"
 #include "libplump/node_manager_interface.h"
@@ -20,6 +22,7 @@ namespace std {
 #include "libplump/hpyp_restaurants.h"
 #include "libplump/hpyp_parameters_interface.h"
 #include "libplump/hpyp_parameters.h"
+#include "libplump/parameter_optimizer.h"
 #include "libplump/random.h"
 #include "libplump/serialization.h"
 #include "libplump/pyp_sample.h"
@@ -45,6 +48,7 @@ typedef int int32_t;
 }}
 
 %ignore getDFSPathIterator;
+%newobject gatsby::libplump::FrozenHPYPModel::load;
 
 /* Parse the header file to generate wrappers */
 %include "libplump/config.h"
@@ -57,8 +61,11 @@ typedef int int32_t;
 %include "libplump/hpyp_parameters_interface.h"
 %include "libplump/hpyp_restaurants.h"
 %include "libplump/hpyp_parameters.h"
+%include "libplump/parameter_optimizer.h"
 %include "libplump/random.h"
 %include "libplump/hpyp_model.h"
+%include "libplump/frozen_hpyp_model.h"
+%include "libplump/streaming_session.h"
 %include "libplump/pyp_sample.h"
 %include "libplump/stirling.h"
  
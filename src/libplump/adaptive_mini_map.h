@@ -0,0 +1,248 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADAPTIVE_MINI_MAP_H_
+#define ADAPTIVE_MINI_MAP_H_
+
+#include <algorithm>
+
+#include "libplump/inline_mini_map.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * An InlineMiniMap for integer keys that adds a direct-indexed lookup table
+ * once it holds at least DENSE_THRESHOLD elements, so that lookups in maps
+ * with a large number of elements (e.g. the child maps of nodes close to the
+ * root of the context tree) take constant time instead of a binary search.
+ *
+ * The table maps each key in [0, range) to its position in the sorted
+ * arrays, so that iteration, find() and serialization behave exactly as for
+ * InlineMiniMap; keys outside the table's range (negative keys, or keys
+ * beyond range, which is bounded by DENSE_MAX_RATIO times the size to keep
+ * the table small for sparse keys) are found by searching as before.
+ *
+ * The table is dropped again when the map shrinks below DENSE_THRESHOLD/2
+ * elements. Maps without a table only pay for one pointer.
+ */
+template<class Key, class T, unsigned int N = 3,
+         unsigned int DENSE_THRESHOLD = 32,
+         typename size_type = unsigned int>
+class AdaptiveMiniMap : public InlineMiniMap<Key, T, N, size_type> {
+  typedef InlineMiniMap<Key, T, N, size_type> Base;
+
+  public:
+    typedef typename Base::key_type key_type;
+    typedef typename Base::mapped_type mapped_type;
+    typedef typename Base::value_type value_type;
+    typedef typename Base::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    // upper bound on the ratio of table entries to elements
+    static const size_type DENSE_MAX_RATIO = 16;
+
+    AdaptiveMiniMap() : Base(), dense(NULL) {}
+
+    AdaptiveMiniMap(const AdaptiveMiniMap& other) : Base(other), dense(NULL) {
+      rebuildIndex();
+    }
+
+    AdaptiveMiniMap& operator=(const AdaptiveMiniMap& other) {
+      if (this != &other) {
+        Base::operator=(other);
+        rebuildIndex();
+      }
+      return *this;
+    }
+
+    ~AdaptiveMiniMap() {
+      freeIndex();
+    }
+
+    void clear() {
+      Base::clear();
+      freeIndex();
+    }
+
+    void swap(AdaptiveMiniMap& other) {
+      Base::swap(other);
+      std::swap(dense, other.dense);
+    }
+
+    /**
+     * Returns true if lookups use the direct-indexed table.
+     */
+    bool isDense() const {
+      return dense != NULL;
+    }
+
+    size_type count(const Key& x) const {
+      if (this->find(x) != this->end()) {
+        return 1;
+      } else {
+        return 0;
+      }
+    }
+
+    const_iterator find(const Key& key) const {
+      if (inIndex(key)) {
+        size_type position = dense[1 + key];
+        if (position == 0) {
+          return this->end();
+        }
+        return const_iterator(this->keys, this->values,
+                              this->keys + position - 1);
+      }
+      return Base::find(key);
+    }
+
+    size_type erase(const Key& key) {
+      size_type offset = this->lowerBound(key);
+      if (offset == this->_size || !(this->keys[offset] == key)) {
+        return 0;
+      }
+      Base::eraseAt(offset);
+      if (inIndex(key)) {
+        dense[1 + key] = 0;
+      }
+      updateIndex(offset);
+      return 1;
+    }
+
+    T& operator[](const Key& key) {
+      if (inIndex(key) && dense[1 + key] != 0) {
+        return this->values[dense[1 + key] - 1];
+      }
+      size_type offset = this->lowerBound(key);
+      if (offset != this->_size && this->keys[offset] == key) {
+        return this->values[offset];
+      }
+      T& value = Base::insert(offset, key, T());
+      updateIndex(offset);
+      return value;
+    }
+
+    const_iterator insert(const_iterator position, const value_type& x) {
+      size_type oldSize = this->_size;
+      Base::insert(position, x);
+      if (this->_size != oldSize) {
+        rebuildIndex();
+      }
+      return find(x.first);
+    }
+
+  private:
+    // NULL, or the lookup table: dense[0] is its range, and dense[1 + key]
+    // is one plus the position of key in the arrays (0 if key is absent)
+    size_type* dense;
+
+    bool inIndex(const Key& key) const {
+      return dense != NULL && key >= 0 && (size_type)key < dense[0];
+    }
+
+    void freeIndex() {
+      delete[] dense;
+      dense = NULL;
+    }
+
+    /**
+     * Return the range of the table for the current elements: the smallest
+     * power of two covering the largest key, bounded by the size.
+     */
+    size_type indexRange() const {
+      Key maxKey = this->keys[this->_size - 1];
+      size_type limit = DENSE_MAX_RATIO * this->_size;
+      size_type range = 64;
+      while (range < limit && maxKey >= 0 && (size_type)maxKey >= range) {
+        range *= 2;
+      }
+      return range;
+    }
+
+    /**
+     * Build the table from scratch, or drop it if the map is too small.
+     */
+    void rebuildIndex() {
+      if (this->_size < DENSE_THRESHOLD) {
+        freeIndex();
+        return;
+      }
+      size_type range = indexRange();
+      if (dense == NULL || dense[0] != range) {
+        freeIndex();
+        dense = new size_type[1 + range];
+        dense[0] = range;
+      }
+      std::fill(dense + 1, dense + 1 + range, (size_type)0);
+      updatePositions(0);
+    }
+
+    /**
+     * Update the table after an element was inserted or removed at offset.
+     */
+    void updateIndex(size_type offset) {
+      if (dense == NULL) {
+        if (this->_size >= DENSE_THRESHOLD) {
+          rebuildIndex();
+        }
+      } else if (this->_size < DENSE_THRESHOLD / 2) {
+        freeIndex();
+      } else if (indexRange() > dense[0]) {
+        rebuildIndex();
+      } else {
+        updatePositions(offset);
+      }
+    }
+
+    void updatePositions(size_type offset) {
+      for (size_type i = offset; i < this->_size; ++i) {
+        if (inIndex(this->keys[i])) {
+          dense[1 + this->keys[i]] = i + 1;
+        }
+      }
+    }
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const {
+      Base::save(ar, version);
+    }
+
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version) {
+      Base::load(ar, version);
+      rebuildIndex();
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+
+template<class Key, class T, unsigned int N, unsigned int DENSE_THRESHOLD,
+         typename size_type>
+void swap(AdaptiveMiniMap<Key, T, N, DENSE_THRESHOLD, size_type>& a,
+          AdaptiveMiniMap<Key, T, N, DENSE_THRESHOLD, size_type>& b) {
+  a.swap(b);
+}
+
+}} // namespace gatsby::libplump
+
+
+#endif /* ADAPTIVE_MINI_MAP_H_ */
@@ -26,6 +26,8 @@
 #include <stdint.h>
 
 #include "libplump/mini_map.h"
+#include "libplump/inline_mini_map.h"
+#include "libplump/adaptive_mini_map.h"
 
 namespace gatsby { namespace libplump {
 
@@ -35,15 +37,15 @@ typedef std::vector<e_type> seq_type;
 
 /*
  * We want an easy way to switch the map type that is used throughout to 
- * test the different performance characteristics.
+ * test the different performance characteristics (InlineMiniMap, MiniMap
+ * and std::map are drop-in alternatives; see "benchmark maps").
  *
  * This should only be typedef'ed to a type that is compatible to the STL map
  * container.
  */
 template<typename K, typename V>
 struct MapType {
-    typedef MiniMap<K,V> Type;
-    //typedef std::map<K,V> Type;
+    typedef AdaptiveMiniMap<K,V> Type;
 };
 
 
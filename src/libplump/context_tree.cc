@@ -20,13 +20,16 @@
 #include "libplump/context_tree.h"
 
 #include <sstream>
+#include <cassert>
 #include "libplump/subseq.h"
 #include "libplump/utils.h"
 
 namespace gatsby { namespace libplump {
 
 ContextTree::ContextTree(INodeManager& nodeManager, seq_type& seq) 
-    : nm(nodeManager), seq(seq) {
+    : nm(nodeManager), seq(seq), useSuffixLinks(true), linksValid(false),
+      leafPayload(NULL), activeStart(0), activeEnd(0), activePath(), nextActivePath(),
+      indicators() {
   root = nm.getRoot();
 }
 
@@ -67,10 +70,192 @@ l_type ContextTree::suffixUntilCheck(l_type thisStart,
 }
 
 
-ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end) 
-{
+void ContextTree::setLeafPayload(void* leafPayload) {
+  this->leafPayload = leafPayload;
+}
+
+
+void ContextTree::setPayload(WrappedNode& node, void* payload) {
+  this->nm.setPayload(node.node, payload);
+  node.payload = payload;
+}
+
+
+void ContextTree::setUseSuffixLinks(bool useSuffixLinks) {
+  this->useSuffixLinks = useSuffixLinks;
+  if (!useSuffixLinks) {
+    invalidateSuffixLinks();
+  }
+}
+
+
+void ContextTree::invalidateSuffixLinks() {
+  linksValid = false;
+  activePath.clear();
+  indicators.clear();
+}
+
+
+ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end) {
+  InsertionResult result;
+  insert(start, end, result);
+  return result;
+}
+
+
+void ContextTree::insert(l_type start, l_type end, InsertionResult& result) {
+  result.path.clear();
+  result.created = true;
+  if (useSuffixLinks) {
+    if (linksValid && start == activeStart && end == activeEnd + 1) {
+      insertIncremental(start, end, result);
+      return;
+    }
+    if (end == start + 1 && nm.getChildren(root).empty()) {
+      // empty tree: start a new run of incremental insertions
+      invalidateSuffixLinks();
+      linksValid = true;
+      activeStart = start;
+      activeEnd = start;
+      activePath.push_back(root);
+      insertIncremental(start, end, result);
+      return;
+    }
+    if (linksValid) {
+      invalidateSuffixLinks();
+    }
+  }
+  insertFromRoot(start, end, result);
+}
+
+
+void ContextTree::insertIncremental(l_type start, l_type end,
+                                    InsertionResult& result) {
+  tracer << "ContextTree::insertIncremental(" << start << ", " << end << ")"
+         << std::endl;
+  WrappedNodeList& path = result.path;
+  e_type symbol = seq[end - 1];
+
+  // Walk up from the previous context [start, end-1) to the deepest node v
+  // such that symbol.v occurs in the tree. By Weiner's lemma symbol.v is the
+  // longest prefix of [start, end) that is already in the tree, so its length
+  // is all we need to find the insertion point.
+  // After the insertion symbol will occur in front of every node on the
+  // previous path, so we record that on the way up. 
+  //
+  // Nodes without children store their symbols only if leaves have been
+  // removed around them (see removeLeaf()): the previous context is the
+  // longest string in the tree, hence always a leaf, and a leaf [start, k) is
+  // otherwise only ever preceded by seq[k] (in context [start, k+1)).
+  size_t v = activePath.size() - 1;
+  if (v > 0) {
+    --v;
+  }
+  while (v > 0 && !indicators.insert(activePath[v], symbol)) {
+    --v;
+  }
+  l_type matchLength;
+  if (v > 0) {
+    matchLength = nm.getEnd(activePath[v]) - nm.getStart(activePath[v]) + 1;
+  } else {
+    matchLength = (nm.getChild(root, symbol) != NULL) ? 1 : 0;
+  }
+
+  // Descend from the root to the insertion point, using only the lengths of
+  // the nodes for the first matchLength symbols, which are known to match.
+  // Removing leaves can leave the sets smaller than they should be (and the
+  // previous context may have been removed), so beyond that the context is
+  // compared against the nodes as in insertFromRoot(); without removals the
+  // first comparison fails.
+  std::vector<NodeId>& newPath = nextActivePath;
+  newPath.clear();
+  NodeId current = root;
+  l_type depth = 0;
+  l_type curLength = 0;
+  path.push_back(wrap(root, 0));
+  newPath.push_back(root);
+  result.action = InsertionResult::INSERT_ACTION_NO_SPLIT;
+  while (true) {
+    if (curLength == end - start) { // context is already in the tree
+      result.created = false;
+      break;
+    }
+    e_type key = seq[end - 1 - curLength];
+    NodeId child = nm.getChild(current, key);
+    if (child == NULL) {
+      assert(curLength >= matchLength);
+      if (current != root && !indicators.contains(current)) {
+        // current becomes an inner node: store its symbol explicitly
+        indicators.insert(current, seq[nm.getEnd(current)]);
+      }
+      NodeId leaf = nm.setChild(current, key, start, end, leafPayload);
+      // The payload of the parent may have changed!
+      path.back().payload = nm.getPayload(current);
+      path.push_back(WrappedNode(start, end, nm.getPayload(leaf), depth + 1,
+                                 leaf));
+      newPath.push_back(leaf);
+      break;
+    }
+    l_type childStart = nm.getStart(child);
+    l_type childEnd = nm.getEnd(child);
+    l_type childLength = childEnd - childStart;
+    l_type common = childLength;
+    if (childLength > matchLength) {
+      common = suffixUntilCheck(childStart, childEnd, start, end,
+                                std::max(matchLength, curLength + 1));
+    }
+    if (common < childLength) { 
+      // The insertion point is on the edge to child: insert a node C for
+      // the common suffix between current and child (see insertFromRoot).
+      e_type oldNodeKey = seq[childEnd - 1 - common];
+      NodeId newParent = nm.insertBetween(current,
+                                          key,
+                                          childEnd - common,
+                                          childEnd,
+                                          oldNodeKey);
+      result.splitChild = wrap(child, depth + 1);
+      path.push_back(WrappedNode(childEnd - common,
+                                 childEnd,
+                                 nm.getPayload(newParent),
+                                 depth + 1,
+                                 newParent));
+      newPath.push_back(newParent);
+
+      // everything that occurs in front of child also occurs in front of C
+      if (indicators.contains(child)) {
+        indicators.copy(child, newParent);
+      } else {
+        indicators.insert(newParent, seq[childEnd]);
+      }
+
+      if (end - start > common) {
+        e_type childKey = seq[end - 1 - common];
+        NodeId leaf = nm.setChild(newParent, childKey, start, end,
+                                  leafPayload);
+        path.push_back(WrappedNode(start, end, nm.getPayload(leaf), depth+2,
+                                   leaf));
+        newPath.push_back(leaf);
+        result.action = InsertionResult::INSERT_ACTION_SPLIT;
+      } else {
+        result.action = InsertionResult::INSERT_ACTION_SPLIT_SUFFIX;
+      }
+      break;
+    }
+    path.push_back(wrap(child, depth + 1));
+    newPath.push_back(child);
+    current = child;
+    curLength = childLength;
+    depth++;
+  }
+
+  activePath.swap(newPath);
+  activeEnd = end;
+}
+
+
+void ContextTree::insertFromRoot(l_type start, l_type end,
+                                 InsertionResult& result) {
   tracer << "ContextTree::insert(" << start << ", " << end << ")" << std::endl;
-  ContextTree::InsertionResult result;
   l_type offset = 0;
   WrappedNodeList& path = result.path;
   NodeId current = root;
@@ -83,7 +268,7 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
     l_type curLength = curEnd - curStart;
 
     // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
+    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth, current);
     path.push_back(n);
 
     // determine the length l of the longest common suffix with s
@@ -92,6 +277,7 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
     if (curLength == longestSuffixLen) { // if context is fully consumed
       if (curLength == end - start) { // context is already in the tree!
         result.action = InsertionResult::INSERT_ACTION_NO_SPLIT;
+        result.created = false;
         break;
       }
       // determine key for the child pointer
@@ -105,10 +291,11 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
         depth++;
         continue;
       } else {
-        child = nm.setChild(current, key, start, end);
+        child = nm.setChild(current, key, start, end, leafPayload);
         // The payload of the parent may have changed!
         path.back().payload = nm.getPayload(current);
-        WrappedNode wrapped_child(start, end, nm.getPayload(child), depth + 1);
+        WrappedNode wrapped_child(start, end, nm.getPayload(child), depth + 1,
+                                  child);
         path.push_back(wrapped_child);
         result.action = InsertionResult::INSERT_ACTION_NO_SPLIT;
         break;
@@ -141,14 +328,17 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
       path.push_back(WrappedNode(shorterStart,
                                  curEnd,
                                  nm.getPayload(newParent),
-                                 depth));
+                                 depth,
+                                 newParent));
 
       // if C is a proper suffix of X, insert X as a child of C
       // and push C onto the path
       if (end - start > curEnd - shorterStart) {
         e_type childKey = seq[end - longestSuffixLen - 1];
-        NodeId child = nm.setChild(newParent, childKey, start, end);
-        path.push_back(WrappedNode(start, end, nm.getPayload(child),depth+1));
+        NodeId child = nm.setChild(newParent, childKey, start, end,
+                                   leafPayload);
+        path.push_back(WrappedNode(start, end, nm.getPayload(child),depth+1,
+                                   child));
         result.action = InsertionResult::INSERT_ACTION_SPLIT;
       } else {   
         result.action = InsertionResult::INSERT_ACTION_SPLIT_SUFFIX;
@@ -156,7 +346,82 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
       break;
     }
   }
-  return result;
+}
+
+
+void ContextTree::findPath(NodeId node, WrappedNodeList& path) const {
+  l_type end = nm.getEnd(node);
+  path.clear();
+  NodeId current = root;
+  l_type curLength = 0;
+  l_type depth = 0;
+  path.push_back(wrap(root, 0));
+  while (current != node) {
+    // the node is in the tree, so its symbols need not be compared
+    current = nm.getChild(current, seq[end - 1 - curLength]);
+    assert(current != NULL);
+    curLength = nm.getEnd(current) - nm.getStart(current);
+    depth++;
+    path.push_back(wrap(current, depth));
+  }
+}
+
+
+void ContextTree::removeLeaf(const WrappedNodeList& path) {
+  assert(path.size() > 1);
+  const WrappedNode& parent = path[path.size() - 2];
+  const WrappedNode& leaf = path.back();
+  assert(nm.getChildren(leaf.node).empty());
+  if (linksValid) {
+    eraseLeafSymbol(parent, leaf);
+  }
+  indicators.erase(leaf.node);
+  nm.removeChild(parent.node, seq[leaf.end - 1 - (parent.end - parent.start)]);
+  nm.destroyNode(leaf.node);
+}
+
+
+void ContextTree::eraseLeafSymbol(const WrappedNode& parent,
+                                  const WrappedNode& leaf) {
+  // The strings that disappear with the leaf L = [a, b) are its suffixes
+  // longer than its parent P, so symbol c = seq[b-1] no longer occurs after
+  // the nodes v that are suffixes of [a, b-1) at least as long as P (and
+  // nothing else changes). Follow the child pointers towards [a, b-1)
+  // without comparing the nodes: removing c from a node that only shares
+  // its first symbols with [a, b-1) merely makes its set too small.
+  l_type length = leaf.end - leaf.start - 1;
+  l_type parentLength = parent.end - parent.start;
+  e_type symbol = seq[leaf.end - 1];
+  NodeId current = root;
+  l_type curLength = 0;
+  while (curLength < length) {
+    current = nm.getChild(current, seq[leaf.end - 2 - curLength]);
+    if (current == NULL) {
+      break;
+    }
+    curLength = nm.getEnd(current) - nm.getStart(current);
+    if (curLength > length) {
+      break;
+    }
+    if (curLength >= parentLength) {
+      if (indicators.contains(current)) {
+        indicators.erase(current, symbol);
+      } else if (seq[nm.getEnd(current)] == symbol) {
+        // a leaf preceded only by symbol: store its (empty) set explicitly
+        indicators.ensure(current);
+      }
+    }
+  }
+
+  // P may become a leaf; its set stays explicit
+  if (parent.node != root && nm.getChildren(parent.node).size() == 1) {
+    indicators.ensure(parent.node);
+  }
+
+  // the next insertion walks up from P instead of from the removed context
+  if (!activePath.empty() && activePath.back() == leaf.node) {
+    activePath.pop_back();
+  }
 }
 
 
@@ -165,49 +430,18 @@ ContextTree::InsertionResult ContextTree::insert(l_type start, l_type end)
  * subsequence within the tree.
  */
 WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const {
-  l_type offset = 0;
   WrappedNodeList path;
-  NodeId current = root;
-  NodeId parent;
-  e_type parentKey = 0;
-  l_type depth = 0;
-  bool done = false;
-  while (!done) {
-    l_type curStart = nm.getStart(current);
-    l_type curEnd = nm.getEnd(current);
-    l_type curLength = curEnd - curStart;
-    // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
-    path.push_back(n);
-    // determine the length l of the longest common suffix with s
-    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd, 
-                                               start, end, offset);
-    if (curLength == longestSuffixLen) { // if context is fully consumed
-      if (curLength == end - start) { // no more input to consume
-        done = true;
-      } else {
-        // determine key for the child pointer
-        e_type key = seq[end - 1 - curLength];
-        current = nm.getChild(current,key);
-        if (current == NULL) {
-          done = true;
-          break;
-        }
-        offset = curLength;
-        parent = current;
-        parentKey = key;
-        depth++;
-      }
-    } else {
-      // drop last node from path as it would have to be split
-      path.pop_back();
-      done = true;
-    }
-  }
+  findLongestSuffix(start, end, path);
   return path;
 }
 
 
+void ContextTree::findLongestSuffix(l_type start, l_type end,
+                                    WrappedNodeList& path) const {
+  findLongestSuffixImpl(VirtualNodeAccess(nm), start, end, false, path);
+}
+
+
 /**
  * Find the path to the node which is the longest suffix of the given
  * subsequence within the tree.
@@ -215,54 +449,23 @@ WrappedNodeList ContextTree::findLongestSuffix (l_type start, l_type end) const
 std::pair<int,WrappedNodeList> ContextTree::findLongestSuffixVirtual(
     l_type start, l_type end) const {
   std::pair<int,WrappedNodeList> ret;
-  ret.first = 0;
-  l_type offset = 0;
-  WrappedNodeList& path = ret.second;
-  NodeId current = root;
-  NodeId parent;
-  e_type parentKey = 0;
-  l_type depth = 0;
-  bool done = false;
-  while (!done) {
-    l_type curStart = nm.getStart(current);
-    l_type curEnd = nm.getEnd(current);
-    l_type curLength = curEnd - curStart;
-    // wrap the current node and put it in the list
-    WrappedNode n(curStart, curEnd, nm.getPayload(current), depth);
-    path.push_back(n);
-    // determine the length l of the longest common suffix with s
-    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd, 
-                                               start, end, offset);
-    if (curLength == longestSuffixLen) { // if context is fully consumed
-      if (curLength == end - start) { // no more input to consume
-        done = true;
-      } else {
-        // determine key for the child pointer
-        e_type key = seq[end - 1 - curLength];
-        current = nm.getChild(current,key);
-        if (current == NULL) {
-          done = true;
-          break;
-        }
-        offset = curLength;
-        parent = current;
-        parentKey = key;
-        depth++;
-      }
-    } else {
-      ret.first = longestSuffixLen; // length of 
-      done = true;
-    }
-  }
+  ret.first = findLongestSuffixVirtual(start, end, ret.second);
   return ret;
 }
 
 
+int ContextTree::findLongestSuffixVirtual(l_type start, l_type end,
+                                          WrappedNodeList& path) const {
+  return findLongestSuffixImpl(VirtualNodeAccess(nm), start, end, true, path);
+}
+
+
 WrappedNode ContextTree::wrap(NodeId node, l_type depth) const {
   return WrappedNode(nm.getStart(node),
                      nm.getEnd(node),
                      nm.getPayload(node),
-                     depth); 
+                     depth,
+                     node); 
 }
 
 
@@ -271,7 +474,44 @@ ContextTree::DFSPathIterator ContextTree::getDFSPathIterator() const {
 }
 
 
-std::string ContextTree::pathToString(WrappedNodeList path,
+ContextTree::DFSPathIterator ContextTree::getDFSPathIterator(
+    const Subtree& subtree) const {
+  return ContextTree::DFSPathIterator(subtree.path, subtree.root, nm, *this);
+}
+
+
+void ContextTree::splitAtDepth(int depth,
+                               std::vector<Subtree>& subtrees,
+                               std::vector<WrappedNodeList>& upperPaths) const {
+  WrappedNodeList path;
+  path.push_back(wrap(root, 0));
+  splitAtDepth(root, depth, path, subtrees, upperPaths);
+}
+
+
+void ContextTree::splitAtDepth(NodeId node,
+                               int depth,
+                               WrappedNodeList& path,
+                               std::vector<Subtree>& subtrees,
+                               std::vector<WrappedNodeList>& upperPaths) const {
+  if ((int)path.size() > depth) {
+    subtrees.push_back(Subtree());
+    subtrees.back().root = node;
+    subtrees.back().path = path;
+    return;
+  }
+  upperPaths.push_back(path);
+  INodeManager::ChildMap& children = nm.getChildren(node);
+  for (INodeManager::ChildMap::iterator it = children.begin();
+       it != children.end(); ++it) {
+    path.push_back(wrap((*it).second, path.size()));
+    splitAtDepth((*it).second, depth, path, subtrees, upperPaths);
+    path.pop_back();
+  }
+}
+
+
+std::string ContextTree::pathToString(const WrappedNodeList& path,
                                       bool printString,
                                       bool printPayload) const {
   std::ostringstream outstream;
@@ -315,6 +555,153 @@ std::string ContextTree::toString() const {
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+////////////   ContextTree::IndicatorSets   ////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+ContextTree::IndicatorSets::IndicatorSets() 
+    : slots(), numNodes(0), entries(), freeEntries(0) {
+  clear();
+}
+
+size_t ContextTree::IndicatorSets::home(NodeId node) const {
+  // Node handles that are created close in time tend to be close in value
+  // (pool or arena allocation); keep them close in the table as well.
+  uintptr_t h = reinterpret_cast<uintptr_t>(node);
+  return (size_t)(h ^ (h >> 4) ^ (h >> 24)) & (slots.size() - 1);
+}
+
+size_t ContextTree::IndicatorSets::findSlot(NodeId node) const {
+  size_t mask = slots.size() - 1;
+  size_t i = home(node);
+  while (slots[i].node != NULL && slots[i].node != node) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+void ContextTree::IndicatorSets::grow() {
+  std::vector<Slot> old;
+  old.swap(slots);
+  Slot empty = {NULL, 0};
+  slots.assign(2 * old.size(), empty);
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (old[i].node != NULL) {
+      slots[findSlot(old[i].node)] = old[i];
+    }
+  }
+}
+
+size_t ContextTree::IndicatorSets::ensureSlot(NodeId node) {
+  size_t i = findSlot(node);
+  if (slots[i].node == NULL) {
+    if (2 * (numNodes + 1) > slots.size()) {
+      grow();
+      i = findSlot(node);
+    }
+    slots[i].node = node;
+    slots[i].head = 0;
+    ++numNodes;
+  }
+  return i;
+}
+
+bool ContextTree::IndicatorSets::contains(NodeId node) const {
+  return slots[findSlot(node)].node != NULL;
+}
+
+void ContextTree::IndicatorSets::ensure(NodeId node) {
+  ensureSlot(node);
+}
+
+bool ContextTree::IndicatorSets::insert(NodeId node, e_type symbol) {
+  size_t i = ensureSlot(node);
+  for (uint32_t e = slots[i].head; e != 0; e = entries[e].next) {
+    if (entries[e].symbol == symbol) {
+      return true;
+    }
+  }
+  Entry entry = {symbol, slots[i].head};
+  if (freeEntries != 0) {
+    slots[i].head = freeEntries;
+    freeEntries = entries[freeEntries].next;
+    entries[slots[i].head] = entry;
+  } else {
+    slots[i].head = entries.size();
+    entries.push_back(entry);
+  }
+  return false;
+}
+
+void ContextTree::IndicatorSets::copy(NodeId from, NodeId to) {
+  // inserting into the set of to only takes entries from the free list or 
+  // appends them, so the list of from stays valid (even if the slots are
+  // rehashed); to gets a set even if that of from is empty
+  ensureSlot(to);
+  uint32_t e = slots[findSlot(from)].head;
+  for (; e != 0; e = entries[e].next) {
+    insert(to, entries[e].symbol);
+  }
+}
+
+void ContextTree::IndicatorSets::erase(NodeId node, e_type symbol) {
+  size_t i = findSlot(node);
+  uint32_t* link = &slots[i].head;
+  while (*link != 0 && entries[*link].symbol != symbol) {
+    link = &entries[*link].next;
+  }
+  if (*link != 0) {
+    uint32_t e = *link;
+    *link = entries[e].next;
+    entries[e].next = freeEntries;
+    freeEntries = e;
+  }
+}
+
+void ContextTree::IndicatorSets::erase(NodeId node) {
+  size_t i = findSlot(node);
+  if (slots[i].node == NULL) {
+    return;
+  }
+  // move the entries to the free list
+  uint32_t e = slots[i].head;
+  if (e != 0) {
+    while (entries[e].next != 0) {
+      e = entries[e].next;
+    }
+    entries[e].next = freeEntries;
+    freeEntries = slots[i].head;
+  }
+  --numNodes;
+
+  // Backward shift deletion: move later slots of the probe sequence into
+  // the hole unless that would put them in front of their home slot.
+  size_t mask = slots.size() - 1;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & mask;
+    if (slots[j].node == NULL) {
+      break;
+    }
+    size_t k = home(slots[j].node);
+    bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+    if (!stays) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i].node = NULL;
+  slots[i].head = 0;
+}
+
+void ContextTree::IndicatorSets::clear() {
+  Slot empty = {NULL, 0};
+  std::vector<Slot>(1024, empty).swap(slots);
+  numNodes = 0;
+  Entry terminator = {0, 0};
+  std::vector<Entry>(1, terminator).swap(entries);
+  freeEntries = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////   ContextTree::ToStringVisitor   //////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -346,6 +733,22 @@ ContextTree::DFSPathIterator::DFSPathIterator(NodeId root,
   }
 }
 
+ContextTree::DFSPathIterator::DFSPathIterator(const WrappedNodeList& prefix,
+                                              NodeId root, 
+                                              const INodeManager& nm, 
+                                              const ContextTree& ct) 
+    : root(root), nm(nm), ct(ct), currentPath(prefix) {
+  IteratorState r(this->nm, this->root);
+  this->iteratorStateStack.push(r);
+  int j = prefix.size();
+  while (this->iteratorStateStack.top().moreChildren()) {
+    IteratorState c(this->nm,this->iteratorStateStack.top().pop());
+    this->iteratorStateStack.push(c);
+    this->currentPath.push_back(ct.wrap(c.node,j));
+    ++j;
+  }
+}
+
 WrappedNodeList& ContextTree::DFSPathIterator::operator*() {
   return this->currentPath;
 }
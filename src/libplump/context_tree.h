@@ -20,10 +20,12 @@
 #ifndef CONTEXT_TREE_H_
 #define CONTEXT_TREE_H_
 
+#include <cassert>
 #include <list>
 #include <string>
 #include <sstream>
 #include <stack>
+#include <vector>
 #include "libplump/config.h"
 #include "libplump/node_manager_interface.h"
 
@@ -45,7 +47,10 @@ class WrappedNode {
   // non-owning pointer
   void* payload;
 
-  WrappedNode() : start(0), end(0), depth(0), payload(NULL) {}
+  // handle of the node in the node manager (INodeManager::NodeId)
+  void* node;
+
+  WrappedNode() : start(0), end(0), depth(0), payload(NULL), node(NULL) {}
 
   WrappedNode(const WrappedNode& other) {
     *this = other;
@@ -58,15 +63,18 @@ class WrappedNode {
    * @param end   End position
    * @param payload Payload for this node (by value!)
    * @param depth Depth of this node in the tree
+   * @param node  Handle of the node in the node manager
    */
-  WrappedNode(l_type start, l_type end, void* payload, l_type depth) : 
-    start(start), end(end), depth(depth), payload(payload) {}
+  WrappedNode(l_type start, l_type end, void* payload, l_type depth,
+              void* node) : 
+    start(start), end(end), depth(depth), payload(payload), node(node) {}
 
   WrappedNode& operator=(const WrappedNode& other) {
     this->start   = other.start;
   	this->end     = other.end;
   	this->depth   = other.depth;
   	this->payload = other.payload;
+  	this->node    = other.node;
   	return *this;
   }
 
@@ -81,20 +89,35 @@ class WrappedNode {
 /**
  * List of WrappedNodes; mainly used for representing pathes through the
  * context tree, e.g. as returned by ContextTree::findLongestSuffix.
+ *
+ * This is a vector rather than a std::list so that a path can be rebuilt in
+ * a reused buffer without touching the heap once the buffer has grown to the
+ * depth of the tree (see the overloads taking an output path).
  */
-typedef std::list<WrappedNode> WrappedNodeList;
+typedef std::vector<WrappedNode> WrappedNodeList;
 
 /**
  * The ContextTree class implements basic operations on context trees 
  * (reverse prefix trees) over arbitrary sequences. These basic operations
  * include inserting a new node into the tree (insert()) and finding the node
  * with the longest common suffix with a given string (findLongestSuffix)
+ *
+ * When contexts [start, start+1), [start, start+2), ... are inserted in 
+ * order into an initially empty tree (as done by HPYPModel::computeLosses),
+ * insert() does not compare the new context against the tree from the root
+ * but uses Weiner links: for every node v it remembers the set of symbols c
+ * such that c.v occurs in the tree. The tree is the suffix tree of the 
+ * reversed sequence and each new context prepends a symbol to the previous
+ * one, so these "reverse suffix links" locate the insertion point without
+ * looking at the sequence beyond a single symbol per node. Leaves can be
+ * removed between such insertions (see removeLeaf()).
  */ 
 class ContextTree {
   public:
     typedef INodeManager::NodeId NodeId;
     class DFSPathIterator; // defined further below
     class InsertionResult; // defined further below
+    struct Subtree; // defined further below
 
 
     ContextTree(INodeManager& nodeManager, seq_type& seq);
@@ -106,22 +129,114 @@ class ContextTree {
      */
     InsertionResult insert(l_type start, l_type end); 
 
+    /**
+     * Same as above, but reuses the path in result.
+     */
+    void insert(l_type start, l_type end, InsertionResult& result);
+
+    /**
+     * Enable or disable incremental insertion using Weiner links (enabled
+     * by default). Disabling it frees the memory used for the links.
+     */
+    void setUseSuffixLinks(bool useSuffixLinks);
+
+    /**
+     * Drop the Weiner links; must be called whenever the structure of the
+     * tree is changed other than through insert() and removeLeaf().
+     * Subsequent insertions will start from the root.
+     */
+    void invalidateSuffixLinks();
+
+    /**
+     * Set the payload given to newly created leaves. By default (NULL) the
+     * node manager makes a new payload for every node; a non-NULL value must
+     * not be owned by the node manager's payload factory, as it is shared by
+     * all new leaves (see ImplicitPayloadRestaurant). Inner nodes created
+     * when splitting a node always get a new payload.
+     */
+    void setLeafPayload(void* leafPayload);
+
+    /**
+     * Replace the payload of the given node, both in the tree and in node;
+     * the node manager recycles the old payload.
+     */
+    void setPayload(WrappedNode& node, void* payload);
+
+    /**
+     * Remove the last node of path, which must be a leaf, from the tree and
+     * destroy it (the node manager recycles its payload). The Weiner links
+     * are repaired, at the cost of one walk down the tree.
+     */
+    void removeLeaf(const WrappedNodeList& path);
+
+    bool isLeaf(NodeId node) const {
+      return nm.getChildren(node).empty();
+    }
+
+    /**
+     * Write the path to the given node, which must be in the tree, into 
+     * path. Follows the child pointers keyed by the context of the node
+     * without comparing it against the nodes on the way.
+     */
+    void findPath(NodeId node, WrappedNodeList& path) const;
+
     /**
      * Find the path to the node which is the longest suffix of the given
      * subsequence within the tree.
      */
     WrappedNodeList findLongestSuffix (l_type start, l_type end) const;
 
+    /**
+     * Same as above, but writes the path into the given (reused) list.
+     */
+    void findLongestSuffix(l_type start, l_type end,
+                           WrappedNodeList& path) const;
+
     /**
      * Find the path to the node which is the longest suffix of the given
      * subsequence within the tree.
      */
     std::pair<int, WrappedNodeList> findLongestSuffixVirtual (l_type start,
                                                               l_type end) const;
+
+    /**
+     * Same as above, but writes the path into the given (reused) list and
+     * returns the first element of the pair.
+     */
+    int findLongestSuffixVirtual(l_type start, l_type end,
+                                 WrappedNodeList& path) const;
+
+    /**
+     * Same as findLongestSuffix (if below is false) or 
+     * findLongestSuffixVirtual (if below is true), but calls the node manager
+     * through its concrete type so that these calls can be inlined. 
+     * NodeManager must be the type of the node manager the tree was 
+     * constructed with.
+     */
+    template<typename NodeManager>
+    int findLongestSuffixStatic(l_type start, l_type end, bool below,
+                                WrappedNodeList& path) const;
     
     DFSPathIterator getDFSPathIterator() const;
 
-    std::string pathToString(WrappedNodeList path, 
+    /**
+     * Iterate over the paths to all nodes of the given subtree; the paths
+     * start at the root of the tree.
+     */
+    DFSPathIterator getDFSPathIterator(const Subtree& subtree) const;
+
+    /**
+     * Split the tree at the given depth (the root has depth 0): the
+     * subtrees rooted at the nodes at that depth are appended to subtrees,
+     * and the paths to all nodes above that depth to upperPaths. Every node
+     * is therefore either on exactly one of the upper paths or in exactly
+     * one of the subtrees.
+     */
+    void splitAtDepth(int depth,
+                      std::vector<Subtree>& subtrees,
+                      std::vector<WrappedNodeList>& upperPaths) const;
+
+    std::string pathToString(const WrappedNodeList& path, 
                              bool printString = false, 
                              bool printPayload = true) const;
 
@@ -156,10 +271,27 @@ class ContextTree {
 
       // the node in which a split occurred that is no longer on the path
       WrappedNode splitChild;
+
+      // false if the context was already in the tree, in which case no
+      // node was created
+      bool created;
     };
 
 
 
+    /**
+     * A subtree of the context tree, as produced by splitAtDepth(). 
+     */
+    struct Subtree {
+      // the root of the subtree
+      NodeId root;
+
+      // the path from the root of the tree to the root of the subtree
+      // (inclusive)
+      WrappedNodeList path;
+    };
+
+
     class ToStringVisitor {
       public:
         ToStringVisitor(seq_type& seq);
@@ -180,6 +312,12 @@ class ContextTree {
       public:
         DFSPathIterator(NodeId root, const INodeManager& nm, 
                         const ContextTree& ct);
+        /**
+         * Iterate over the subtree rooted at root; prefix is the path to
+         * (and including) root.
+         */
+        DFSPathIterator(const WrappedNodeList& prefix, NodeId root,
+                        const INodeManager& nm, const ContextTree& ct);
         WrappedNodeList& operator*();
         DFSPathIterator& operator ++(); // prefix version
         DFSPathIterator operator ++(int); // postfix version
@@ -208,10 +346,137 @@ class ContextTree {
 
 
   private: 
+    /**
+     * Calls the node manager through the INodeManager interface.
+     */
+    class VirtualNodeAccess {
+      public:
+        VirtualNodeAccess(const INodeManager& nm) : nm(nm) {}
+        NodeId getChild(NodeId node, e_type key) const {
+          return nm.getChild(node, key);
+        }
+        void* getPayload(NodeId node) const { return nm.getPayload(node); }
+        l_type getStart(NodeId node) const { return nm.getStart(node); }
+        l_type getEnd(NodeId node) const { return nm.getEnd(node); }
+      private:
+        const INodeManager& nm;
+    };
+
+    /**
+     * Calls the node manager non-virtually through its concrete type.
+     */
+    template<typename NodeManager>
+    class StaticNodeAccess {
+      public:
+        StaticNodeAccess(const INodeManager& nm) 
+            : nm(static_cast<const NodeManager&>(nm)) {}
+        NodeId getChild(NodeId node, e_type key) const {
+          return nm.NodeManager::getChild(node, key);
+        }
+        void* getPayload(NodeId node) const { 
+          return nm.NodeManager::getPayload(node);
+        }
+        l_type getStart(NodeId node) const { 
+          return nm.NodeManager::getStart(node);
+        }
+        l_type getEnd(NodeId node) const { 
+          return nm.NodeManager::getEnd(node);
+        }
+      private:
+        const NodeManager& nm;
+    };
+
+    /**
+     * Common implementation of the findLongestSuffix variants; returns the
+     * length of the common suffix with the node in which the context ends 
+     * partially (0 if there is no such node), and keeps that node on the path
+     * iff below is true.
+     */
+    template<typename NodeAccess>
+    int findLongestSuffixImpl(const NodeAccess& access, 
+                              l_type start, l_type end, bool below,
+                              WrappedNodeList& path) const;
+
+    /**
+     * Sets of symbols attached to nodes, stored compactly: an open 
+     * addressing hash table maps each node to the head of an (unsorted) 
+     * linked list of symbols kept in a single array. Entries of erased sets
+     * are kept on a free list and reused.
+     */
+    class IndicatorSets {
+      public:
+        IndicatorSets();
+        /** Add symbol to the set of node; returns whether it was present. */
+        bool insert(NodeId node, e_type symbol);
+        /** Add the symbols of from to the set of to (creating it). */
+        void copy(NodeId from, NodeId to);
+        /** Whether node has a set (which may be empty). */
+        bool contains(NodeId node) const;
+        /** Give node an empty set unless it has one. */
+        void ensure(NodeId node);
+        /** Remove symbol from the set of node, if present. */
+        void erase(NodeId node, e_type symbol);
+        /** Remove the set of node (e.g. because node is destroyed). */
+        void erase(NodeId node);
+        void clear();
+
+      private:
+        struct Slot {
+          NodeId node;
+          uint32_t head;
+        };
+        struct Entry {
+          e_type symbol;
+          uint32_t next;
+        };
+
+        size_t home(NodeId node) const;
+        size_t findSlot(NodeId node) const;
+        size_t ensureSlot(NodeId node);
+        void grow();
+
+        std::vector<Slot> slots;
+        size_t numNodes;
+        std::vector<Entry> entries; // entry 0 terminates all lists
+        uint32_t freeEntries;       // list of unused entries
+    };
+
     INodeManager& nm;
     seq_type& seq;
     INodeManager::NodeId root;
 
+    // State for incremental insertion: activePath is the path to the 
+    // context [activeStart, activeEnd) inserted last (or to the deepest of
+    // its ancestors left if it has been removed); indicators maps each
+    // node v (other than the root) to the set of symbols c for which c.v 
+    // occurs in the tree. After leaves have been removed a set may lack
+    // some of these symbols, but it never contains any other.
+    bool useSuffixLinks;
+    bool linksValid;
+    void* leafPayload;
+    l_type activeStart, activeEnd;
+    std::vector<NodeId> activePath;
+    std::vector<NodeId> nextActivePath; // reused buffer
+    IndicatorSets indicators;
+
+    /**
+     * Insert [start, end) by comparing it against the tree from the root.
+     */
+    void insertFromRoot(l_type start, l_type end, InsertionResult& result);
+
+    /**
+     * Insert [start, end) using the Weiner links; requires that the last
+     * insertion was [start, end-1) and that the tree has since only been
+     * changed through removeLeaf().
+     */
+    void insertIncremental(l_type start, l_type end, InsertionResult& result);
+
+    /**
+     * Remove the symbol that leaf (a child of parent which is about to be
+     * removed) contributes to the sets of the Weiner links.
+     */
+    void eraseLeafSymbol(const WrappedNode& parent, const WrappedNode& leaf);
+
     /**
      * Determine the first position where the subsequence delimited by start 
      * and end and the subsequence s differ, 
@@ -236,10 +501,70 @@ class ContextTree {
     
     WrappedNode wrap(NodeId node, l_type depth) const;
 
+    /**
+     * Recursive part of splitAtDepth(); path is the path to node.
+     */
+    void splitAtDepth(NodeId node,
+                      int depth,
+                      WrappedNodeList& path,
+                      std::vector<Subtree>& subtrees,
+                      std::vector<WrappedNodeList>& upperPaths) const;
+
 
 
 };
 
+template<typename NodeManager>
+int ContextTree::findLongestSuffixStatic(l_type start, l_type end, bool below,
+                                         WrappedNodeList& path) const {
+  assert(dynamic_cast<const NodeManager*>(&nm) != NULL);
+  return findLongestSuffixImpl(StaticNodeAccess<NodeManager>(nm), 
+                               start, end, below, path);
+}
+
+template<typename NodeAccess>
+int ContextTree::findLongestSuffixImpl(const NodeAccess& access, 
+                                       l_type start, l_type end, bool below,
+                                       WrappedNodeList& path) const {
+  int splitLength = 0;
+  l_type offset = 0;
+  path.clear();
+  NodeId current = root;
+  l_type depth = 0;
+  while (true) {
+    l_type curStart = access.getStart(current);
+    l_type curEnd = access.getEnd(current);
+    l_type curLength = curEnd - curStart;
+    // wrap the current node and put it in the list
+    path.push_back(WrappedNode(curStart, curEnd, access.getPayload(current),
+                               depth, current));
+    // determine the length l of the longest common suffix with s
+    l_type longestSuffixLen = suffixUntilCheck(curStart, curEnd, 
+                                               start, end, offset);
+    if (curLength != longestSuffixLen) { 
+      // context ends inside the current node
+      if (below) {
+        splitLength = longestSuffixLen;
+      } else {
+        // drop last node from path as it would have to be split
+        path.pop_back();
+      }
+      break;
+    }
+    if (curLength == end - start) { // no more input to consume
+      break;
+    }
+    // determine key for the child pointer
+    current = access.getChild(current, seq[end - 1 - curLength]);
+    if (current == NULL) {
+      break;
+    }
+    offset = curLength;
+    depth++;
+  }
+  return splitLength;
+}
+
 template<typename Visitor>
 void ContextTree::visitDFSWithChildren(Visitor& visitor) const {
     typedef std::pair<NodeId, int> mypair;
@@ -251,7 +576,8 @@ void ContextTree::visitDFSWithChildren(Visitor& visitor) const {
       WrappedNode n(nm.getStart(current.first), 
                     nm.getEnd(current.first),
                     nm.getPayload(current.first),
-                    current.second);
+                    current.second,
+                    current.first);
       INodeManager::ChildMap children = nm.getChildren(current.first);
       std::list<WrappedNode> childList;
       for (typename INodeManager::ChildMapIterator it = children.begin();
@@ -264,7 +590,8 @@ void ContextTree::visitDFSWithChildren(Visitor& visitor) const {
               nm.getStart(child.first),
               nm.getEnd(child.first),
               nm.getPayload(child.first),
-              child.second));
+              child.second,
+              child.first));
       }
       visitor(n, childList);
     }
@@ -281,7 +608,8 @@ void ContextTree::visitDFS(Visitor& visitor) const {
     WrappedNode n(nm.getStart(current.first), 
         nm.getEnd(current.first), 
         nm.getPayload(current.first), 
-        current.second);
+        current.second,
+        current.first);
     visitor(n);
     INodeManager::ChildMap children = nm.getChildren(current.first);
     for (typename INodeManager::ChildMapIterator it = children.begin(); 
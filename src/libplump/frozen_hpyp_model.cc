@@ -0,0 +1,538 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libplump/frozen_hpyp_model.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libplump/hpyp_restaurants.h"
+#include "libplump/parallel.h"
+#include "libplump/scaled_distribution.h"
+
+
+namespace gatsby { namespace libplump {
+
+namespace {
+
+uint64_t alignOffset(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Write size bytes of data at the given file offset, padding with zeros from
+ * the current position.
+ */
+void writeArray(std::ofstream& out, uint64_t offset, const void* data,
+                uint64_t size) {
+  while ((uint64_t)out.tellp() < offset) {
+    out.put(0);
+  }
+  out.write((const char*)data, size);
+}
+
+} // namespace
+
+
+FrozenHPYPModel::FrozenHPYPModel(const HPYPModel& model)
+    : seq(model.seq), numTypes(model.numTypes), baseProb(model.baseProb),
+      mapping(NULL), mappingSize(0) {
+  // only the counts are frozen, so the restaurant has to predict from them
+  assert(model.restaurant.hasHPYPPredictive());
+  CollectVisitor visitor;
+  model.contextTree.visitDFS(visitor);
+  std::vector<WrappedNode>& preorder = visitor.nodes;
+  numNodes = preorder.size();
+
+  // Walk the nodes in DFS order, keeping the path from the root in a
+  // WrappedNodeList so that the parameters object computes discounts and
+  // concentrations exactly as it does for the live model. Also record the
+  // parent and child key of each node.
+  std::vector<std::vector<std::pair<e_type, l_type> > > children(numNodes);
+  d_vec discounts(numNodes), concentrations(numNodes);
+  WrappedNodeList path;
+  std::vector<l_type> pathIndices;
+  l_type maxEnd = 0;
+  for (size_t i = 0; i < numNodes; ++i) {
+    const WrappedNode& n = preorder[i];
+    while ((l_type)path.size() > n.depth) {
+      path.pop_back();
+      pathIndices.pop_back();
+    }
+    if (!path.empty()) {
+      l_type parentLength = path.back().end - path.back().start;
+      children[pathIndices.back()].push_back(
+          std::make_pair(model.seq[n.end - 1 - parentLength], i));
+    }
+    path.push_back(n);
+    pathIndices.push_back(i);
+    d_vec discountPath = model.parameters.getDiscounts(path);
+    d_vec concentrationPath = model.parameters.getConcentrations(
+        path, discountPath);
+    discounts[i] = discountPath.back();
+    concentrations[i] = concentrationPath.back();
+    maxEnd = std::max(maxEnd, n.end);
+  }
+
+  // Lay the nodes out in BFS order with the children of each node sorted by
+  // key; the children of consecutive nodes are then consecutive as well.
+  std::vector<l_type> order;
+  order.reserve(numNodes);
+  nodeStorage.resize(numNodes + 1);
+  keyStorage.resize(numNodes);
+  if (numNodes > 0) {
+    order.push_back(0);
+    keyStorage[0] = 0;
+  }
+  for (l_type k = 0; k < (l_type)order.size(); ++k) {
+    l_type i = order[k];
+    const WrappedNode& n = preorder[i];
+    Node& node = nodeStorage[k];
+    node.start = n.start;
+    node.end = n.end;
+    node.firstChild = order.size();
+    node.firstType = typeStorage.size();
+    node.c = model.restaurant.getC(n.payload);
+    node.t = model.restaurant.getT(n.payload);
+    node.discount = discounts[i];
+    node.concentration = concentrations[i];
+
+    IHPYPBaseRestaurant::TypeVector typeVector =
+        model.restaurant.getTypeVector(n.payload);
+    std::sort(typeVector.begin(), typeVector.end());
+    for (IHPYPBaseRestaurant::TypeVectorIterator it = typeVector.begin();
+         it != typeVector.end(); ++it) {
+      TypeCounts typeCounts;
+      typeCounts.cw = model.restaurant.getC(n.payload, *it);
+      typeCounts.tw = model.restaurant.getT(n.payload, *it);
+      if (typeCounts.cw == 0 && typeCounts.tw == 0) {
+        continue;
+      }
+      typeStorage.push_back(*it);
+      countStorage.push_back(typeCounts);
+    }
+
+    std::sort(children[i].begin(), children[i].end());
+    for (size_t j = 0; j < children[i].size(); ++j) {
+      keyStorage[order.size()] = children[i][j].first;
+      order.push_back(children[i][j].second);
+    }
+  }
+  assert(order.size() == numNodes);
+
+  Node& sentinel = nodeStorage[numNodes];
+  sentinel.start = sentinel.end = 0;
+  sentinel.firstChild = numNodes;
+  sentinel.firstType = typeStorage.size();
+  sentinel.c = sentinel.t = 0;
+  sentinel.discount = sentinel.concentration = 0;
+
+  labelStorage.assign(model.seq.begin(), model.seq.begin() + maxEnd);
+  numEntries = typeStorage.size();
+  numLabels = labelStorage.size();
+  setViews();
+}
+
+
+FrozenHPYPModel::FrozenHPYPModel(const seq_type& seq)
+    : seq(seq), numTypes(0), baseProb(0), numNodes(0), numEntries(0),
+      numLabels(0), nodes(NULL), keys(NULL), types(NULL), counts(NULL),
+      labels(NULL), mapping(NULL), mappingSize(0) {}
+
+
+FrozenHPYPModel* FrozenHPYPModel::load(const std::string& filename,
+                                       const seq_type& seq) {
+  FrozenHPYPModel* model = new FrozenHPYPModel(seq);
+  if (!model->map(filename)) {
+    delete model;
+    return NULL;
+  }
+  return model;
+}
+
+
+bool FrozenHPYPModel::map(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    std::cerr << "Could not open model file " << filename << std::endl;
+    return false;
+  }
+  if ((size_t)st.st_size < sizeof(FileHeader)) {
+    close(fd);
+    std::cerr << "Invalid model file " << filename << std::endl;
+    return false;
+  }
+  mappingSize = st.st_size;
+  mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping = NULL;
+  }
+  if (mapping == NULL) {
+    std::cerr << "Could not map model file " << filename << std::endl;
+    return false;
+  }
+
+  const char* base = (const char*)mapping;
+  FileHeader header;
+  memcpy(&header, base, sizeof(FileHeader));
+  numNodes = header.numNodes;
+  numEntries = header.numEntries;
+  numLabels = header.numLabels;
+  numTypes = header.numTypes;
+  baseProb = header.baseProb;
+  FileHeader expected = makeHeader();
+  if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+      || header.version != FILE_VERSION
+      || header.byteOrder != BYTE_ORDER_MARK
+      || header.nodeSize != sizeof(Node)
+      || header.numNodes == 0
+      || header.numTypes <= 0
+      || header.numNodes >= (uint64_t)std::numeric_limits<l_type>::max()
+      || header.numEntries >= (uint64_t)std::numeric_limits<l_type>::max()
+      || header.numLabels >= (uint64_t)std::numeric_limits<l_type>::max()
+      || header.nodesOffset != expected.nodesOffset
+      || header.keysOffset != expected.keysOffset
+      || header.typesOffset != expected.typesOffset
+      || header.countsOffset != expected.countsOffset
+      || header.labelsOffset != expected.labelsOffset
+      || header.fileSize != expected.fileSize
+      || header.fileSize > mappingSize) {
+    std::cerr << "Invalid or incompatible model file " << filename
+              << std::endl;
+    return false;
+  }
+  nodes = (const Node*)(base + header.nodesOffset);
+  keys = (const e_type*)(base + header.keysOffset);
+  types = (const e_type*)(base + header.typesOffset);
+  counts = (const TypeCounts*)(base + header.countsOffset);
+  labels = (const e_type*)(base + header.labelsOffset);
+  if (!checkIndices()) {
+    std::cerr << "Corrupt model file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+bool FrozenHPYPModel::checkIndices() const {
+  // The children of node i are nodes[i].firstChild up to (but excluding)
+  // nodes[i+1].firstChild, and they all come after i (BFS order); the types
+  // are delimited in the same way. Both sequences end at the sentinel.
+  if (nodes[numNodes].firstChild != (l_type)numNodes
+      || nodes[numNodes].firstType != (l_type)numEntries) {
+    return false;
+  }
+  for (size_t i = 0; i < numNodes; ++i) {
+    const Node& node = nodes[i];
+    if (node.firstChild <= (l_type)i
+        || node.firstChild > nodes[i + 1].firstChild
+        || node.firstType < 0
+        || node.firstType > nodes[i + 1].firstType
+        || node.start < 0
+        || node.start > node.end
+        || node.end > (l_type)numLabels) {
+      return false;
+    }
+  }
+  for (size_t j = 0; j < numEntries; ++j) {
+    if (types[j] < 0 || types[j] >= numTypes) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+FrozenHPYPModel::~FrozenHPYPModel() {
+  if (mapping != NULL) {
+    munmap(mapping, mappingSize);
+  }
+}
+
+
+bool FrozenHPYPModel::save(const std::string& filename) const {
+  FileHeader header = makeHeader();
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  out.write((const char*)&header, sizeof(FileHeader));
+  writeArray(out, header.nodesOffset, nodes, (numNodes + 1) * sizeof(Node));
+  writeArray(out, header.keysOffset, keys, numNodes * sizeof(e_type));
+  writeArray(out, header.typesOffset, types, numEntries * sizeof(e_type));
+  writeArray(out, header.countsOffset, counts,
+             numEntries * sizeof(TypeCounts));
+  writeArray(out, header.labelsOffset, labels, numLabels * sizeof(e_type));
+  if (!out) {
+    std::cerr << "Could not write model file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+double FrozenHPYPModel::predict(l_type start, l_type stop, e_type obs) const {
+  return computeProbability(start, stop, obs, false);
+}
+
+
+double FrozenHPYPModel::predictBelow(l_type start,
+                                     l_type stop,
+                                     e_type obs) const {
+  return computeProbability(start, stop, obs, true);
+}
+
+
+namespace {
+
+// computes the predictions for a range of positions in predictSequence
+class FrozenPredictSequenceWork {
+  public:
+    FrozenPredictSequenceWork(const FrozenHPYPModel& model,
+                              const seq_type& seq,
+                              l_type start,
+                              l_type first,
+                              FrozenHPYPModel::PredictMode mode,
+                              d_vec& probs)
+        : model(model), seq(seq), start(start), first(first), mode(mode),
+          probs(probs) {}
+
+    void operator()(int thread, l_type begin, l_type end) {
+      for (l_type i = begin; i < end; ++i) {
+        probs[i - first] = (mode == FrozenHPYPModel::BELOW)
+                           ? model.predictBelow(start, i, seq[i])
+                           : model.predict(start, i, seq[i]);
+      }
+    }
+
+  private:
+    const FrozenHPYPModel& model;
+    const seq_type& seq;
+    l_type start, first;
+    FrozenHPYPModel::PredictMode mode;
+    d_vec& probs;
+};
+
+} // namespace
+
+
+d_vec FrozenHPYPModel::predictSequence(l_type start,
+                                       l_type stop,
+                                       PredictMode mode,
+                                       int numThreads) const {
+  return predictSequence(start, start, stop, mode, numThreads);
+}
+
+
+d_vec FrozenHPYPModel::predictSequence(l_type start,
+                                       l_type first,
+                                       l_type stop,
+                                       PredictMode mode,
+                                       int numThreads) const {
+  d_vec probs(std::max(stop - first, (l_type)0));
+  FrozenPredictSequenceWork work(*this, seq, start, first, mode, probs);
+  parallelFor(first, stop, numThreads, work);
+  return probs;
+}
+
+
+d_vec FrozenHPYPModel::predictiveDistribution(l_type start,
+                                              l_type stop) const {
+  // single pass down the path as in HPYPModel::predictiveDistribution
+  ScaledDistribution distribution;
+  distribution.reset(numTypes, baseProb);
+  d_vec parentProbabilities;
+  l_type current = 0;
+  l_type offset = 0;
+  while (numNodes > 0) {
+    const Node& node = nodes[current];
+    l_type length = node.end - node.start;
+    if (commonSuffixLength(node, start, stop, offset) != length) {
+      break;
+    }
+    if (node.c > 0) {
+      // scale all probabilities by the backoff factor, then recompute the
+      // probabilities of the types present in this node
+      l_type first = node.firstType;
+      l_type last = nodes[current + 1].firstType;
+      parentProbabilities.resize(last - first);
+      for (l_type j = first; j < last; ++j) {
+        parentProbabilities[j - first] = distribution.get(types[j]);
+      }
+      distribution.multiply((node.concentration + node.discount * node.t)
+                            / (node.c + node.concentration));
+      for (l_type j = first; j < last; ++j) {
+        distribution.set(types[j],
+                         computeHPYPPredictive(counts[j].cw, counts[j].tw,
+                                               node.c, node.t,
+                                               parentProbabilities[j - first],
+                                               node.discount,
+                                               node.concentration));
+      }
+    }
+    if (length == stop - start) {
+      break;
+    }
+    current = findChild(current, seq[stop - 1 - length]);
+    if (current == NO_NODE) {
+      break;
+    }
+    offset = length;
+  }
+  d_vec predictive;
+  distribution.getDistribution(predictive);
+  return predictive;
+}
+
+
+size_t FrozenHPYPModel::getNumNodes() const {
+  return numNodes;
+}
+
+
+size_t FrozenHPYPModel::getMemoryUsage() const {
+  return sizeof(*this)
+         + (numNodes + 1) * sizeof(Node)
+         + numNodes * sizeof(e_type)
+         + numEntries * (sizeof(e_type) + sizeof(TypeCounts))
+         + numLabels * sizeof(e_type);
+}
+
+
+double FrozenHPYPModel::computeProbability(l_type start,
+                                           l_type stop,
+                                           e_type obs,
+                                           bool below) const {
+  double prob = baseProb;
+  if (numNodes == 0) {
+    return prob;
+  }
+  l_type current = 0;
+  l_type offset = 0;
+  while (true) {
+    const Node& node = nodes[current];
+    l_type length = node.end - node.start;
+    if (commonSuffixLength(node, start, stop, offset) != length) {
+      // the context ends inside the edge leading to this node
+      if (below) {
+        prob = nodeProbability(current, obs, prob);
+      }
+      break;
+    }
+    prob = nodeProbability(current, obs, prob);
+    if (length == stop - start) {
+      break;
+    }
+    current = findChild(current, seq[stop - 1 - length]);
+    if (current == NO_NODE) {
+      break;
+    }
+    offset = length;
+  }
+  return prob;
+}
+
+
+double FrozenHPYPModel::nodeProbability(l_type node,
+                                        e_type obs,
+                                        double prob) const {
+  const Node& n = nodes[node];
+  const e_type* end = types + nodes[node + 1].firstType;
+  const e_type* it = std::lower_bound(types + n.firstType, end, obs);
+  l_type cw = 0, tw = 0;
+  if (it != end && *it == obs) {
+    const TypeCounts& typeCounts = counts[it - types];
+    cw = typeCounts.cw;
+    tw = typeCounts.tw;
+  }
+  return computeHPYPPredictive(cw, tw, n.c, n.t, prob,
+                               n.discount, n.concentration);
+}
+
+
+l_type FrozenHPYPModel::findChild(l_type node, e_type key) const {
+  const e_type* end = keys + nodes[node + 1].firstChild;
+  const e_type* it = std::lower_bound(keys + nodes[node].firstChild, end, key);
+  if (it != end && *it == key) {
+    return it - keys;
+  }
+  return NO_NODE;
+}
+
+
+l_type FrozenHPYPModel::commonSuffixLength(const Node& node,
+                                           l_type start,
+                                           l_type stop,
+                                           l_type offset) const {
+  l_type l = std::min(node.end - node.start, stop - start);
+  l_type i;
+  for (i = offset; i < l; ++i) {
+    if (labels[node.end - 1 - i] != seq[stop - 1 - i]) {
+      break;
+    }
+  }
+  return i;
+}
+
+
+void FrozenHPYPModel::setViews() {
+  nodes = &nodeStorage[0];
+  keys = keyStorage.empty() ? NULL : &keyStorage[0];
+  types = typeStorage.empty() ? NULL : &typeStorage[0];
+  counts = countStorage.empty() ? NULL : &countStorage[0];
+  labels = labelStorage.empty() ? NULL : &labelStorage[0];
+}
+
+
+FrozenHPYPModel::FileHeader FrozenHPYPModel::makeHeader() const {
+  FileHeader header;
+  memset(&header, 0, sizeof(FileHeader));
+  memcpy(header.magic, "PLUMPFRZ", sizeof(header.magic));
+  header.version = FILE_VERSION;
+  header.byteOrder = BYTE_ORDER_MARK;
+  header.nodeSize = sizeof(Node);
+  header.numTypes = numTypes;
+  header.baseProb = baseProb;
+  header.numNodes = numNodes;
+  header.numEntries = numEntries;
+  header.numLabels = numLabels;
+  header.nodesOffset = alignOffset(sizeof(FileHeader));
+  header.keysOffset = alignOffset(header.nodesOffset
+                                  + (numNodes + 1) * sizeof(Node));
+  header.typesOffset = alignOffset(header.keysOffset
+                                   + numNodes * sizeof(e_type));
+  header.countsOffset = alignOffset(header.typesOffset
+                                    + numEntries * sizeof(e_type));
+  header.labelsOffset = alignOffset(header.countsOffset
+                                    + numEntries * sizeof(TypeCounts));
+  header.fileSize = header.labelsOffset + numLabels * sizeof(e_type);
+  return header;
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,269 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FROZEN_HPYP_MODEL_H_
+#define FROZEN_HPYP_MODEL_H_
+
+#include <string>
+#include <vector>
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/hpyp_model.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * An immutable snapshot of a trained HPYPModel that only supports
+ * prediction.
+ *
+ * Freezing walks the context tree once and stores it in flat arrays: nodes
+ * are laid out in breadth-first order so that the children of every node
+ * occupy a contiguous, key-sorted range (CSR form), and each node carries
+ * its discount, concentration and total customer/table counts, which the
+ * live model recomputes from the parameters on every call. The per-type
+ * (cw, tw) counts of all restaurants are stored in one array, sorted by type
+ * within each node.
+ *
+ * Predictions are identical to those of the model at the time it was frozen
+ * for the ABOVE and BELOW prediction modes. Prediction with fragmentation
+ * needs the seating arrangements and a mutable restaurant and is therefore
+ * not supported; neither is the ExpectedTablesCompactRestaurant, whose
+ * predictive rule is not a function of (cw, tw, c, t).
+ *
+ * All methods are const and do not touch any shared mutable state, so a
+ * frozen model can be used by any number of concurrent readers.
+ *
+ * A frozen model can be saved to a file that is later mmap'ed and queried
+ * in place, without deserialization. The file consists of a fixed header
+ * followed by the node, key, type, count and label arrays at 8-byte aligned
+ * offsets; it contains no pointers, so it can be mapped at any address and
+ * shared between processes through the page cache. The parameters are
+ * stored in the form in which they are used, i.e. as per-node discounts and
+ * concentrations. The format uses the native byte order and is rejected on
+ * load if that or the layout of the node records does not match.
+ */
+class FrozenHPYPModel {
+  public:
+    enum PredictMode {ABOVE, BELOW};
+
+    /**
+     * Freeze the current state of the given model.
+     *
+     * The model is only read and may be modified or destroyed afterwards.
+     * Its restaurant must compute the plain HPYP predictive probabilities
+     * (see IHPYPBaseRestaurant::hasHPYPPredictive()).
+     * The sequence of the model must outlive the frozen model, as contexts
+     * passed to the predict methods are positions in that sequence.
+     */
+    FrozenHPYPModel(const HPYPModel& model);
+
+    /**
+     * Map a model saved with save() into memory. Contexts passed to the
+     * predict methods are positions in seq, which is usually different from
+     * the sequence the model was trained on (which is stored in the file).
+     *
+     * Returns NULL (after printing an error message) if the file cannot be
+     * mapped, is not a valid model file of the current version, or contains
+     * out of range node or type indices. The caller owns the returned model.
+     */
+    static FrozenHPYPModel* load(const std::string& filename,
+                                 const seq_type& seq);
+
+    ~FrozenHPYPModel();
+
+    /**
+     * Write the model to the given file in the mmap'able format; returns
+     * false if the file could not be written.
+     */
+    bool save(const std::string& filename) const;
+
+    /**
+     * Compute the predictive probability of obs in the context
+     * [start, stop), predicting from the longest suffix of the context that
+     * is a node in the tree. Same as HPYPModel::predict.
+     */
+    double predict(l_type start, l_type stop, e_type obs) const;
+
+    /**
+     * Predict from below the split point if the context ends inside an
+     * edge. Same as HPYPModel::predictBelow.
+     */
+    double predictBelow(l_type start, l_type stop, e_type obs) const;
+
+    /**
+     * For each i in [start, stop), compute p(x_i|x_{start:i}), splitting the
+     * positions across numThreads threads. The result does not depend on the
+     * number of threads.
+     */
+    d_vec predictSequence(l_type start, l_type stop,
+                          PredictMode mode = ABOVE,
+                          int numThreads = 1) const;
+
+    /**
+     * Same as above, but only for the positions i in [first, stop); the
+     * contexts still begin at start.
+     */
+    d_vec predictSequence(l_type start, l_type first, l_type stop,
+                          PredictMode mode, int numThreads) const;
+
+    /**
+     * Compute the entire predictive distribution in the given context.
+     */
+    d_vec predictiveDistribution(l_type start, l_type stop) const;
+
+    /**
+     * Number of context tree nodes in the frozen model.
+     */
+    size_t getNumNodes() const;
+
+    /**
+     * Approximate number of bytes used by the frozen model's arrays.
+     */
+    size_t getMemoryUsage() const;
+
+  private:
+    /**
+     * Per-node data; nodes[i+1].firstChild and nodes[i+1].firstType delimit
+     * the children and types of node i, so there is one extra sentinel node
+     * at the end of the array.
+     */
+    struct Node {
+      l_type start, end;
+      l_type firstChild, firstType;
+      l_type c, t;
+      double discount, concentration;
+    };
+
+    struct TypeCounts {
+      l_type cw, tw;
+    };
+
+    /**
+     * Header at the beginning of a model file; offsets are in bytes from the
+     * start of the file.
+     */
+    struct FileHeader {
+      char magic[8];
+      uint32_t version;
+      uint32_t byteOrder;
+      uint32_t nodeSize;
+      int32_t numTypes;
+      double baseProb;
+      uint64_t numNodes, numEntries, numLabels;
+      uint64_t nodesOffset, keysOffset, typesOffset, countsOffset;
+      uint64_t labelsOffset, fileSize;
+    };
+
+    static const uint32_t FILE_VERSION = 1;
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    static const l_type NO_NODE = -1;
+
+    /**
+     * Create an empty model to be filled by map().
+     */
+    FrozenHPYPModel(const seq_type& seq);
+
+    /**
+     * Map the given model file and point the array views into it.
+     */
+    bool map(const std::string& filename);
+
+    /**
+     * Check that all child, type and label indices of the nodes are within
+     * the bounds of the respective arrays, and that all types are valid.
+     */
+    bool checkIndices() const;
+
+    /**
+     * Compute the probability of obs by walking down from the root along
+     * the given context; the node in which the context ends partially is
+     * included iff below is true.
+     */
+    double computeProbability(l_type start, l_type stop, e_type obs,
+                              bool below) const;
+
+    /**
+     * Update the probability prob of obs computed in the parent of node
+     * to the probability in node.
+     */
+    double nodeProbability(l_type node, e_type obs, double prob) const;
+
+    l_type findChild(l_type node, e_type key) const;
+
+    /**
+     * Length of the common suffix of node and the context ending at stop,
+     * checking only positions from offset on.
+     */
+    l_type commonSuffixLength(const Node& node, l_type start, l_type stop,
+                              l_type offset) const;
+
+    /**
+     * Point the array views at the storage vectors.
+     */
+    void setViews();
+
+    /**
+     * Compute the header (including all offsets) for this model.
+     */
+    FileHeader makeHeader() const;
+
+    /**
+     * Visitor used to collect all nodes of the live context tree.
+     */
+    class CollectVisitor {
+      public:
+        void operator()(const WrappedNode& n) {
+          nodes.push_back(n);
+        }
+        std::vector<WrappedNode> nodes;
+    };
+
+    const seq_type& seq;
+    int numTypes;
+    double baseProb;
+
+    // number of nodes (without the sentinel), type entries and labels
+    size_t numNodes, numEntries, numLabels;
+
+    // views of the arrays; point either into the storage vectors below or
+    // into the mapped file
+    const Node* nodes;
+    const e_type* keys;
+    const e_type* types;
+    const TypeCounts* counts;
+    // the part of the training sequence the node labels refer to
+    const e_type* labels;
+
+    std::vector<Node> nodeStorage;
+    std::vector<e_type> keyStorage;
+    std::vector<e_type> typeStorage;
+    std::vector<TypeCounts> countStorage;
+    seq_type labelStorage;
+
+    void* mapping;
+    size_t mappingSize;
+
+    DISALLOW_COPY_AND_ASSIGN(FrozenHPYPModel);
+};
+
+}} // namespace gatsby::libplump
+
+#endif
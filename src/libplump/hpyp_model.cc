@@ -19,12 +19,16 @@
 
 #include "libplump/hpyp_model.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "libplump/utils.h"
 #include "libplump/subseq.h"
+#include "libplump/parallel.h"
+#include "libplump/random.h"
 
 
 namespace gatsby { namespace libplump {
@@ -38,9 +42,24 @@ HPYPModel::HPYPModel(seq_type& seq,
       contextTree_(new ContextTree(nodeManager, seq)), 
       contextTree(*contextTree_), 
       restaurant(restaurant),
+      implicitRestaurant(
+          dynamic_cast<const ImplicitPayloadRestaurant*>(&restaurant)),
       parameters(parameters), 
-      numTypes(numTypes) {
+      optimizer(parameters),
+      numTypes(numTypes),
+      maxNodes(0),
+      evictionPolicy(EVICT_RANDOM),
+      numNodes(0),
+      numEvictions(0),
+      evictionTime(0),
+      leaves(),
+      windowSize(0),
+      window(),
+      windowPos(0) {
     baseProb = 1./((double) numTypes);
+    if (implicitRestaurant != NULL) {
+      contextTree.setLeafPayload(ImplicitPayloadRestaurant::emptyPayload());
+    }
   }
  
 
@@ -49,15 +68,20 @@ void HPYPModel::insertRoot(e_type obs) {
   d_vec discount_path = this->parameters.getDiscounts(root_path);
   d_vec concentration_path = this->parameters.getConcentrations(root_path,
                                                                 discount_path);
-  d_vec prob_path = this->computeProbabilityPath(root_path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
+  d_vec prob_path;
+  this->computeProbabilityPath(root_path,
+                               discount_path,
+                               concentration_path,
+                               obs,
+                               prob_path);
   this->updatePath(root_path,
                    prob_path,
                    discount_path,
                    concentration_path,
                    obs);
+  if (this->windowSize > 0) {
+    this->rememberObservation(root_path.back().node, obs);
+  }
 }
 
 
@@ -66,10 +90,17 @@ void HPYPModel::insertRoot(e_type obs) {
  * split.
  */
 WrappedNodeList HPYPModel::insertContext(l_type start, l_type stop) {
+  insertContext(start, stop, buffers.insertion);
+  return buffers.insertion.path;
+}
+
+
+void HPYPModel::insertContext(l_type start, l_type stop,
+                              ContextTree::InsertionResult& insertionResult) {
   typedef ContextTree::InsertionResult InsertionResult;
 
   // insert context
-  InsertionResult insertionResult = contextTree.insert(start, stop);
+  contextTree.insert(start, stop, insertionResult);
 
   // handle split if one occurred
   if (insertionResult.action != InsertionResult::INSERT_ACTION_NO_SPLIT) { 
@@ -100,60 +131,88 @@ WrappedNodeList HPYPModel::insertContext(l_type start, l_type stop) {
                       insertionResult.splitChild,
                       nodeC); 
   }
-  return insertionResult.path;    
+
+  if (this->maxNodes > 0 || this->windowSize > 0) {
+    this->countInsertion(insertionResult);
+  }
 }
 
 
 d_vec HPYPModel::insertContextAndObservation(l_type start, 
                                              l_type stop,
                                              e_type obs) {
+  insertContextAndObservation(start, stop, obs, buffers);
+  return buffers.probabilities;
+}
+
+
+void HPYPModel::insertContextAndObservation(l_type start,
+                                            l_type stop,
+                                            e_type obs,
+                                            PathBuffers& buffers) {
   // insert context (and handle a potential split)
-  WrappedNodeList path = insertContext(start, stop);
-
-  // insert observation
-  d_vec discountPath = this->parameters.getDiscounts(path);
-  d_vec concentrationPath = this->parameters.getConcentrations(path,
-                                                               discountPath);
-  d_vec probabilityPath = this->computeProbabilityPath(path,
-                                                       discountPath,
-                                                       concentrationPath,
-                                                       obs);
-  this->parameters.accumulateParameterGradient(this->restaurant, 
-      path, probabilityPath, discountPath, concentrationPath, obs);
+  insertContext(start, stop, buffers.insertion);
+  insertObservationAtPath(buffers.insertion.path, obs, buffers);
+}
+
+
+void HPYPModel::insertObservationAtPath(WrappedNodeList& path,
+                                        e_type obs,
+                                        PathBuffers& buffers) {
+  d_vec& discountPath = buffers.discounts;
+  d_vec& concentrationPath = buffers.concentrations;
+  d_vec& probabilityPath = buffers.probabilities;
+  this->computeParameterPath(path, discountPath, concentrationPath);
+  this->computeProbabilityPath(path,
+                               discountPath,
+                               concentrationPath,
+                               obs,
+                               probabilityPath);
+  this->optimizer.observe(this->restaurant, path, probabilityPath,
+                          discountPath, concentrationPath, obs);
 
   this->updatePath(path, probabilityPath, discountPath,
                    concentrationPath, obs);
 
-  static int j = 0;
-  if (j == 1) {
-    this->parameters.stepParameterGradient(10e-5);
-    j = 0;
+  if (this->maxNodes > 0) {
+    ++this->evictionTime;
+    this->leaves.touch(path.back().node, this->evictionTime);
+    this->enforceNodeBudget(path.back().node);
+  }
+  if (this->windowSize > 0) {
+    this->rememberObservation(path.back().node, obs);
   }
-  j++;
-
-  return probabilityPath; 
 }
 
 
 d_vec HPYPModel::insertObservation(l_type start, l_type stop, e_type obs) {
+  insertObservation(start, stop, obs, buffers);
+  return buffers.probabilities; 
+}
+
+
+void HPYPModel::insertObservation(l_type start, l_type stop, e_type obs,
+                                  PathBuffers& buffers) {
   tracer << "HPYPModel::insertObservation(" << start << ", " << stop 
          << ", " << obs << ")" << std::endl;
   
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start,stop);
+  WrappedNodeList& path = buffers.path;
+  this->findContextPath(start, stop, false, path);
   
   tracer << "  HPYPModel::insertObservation: longest suffix path: " 
          << std::endl << this->contextTree.pathToString(path) << std::endl;
   
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  this->updatePath(path, prob_path, discount_path,
-                   concentration_path, obs);
-  return prob_path; 
+  this->computeParameterPath(path, buffers.discounts, buffers.concentrations);
+  this->computeProbabilityPath(path,
+                               buffers.discounts,
+                               buffers.concentrations,
+                               obs,
+                               buffers.probabilities);
+  this->updatePath(path, buffers.probabilities, buffers.discounts,
+                   buffers.concentrations, obs);
+  if (this->windowSize > 0) {
+    this->rememberObservation(path.back().node, obs);
+  }
 }
 
 
@@ -163,15 +222,16 @@ void HPYPModel::removeObservation(
   tracer << "HPYPModel::removeObservation(" << start << ", " << stop 
          << ", " << obs << ")" << std::endl;
 
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start, stop);
+  WrappedNodeList& path = buffers.path;
+  this->contextTree.findLongestSuffix(start, stop, path);
   
   tracer << "  HPYPModel::removeObservation: longest suffix path: " 
          << std::endl << contextTree.pathToString(path) << std::endl;
   
-  d_vec discountPath = this->parameters.getDiscounts(path);
+  this->parameters.getDiscounts(path, buffers.discounts);
   
   this->removeObservationFromPath(path, 
-                                  discountPath,
+                                  buffers.discounts,
                                   obs,
                                   payloadDataPath);
 }
@@ -189,7 +249,8 @@ d_vec HPYPModel::computeLosses(l_type start, l_type stop) {
   start_t = clock();
 
   for (l_type i=start+1; i < stop; i++) {
-    d_vec prob_path = this->insertContextAndObservation(start,i,this->seq[i]);
+    this->insertContextAndObservation(start, i, this->seq[i], buffers);
+    const d_vec& prob_path = buffers.probabilities;
     double prob = prob_path[prob_path.size()-2];
     losses.push_back(-log2(prob));
     
@@ -211,22 +272,86 @@ d_vec HPYPModel::computeLosses(l_type start, l_type stop) {
 }
 
 
-d_vec HPYPModel::predictSequence(l_type start, l_type stop, PredictMode mode) {
-  d_vec probs;
-  for (l_type i = start; i < stop; i++) {
+d_vec HPYPModel::predictSequence(l_type start, l_type stop, PredictMode mode,
+                                 int numThreads) {
+  return predictSequence(start, start, stop, mode, numThreads);
+}
+
+
+d_vec HPYPModel::predictSequence(l_type start, l_type first, l_type stop,
+                                 PredictMode mode, int numThreads) {
+  d_vec probs(std::max(stop - first, (l_type)0));
+  if (numThreads <= 1) {
+    for (l_type i = first; i < stop; i++) {
+      switch(mode) {
+        case ABOVE:
+          probs[i - first] = this->predict(start, i, this->seq[i]);
+          break;
+        case FRAGMENT:
+          probs[i - first] = this->predictWithFragmentation(start, i,
+                                                            this->seq[i]);
+          break;
+        case BELOW:
+          probs[i - first] = this->predictBelow(start, i, this->seq[i]);
+          break;
+      }
+    }
+  } else {
+    PredictSequenceWork work(*this, start, first, mode, numThreads, probs);
+    parallelFor(first, stop, numThreads, work);
+  }
+  return probs;
+}
+
+
+HPYPModel::PredictSequenceWork::PredictSequenceWork(const HPYPModel& model,
+                                                    l_type start,
+                                                    l_type first,
+                                                    PredictMode mode,
+                                                    int numThreads,
+                                                    d_vec& probs)
+    : model(model), start(start), first(first), mode(mode), probs(probs),
+      buffers(numThreads), rngs() {
+  if (mode == FRAGMENT) {
+    // fragmentation samples; the global RNG cannot be shared, so every
+    // thread gets its own stream derived from a single draw
+    RNG base(gsl_rng_get(get_rng()));
+    for (int i = 0; i < numThreads; ++i) {
+      rngs.push_back(base.stream(i));
+    }
+  }
+}
+
+
+HPYPModel::PredictSequenceWork::~PredictSequenceWork() {
+  for (size_t i = 0; i < rngs.size(); ++i) {
+    delete rngs[i];
+  }
+}
+
+
+void HPYPModel::PredictSequenceWork::operator()(int thread, 
+                                                l_type begin, 
+                                                l_type end) {
+  PathBuffers& threadBuffers = buffers[thread];
+  const seq_type& seq = model.seq;
+  for (l_type i = begin; i < end; ++i) {
     switch(mode) {
       case ABOVE:
-        probs.push_back(this->predict(start, i, this->seq[i]));
+        probs[i - first] = model.predict(start, i, seq[i], threadBuffers);
         break;
-      case FRAGMENT:
-        probs.push_back(this->predictWithFragmentation(start, i, this->seq[i]));
+      case FRAGMENT: {
+        RNGBinding binding(*rngs[thread]);
+        probs[i - first] = model.predictWithFragmentation(start, i, seq[i],
+                                                          threadBuffers);
         break;
+      }
       case BELOW:
-        probs.push_back(this->predictBelow(start, i, this->seq[i]));
+        probs[i - first] = model.predictBelow(start, i, seq[i], 
+                                              threadBuffers);
         break;
     }
   }
-  return probs;
 }
 
 
@@ -246,16 +371,22 @@ void HPYPModel::updateTree(l_type start, l_type stop) {
 
 
 double HPYPModel::predict(l_type start, l_type stop, e_type obs) {
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start,stop);
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
+  return predict(start, stop, obs, buffers);
+}
 
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  return prob_path.back();
+
+double HPYPModel::predict(l_type start, l_type stop, e_type obs,
+                          PathBuffers& buffers) const {
+  WrappedNodeList& path = buffers.path;
+  this->findContextPath(start, stop, false, path);
+  this->computeParameterPath(path, buffers.discounts, buffers.concentrations);
+
+  this->computeProbabilityPath(path,
+                               buffers.discounts,
+                               buffers.concentrations,
+                               obs,
+                               buffers.probabilities);
+  return buffers.probabilities.back();
 }
 
 
@@ -264,45 +395,61 @@ double HPYPModel::predict(l_type start, l_type stop, e_type obs) {
  * _below_ the split point!
  */
 double HPYPModel::predictBelow(l_type start, l_type stop, e_type obs) {
-  WrappedNodeList path = 
-      this->contextTree.findLongestSuffixVirtual(start,stop).second;
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
+  return predictBelow(start, stop, obs, buffers);
+}
+
+
+double HPYPModel::predictBelow(l_type start, l_type stop, e_type obs,
+                               PathBuffers& buffers) const {
+  WrappedNodeList& path = buffers.path;
+  this->findContextPath(start, stop, true, path);
+  this->computeParameterPath(path, buffers.discounts, buffers.concentrations);
 
-  d_vec prob_path = this->computeProbabilityPath(path,
-                                                 discount_path,
-                                                 concentration_path,
-                                                 obs);
-  return prob_path.back();
+  this->computeProbabilityPath(path,
+                               buffers.discounts,
+                               buffers.concentrations,
+                               obs,
+                               buffers.probabilities);
+  return buffers.probabilities.back();
 }
 
 
 double HPYPModel::predictWithFragmentation(l_type start, 
                                            l_type stop,
                                            e_type obs) {
-  std::pair<int, WrappedNodeList> path = contextTree.findLongestSuffixVirtual(
-      start, stop);
+  return predictWithFragmentation(start, stop, obs, buffers);
+}
 
-  d_vec discountPath = parameters.getDiscounts(path.second);
-  d_vec concentrationPath = parameters.getConcentrations(path.second,
-                                                         discountPath);
-  d_vec probabilityPath = this->computeProbabilityPath(path.second,
-                                                       discountPath,
-                                                       concentrationPath,
-                                                       obs);
+
+double HPYPModel::predictWithFragmentation(l_type start, 
+                                           l_type stop,
+                                           e_type obs,
+                                           PathBuffers& buffers) const {
+  WrappedNodeList& path = buffers.path;
+  int splitLength = contextTree.findLongestSuffixVirtual(start, stop, path);
+
+  d_vec& discountPath = buffers.discounts;
+  d_vec& concentrationPath = buffers.concentrations;
+  d_vec& probabilityPath = buffers.probabilities;
+  parameters.getDiscounts(path, discountPath);
+  parameters.getConcentrations(path, discountPath, concentrationPath);
+  this->computeProbabilityPath(path,
+                               discountPath,
+                               concentrationPath,
+                               obs,
+                               probabilityPath);
 
   double probability = 0;
-  if (path.first != 0) {
+  if (splitLength != 0) {
     // create a new payload for the node we are predicting from
     // fragmentation -- last probability on the path needs to be recomputed
-    // by creating a new, split node of length path.second. 
+    // by creating a new, split node of length splitLength. 
     void* splitNode = this->restaurant.getFactory().make();
-    WrappedNodeList::iterator it = path.second.end();
+    WrappedNodeList::iterator it = path.end();
     it--; it--; // one before last; parent of node we need to split
     int parentLength = it->end - it->start; 
-    // path.first is length of parent after split
-    double discountAfter = parameters.getDiscount(path.first, it->end - it->start);
+    // splitLength is length of parent after split
+    double discountAfter = parameters.getDiscount(splitLength, it->end - it->start);
     it++; // last node
     this->restaurant.updateAfterSplit(
         it->payload,
@@ -311,9 +458,9 @@ double HPYPModel::predictWithFragmentation(l_type start,
         discountAfter,
         true); // update splitNode only
     double discountFragmented = this->parameters.getDiscount(parentLength,
-                                                             path.first);
+                                                             splitLength);
     double concentrationFragmented = this->parameters.getConcentration(
-        discountFragmented, parentLength, path.first);
+        discountFragmented, parentLength, splitLength);
     probability = this->restaurant.computeProbability(
         splitNode, obs, probabilityPath[probabilityPath.size()-2],
         discountFragmented, concentrationFragmented);
@@ -327,21 +474,17 @@ double HPYPModel::predictWithFragmentation(l_type start,
 
 d_vec HPYPModel::predictiveDistribution(l_type start, l_type stop) {
   d_vec predictive;
-  predictive.reserve(this->numTypes);
-  WrappedNodeList path = this->contextTree.findLongestSuffix(start,stop);
-  d_vec discount_path = this->parameters.getDiscounts(path);
-  d_vec concentration_path = this->parameters.getConcentrations(path,
-                                                                discount_path);
+  predictiveDistribution(start, stop, predictive, buffers);
+  return predictive;
+}
 
-  for(int i = 0; i < this->numTypes; ++i) {
-    d_vec prob_path = this->computeProbabilityPath(path,
-                                                   discount_path,
-                                                   concentration_path,
-                                                   i);
-    predictive.push_back(prob_path.back());
-  }
 
-  return predictive;
+void HPYPModel::predictiveDistribution(l_type start, 
+                                       l_type stop,
+                                       d_vec& distribution,
+                                       PathBuffers& buffers) const {
+  computePredictiveDistribution(start, stop, NULL, buffers);
+  buffers.distribution.getDistribution(distribution);
 }
 
 
@@ -349,29 +492,84 @@ d_vec HPYPModel::predictiveDistributionWithMixing(l_type start,
                                                   l_type stop, 
                                                   d_vec& mixingWeights) {
   d_vec predictive;
-  predictive.reserve(this->numTypes);
-  const WrappedNodeList path = this->contextTree.findLongestSuffix(start, stop);
-  const d_vec discount_path = this->parameters.getDiscounts(path);
-  const d_vec concentration_path 
-      = this->parameters.getConcentrations(path, discount_path);
-
-  for(int i = 0; i < this->numTypes; ++i) {
-    d_vec prob_path = this->computeProbabilityPath(path,
-                                                   discount_path,
-                                                   concentration_path,
-                                                   i);
-    double prob = 0;
-    double sum = 0;
-    for (int j = 0; 
-         j < std::min<int>(mixingWeights.size(), prob_path.size());
-         ++j) {
-      prob += mixingWeights[j]*prob_path[j];
-      sum += mixingWeights[j];
-    }
-    predictive.push_back(prob + (1 - sum)*prob_path.back());
+  predictiveDistributionWithMixing(start, stop, mixingWeights, predictive,
+                                   buffers);
+  return predictive;
+}
+
+
+void HPYPModel::predictiveDistributionWithMixing(l_type start, 
+                                                 l_type stop, 
+                                                 const d_vec& mixingWeights,
+                                                 d_vec& distribution,
+                                                 PathBuffers& buffers) const {
+  computePredictiveDistribution(start, stop, &mixingWeights, buffers);
+  buffers.distribution.getMixture(distribution);
+}
+
+
+void HPYPModel::computePredictiveDistribution(l_type start,
+                                              l_type stop,
+                                              const d_vec* mixingWeights,
+                                              PathBuffers& buffers) const {
+  this->findContextPath(start, stop, false, buffers.path);
+  computePathDistribution(buffers.path, mixingWeights, buffers);
+}
+
+
+void HPYPModel::computePathDistribution(const WrappedNodeList& path,
+                                        const d_vec* mixingWeights,
+                                        PathBuffers& buffers) const {
+  this->computeParameterPath(path, buffers.discounts, buffers.concentrations);
+
+  ScaledDistribution& distribution = buffers.distribution;
+  IHPYPBaseRestaurant::TypeVector& types = buffers.types;
+  d_vec& parentProbabilities = buffers.probabilities;
+  const IAddRemoveRestaurant& r = this->restaurant; // shortcut
+
+  // entry j of the mixing weights applies to the distribution after the 
+  // first j nodes of the path (j = 0 being the base distribution)
+  size_t numWeights = 0;
+  double sumWeights = 0;
+  if (mixingWeights != NULL) {
+    numWeights = std::min(mixingWeights->size(), path.size() + 1);
   }
 
-  return predictive;
+  distribution.reset(this->numTypes, this->baseProb);
+  for (size_t j = 0; j <= path.size(); ++j) {
+    if (j > 0) {
+      void* payload = path[j - 1].payload;
+      double discount = buffers.discounts[j - 1];
+      double concentration = buffers.concentrations[j - 1];
+      l_type c = r.getC(payload);
+      if (c > 0) {
+        // scale all probabilities by the backoff factor, then recompute the
+        // probabilities of the types present in this restaurant
+        r.getTypeVector(payload, types);
+        parentProbabilities.resize(types.size());
+        for (size_t i = 0; i < types.size(); ++i) {
+          parentProbabilities[i] = distribution.get(types[i]);
+        }
+        distribution.multiply((concentration + discount * r.getT(payload))
+                              / (c + concentration));
+        for (size_t i = 0; i < types.size(); ++i) {
+          distribution.set(types[i],
+                           r.computeProbability(payload,
+                                                types[i],
+                                                parentProbabilities[i],
+                                                discount,
+                                                concentration));
+        }
+      }
+    }
+    if (j < numWeights) {
+      distribution.addToMixture((*mixingWeights)[j]);
+      sumWeights += (*mixingWeights)[j];
+    }
+  }
+  if (mixingWeights != NULL) {
+    distribution.addToMixture(1 - sumWeights);
+  }
 }
         
 
@@ -385,7 +583,9 @@ void HPYPModel::gibbsSamplePath(
     const d_vec& discountPath, 
     const d_vec& concentrationPath, 
     const HPYPModel::PayloadDataPath& payloadDataPath,
-    double baseProb) {
+    double baseProb,
+    PathBuffers& buffers,
+    SharedRestaurants* shared) {
   assert(path.size() > 0);
   assert(path.size() == discountPath.size());
   assert(path.size() == concentrationPath.size());
@@ -394,7 +594,9 @@ void HPYPModel::gibbsSamplePath(
   void* main = path.back().payload;
   const IAddRemoveRestaurant& r = this->restaurant; // shortcut
   
-  IHPYPBaseRestaurant::TypeVector types = r.getTypeVector(main);
+  IHPYPBaseRestaurant::TypeVector& types = buffers.types;
+  r.getTypeVector(main, types);
+  d_vec& probabilityPath = buffers.probabilities;
   for(IHPYPBaseRestaurant::TypeVectorIterator it = types.begin(); 
       it != types.end(); ++it) { // for each type of customer 
 
@@ -405,29 +607,34 @@ void HPYPModel::gibbsSamplePath(
       continue; // no point in reseating in a 1 customer restaurant
     }
 
-    d_vec probabilityPath = this->computeProbabilityPath(path,
-                                                         discountPath,
-                                                         concentrationPath,
-                                                         type);
-    WrappedNodeList::const_iterator current;
+    {
+      SharedRestaurants::Lock lock(shared);
+      lock.acquire(0);
+      this->computeProbabilityPath(path,
+                                   discountPath,
+                                   concentrationPath,
+                                   type,
+                                   probabilityPath);
+    }
     for (l_type i = 0; i < cw; ++i) { // for each customer of this type
-      current = --path.end(); // set current to last restaurant in path
-      
-      // index into d/alpha vectors for current restaurant
+      SharedRestaurants::Lock lock(shared);
+
+      // index into path and d/alpha vectors for current restaurant, 
+      // starting with the last restaurant in path
       int j = discountPath.size() - 1;
       
       bool goUp = true;
       while(goUp && j != -1) {
+        lock.acquire(j);
         void* additionalData = NULL;
         if (useAdditionalData) {
           additionalData = payloadDataPath[j].get();
         }
-        bool removed = r.removeCustomer(current->payload,
+        bool removed = r.removeCustomer(path[j].payload,
                                         type,
                                         discountPath[j],
                                         additionalData);
         if (removed) {
-          --current;
           --j;
         } else {
           goUp = false;
@@ -435,38 +642,36 @@ void HPYPModel::gibbsSamplePath(
       }
 
       // recompute probabilities back down; need not recompute last probability
+      if (j == -1) {
+        // can't recompute base distribution probabilities at prob_path[0]
+        j = 0;
+      }
       while(j < (int)probabilityPath.size() - 1) {
-        if (j == -1) {
-          // can't recompute base distribution probabilities at prob_path[0]
-          j = 0; // 
-          ++current;
-        }
-        probabilityPath[j+1] = r.computeProbability(current->payload, 
+        lock.acquire(j);
+        probabilityPath[j+1] = r.computeProbability(path[j].payload, 
                                                     type,
                                                     probabilityPath[j],
                                                     discountPath[j],
                                                     concentrationPath[j]);
         ++j; 
-        ++current;
       }
 
-      // set current and j to the last restaurant on path
-      current = --path.end(); 
+      // go back to the last restaurant on path
       j = discountPath.size() - 1; 
       goUp = true;
       while(goUp && j != -1) {
+        lock.acquire(j);
         void* additionalData = NULL;
         if (useAdditionalData) {
           additionalData = payloadDataPath[j].get();
         }
-        bool inserted = r.addCustomer(current->payload, 
+        bool inserted = r.addCustomer(path[j].payload, 
                                       type,
                                       probabilityPath[j],
                                       discountPath[j],
                                       concentrationPath[j], 
                                       additionalData);
         if (inserted) {
-          current--;
           j--;
         } else {
           goUp = false;
@@ -480,6 +685,24 @@ void HPYPModel::gibbsSamplePath(
 }
 
 
+boost::shared_ptr<void> HPYPModel::makeAdditionalDataPtr(
+    const WrappedNode& node, 
+    double discount, 
+    double concentration,
+    int level,
+    SharedRestaurants* shared) {
+  if (shared == NULL || level >= shared->depth) {
+    return makeAdditionalDataPtr(node.payload, discount, concentration);
+  }
+  ScopedLock lock(shared->mutex);
+  boost::shared_ptr<void>& data = shared->additionalData[node.node];
+  if (!data) {
+    data = makeAdditionalDataPtr(node.payload, discount, concentration);
+  }
+  return data;
+}
+
+
 boost::shared_ptr<void> HPYPModel::makeAdditionalDataPtr(void* payload, 
                                                          double discount, 
                                                          double concentration) {
@@ -495,6 +718,13 @@ boost::shared_ptr<void> HPYPModel::makeAdditionalDataPtr(void* payload,
 
 void HPYPModel::runGibbsSampler() {
   ContextTree::DFSPathIterator pathIterator = contextTree.getDFSPathIterator();
+  this->gibbsSampleSubtree(pathIterator, buffers, NULL);
+}
+
+
+void HPYPModel::gibbsSampleSubtree(ContextTree::DFSPathIterator& pathIterator,
+                                   PathBuffers& buffers,
+                                   SharedRestaurants* shared) {
   d_vec discountPath = parameters.getDiscounts(*pathIterator);
   d_vec concentrationPath = parameters.getConcentrations(*pathIterator, 
                                                          discountPath);
@@ -506,18 +736,18 @@ void HPYPModel::runGibbsSampler() {
   for (WrappedNodeList::const_iterator it = (*pathIterator).begin();
        it != (*pathIterator).end(); ++it) {
       payloadDataPath.push_back(this->makeAdditionalDataPtr(
-            it->payload, discountPath[j], concentrationPath[j]));
+            *it, discountPath[j], concentrationPath[j], j, shared));
     j++;
   }
 
   this->gibbsSamplePath(*pathIterator, discountPath, concentrationPath,
-                        payloadDataPath, baseProb);
+                        payloadDataPath, baseProb, buffers, shared);
 
   size_t pathLength = (*pathIterator).size();
   
   while(pathIterator.hasMore()) { // loop over all paths in the tree
     ++pathIterator;
-    if ((*pathIterator).size() == 0) {
+    if (!pathIterator.hasMore()) {
       break;
     }
 
@@ -531,9 +761,11 @@ void HPYPModel::runGibbsSampler() {
                                       concentrationPath);
       payloadDataPath.pop_back();
       payloadDataPath.push_back(
-          this->makeAdditionalDataPtr((*pathIterator).back().payload, 
+          this->makeAdditionalDataPtr((*pathIterator).back(), 
                                       discountPath.back(), 
-                                      concentrationPath.back()));
+                                      concentrationPath.back(),
+                                      discountPath.size() - 1,
+                                      shared));
 
     } else {
       if ((*pathIterator).size() == pathLength - 1) {
@@ -557,9 +789,11 @@ void HPYPModel::runGibbsSampler() {
         }
         for (size_t i = payloadDataPath.size(); i < discountPath.size(); ++i) {
           payloadDataPath.push_back(
-              this->makeAdditionalDataPtr(it->payload, 
+              this->makeAdditionalDataPtr(*it, 
                                           discountPath[i], 
-                                          concentrationPath[i]));
+                                          concentrationPath[i],
+                                          i,
+                                          shared));
 
           ++it;
         }
@@ -574,52 +808,131 @@ void HPYPModel::runGibbsSampler() {
     
     
     this->gibbsSamplePath(*pathIterator, discountPath, concentrationPath,
-                          payloadDataPath, baseProb);
+                          payloadDataPath, baseProb, buffers, shared);
+  }
+}
+
+
+void HPYPModel::runParallelGibbsSampler(int numThreads, int splitDepth) {
+  std::vector<ContextTree::Subtree> subtrees;
+  std::vector<WrappedNodeList> upperPaths;
+  contextTree.splitAtDepth(splitDepth, subtrees, upperPaths);
+  SharedRestaurants shared(splitDepth);
+
+  // resample the shared restaurants first
+  d_vec discountPath, concentrationPath;
+  for (size_t p = 0; p < upperPaths.size(); ++p) {
+    const WrappedNodeList& path = upperPaths[p];
+    parameters.getDiscounts(path, discountPath);
+    parameters.getConcentrations(path, discountPath, concentrationPath);
+    HPYPModel::PayloadDataPath payloadDataPath;
+    for (size_t i = 0; i < path.size(); ++i) {
+      payloadDataPath.push_back(this->makeAdditionalDataPtr(
+            path[i], discountPath[i], concentrationPath[i], i,
+            &shared));
+    }
+    this->gibbsSamplePath(path, discountPath, concentrationPath,
+                          payloadDataPath, baseProb, buffers, &shared);
+  }
+
+  // sample the largest subtrees (by the number of customers in their root)
+  // first, so that the threads finish at roughly the same time
+  std::vector<std::pair<l_type, size_t> > sizes;
+  for (size_t i = 0; i < subtrees.size(); ++i) {
+    sizes.push_back(std::make_pair(
+          -restaurant.getC(subtrees[i].path.back().payload), i));
+  }
+  std::sort(sizes.begin(), sizes.end());
+  std::vector<size_t> order;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    order.push_back(sizes[i].second);
+  }
+
+  GibbsSubtreeWork work(*this, subtrees, order, shared, numThreads);
+  parallelFor(0, subtrees.size(), numThreads, work, 1);
+}
+
+
+HPYPModel::GibbsSubtreeWork::GibbsSubtreeWork(
+    HPYPModel& model,
+    const std::vector<ContextTree::Subtree>& subtrees,
+    const std::vector<size_t>& order,
+    SharedRestaurants& shared,
+    int numThreads)
+    : model(model), subtrees(subtrees), order(order), shared(shared),
+      buffers(numThreads), base(gsl_rng_get(get_rng())) {}
+
+
+void HPYPModel::GibbsSubtreeWork::operator()(int thread, 
+                                             l_type begin, 
+                                             l_type end) {
+  for (l_type i = begin; i < end; ++i) {
+    size_t subtree = order[i];
+    // every subtree has its own stream, independent of the thread
+    boost::scoped_ptr<RNG> rng(base.stream(subtree));
+    RNGBinding binding(*rng);
+    ContextTree::DFSPathIterator pathIterator =
+        model.contextTree.getDFSPathIterator(subtrees[subtree]);
+    model.gibbsSampleSubtree(pathIterator, buffers[thread], &shared);
+  }
+}
+
+
+int HPYPModel::findContextPath(l_type start, l_type stop, bool below,
+                               WrappedNodeList& path) const {
+  if (below) {
+    return this->contextTree.findLongestSuffixVirtual(start, stop, path);
   }
+  this->contextTree.findLongestSuffix(start, stop, path);
+  return 0;
 }
 
 
-d_vec HPYPModel::computeProbabilityPath(const WrappedNodeList& path, 
-                                        const d_vec& discount_path, 
-                                        const d_vec& concentration_path,
-                                        e_type obs) {
-  d_vec out;
+void HPYPModel::computeParameterPath(const WrappedNodeList& path,
+                                     d_vec& discount_path,
+                                     d_vec& concentration_path) const {
+  this->parameters.getDiscounts(path, discount_path);
+  this->parameters.getConcentrations(path, discount_path, concentration_path);
+}
+
+
+void HPYPModel::computeProbabilityPath(const WrappedNodeList& path, 
+                                       const d_vec& discount_path, 
+                                       const d_vec& concentration_path,
+                                       e_type obs,
+                                       d_vec& out) const {
+  out.clear();
   out.reserve(path.size() + 1);
   
   double prob = this->baseProb; // base distribution
   out.push_back(prob);
   
-  int j = 0;
-  for(WrappedNodeList::const_iterator it = path.begin();
-      it!= path.end();
-      ++it) {
-    prob = this->restaurant.computeProbability(it->payload, 
+  for(size_t j = 0; j < path.size(); ++j) {
+    prob = this->restaurant.computeProbability(path[j].payload, 
                                                obs,
                                                prob,
                                                discount_path[j],
                                                concentration_path[j]);
     out.push_back(prob);
-    j++;
   } 
-  return out;
 }
 
 
-void HPYPModel::updatePath(const WrappedNodeList& path, 
+void HPYPModel::updatePath(WrappedNodeList& path, 
                            const d_vec& prob_path, 
                            const d_vec& discount_path, 
                            const d_vec& concentration_path, 
                            e_type obs) {
 
   unsigned int j=path.size()-1;
-  for(WrappedNodeList::const_reverse_iterator it = path.rbegin(); 
+  for(WrappedNodeList::reverse_iterator it = path.rbegin(); 
       it != path.rend();
       ++it) {
-    bool newTable = this->restaurant.addCustomer(it->payload,
-                                                 obs,
-                                                 prob_path[j],
-                                                 discount_path[j],
-                                                 concentration_path[j]);
+    bool newTable = this->addCustomer(*it,
+                                      obs,
+                                      prob_path[j],
+                                      discount_path[j],
+                                      concentration_path[j]);
     if (!newTable) {
       break;
     }
@@ -629,13 +942,13 @@ void HPYPModel::updatePath(const WrappedNodeList& path,
     
 
 void HPYPModel::removeObservationFromPath(
-    const WrappedNodeList& path,
+    WrappedNodeList& path,
     const d_vec& discountPath,
     e_type obs,
     const HPYPModel::PayloadDataPath& payloadDataPath) {
   int j = path.size()-1;
 
-  for(WrappedNodeList::const_reverse_iterator it = path.rbegin();
+  for(WrappedNodeList::reverse_iterator it = path.rbegin();
     it != path.rend(); it++) {
 
     void* payloadData = NULL;
@@ -643,15 +956,68 @@ void HPYPModel::removeObservationFromPath(
       payloadData = payloadDataPath[j].get();
     }
 
-    bool tableDeleted = this->restaurant.removeCustomer(it->payload,
-                                                        obs,
-                                                        discountPath[j],
-                                                        payloadData);
+    bool tableDeleted = this->removeCustomer(*it,
+                                             obs,
+                                             discountPath[j],
+                                             payloadData);
     if (!tableDeleted)
       break;
     j--;
   }
 }
+
+
+bool HPYPModel::addCustomer(WrappedNode& node,
+                            e_type type,
+                            double parentProbability,
+                            double discount,
+                            double concentration) {
+  if (this->implicitRestaurant == NULL ||
+      !ImplicitPayloadRestaurant::isImplicit(node.payload)) {
+    return this->restaurant.addCustomer(node.payload,
+                                        type,
+                                        parentProbability,
+                                        discount,
+                                        concentration);
+  }
+  if (this->restaurant.getC(node.payload) == 0) {
+    // the first customer always sits at a new table
+    this->contextTree.setPayload(node,
+                                 ImplicitPayloadRestaurant::makeImplicit(type));
+    return true;
+  }
+  void* payload = this->implicitRestaurant->materialize(node.payload);
+  bool newTable = this->restaurant.addCustomer(payload,
+                                               type,
+                                               parentProbability,
+                                               discount,
+                                               concentration);
+  this->contextTree.setPayload(node, payload);
+  return newTable;
+}
+
+
+bool HPYPModel::removeCustomer(WrappedNode& node,
+                               e_type type,
+                               double discount,
+                               void* additionalData) {
+  if (this->implicitRestaurant == NULL ||
+      !ImplicitPayloadRestaurant::isImplicit(node.payload)) {
+    return this->restaurant.removeCustomer(node.payload,
+                                           type,
+                                           discount,
+                                           additionalData);
+  }
+  // removing the customer may draw random numbers, so do it on a real copy
+  void* payload = this->implicitRestaurant->materialize(node.payload);
+  bool tableDeleted = this->restaurant.removeCustomer(payload,
+                                                      type,
+                                                      discount,
+                                                      additionalData);
+  this->contextTree.setPayload(node,
+                               this->implicitRestaurant->compact(payload));
+  return tableDeleted;
+}
         
 
 void HPYPModel::handleSplit(const WrappedNode& nodeA,
@@ -675,6 +1041,240 @@ void HPYPModel::handleSplit(const WrappedNode& nodeA,
 }
 
 
+void HPYPModel::setNodeBudget(size_t maxNodes, EvictionPolicy policy) {
+  assert(maxNodes == 0 || this->windowSize == 0);
+  this->maxNodes = maxNodes;
+  this->evictionPolicy = policy;
+  this->countNodes();
+}
+
+
+void HPYPModel::setWindow(l_type windowSize) {
+  assert(windowSize == 0 || this->maxNodes == 0);
+  this->windowSize = windowSize;
+  this->window.assign(windowSize,
+                      std::make_pair(ContextTree::NodeId(NULL), e_type()));
+  this->windowPos = 0;
+  this->countNodes();
+}
+
+
+void HPYPModel::countNodes() {
+  this->numNodes = 0;
+  this->leaves.clear();
+  if (this->maxNodes > 0 || this->windowSize > 0) {
+    CountNodesVisitor visitor(*this);
+    this->contextTree.visitDFSWithChildren(visitor);
+  }
+}
+
+
+void HPYPModel::countInsertion(const ContextTree::InsertionResult& result) {
+  typedef ContextTree::InsertionResult InsertionResult;
+  if (!result.created) {
+    return;
+  }
+  const WrappedNodeList& path = result.path;
+  switch (result.action) {
+    case InsertionResult::INSERT_ACTION_NO_SPLIT :
+      // new leaf, whose parent may have been a leaf before
+      this->numNodes += 1;
+      if (this->maxNodes > 0) {
+        this->leaves.erase(path[path.size() - 2].node);
+        this->leaves.insert(path.back().node, this->evictionTime);
+      }
+      break;
+    case InsertionResult::INSERT_ACTION_SPLIT :
+      // new leaf and its parent
+      this->numNodes += 2;
+      if (this->maxNodes > 0) {
+        this->leaves.insert(path.back().node, this->evictionTime);
+      }
+      break;
+    case InsertionResult::INSERT_ACTION_SPLIT_SUFFIX :
+      // new inner node
+      this->numNodes += 1;
+      break;
+  }
+}
+
+
+void HPYPModel::enforceNodeBudget(ContextTree::NodeId keep) {
+  while (this->numNodes > this->maxNodes) {
+    ContextTree::NodeId leaf = (this->evictionPolicy == EVICT_RANDOM)
+                               ? this->leaves.random(keep)
+                               : this->leaves.leastRecent(keep);
+    if (leaf == NULL) {
+      break;
+    }
+    this->evictLeaf(leaf);
+  }
+}
+
+
+void HPYPModel::evictLeaf(ContextTree::NodeId node) {
+  WrappedNodeList& path = this->buffers.path;
+  d_vec& discounts = this->buffers.discounts;
+  d_vec& concentrations = this->buffers.concentrations;
+  this->contextTree.findPath(node, path);
+  this->parameters.getDiscounts(path, discounts);
+  this->parameters.getConcentrations(path, discounts, concentrations);
+
+  // every table in the leaf is a customer in its parent
+  WrappedNode leaf = path.back();
+  path.pop_back();
+  PayloadDataPath& payloadDataPath = this->buffers.payloadData;
+  payloadDataPath.assign(path.size(), boost::shared_ptr<void>());
+  IHPYPBaseRestaurant::TypeVector& types = this->buffers.types;
+  this->restaurant.getTypeVector(leaf.payload, types);
+  for (IHPYPBaseRestaurant::TypeVectorIterator it = types.begin();
+       it != types.end(); ++it) {
+    for (l_type t = this->restaurant.getT(leaf.payload, *it); t > 0; --t) {
+      this->removeCustomerFromPath(path, discounts, concentrations, *it,
+                                   payloadDataPath);
+    }
+  }
+  payloadDataPath.clear();
+  path.push_back(leaf);
+
+  l_type lastUse = this->leaves.getTime(node);
+  this->leaves.erase(node);
+  this->contextTree.removeLeaf(path);
+  --this->numNodes;
+  ++this->numEvictions;
+
+  // the parent (unless it is the root) becomes a leaf if this was its last
+  // child
+  if (path.size() > 2 && this->contextTree.isLeaf(path[path.size()-2].node)) {
+    this->leaves.insert(path[path.size() - 2].node, lastUse);
+  }
+}
+
+
+void HPYPModel::removeCustomerFromPath(WrappedNodeList& path,
+                                       const d_vec& discounts,
+                                       const d_vec& concentrations,
+                                       e_type type,
+                                       PayloadDataPath& payloadDataPath) {
+  for (int j = path.size() - 1; j >= 0; --j) {
+    if (!payloadDataPath[j]) {
+      payloadDataPath[j] = this->makeAdditionalDataPtr(path[j].payload,
+                                                       discounts[j],
+                                                       concentrations[j]);
+    }
+    if (!this->removeCustomer(path[j], type, discounts[j],
+                              payloadDataPath[j].get())) {
+      break;
+    }
+  }
+}
+
+
+void HPYPModel::rememberObservation(ContextTree::NodeId node, e_type obs) {
+  std::pair<ContextTree::NodeId, e_type>& slot = this->window[this->windowPos];
+  if (slot.first != NULL) {
+    this->forgetObservation(slot.first, slot.second);
+  }
+  slot.first = node;
+  slot.second = obs;
+  this->windowPos = (this->windowPos + 1) % this->windowSize;
+}
+
+
+void HPYPModel::forgetObservation(ContextTree::NodeId node, e_type obs) {
+  WrappedNodeList& path = this->buffers.path;
+  d_vec& discounts = this->buffers.discounts;
+  this->contextTree.findPath(node, path);
+  this->parameters.getDiscounts(path, discounts);
+  // a single customer is removed from each restaurant, so the restaurants 
+  // do not get additional data, which would have to be built for all types
+  this->removeObservationFromPath(path, discounts, obs, PayloadDataPath());
+
+  // Remove the leaves left without customers, and then their parents if 
+  // they become such leaves. No observation in the window is stored in them,
+  // as each of those is a customer in the node it was inserted into.
+  while (path.size() > 1 && this->contextTree.isLeaf(path.back().node) &&
+         this->restaurant.getC(path.back().payload) == 0) {
+    this->contextTree.removeLeaf(path);
+    path.pop_back();
+    --this->numNodes;
+  }
+}
+
+
+void HPYPModel::LeafSet::clear() {
+  nodes.clear();
+  entries.clear();
+  byTime.clear();
+}
+
+
+void HPYPModel::LeafSet::insert(NodeId node, l_type time) {
+  Entry entry;
+  entry.position = nodes.size();
+  entry.time = time;
+  if (entries.insert(std::make_pair(node, entry)).second) {
+    nodes.push_back(node);
+    byTime.insert(std::make_pair(time, node));
+  }
+}
+
+
+void HPYPModel::LeafSet::erase(NodeId node) {
+  std::map<NodeId, Entry>::iterator it = entries.find(node);
+  if (it == entries.end()) {
+    return;
+  }
+  // move the last node into the position of the erased one
+  NodeId last = nodes.back();
+  nodes[it->second.position] = last;
+  entries[last].position = it->second.position;
+  nodes.pop_back();
+  byTime.erase(std::make_pair(it->second.time, node));
+  entries.erase(it);
+}
+
+
+void HPYPModel::LeafSet::touch(NodeId node, l_type time) {
+  std::map<NodeId, Entry>::iterator it = entries.find(node);
+  if (it != entries.end()) {
+    byTime.erase(std::make_pair(it->second.time, node));
+    it->second.time = time;
+    byTime.insert(std::make_pair(time, node));
+  }
+}
+
+
+l_type HPYPModel::LeafSet::getTime(NodeId node) const {
+  std::map<NodeId, Entry>::const_iterator it = entries.find(node);
+  assert(it != entries.end());
+  return it->second.time;
+}
+
+
+HPYPModel::LeafSet::NodeId HPYPModel::LeafSet::random(NodeId keep) const {
+  if (nodes.empty() || (nodes.size() == 1 && nodes[0] == keep)) {
+    return NULL;
+  }
+  while (true) {
+    NodeId node = nodes[uniform_int(nodes.size())];
+    if (node != keep) {
+      return node;
+    }
+  }
+}
+
+
+HPYPModel::LeafSet::NodeId HPYPModel::LeafSet::leastRecent(
+    NodeId keep) const {
+  std::set<std::pair<l_type, NodeId> >::const_iterator it = byTime.begin();
+  if (it != byTime.end() && it->second == keep) {
+    ++it;
+  }
+  return (it != byTime.end()) ? it->second : NULL;
+}
+
+
 bool HPYPModel::checkConsistency(const WrappedNode& node, 
                       const std::list<WrappedNode>& children) const {
   bool consistent = this->restaurant.checkConsistency(node.payload);
@@ -740,6 +1340,19 @@ void HPYPModel::CheckConsistencyVisitor::operator()(
 }
 
 
+HPYPModel::CountNodesVisitor::CountNodesVisitor(HPYPModel& model) 
+    : model(model) {}
+
+
+void HPYPModel::CountNodesVisitor::operator()(
+    WrappedNode& n, std::list<WrappedNode>& children) {
+  ++model.numNodes;
+  if (model.maxNodes > 0 && n.depth > 0 && children.empty()) {
+    model.leaves.insert(n.node, model.evictionTime);
+  }
+}
+
+
 std::string HPYPModel::toString() {
   HPYPModel::ToStringVisitor visitor(this->seq, this->restaurant);
   this->contextTree.visitDFS(visitor);
@@ -21,15 +21,23 @@
 #define HPYP_MODEL_H_
 
 
+#include <map>
+#include <set>
 #include <vector>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "libplump/config.h"
+#include "libplump/utils.h"
 #include "libplump/context_tree.h"
+#include "libplump/implicit_payload_restaurant.h"
 #include "libplump/node_manager_interface.h"
 #include "libplump/hpyp_restaurant_interface.h"
 #include "libplump/hpyp_parameters_interface.h"
+#include "libplump/parallel.h"
+#include "libplump/parameter_optimizer.h"
+#include "libplump/random.h"
+#include "libplump/scaled_distribution.h"
 
 namespace gatsby { namespace libplump {
   
@@ -39,9 +47,37 @@ class HPYPModel {
     typedef std::vector<boost::shared_ptr<void> > PayloadDataPath;
 
     enum PredictMode {ABOVE, FRAGMENT, BELOW};
+
+    enum EvictionPolicy {EVICT_RANDOM, EVICT_LEAST_RECENT};
+
+    /**
+     * Scratch space for the computations along a path through the tree.
+     * Once the buffers have grown to the depth of the tree, computing a
+     * prediction or inserting an observation does not allocate any memory
+     * for bookkeeping.
+     *
+     * The model keeps one instance for its own use; the const prediction
+     * methods take one as an argument so that different threads can predict
+     * using separate buffers.
+     */
+    struct PathBuffers {
+      WrappedNodeList path;
+      d_vec discounts;
+      d_vec concentrations;
+      d_vec probabilities;
+      IHPYPBaseRestaurant::TypeVector types;
+      ContextTree::InsertionResult insertion;
+      ScaledDistribution distribution;
+      PayloadDataPath payloadData;
+    };
     
     /**
      * Construct a new HPYP model using the given nodeManager and restaurant.
+     *
+     * If restaurant is an ImplicitPayloadRestaurant, new leaves are created
+     * with implicit payloads, which are replaced by real payloads when they
+     * get a second customer (or a child). The node manager must then use the
+     * factory of the ImplicitPayloadRestaurant.
      */
     HPYPModel(seq_type& seq,
               INodeManager& nodeManager, 
@@ -49,7 +85,7 @@ class HPYPModel {
               IParameters& parameters,
               int numTypes);
 
-    ~HPYPModel() {}
+    virtual ~HPYPModel() {}
 
     /**
      * Create the root node and insert the given observation into it.
@@ -72,11 +108,26 @@ class HPYPModel {
      */
     d_vec insertContextAndObservation(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Same as above, but leaves the path and the probabilities along it in
+     * buffers instead of returning them, so that it does not allocate for
+     * bookkeeping.
+     */
+    void insertContextAndObservation(l_type start, l_type stop, e_type obs,
+                                     PathBuffers& buffers);
+
     /**
      * Insert an observation into an existing context.
      */
     d_vec insertObservation(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Same as above, but leaves the path and the probabilities along it in
+     * buffers.
+     */
+    void insertObservation(l_type start, l_type stop, e_type obs,
+                           PathBuffers& buffers);
+
     /**
      * Remove an observation of type obs from the given context.
      *
@@ -115,12 +166,24 @@ class HPYPModel {
      */
     double predict(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Same as above, using the given buffers.
+     */
+    double predict(l_type start, l_type stop, e_type obs,
+                   PathBuffers& buffers) const;
+
     /**
      * Predict prob; in the case of required fragmentation, predict form 
      * _below_ the split point!
      */
     double predictBelow(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Same as above, using the given buffers.
+     */
+    double predictBelow(l_type start, l_type stop, e_type obs,
+                        PathBuffers& buffers) const;
+
     /**
      * Compute the predictive probability of the given observation
      * in the context [start, stop). If the required context is not in tree, 
@@ -129,19 +192,54 @@ class HPYPModel {
      */
     double predictWithFragmentation(l_type start, l_type stop, e_type obs);
 
+    /**
+     * Same as above, using the given buffers.
+     */
+    double predictWithFragmentation(l_type start, l_type stop, e_type obs,
+                                    PathBuffers& buffers) const;
+
 
     /**
      * Compute predictive probability for a sequence of observations, 
      * i.e. for each i in [start, stop), compute p(x_i|x_{start:i}).
+     *
+     * The predictions are independent of each other and can be split across
+     * numThreads threads. For ABOVE and BELOW the result does not depend on
+     * the number of threads. For FRAGMENT every thread samples using its own
+     * RNG seeded from the global RNG, so that the result depends on
+     * the number of threads and on how the positions are assigned to them.
+     *
+     * The model must not be modified while this function is running.
      */
     d_vec predictSequence(l_type start, l_type stop,
-                          PredictMode mode = ABOVE);
+                          PredictMode mode = ABOVE,
+                          int numThreads = 1);
+
+    /**
+     * Same as above, but only for the positions i in [first, stop); the
+     * contexts still begin at start.
+     */
+    d_vec predictSequence(l_type start, l_type first, l_type stop,
+                          PredictMode mode, int numThreads);
 
     /**
      * Compute the entire predictive distribution in the given context.
+     *
+     * The distribution is computed in a single pass down the path, which
+     * takes time linear in the depth of the context plus the total number of
+     * types in the restaurants along the path (plus the number of types for
+     * writing the result).
      */
     d_vec predictiveDistribution(l_type start, l_type stop);
 
+    /**
+     * Same as above, writing the distribution into the given vector and
+     * using the given buffers.
+     */
+    void predictiveDistribution(l_type start, l_type stop, 
+                                d_vec& distribution,
+                                PathBuffers& buffers) const;
+
     /**
      * Compute the entire predictive distribution in the given context by
      * mixing the distributions in all contexts up to the root with
@@ -151,11 +249,39 @@ class HPYPModel {
                                            l_type stop,
                                            d_vec& mixingWeights);
 
+    /**
+     * Same as above, writing the distribution into the given vector and
+     * using the given buffers.
+     */
+    void predictiveDistributionWithMixing(l_type start, 
+                                          l_type stop,
+                                          const d_vec& mixingWeights,
+                                          d_vec& distribution,
+                                          PathBuffers& buffers) const;
+
     /**
      * Run one iteration of Gibbs sampling in the model.
      */
     void runGibbsSampler();
 
+    /**
+     * Run one iteration of Gibbs sampling using numThreads threads.
+     *
+     * The tree is split at splitDepth (see ContextTree::splitAtDepth): the
+     * restaurants above are resampled first by the calling thread, then the
+     * subtrees are distributed over the threads, largest first. The
+     * restaurants in different subtrees only interact through the shared
+     * restaurants above the split depth, which are locked whenever a
+     * customer is added to or removed from them. Each subtree is sampled
+     * using its own RNG stream.
+     *
+     * While the sweep is exact for a single thread, the predictive
+     * probabilities of the shared restaurants are only refreshed once per
+     * type and path, so that with several threads they may lag behind the
+     * changes made by other threads.
+     */
+    void runParallelGibbsSampler(int numThreads, int splitDepth = 2);
+
     /**
      * Return a string representation of entire model.
      */
@@ -169,18 +295,129 @@ class HPYPModel {
      */
     bool checkConsistency() const;
 
+    /**
+     * Bound the number of nodes in the context tree by maxNodes (0 removes
+     * the bound). Whenever inserting an observation leaves more than 
+     * maxNodes nodes in the tree, leaves other than the one the observation
+     * was inserted into are removed together with their customers until the
+     * bound holds again. Every table in a removed leaf is a customer in its 
+     * parent, which is removed as in removeObservation(), so that the 
+     * seating arrangements stay consistent. The leaves are chosen uniformly
+     * at random (EVICT_RANDOM) or by the time of the last observation 
+     * inserted into them (EVICT_LEAST_RECENT).
+     *
+     * The nodes are counted when the bound is set, so the tree must not be
+     * changed other than through this model afterwards. Contexts are still
+     * inserted using the Weiner links after leaves have been removed (see
+     * ContextTree::removeLeaf()). A node budget cannot be combined with a
+     * window.
+     */
+    void setNodeBudget(size_t maxNodes, EvictionPolicy policy = EVICT_RANDOM);
+
+    /**
+     * Only keep the last windowSize observations in the model (0 keeps all
+     * of them). Whenever an observation is inserted, the one inserted 
+     * windowSize observations before is removed from the context it was 
+     * inserted into, as in removeObservation(); contexts left without
+     * customers and children are then removed from the tree, so that the
+     * number of nodes stays proportional to windowSize. Observations 
+     * inserted before the window was set are kept.
+     *
+     * As for setNodeBudget(), the nodes are counted when the window is set,
+     * and removing nodes keeps the Weiner links. A window cannot be combined
+     * with a node budget.
+     */
+    void setWindow(l_type windowSize);
+
+    /**
+     * The number of nodes in the tree if a node budget or a window is set, 0
+     * otherwise.
+     */
+    size_t getNumNodes() const {
+      return numNodes;
+    }
+
+    /**
+     * The number of leaves removed to stay within the node budget.
+     */
+    size_t getNumEvictions() const {
+      return numEvictions;
+    }
+
+    /**
+     * The optimizer that learns the free parameters from the observations
+     * inserted into the model (by default using plain gradient steps on
+     * mini-batches of two observations); use setOptions() to configure it.
+     */
+    ParameterOptimizer& getOptimizer() {
+      return optimizer;
+    }
+
 
   private:
 
+    // The following four methods are the per-node loops of training and
+    // prediction. They are virtual so that HPYPModelT can replace them with
+    // versions that call the concrete node manager, restaurant and
+    // parameters; everything else is shared.
+
+    /**
+     * Find the path for the context [start, stop) as 
+     * ContextTree::findLongestSuffix (if below is false) or
+     * ContextTree::findLongestSuffixVirtual (if below is true) do.
+     */
+    virtual int findContextPath(l_type start, l_type stop, bool below,
+                                WrappedNodeList& path) const;
+
+    /**
+     * Compute the discounts and concentrations along a path.
+     */
+    virtual void computeParameterPath(const WrappedNodeList& path,
+                                      d_vec& discount_path,
+                                      d_vec& concentration_path) const;
+
     /** 
      * Compute the predictive probability for a symbol along a path, starting
      * with the base distribution at the root. At position i it contains the
      * parentProb for node i.
      */
-    d_vec computeProbabilityPath(const WrappedNodeList& path, 
-                                 const d_vec& discount_path, 
-                                 const d_vec& concentration_path,
-                                 e_type obs);
+    virtual void computeProbabilityPath(const WrappedNodeList& path, 
+                                        const d_vec& discount_path, 
+                                        const d_vec& concentration_path,
+                                        e_type obs,
+                                        d_vec& probability_path) const;
+
+    /**
+     * Compute the predictive distribution in the context [start, stop) into
+     * buffers.distribution, mixing in the distributions along the path if 
+     * mixingWeights is not NULL.
+     */
+    void computePredictiveDistribution(l_type start, l_type stop,
+                                       const d_vec* mixingWeights,
+                                       PathBuffers& buffers) const;
+
+    /**
+     * Compute the predictive distribution at the end of the given path into
+     * buffers.distribution; path may be buffers.path.
+     */
+    void computePathDistribution(const WrappedNodeList& path,
+                                 const d_vec* mixingWeights,
+                                 PathBuffers& buffers) const;
+
+    /**
+     * Insert an observation into the last node of path, which must be in the
+     * tree, leaving the probabilities along the path in buffers (path may be
+     * buffers.insertion.path).
+     */
+    void insertObservationAtPath(WrappedNodeList& path, e_type obs,
+                                 PathBuffers& buffers);
+
+    /**
+     * Insert a context into the tree and handle a potential split; the
+     * path to the inserted node is left in result.path.
+     */
+    void insertContext(l_type start, l_type stop,
+                       ContextTree::InsertionResult& result);
 
 
     /**
@@ -188,11 +425,11 @@ class HPYPModel {
      * recursively insert customers up the path if a new table was created by
      * the last insertion.
      */
-    void updatePath(const WrappedNodeList& path, 
-                    const d_vec& prob_path, 
-                    const d_vec& discount_path, 
-                    const d_vec& concentration_path, 
-                    e_type obs);
+    virtual void updatePath(WrappedNodeList& path, 
+                            const d_vec& prob_path, 
+                            const d_vec& discount_path, 
+                            const d_vec& concentration_path, 
+                            e_type obs);
     
 
 
@@ -207,10 +444,30 @@ class HPYPModel {
      *        to e.g. cache stirling numbers along a path. 
      *
      */
-    void removeObservationFromPath(const WrappedNodeList& path, 
+    void removeObservationFromPath(WrappedNodeList& path, 
                                    const d_vec& discountPath, 
                                    e_type obs,
                                    const PayloadDataPath& payloadDataPath);
+
+    /**
+     * Add a customer to the restaurant of node; if node has an implicit
+     * payload, it is replaced by the payload representing the result.
+     * Returns true if a new table was created.
+     */
+    bool addCustomer(WrappedNode& node,
+                     e_type type,
+                     double parentProbability,
+                     double discount,
+                     double concentration);
+
+    /**
+     * Remove a customer from the restaurant of node, replacing an implicit
+     * payload like addCustomer. Returns true if a table was removed.
+     */
+    bool removeCustomer(WrappedNode& node,
+                        e_type type,
+                        double discount,
+                        void* additionalData);
     
 
     /**
@@ -230,16 +487,174 @@ class HPYPModel {
                      const WrappedNode& nodeB, 
                      const WrappedNode& nodeC);
 
+    /**
+     * Count the nodes (and leaves) created by an insertion for the node 
+     * budget or the window.
+     */
+    void countInsertion(const ContextTree::InsertionResult& result);
+
+    /**
+     * Remove leaves until the tree is within the node budget, never removing
+     * the node keep.
+     */
+    void enforceNodeBudget(ContextTree::NodeId keep);
+
+    /**
+     * Remove the given leaf and its customers from the tree, removing its 
+     * tables from the restaurants above.
+     */
+    void evictLeaf(ContextTree::NodeId leaf);
+
+    /**
+     * Count the nodes of the tree (and the leaves if there is a node 
+     * budget).
+     */
+    void countNodes();
+
+    /**
+     * Remove a customer of the given type from the last node of path, and 
+     * from the nodes above as long as tables are removed (as 
+     * removeObservationFromPath does). The additional data for each node is
+     * created when the node is first reached and kept in payloadDataPath,
+     * which must have the same length as path.
+     */
+    void removeCustomerFromPath(WrappedNodeList& path,
+                                const d_vec& discounts,
+                                const d_vec& concentrations,
+                                e_type type,
+                                PayloadDataPath& payloadDataPath);
+
+    /**
+     * Record that obs was inserted into node, forgetting the observation 
+     * that falls out of the window.
+     */
+    void rememberObservation(ContextTree::NodeId node, e_type obs);
+
+    /**
+     * Remove an observation of type obs from the given node and remove the
+     * nodes left without customers and children.
+     */
+    void forgetObservation(ContextTree::NodeId node, e_type obs);
+
+    /**
+     * The leaves that may be removed to stay within the node budget, each
+     * with the time of the last observation inserted into it. Supports
+     * choosing a leaf uniformly at random in constant time and choosing the
+     * least recently used leaf in O(log n).
+     */
+    class LeafSet {
+      public:
+        typedef ContextTree::NodeId NodeId;
+
+        void clear();
+        void insert(NodeId node, l_type time);
+        void erase(NodeId node);
+        /** Update the time of node if it is in the set. */
+        void touch(NodeId node, l_type time);
+        l_type getTime(NodeId node) const;
+
+        size_t size() const {
+          return nodes.size();
+        }
+
+        /** A leaf other than keep chosen uniformly at random, or NULL. */
+        NodeId random(NodeId keep) const;
+        /** The least recently used leaf other than keep, or NULL. */
+        NodeId leastRecent(NodeId keep) const;
+
+      private:
+        struct Entry {
+          size_t position; // in nodes
+          l_type time;
+        };
+
+        std::vector<NodeId> nodes;
+        std::map<NodeId, Entry> entries;
+        std::set<std::pair<l_type, NodeId> > byTime;
+    };
+
+
+    /**
+     * The restaurants above the split depth in runParallelGibbsSampler,
+     * which are shared by all threads. Access to them is serialized using
+     * the mutex, and all threads use the same additional data for them.
+     */
+    class SharedRestaurants {
+      public:
+        explicit SharedRestaurants(int depth) : depth(depth) {}
+
+        int depth;
+        Mutex mutex;
+        // keyed by node, as implicit payloads are not unique
+        std::map<void*, boost::shared_ptr<void> > additionalData;
+
+        /**
+         * Locks the shared restaurants when acquire() is first called for
+         * a level above the split depth, and unlocks them when destroyed.
+         * Does nothing if shared is NULL.
+         */
+        class Lock {
+          public:
+            explicit Lock(SharedRestaurants* shared)
+                : shared(shared), locked(false) {}
+
+            ~Lock() {
+              if (locked) {
+                shared->mutex.unlock();
+              }
+            }
+
+            void acquire(int level) {
+              if (!locked && shared != NULL && level < shared->depth) {
+                shared->mutex.lock();
+                locked = true;
+              }
+            }
+
+          private:
+            SharedRestaurants* shared;
+            bool locked;
+
+            DISALLOW_COPY_AND_ASSIGN(Lock);
+        };
+
+      private:
+        DISALLOW_COPY_AND_ASSIGN(SharedRestaurants);
+    };
 
+    /**
+     * Resample the seating arrangements of all customers in the restaurant
+     * at the end of path. If shared is not NULL, the restaurants above
+     * shared->depth are locked while they are accessed.
+     */
     void gibbsSamplePath(const WrappedNodeList& path, 
                          const d_vec& discountPath, 
                          const d_vec& concentrationPath, 
                          const PayloadDataPath& payloadDataPath,
-                         double baseProb);
+                         double baseProb,
+                         PathBuffers& buffers,
+                         SharedRestaurants* shared);
+
+    /**
+     * Call gibbsSamplePath for all paths returned by the iterator.
+     */
+    void gibbsSampleSubtree(ContextTree::DFSPathIterator& pathIterator,
+                            PathBuffers& buffers,
+                            SharedRestaurants* shared);
     
     boost::shared_ptr<void> makeAdditionalDataPtr(void* payload, 
                                                   double discount, 
                                                   double concentration);
+
+    /**
+     * Same as above, but returns the same additional data for all calls
+     * with the same node if it is one of the shared restaurants.
+     */
+    boost::shared_ptr<void> makeAdditionalDataPtr(const WrappedNode& node, 
+                                                  double discount, 
+                                                  double concentration,
+                                                  int level,
+                                                  SharedRestaurants* shared);
     
 
     bool checkConsistency(const WrappedNode& node, 
@@ -257,6 +672,53 @@ class HPYPModel {
         const IHPYPBaseRestaurant& restaurant;
     };
     
+    /**
+     * Computes the predictions for a range of positions in predictSequence;
+     * keeps separate buffers (and RNGs) for every thread.
+     */
+    class PredictSequenceWork {
+      public:
+        PredictSequenceWork(const HPYPModel& model, l_type start,
+                            l_type first, PredictMode mode, int numThreads,
+                            d_vec& probs);
+        ~PredictSequenceWork();
+        void operator()(int thread, l_type begin, l_type end);
+
+      private:
+        const HPYPModel& model;
+        l_type start, first;
+        PredictMode mode;
+        d_vec& probs;
+        std::vector<PathBuffers> buffers;
+        std::vector<RNG*> rngs;
+
+        DISALLOW_COPY_AND_ASSIGN(PredictSequenceWork);
+    };
+
+    /**
+     * Samples the subtrees in runParallelGibbsSampler, in the given order;
+     * keeps separate buffers for every thread.
+     */
+    class GibbsSubtreeWork {
+      public:
+        GibbsSubtreeWork(HPYPModel& model,
+                         const std::vector<ContextTree::Subtree>& subtrees,
+                         const std::vector<size_t>& order,
+                         SharedRestaurants& shared,
+                         int numThreads);
+        void operator()(int thread, l_type begin, l_type end);
+
+      private:
+        HPYPModel& model;
+        const std::vector<ContextTree::Subtree>& subtrees;
+        const std::vector<size_t>& order;
+        SharedRestaurants& shared;
+        std::vector<PathBuffers> buffers;
+        RNG base;
+
+        DISALLOW_COPY_AND_ASSIGN(GibbsSubtreeWork);
+    };
+
     class CheckConsistencyVisitor {
       public:
         CheckConsistencyVisitor(const HPYPModel& model);
@@ -267,16 +729,48 @@ class HPYPModel {
         const HPYPModel& model;
     };
 
+    class CountNodesVisitor {
+      public:
+        CountNodesVisitor(HPYPModel& model);
+        void operator()(WrappedNode& n, std::list<WrappedNode>& children);
+
+      private:
+        HPYPModel& model;
+    };
+
+    // reads the tree, restaurants and parameters when freezing a model
+    friend class FrozenHPYPModel;
+    // inserts contexts and observations along its own path
+    friend class StreamingSession;
+    // overrides the per-node loops
+    template <class NodeManager, class Restaurant, class Parameters>
+    friend class HPYPModelT;
 
     seq_type& seq;
     boost::scoped_ptr<ContextTree> contextTree_;
     ContextTree& contextTree;
     const IAddRemoveRestaurant& restaurant;
+    // restaurant, if it is an ImplicitPayloadRestaurant (NULL otherwise)
+    const ImplicitPayloadRestaurant* implicitRestaurant;
     IParameters& parameters;
+    ParameterOptimizer optimizer;
     int numTypes;
     double baseProb;
-
-
+    PathBuffers buffers;
+
+    // node budget (see setNodeBudget), 0 if there is none
+    size_t maxNodes;
+    EvictionPolicy evictionPolicy;
+    size_t numNodes;
+    size_t numEvictions;
+    l_type evictionTime; // number of observations inserted under the budget
+    LeafSet leaves;
+
+    // window (see setWindow): ring buffer of the nodes the last windowSize
+    // observations were inserted into; windowPos is the oldest entry
+    l_type windowSize;
+    std::vector<std::pair<ContextTree::NodeId, e_type> > window;
+    l_type windowPos;
 };
 
 
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HPYP_MODEL_T_H_
+#define HPYP_MODEL_T_H_
+
+#include "libplump/config.h"
+#include "libplump/context_tree.h"
+#include "libplump/hpyp_model.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * An HPYP model whose node manager, restaurant and parameters are fixed at
+ * compile time.
+ *
+ * HPYPModel accesses these through the INodeManager, IAddRemoveRestaurant
+ * and IParameters interfaces, so every step along a path through the tree
+ * is a virtual call. HPYPModelT overrides the per-node loops of HPYPModel
+ * (finding the path of a context, computing the parameters and
+ * probabilities along it, and adding the customers) with versions that call
+ * the classes given as template arguments non-virtually, so that node
+ * lookups and the predictive probabilities of the restaurants (see the
+ * inline section of hpyp_restaurants.h) can be inlined into the loops. What
+ * remains is one virtual call per loop rather than one per node.
+ *
+ * Everything else -- parameter optimization, node budgets and windows,
+ * removal, fragmentation and Gibbs sampling -- is inherited from HPYPModel,
+ * and an HPYPModelT can be used wherever an HPYPModel is expected. For
+ * example,
+ *
+ *   HPYPModelT<SimpleNodeManager, StirlingCompactRestaurant,
+ *              SimpleParameters>
+ *
+ * is a fully static configuration. The template arguments must be the
+ * dynamic types of the objects passed to the constructor; in particular
+ * they cannot be the interfaces themselves. Results are exactly the same as
+ * those of HPYPModel.
+ */
+template <class NodeManager, class Restaurant, class Parameters>
+class HPYPModelT : public HPYPModel {
+  public:
+    HPYPModelT(seq_type& seq,
+               NodeManager& nodeManager,
+               const Restaurant& restaurant,
+               Parameters& parameters,
+               int numTypes)
+        : HPYPModel(seq, nodeManager, restaurant, parameters, numTypes),
+          staticRestaurant(restaurant),
+          staticParameters(parameters) {}
+
+  private:
+    int findContextPath(l_type start, l_type stop, bool below,
+                        WrappedNodeList& path) const {
+      return this->contextTree.template findLongestSuffixStatic<NodeManager>(
+          start, stop, below, path);
+    }
+
+    void computeParameterPath(const WrappedNodeList& path,
+                              d_vec& discount_path,
+                              d_vec& concentration_path) const {
+      this->staticParameters.Parameters::getDiscounts(path, discount_path);
+      this->staticParameters.Parameters::getConcentrations(
+          path, discount_path, concentration_path);
+    }
+
+    void computeProbabilityPath(const WrappedNodeList& path,
+                                const d_vec& discount_path,
+                                const d_vec& concentration_path,
+                                e_type obs,
+                                d_vec& out) const {
+      out.clear();
+      out.reserve(path.size() + 1);
+
+      double prob = this->baseProb; // base distribution
+      out.push_back(prob);
+
+      for (size_t j = 0; j < path.size(); ++j) {
+        prob = this->staticRestaurant.Restaurant::computeProbability(
+            path[j].payload, obs, prob, discount_path[j],
+            concentration_path[j]);
+        out.push_back(prob);
+      }
+    }
+
+    void updatePath(WrappedNodeList& path,
+                    const d_vec& prob_path,
+                    const d_vec& discount_path,
+                    const d_vec& concentration_path,
+                    e_type obs) {
+      if (this->implicitRestaurant != NULL) {
+        // implicit payloads are materialized by HPYPModel::addCustomer
+        HPYPModel::updatePath(path, prob_path, discount_path,
+                              concentration_path, obs);
+        return;
+      }
+      for (int j = path.size() - 1; j >= 0; --j) {
+        bool newTable = this->staticRestaurant.Restaurant::addCustomer(
+            path[j].payload, obs, prob_path[j], discount_path[j],
+            concentration_path[j], NULL);
+        if (!newTable) {
+          break;
+        }
+      }
+    }
+
+    const Restaurant& staticRestaurant;
+    Parameters& staticParameters;
+
+    DISALLOW_COPY_AND_ASSIGN(HPYPModelT);
+};
+
+}} // namespace gatsby::libplump
+
+#endif
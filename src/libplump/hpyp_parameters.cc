@@ -7,8 +7,23 @@
 namespace gatsby { namespace libplump {
 
 
+void DiscountTable::set(const d_vec& levelDiscounts) {
+  numLevels = levelDiscounts.size();
+  last = levelDiscounts.back();
+  products.assign(numLevels * numLevels, 1);
+  for (int p = -1; p < numLevels - 1; ++p) {
+    double discount = 1;
+    for (int t = p + 1; t < numLevels; ++t) {
+      discount *= levelDiscounts[t];
+      products[(p + 1) * numLevels + t] = discount;
+    }
+  }
+}
+
+
 SimpleParameters::SimpleParameters() : discounts(), alpha(0) {
   discounts.push_back(0.5);
+  table.set(discounts);
 }
 
 /**
@@ -16,37 +31,26 @@ SimpleParameters::SimpleParameters() : discounts(), alpha(0) {
  */
 d_vec SimpleParameters::getDiscounts(const WrappedNodeList& path) {
   d_vec discount_path;
+  getDiscounts(path, discount_path);
+  return discount_path;
+}
+
+
+void SimpleParameters::getDiscounts(const WrappedNodeList& path,
+                                    d_vec& discount_path) {
+  discount_path.clear();
   int parent_length = -1;
-  int max_context_len = discounts.size()-1;
   for(WrappedNodeList::const_iterator it = path.begin(); 
       it != path.end(); ++it) {
-    double discount = 1;
     int this_length = it->end - it->start;
-    
-    // we need to loop over all depths that lie between parent_length+1 and
-    // this_length (inclusive)
-    for(int i = parent_length + 1; i <= std::min(this_length,max_context_len);
-        ++i) {
-      discount *= discounts[i];
-    }
-    
-    if(this_length > max_context_len) { 
-      // our context is longer than we have explicit discounts
-      int additional_depth =   this_length 
-                             - std::max(parent_length,max_context_len);
-      discount *= std::pow(discounts.back(),additional_depth); 
-    }
-    
-    discount_path.push_back(discount);
+    discount_path.push_back(table.get(parent_length, this_length));
     parent_length = this_length;
   }
-  return discount_path;
 }
 
 
 void SimpleParameters::extendDiscounts(const WrappedNodeList& path, 
                                        d_vec& discount_path) {
-  int max_context_len = discounts.size()-1;
   WrappedNodeList::const_iterator it = path.begin();
   for (int i = 0; i < (int)discount_path.size() - 1; ++i) {
     it++;
@@ -54,25 +58,8 @@ void SimpleParameters::extendDiscounts(const WrappedNodeList& path,
   int parent_length = (it->end - it->start); 
   it++;
   for(; it!= path.end(); it++) {
-    double discount = 1;
     int this_length = it->end - it->start;
-    
-    // we need to loop over all depths that lie between parent_length+1 and 
-    // this_length (inclusive)
-    for(int i = parent_length+1; 
-        i <= std::min(this_length,max_context_len);
-        ++i) {
-      discount *= discounts[i];
-    }
-
-    if(this_length > max_context_len) { 
-      // our context is longer than we have explicit discounts
-      int additional_depth =   this_length 
-                             - std::max(parent_length,max_context_len);
-      discount *= std::pow(discounts.back(),additional_depth); 
-    }
-
-    discount_path.push_back(discount);
+    discount_path.push_back(table.get(parent_length, this_length));
     parent_length = this_length;
   }
 }
@@ -81,13 +68,21 @@ void SimpleParameters::extendDiscounts(const WrappedNodeList& path,
 d_vec SimpleParameters::getConcentrations(const WrappedNodeList& path, 
                                           const d_vec& discounts) {
   d_vec concentration_path;
+  getConcentrations(path, discounts, concentration_path);
+  return concentration_path;
+}
+
+
+void SimpleParameters::getConcentrations(const WrappedNodeList& path,
+                                         const d_vec& discounts,
+                                         d_vec& concentration_path) {
+  concentration_path.clear();
   double current = alpha;
   for (d_vec::const_iterator it = discounts.begin();
       it != discounts.end(); ++it) {
     concentration_path.push_back(current);
     current *= *it;
   }
-  return concentration_path;
 }
 
 
@@ -106,25 +101,7 @@ double SimpleParameters::getDiscount(int parent_length,
                                      int this_length) {
   tracer << "SimpleParameters::getDiscount(" << parent_length << ", " 
          << this_length << ")" << std::endl;
-  int max_context_len = discounts.size()-1;
-  double discount = 1;
-
-  // we need to loop over all depths that lie between parent_length+1 and 
-  // this_length (inclusive)
-  for(int i = parent_length+1;
-      i <= std::min(this_length,max_context_len);
-      i++) {
-    discount *= discounts[i];
-  }
-
-  if(this_length > max_context_len) { 
-    // our context is longer than we have explicit discounts
-    int additional_depth =   this_length
-                           - std::max(parent_length,max_context_len);
-    discount *= std::pow(discounts.back(),additional_depth); 
-  }
-
-  return discount;
+  return table.get(parent_length, this_length);
 }
     
 
@@ -150,16 +127,20 @@ void SimpleParameters::accumulateParameterGradient(
     const d_vec& prob_path, 
     const d_vec& discount_path, 
     const d_vec& concentration_path, 
-    e_type obs) {
-  // DO NOTHING FOR NOW
+    e_type obs,
+    d_vec& gradient) {
+  // no free parameters
 }
     
 
-void SimpleParameters::stepParameterGradient(double stepSize) {
-  // DO NOTHING FOR NOW
+void SimpleParameters::getFreeParameters(d_vec& values) {
+  values.clear();
 }
 
 
+void SimpleParameters::setFreeParameters(const d_vec& values) {}
+
+
 
 /////// GradientParameters //////////////////////////
 
@@ -168,37 +149,39 @@ void SimpleParameters::stepParameterGradient(double stepSize) {
  */
 d_vec GradientParameters::getDiscounts(const WrappedNodeList& path) {
   d_vec discount_path;
+  getDiscounts(path, discount_path);
+  return discount_path;
+}
+
+
+void GradientParameters::updateTable() {
+  d_vec discounts(sigmoid_discounts.size());
+  level_gradient.resize(sigmoid_discounts.size());
+  for (size_t i = 0; i < discounts.size(); ++i) {
+    discounts[i] = sigmoid(sigmoid_discounts[i]);
+    level_gradient[i] = 1 - discounts[i];
+  }
+  table.set(discounts);
+}
+
+
+void GradientParameters::getDiscounts(const WrappedNodeList& path,
+                                      d_vec& discount_path) {
+  const DiscountTable& table = getTable();
+  discount_path.clear();
   int parent_length = -1;
-  int max_context_len = sigmoid_discounts.size()-1;
   for(WrappedNodeList::const_iterator it = path.begin(); 
       it != path.end(); ++it) {
     int this_length = it->end - it->start;
-    
-    // we need to loop over all depths that lie between parent_length+1 and
-    // this_length (inclusive)
-    double discount = 1; 
-    for(int i = parent_length + 1; i <= std::min(this_length,max_context_len);
-        ++i) {
-      discount *= sigmoid(sigmoid_discounts[i]);
-    }
-    
-    if(this_length > max_context_len) { 
-      // our context is longer than we have explicit discounts
-      int additional_depth =   this_length 
-                             - std::max(parent_length,max_context_len);
-      discount *= std::pow(sigmoid(sigmoid_discounts.back()),additional_depth); 
-    }
-    
-    discount_path.push_back(discount);
+    discount_path.push_back(table.get(parent_length, this_length));
     parent_length = this_length;
   }
-  return discount_path;
 }
 
 
 void GradientParameters::extendDiscounts(const WrappedNodeList& path, 
                                        d_vec& discount_path) {
-  int max_context_len = sigmoid_discounts.size()-1;
+  const DiscountTable& table = getTable();
   WrappedNodeList::const_iterator it = path.begin();
   for (int i = 0; i < (int)discount_path.size() - 1; ++i) {
     it++;
@@ -207,24 +190,7 @@ void GradientParameters::extendDiscounts(const WrappedNodeList& path,
   it++;
   for(; it!= path.end(); it++) {
     int this_length = it->end - it->start;
-    
-    // we need to loop over all depths that lie between parent_length+1 and 
-    // this_length (inclusive)
-    double discount = 1;
-    for(int i = parent_length+1; 
-        i <= std::min(this_length,max_context_len);
-        ++i) {
-      discount *= sigmoid(sigmoid_discounts[i]);
-    }
-
-    if(this_length > max_context_len) { 
-      // our context is longer than we have explicit discounts
-      int additional_depth =   this_length 
-                             - std::max(parent_length,max_context_len);
-      discount *= std::pow(sigmoid(sigmoid_discounts.back()),additional_depth); 
-    }
-
-    discount_path.push_back(discount);
+    discount_path.push_back(table.get(parent_length, this_length));
     parent_length = this_length;
   }
 }
@@ -233,13 +199,21 @@ void GradientParameters::extendDiscounts(const WrappedNodeList& path,
 d_vec GradientParameters::getConcentrations(const WrappedNodeList& path, 
                                           const d_vec& discounts) {
   d_vec concentration_path;
+  getConcentrations(path, discounts, concentration_path);
+  return concentration_path;
+}
+
+
+void GradientParameters::getConcentrations(const WrappedNodeList& path,
+                                           const d_vec& discounts,
+                                           d_vec& concentration_path) {
+  concentration_path.clear();
   double current = exp(log_alpha);
   for (d_vec::const_iterator it = discounts.begin();
       it != discounts.end(); ++it) {
     concentration_path.push_back(current);
     current *= *it;
   }
-  return concentration_path;
 }
 
 
@@ -258,25 +232,7 @@ double GradientParameters::getDiscount(int parent_length,
                                      int this_length) {
   tracer << "GradientParameters::getDiscount(" << parent_length << ", " 
          << this_length << ")" << std::endl;
-  int max_context_len = sigmoid_discounts.size()-1;
-
-  // we need to loop over all depths that lie between parent_length+1 and 
-  // this_length (inclusive)
-  double discount = 1;
-  for(int i = parent_length+1;
-      i <= std::min(this_length,max_context_len);
-      i++) {
-    discount *= sigmoid(sigmoid_discounts[i]);
-  }
-
-  if(this_length > max_context_len) { 
-    // our context is longer than we have explicit discounts
-    int additional_depth =   this_length
-                           - std::max(parent_length,max_context_len);
-    discount *= std::pow(sigmoid(sigmoid_discounts.back()),additional_depth); 
-  }
-
-  return discount;
+  return getTable().get(parent_length, this_length);
 }
     
 
@@ -296,62 +252,88 @@ double GradientParameters::getDiscount(int level) {
 }
 
 
+/**
+ * Number of depths in (parent_length, this_length] that use the discount of
+ * the given level.
+ */
+static int levelMultiplicity(int level, int parent_length, int this_length,
+                             int num_levels) {
+  if (level < num_levels - 1) {
+    return (parent_length < level && level <= this_length) ? 1 : 0;
+  }
+  return std::max(0, this_length - std::max(parent_length, num_levels - 2));
+}
+
+
 void GradientParameters::accumulateParameterGradient(
     const IAddRemoveRestaurant& restaurant,
     const WrappedNodeList& path, 
     const d_vec& prob_path, 
     const d_vec& discount_path, 
     const d_vec& concentration_path, 
-    e_type obs) {
+    e_type obs,
+    d_vec& gradient) {
+  int num_levels = sigmoid_discounts.size();
+  // derivatives of the predictive probability at the current node and of
+  // the log of the product of the discounts above it (which is the 
+  // concentration divided by alpha) with respect to the free parameters, 
+  // propagated down the path; the buffers keep their capacity between calls
+  prob_gradient.assign(num_levels + 1, 0);
+  log_product_gradient.assign(num_levels, 0);
   int parent_length = -1;
-  int max_context_len = sigmoid_discounts.size()-2;
-  double last_discount_gradient = 0;
   int j = 0;
   for(WrappedNodeList::const_iterator it = path.begin(); 
-      it != path.end(); ++it) {
-    int cw = restaurant.getC(it->payload, obs);
+      it != path.end(); ++it, ++j) {
+    int this_length = it->end - it->start;
     int tw = restaurant.getT(it->payload, obs);
     int c  = restaurant.getC(it->payload);
     int t  = restaurant.getT(it->payload);
-    int this_length = it->end - it->start;
-    for(int i = parent_length + 1; i <= std::min(this_length, max_context_len); ++i) {
-      double s = sigmoid(this->sigmoid_discounts[i]);
-      // update explicit discount gradients
-      this->sigmoid_discount_gradient[i] += PYPPredictiveGradientIndividualDiscount(cw, tw, c, t, 
-      prob_path[j], discount_path[j], s, 
-      concentration_path[j]) / prob_path[j+1] * s * (1 - s);
+    double discount = discount_path[j];
+    double concentration = concentration_path[j];
+    double parent_prob = prob_path[j];
+    double prob = prob_path[j + 1];
+    // without customers and concentration the node predicts with its parent
+    double denom = c + concentration;
+    for (int k = 0; k < num_levels; ++k) {
+      double log_discount_gradient = level_gradient[k] 
+          * levelMultiplicity(k, parent_length, this_length, num_levels);
+      if (denom > 0) {
+        prob_gradient[k] = 
+            (  (t * parent_prob - tw) * discount * log_discount_gradient
+             + (concentration + discount * t) * prob_gradient[k]
+             + (parent_prob - prob) * concentration * log_product_gradient[k])
+            / denom;
+      }
+      log_product_gradient[k] += log_discount_gradient;
     }
-    if(this_length > max_context_len) { 
-       // our context is longer than we have explicit discounts
-      int additional_depth =   this_length 
-                               - std::max(parent_length, max_context_len);
-      double s = sigmoid(this->sigmoid_discounts.back());
-      // update explicit discount gradients
-      last_discount_gradient = PYPPredictiveGradientIndividualDiscount(
-                cw, tw, c, t, 
-                prob_path[j], discount_path[j], s, concentration_path[j],
-                last_discount_gradient, additional_depth
-                ) / prob_path[j+1] * s * (1 - s);
-      this->sigmoid_discount_gradient[this->sigmoid_discount_gradient.size() - 1] += last_discount_gradient;
+    if (denom > 0) {
+      prob_gradient[num_levels] = 
+          (  (concentration + discount * t) * prob_gradient[num_levels]
+           + (parent_prob - prob) * concentration) / denom;
     }
-    //  
     parent_length = this_length;
-    ++j;
   }
-  d_vec approx_grad = this->approximateParameterGradient(
-    restaurant,
-    path, 
-    prob_path, 
-    discount_path, 
-    concentration_path, 
-    obs);
-
-
-  //std::cout << "Grad: " << iterableToString(this->sigmoid_discount_gradient) << std::endl; 
- // std::cout << "Approx-grad: " << iterableToString(approx_grad) << std::endl;
-  add_vec(this->sigmoid_discount_gradient, approx_grad);
+
+  for (int k = 0; k <= num_levels; ++k) {
+    gradient[k] += prob_gradient[k] / prob_path.back();
+  }
+}
+
+
+void GradientParameters::getFreeParameters(d_vec& values) {
+  values = sigmoid_discounts;
+  values.push_back(log_alpha);
 }
 
+
+void GradientParameters::setFreeParameters(const d_vec& values) {
+  std::copy(values.begin(), values.begin() + sigmoid_discounts.size(),
+            sigmoid_discounts.begin());
+  log_alpha = values[sigmoid_discounts.size()];
+  updateTable();
+}
+
+
 d_vec GradientParameters::approximateParameterGradient(
     const IAddRemoveRestaurant& restaurant,
     const WrappedNodeList& path, 
@@ -365,6 +347,7 @@ d_vec GradientParameters::approximateParameterGradient(
   for (int i=0; i < this->sigmoid_discounts.size(); ++i) {
     double orig_discount = sigmoid_discounts[i];
     this->sigmoid_discounts[i] += eps;
+    updateTable();
     d_vec d_path = this->getDiscounts(path);
     d_vec c_path = this->getConcentrations(path, d_path);
     int j = 0;
@@ -381,6 +364,7 @@ d_vec GradientParameters::approximateParameterGradient(
     ++j;
     }
     this->sigmoid_discounts[i] = orig_discount - eps;
+    updateTable();
     d_path = this->getDiscounts(path);
     c_path = this->getConcentrations(path, d_path);
     j = 0;
@@ -395,17 +379,11 @@ d_vec GradientParameters::approximateParameterGradient(
     }
     ret[i] = (log(pp) - log(pm))/(2*eps);
     this->sigmoid_discounts[i] = orig_discount;
+    updateTable();
   }
   return ret;
 }
 
-void GradientParameters::stepParameterGradient(double stepSize) {
-  std::cout << "Grad: " << iterableToString(this->sigmoid_discount_gradient) << std::endl; 
-  mult_vec(this->sigmoid_discount_gradient, stepSize);
-  add_vec(this->sigmoid_discounts, this->sigmoid_discount_gradient);
-  fill(this->sigmoid_discount_gradient.begin(), this->sigmoid_discount_gradient.end(), 0.0); 
-  std::cout << "Disc: " << iterableToString(this->sigmoid_discounts) << std::endl; 
-}
 
 
 }} // namespace gatsby::libplump
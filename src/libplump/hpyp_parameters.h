@@ -25,6 +25,8 @@
 #ifndef HPYP_PARAMETERS_H_
 #define HPYP_PARAMETERS_H_
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include "libplump/config.h"
@@ -39,7 +41,7 @@ namespace gatsby { namespace libplump {
  * Compute the gradient of the PYP predictive probability
  * with respect to the discount parameter.
  */
-double PYPPredictiveGradientDiscount(int cw, int tw, int c, int t, 
+inline double PYPPredictiveGradientDiscount(int cw, int tw, int c, int t, 
     double parentProbability, double discount, double concentration,
     double parentGradientDiscount) {
 
@@ -49,7 +51,7 @@ double PYPPredictiveGradientDiscount(int cw, int tw, int c, int t,
 }
 
 
-double PYPPredictiveGradientIndividualDiscount(int cw, int tw, int c, int t, 
+inline double PYPPredictiveGradientIndividualDiscount(int cw, int tw, int c, int t, 
       double parentProbability, double totalDiscount, double individualDiscount, double concentration,
       double DParentProbabilityWrtIndividualDiscount = 0.0,
       int individualDiscountMultiplicity = 1) 
@@ -72,7 +74,7 @@ double PYPPredictiveGradientIndividualDiscount(int cw, int tw, int c, int t,
  * parameter for the predictive distribution, so that
  *   concentration = \alpha_0 * discount
  */
-double PYPPredictiveGradientConcentration(int cw, int tw, int c, int t, 
+inline double PYPPredictiveGradientConcentration(int cw, int tw, int c, int t, 
       double parentProbability, double discount, double concentration,
       double DParentProbabilityWrtConcentration) 
 {
@@ -85,6 +87,50 @@ double PYPPredictiveGradientConcentration(int cw, int tw, int c, int t,
 }
 
 
+/**
+ * Discounts of the nodes of a context tree given per-level discounts: the
+ * discount of a node is the product of the per-level discounts for the
+ * depths (parentLength, thisLength], where depths beyond the last level use
+ * the discount of the last level.
+ *
+ * The products over the explicit levels are tabulated for all pairs of
+ * depths, so that get() takes constant time instead of time linear in the
+ * difference in length. There are only a few levels in practice; the table
+ * holds the products in the order the levels would be multiplied, so the
+ * results are identical to multiplying them for every node.
+ */
+class DiscountTable {
+  public:
+    DiscountTable() : numLevels(0), last(0) {}
+
+    /**
+     * Rebuild the table from the given per-level discounts (which must not
+     * be empty).
+     */
+    void set(const d_vec& levelDiscounts);
+
+    double get(l_type parentLength, l_type thisLength) const {
+      int maxLength = numLevels - 1;
+      if (parentLength >= maxLength) {
+        return std::pow(last, (int)(thisLength - parentLength));
+      }
+      double discount = products[(parentLength + 1) * numLevels
+                                 + std::min((int)thisLength, maxLength)];
+      if (thisLength > maxLength) {
+        discount *= std::pow(last, (int)(thisLength - maxLength));
+      }
+      return discount;
+    }
+
+  private:
+    int numLevels;
+    double last;
+    // products[(p + 1) * numLevels + t] is the product of the discounts of 
+    // the levels p + 1, ..., t for -1 <= p < t < numLevels
+    d_vec products;
+};
+
+
 /**
  * A basic implementation of a class that stores per-level 
  * discount and concentration parameters.
@@ -94,19 +140,29 @@ class SimpleParameters : public IParameters {
     
     SimpleParameters();
 
-    SimpleParameters(d_vec s) : discounts(s), alpha(0) {}
+    SimpleParameters(d_vec s) : discounts(s), alpha(0) {
+      table.set(discounts);
+    }
 
-    SimpleParameters(d_vec s, double alpha) : discounts(s), alpha(alpha)  {}
+    SimpleParameters(d_vec s, double alpha) : discounts(s), alpha(alpha)  {
+      table.set(discounts);
+    }
 
     /**
      * Get discount parameters for each node in the node list.
      */
     d_vec getDiscounts(const WrappedNodeList& path);
 
+    void getDiscounts(const WrappedNodeList& path, d_vec& discount_path);
+
     void extendDiscounts(const WrappedNodeList& path, d_vec& discount_path);
 
     d_vec getConcentrations(const WrappedNodeList& path, 
                             const d_vec& discounts);
+
+    void getConcentrations(const WrappedNodeList& path,
+                           const d_vec& discounts,
+                           d_vec& concentration_path);
     
     void extendConcentrations(const WrappedNodeList& path, 
                               const d_vec& discounts, 
@@ -126,13 +182,20 @@ class SimpleParameters : public IParameters {
       const d_vec& prob_path, 
       const d_vec& discount_path, 
       const d_vec& concentration_path, 
-      e_type obs);
+      e_type obs,
+      d_vec& gradient);
     
-    void stepParameterGradient(double stepSize);
+    /**
+     * There are no free parameters.
+     */
+    void getFreeParameters(d_vec& values);
+
+    void setFreeParameters(const d_vec& values);
   
   private:
     d_vec discounts;
     double alpha;
+    DiscountTable table;
 
     DISALLOW_COPY_AND_ASSIGN(SimpleParameters);
 };
@@ -148,24 +211,19 @@ class GradientParameters : public IParameters {
   public:
     
     GradientParameters() : sigmoid_discounts(), 
-        log_alpha(-std::numeric_limits<double>::infinity()),
-        sigmoid_discount_gradient(), log_alpha_gradient(0) {
+        log_alpha(-std::numeric_limits<double>::infinity()) {
       sigmoid_discounts.push_back(logit(0.5));
-      sigmoid_discount_gradient.push_back(0);
+      updateTable();
     }
 
     GradientParameters(d_vec s) : sigmoid_discounts(s.size()),
-                                  log_alpha(-std::numeric_limits<double>::infinity()),
-                                  sigmoid_discount_gradient(s.size(),0.0),
-                                  log_alpha_gradient(0.0) {
+                                  log_alpha(-std::numeric_limits<double>::infinity()) {
       this->setDiscounts(s);
     }
 
     GradientParameters(d_vec s, double alpha) : 
         sigmoid_discounts(s.size()), 
-        log_alpha(log(alpha)),
-        sigmoid_discount_gradient(s.size(),0.0),
-        log_alpha_gradient(0.0) {
+        log_alpha(log(alpha)) {
       this->setDiscounts(s);
     }
 
@@ -174,10 +232,16 @@ class GradientParameters : public IParameters {
      */
     d_vec getDiscounts(const WrappedNodeList& path);
 
+    void getDiscounts(const WrappedNodeList& path, d_vec& discount_path);
+
     void extendDiscounts(const WrappedNodeList& path, d_vec& discount_path);
 
     d_vec getConcentrations(const WrappedNodeList& path, 
                             const d_vec& discounts);
+
+    void getConcentrations(const WrappedNodeList& path,
+                           const d_vec& discounts,
+                           d_vec& concentration_path);
     
     void extendConcentrations(const WrappedNodeList& path, 
                               const d_vec& discounts, 
@@ -197,9 +261,16 @@ class GradientParameters : public IParameters {
       const d_vec& prob_path, 
       const d_vec& discount_path, 
       const d_vec& concentration_path, 
-      e_type obs);
+      e_type obs,
+      d_vec& gradient);
     
-    void stepParameterGradient(double stepSize);
+    /**
+     * The free parameters are the logits of the per-level discounts,
+     * followed by the log of the concentration.
+     */
+    void getFreeParameters(d_vec& values);
+
+    void setFreeParameters(const d_vec& values);
 
     d_vec approximateParameterGradient(
         const IAddRemoveRestaurant& restaurant,
@@ -216,14 +287,28 @@ class GradientParameters : public IParameters {
       for (size_t i = 0; i < d.size(); ++i) {
         sigmoid_discounts[i] = logit(d[i]);
       }
+      updateTable();
+    }
+
+    // rebuild the discount table; must be called whenever sigmoid_discounts
+    // changes, so that the table can be read concurrently
+    void updateTable();
+
+    const DiscountTable& getTable() const {
+      return table;
     }
 
     d_vec sigmoid_discounts;
     double log_alpha;
-    d_vec sigmoid_discount_gradient;
-    double log_alpha_gradient;
-    static const int mini_batch_size = 100;
-    static const double default_step_size = 1e-5;
+    DiscountTable table;
+
+    // derivative of the log discount of each level with respect to its
+    // logit; rebuilt by updateTable()
+    d_vec level_gradient;
+
+    // buffers of accumulateParameterGradient
+    d_vec prob_gradient;
+    d_vec log_product_gradient;
 
     DISALLOW_COPY_AND_ASSIGN(GradientParameters);
 };
@@ -40,6 +40,13 @@ class IParameters {
      * Get discount parameters for each node in the node list.
      */
     virtual d_vec getDiscounts(const WrappedNodeList& path) = 0; 
+
+    /**
+     * Same as above, but overwrites discount_path instead of allocating a
+     * new vector.
+     */
+    virtual void getDiscounts(const WrappedNodeList& path,
+                              d_vec& discount_path) = 0;
     
     virtual void extendDiscounts(const WrappedNodeList& path, 
                                  d_vec& discount_path) = 0;
@@ -47,6 +54,13 @@ class IParameters {
     virtual d_vec getConcentrations(const WrappedNodeList& path, 
                                     const d_vec& discounts) = 0;
 
+    /**
+     * Same as above, but overwrites concentration_path.
+     */
+    virtual void getConcentrations(const WrappedNodeList& path,
+                                   const d_vec& discounts,
+                                   d_vec& concentration_path) = 0;
+
     virtual void extendConcentrations(const WrappedNodeList& path, 
                                       const d_vec& discounts, 
                                       d_vec& concentration_path) = 0;
@@ -59,15 +73,29 @@ class IParameters {
 
     virtual double getDiscount(l_type level) = 0;
 
+    /**
+     * Add the gradient of the log predictive probability of obs at the end
+     * of path with respect to the free parameters to gradient, which has
+     * one entry per free parameter (see getFreeParameters).
+     */
     virtual void accumulateParameterGradient(
       const IAddRemoveRestaurant& restaurant,
       const WrappedNodeList& path, 
       const d_vec& prob_path, 
       const d_vec& discount_path, 
       const d_vec& concentration_path, 
-      e_type obs) = 0;
+      e_type obs,
+      d_vec& gradient) = 0;
+
+    /**
+     * Get the values of the free parameters, i.e. those that can be learned
+     * by gradient ascent (see ParameterOptimizer); these may be transformed
+     * versions of the discounts and concentrations, so that any values are
+     * valid.
+     */
+    virtual void getFreeParameters(d_vec& values) = 0;
 
-    virtual void stepParameterGradient(double stepSize) = 0;
+    virtual void setFreeParameters(const d_vec& values) = 0;
 };
 
 }} // namespace gatsby::libplump
@@ -45,6 +45,9 @@ class IHPYPBaseRestaurant {
                                       double discount, 
                                       double concentration) const = 0;
     virtual TypeVector getTypeVector(void* payloadPtr) const = 0;
+    // same as above, but overwrites the given (reused) vector
+    virtual void getTypeVector(void* payloadPtr,
+                               TypeVector& typeVector) const = 0;
     virtual const IPayloadFactory& getFactory() const = 0;
     virtual void updateAfterSplit(void* longerPayload, 
                                   void* shorterPayload, 
@@ -53,6 +56,12 @@ class IHPYPBaseRestaurant {
                                   bool parentOnly = false) const = 0;
     virtual std::string toString(void* payloadPtr) const = 0;
     virtual bool checkConsistency(void* payloadPtr) const = 0;
+    // true if computeProbability is computeHPYPPredictive of the counts
+    // returned by getC and getT; models that only store the counts (such as
+    // FrozenHPYPModel) require this
+    virtual bool hasHPYPPredictive() const {
+      return true;
+    }
 };
 
 
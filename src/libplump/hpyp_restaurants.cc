@@ -1,7 +1,7 @@
 #include "libplump/hpyp_restaurants.h"
 
+#include <iterator>
 #include <sstream>
-#include <boost/scoped_ptr.hpp>
 
 // serialization stuff
 #include <boost/archive/binary_oarchive.hpp>
@@ -55,39 +55,22 @@ l_type SimpleFullRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double SimpleFullRestaurant::computeProbability(void*  payloadPtr,
-                                                e_type type, 
-                                                double parentProbability,
-                                                double discount, 
-                                                double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  int cw = 0;
-  int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.first;
-    tw = (*it).second.second.size();
-  }
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.sumTables, // t
-                               parentProbability,
-                               discount,
-                               concentration);
+IHPYPBaseRestaurant::TypeVector SimpleFullRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  IHPYPBaseRestaurant::TypeVector typeVector;
+  getTypeVector(payloadPtr, typeVector);
+  return typeVector;
 }
 
 
-IHPYPBaseRestaurant::TypeVector SimpleFullRestaurant::getTypeVector(
-    void* payloadPtr) const {
+void SimpleFullRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
   Payload& payload = *((Payload*)payloadPtr);
-  IHPYPBaseRestaurant::TypeVector typeVector;
-  typeVector.reserve(payload.tableMap.size());
+  typeVector.clear();
   for (Payload::TableMap::iterator it = payload.tableMap.begin();
        it != payload.tableMap.end(); ++it) {
     typeVector.push_back(it->first); 
   }
-  return typeVector;
 }
 
 
@@ -112,7 +95,7 @@ void SimpleFullRestaurant::updateAfterSplit(void* longerPayloadPtr,
   for(Payload::TableMap::iterator it = payload.tableMap.begin();
       it != payload.tableMap.end(); ++it) {
     e_type type = it->first;
-    Payload::Arrangement& arrangement = payload.tableMap[type];
+    Payload::Arrangement& arrangement = it->second;
     Payload::Arrangement& parentArrangement = newParent.tableMap[type];
 
     if (arrangement.first == 1) { // just one customer -- can't split
@@ -145,10 +128,10 @@ void SimpleFullRestaurant::updateAfterSplit(void* longerPayloadPtr,
         newTables.clear();
       }
 
+      std::vector<int> frag, customerTables;
       for (l_type k = 0; k < (l_type)oldTables.size(); ++k) { // for each table
-        std::vector<int> frag = sample_crp_c(discountAfterSplit,
-                                             -discountBeforeSplit,
-                                             oldTables[k]);
+        sample_crp_c(discountAfterSplit, -discountBeforeSplit, oldTables[k],
+                     frag, customerTables);
         // add table to parent with cwk = frag.size()
         parentTables.push_back(frag.size());
         parentArrangement.first += frag.size();
@@ -194,7 +177,7 @@ bool SimpleFullRestaurant::addCustomer(void*  payloadPtr,
   }
  
   // probs for old tables: \propto cwk - d
-  d_vec tableProbs(tables.size() + 1, 0);
+  ProbabilityBuffer<> tableProbs(tables.size() + 1);
   for(int i = 0; i < (int)tables.size(); ++i) {
     tableProbs[i] = tables[i] - discount;
   }
@@ -204,7 +187,7 @@ bool SimpleFullRestaurant::addCustomer(void*  payloadPtr,
     (concentration + discount*payload.sumTables)*parentProbability;
   
   // choose table for customer to sit at
-  int table = sample_unnormalized_pdf(tableProbs);
+  int table = sample_unnormalized_pdf(tableProbs.get(), tables.size() + 1);
   assert(table <= (int)tables.size());
 
   if(table == (int)tables.size()) {
@@ -239,9 +222,10 @@ bool SimpleFullRestaurant::removeCustomer(void* payloadPtr,
   --payload.sumCustomers; // c
   --arrangement.first; // cw
   
-  d_vec tableProbs(tables.begin(), tables.end()); // cast to double
   // chose a table to delete the customer from; prob proportional to table size
-  int table = sample_unnormalized_pdf(tableProbs);
+  // (the table sizes sum to the number of customers before the removal)
+  int table = sample_unnormalized_pdf(get_rng(), &tables[0], tables.size(),
+                                      arrangement.first + 1);
   assert(table < (int)tables.size());
   
   // remove customer from table
@@ -327,6 +311,10 @@ void* SimpleFullRestaurant::newPayloadFromOther(
     e_type type = *it;
     int cw = fromRestaurant.getC(otherPayload, type);
     int tw = fromRestaurant.getT(otherPayload, type);
+    if (cw == 0) {
+      // all customers of this type have been removed
+      continue;
+    }
     payload->tableMap[type].first = cw;
     std::vector<int> cwk = sample_crp_ct(discount, cw, tw);
     assert((int)cwk.size() == tw);
@@ -404,39 +392,22 @@ l_type HistogramRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double HistogramRestaurant::computeProbability(void*  payloadPtr,
-                                               e_type type, 
-                                               double parentProbability,
-                                               double discount, 
-                                               double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  int cw = 0;
-  int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.cw;
-    tw = (*it).second.tw;
-  }
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.sumTables, // t
-                               parentProbability,
-                               discount,
-                               concentration);
+IHPYPBaseRestaurant::TypeVector HistogramRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  IHPYPBaseRestaurant::TypeVector typeVector;
+  getTypeVector(payloadPtr, typeVector);
+  return typeVector;
 }
 
 
-IHPYPBaseRestaurant::TypeVector HistogramRestaurant::getTypeVector(
-    void* payloadPtr) const {
+void HistogramRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
   Payload& payload = *((Payload*)payloadPtr);
-  IHPYPBaseRestaurant::TypeVector typeVector;
-  typeVector.reserve(payload.tableMap.size());
+  typeVector.clear();
   for (Payload::TableMap::iterator it = payload.tableMap.begin();
        it != payload.tableMap.end(); ++it) {
     typeVector.push_back(it->first); 
   }
-  return typeVector;
 }
 
 
@@ -461,7 +432,7 @@ void HistogramRestaurant::updateAfterSplit(void* longerPayloadPtr,
   for(Payload::TableMap::iterator it = payload.tableMap.begin();
       it != payload.tableMap.end(); ++it) {
     e_type type = it->first;
-    Payload::Arrangement& arrangement = payload.tableMap[type];
+    Payload::Arrangement& arrangement = it->second;
     Payload::Arrangement& parentArrangement = newParent.tableMap[type];
 
     if (arrangement.cw == 1) { // just one customer -- can't split
@@ -492,13 +463,13 @@ void HistogramRestaurant::updateAfterSplit(void* longerPayloadPtr,
         arrangement.histogram.clear();
       }
 
+      std::vector<int> frag, customerTables;
       for (Payload::Histogram::iterator it = oldArrangement.histogram.begin();
            it != oldArrangement.histogram.end();
            ++it) { // for all table sizes
         for (l_type k = 0; k < (*it).second; ++k) { // all tables of this size
-          std::vector<int> frag = sample_crp_c(discountAfterSplit,
-              -discountBeforeSplit,
-              (*it).first);
+          sample_crp_c(discountAfterSplit, -discountBeforeSplit, (*it).first,
+                       frag, customerTables);
           // add table to parent with cwk = frag.size()
           parentArrangement.histogram[frag.size()] += 1;
           parentArrangement.cw += frag.size();
@@ -553,15 +524,13 @@ bool HistogramRestaurant::addCustomer(void*  payloadPtr,
 
 
   int numBuckets = arrangement.histogram.size(); 
-  d_vec tableProbs(numBuckets + 1, 0);
-  std::vector<int> assignment(numBuckets,0);
+  ProbabilityBuffer<> tableProbs(numBuckets + 1);
   int i = 0;
   for(Payload::Histogram::iterator it = arrangement.histogram.begin();
       it != arrangement.histogram.end();
       ++it) {
     // prob for joining a table of size k: \propto (k - d)t[k]
     tableProbs[i] = ((*it).first - discount) * (*it).second;
-    assignment[i] = (*it).first;
     ++i;
   }
   // prob for new table: \propto (alpha + d*t)*P0
@@ -570,7 +539,7 @@ bool HistogramRestaurant::addCustomer(void*  payloadPtr,
     (concentration + discount*payload.sumTables)*parentProbability;
   
   // choose table for customer to sit at
-  int sample = sample_unnormalized_pdf(tableProbs);
+  int sample = sample_unnormalized_pdf(tableProbs.get(), numBuckets + 1);
   assert(sample <= (int)numBuckets);
 
   if(sample == (int)numBuckets) {
@@ -580,13 +549,16 @@ bool HistogramRestaurant::addCustomer(void*  payloadPtr,
     payload.sumTables += 1;
     return true;
   } else {
-    // existing table
-    arrangement.histogram[assignment[sample]] -= 1;
-    if (arrangement.histogram[assignment[sample]] == 0) {
+    // existing table of the sample-th size
+    Payload::Histogram::iterator it = arrangement.histogram.begin();
+    std::advance(it, sample);
+    int size = (*it).first;
+    arrangement.histogram[size] -= 1;
+    if (arrangement.histogram[size] == 0) {
       // delete empty bucket from histogram
-      arrangement.histogram.erase(assignment[sample]);
+      arrangement.histogram.erase(size);
     }
-    arrangement.histogram[assignment[sample]+1] += 1;
+    arrangement.histogram[size+1] += 1;
     return false;
   }
 }
@@ -609,9 +581,7 @@ bool HistogramRestaurant::removeCustomer(void* payloadPtr,
   assert(payload.sumCustomers >= 0);
 
   int numBuckets = arrangement.histogram.size(); 
-  int singletonBucket = -1; // invalid bucket
-  d_vec tableProbs(numBuckets, 0);
-  std::vector<int> assignment(numBuckets,0);
+  ProbabilityBuffer<> tableProbs(numBuckets);
 
   int i = 0;
   for(Payload::Histogram::iterator it = arrangement.histogram.begin();
@@ -619,19 +589,20 @@ bool HistogramRestaurant::removeCustomer(void* payloadPtr,
       ++it) {
     // prob for choosing a bucket k*t[k]
     tableProbs[i] = (*it).first * (*it).second;
-    assignment[i] = (*it).first;
-    if ((*it).first == 1) {
-      singletonBucket = i;
-    }
     ++i;
   }
   
-  // choose table for customer to sit at
-  int sample = sample_unnormalized_pdf(tableProbs);
-  assert(sample <= (int)numBuckets);
+  // choose table for customer to sit at; the weights sum to the number of
+  // customers before the removal
+  int sample = sample_unnormalized_pdf(get_rng(), tableProbs.get(), 
+                                       numBuckets, arrangement.cw + 1);
+  assert(sample < (int)numBuckets);
   assert(tableProbs[sample] > 0);
+  Payload::Histogram::iterator bucket = arrangement.histogram.begin();
+  std::advance(bucket, sample);
+  int size = (*bucket).first;
 
-  if (sample == singletonBucket) {
+  if (size == 1) {
     tracer << "HistogramRestaurant: deleting from singleton bucket" << std::endl;
     assert(arrangement.histogram[1] > 0);
     // singleton -> drop table
@@ -649,13 +620,13 @@ bool HistogramRestaurant::removeCustomer(void* payloadPtr,
     return true;
   } else {
     // non-singleton bucket
-    arrangement.histogram[assignment[sample]] -= 1;
-    assert(arrangement.histogram[assignment[sample]] >= 0);
-    if (arrangement.histogram[assignment[sample]] == 0) {
+    arrangement.histogram[size] -= 1;
+    assert(arrangement.histogram[size] >= 0);
+    if (arrangement.histogram[size] == 0) {
       // delete empty bucket from histogram
-      arrangement.histogram.erase(assignment[sample]);
+      arrangement.histogram.erase(size);
     }
-    arrangement.histogram[assignment[sample]-1] += 1;
+    arrangement.histogram[size-1] += 1;
     return false;
   }
 }
@@ -751,6 +722,10 @@ void* HistogramRestaurant::newPayloadFromOther(
     e_type type = *it;
     int cw = fromRestaurant.getC(otherPayload, type);
     int tw = fromRestaurant.getT(otherPayload, type);
+    if (cw == 0) {
+      // all customers of this type have been removed
+      continue;
+    }
     Payload::Arrangement& arrangement = payload->tableMap[type];
     arrangement.cw = cw;
     arrangement.tw = tw;
@@ -771,7 +746,10 @@ void HistogramRestaurant::Payload::Arrangement::serialize(
     InArchive & ar, const unsigned int version) {
   ar >> cw;
   ar >> tw;
-  ar >> histogram;
+  // stored as a std::map, which keeps the file format of earlier versions
+  std::map<l_type, l_type> buckets;
+  ar >> buckets;
+  histogram.assign(buckets.begin(), buckets.end());
 }
 
 
@@ -779,7 +757,8 @@ void HistogramRestaurant::Payload::Arrangement::serialize(
     OutArchive & ar, const unsigned int version) {
   ar << cw;
   ar << tw;
-  ar << histogram;
+  std::map<l_type, l_type> buckets(histogram.begin(), histogram.end());
+  ar << buckets;
 }
 
 
@@ -818,9 +797,9 @@ void* HistogramRestaurant::PayloadFactory::load(InArchive& ia) const {
 
 l_type BaseCompactRestaurant::getC(void* payloadPtr, e_type type) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    return (*it).second.first; // cw
+  int i = payload.find(type);
+  if (i != -1) {
+    return payload.cw(i);
   } else {
     return 0;
   }
@@ -834,9 +813,9 @@ l_type BaseCompactRestaurant::getC(void* payloadPtr) const {
 
 l_type BaseCompactRestaurant::getT(void* payloadPtr, e_type type) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    return (*it).second.second; // tw
+  int i = payload.find(type);
+  if (i != -1) {
+    return payload.tw(i);
   } else {
     return 0;
   }
@@ -848,39 +827,21 @@ l_type BaseCompactRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double BaseCompactRestaurant::computeProbability(void*  payloadPtr,
-                                                 e_type type, 
-                                                 double parentProbability,
-                                                 double discount, 
-                                                 double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  int cw = 0;
-  int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.first;
-    tw = (*it).second.second;
-  }
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.sumTables, // t
-                               parentProbability,
-                               discount,
-                               concentration);
+IHPYPBaseRestaurant::TypeVector BaseCompactRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  IHPYPBaseRestaurant::TypeVector typeVector;
+  getTypeVector(payloadPtr, typeVector);
+  return typeVector;
 }
 
 
-IHPYPBaseRestaurant::TypeVector BaseCompactRestaurant::getTypeVector(
-    void* payloadPtr) const {
+void BaseCompactRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
   Payload& payload = *((Payload*)payloadPtr);
-  IHPYPBaseRestaurant::TypeVector typeVector;
-  typeVector.reserve(payload.tableMap.size());
-  for (Payload::TableMap::iterator it = payload.tableMap.begin();
-       it != payload.tableMap.end(); ++it) {
-    typeVector.push_back((*it).first); 
+  typeVector.clear();
+  for (unsigned int i = 0; i < payload.size(); ++i) {
+    typeVector.push_back(payload.type(i)); 
   }
-  return typeVector;
 }
 
 
@@ -907,47 +868,47 @@ void BaseCompactRestaurant::updateAfterSplit(void* longerPayloadPtr,
   // make sure the parent is empty
   assert(newParent.sumCustomers == 0);
   assert(newParent.sumTables == 0);
-  assert(newParent.tableMap.size() == 0);
-
-  for(Payload::TableMap::iterator it = payload.tableMap.begin();
-      it != payload.tableMap.end(); ++it) {
-    e_type type = (*it).first;
-    Payload::Arrangement& arrangement = payload.tableMap[type];
-    Payload::Arrangement& parentArrangement = newParent.tableMap[type];
+  assert(newParent.size() == 0);
+
+  for (unsigned int i = 0; i < payload.size(); ++i) {
+    e_type type = payload.type(i);
+    l_type cw = payload.cw(i);
+    l_type tw = payload.tw(i);
+    if (cw == 0) {
+      // all customers of this type have been removed
+      continue;
+    }
+    unsigned int parent = newParent.insert(type);
   
-    if (arrangement.first == 1) { // just one customer -- can't split
+    if (cw == 1) { // just one customer -- can't split
       // seat customer at his own table in parent
       ++newParent.sumCustomers; // c
       ++newParent.sumTables; // t
-      parentArrangement.first = 1; // cw
-      parentArrangement.second = 1; // tw
+      newParent.set(parent, 1, 1); // cw, tw
     } else {
       // in order to split the restaurant we will re-instantiate a full 
       // seating arrangement
-      std::vector<int> cwk = sample_crp_ct(discountBeforeSplit, 
-                                           arrangement.first,
-                                           arrangement.second);
+      std::vector<int> cwk = sample_crp_ct(discountBeforeSplit, cw, tw);
       
+      // only the number of fragments of each table is needed
       int totalTables = 0;
       for (int k = 0; k < (int)cwk.size(); ++k) { // for each table
-        std::vector<int> frag = sample_crp_c(discountAfterSplit,
-                                             -discountBeforeSplit,cwk[k]);
-        totalTables += frag.size();
+        totalTables += sample_crp_c_tables(discountAfterSplit,
+                                           -discountBeforeSplit, cwk[k]);
       }
 
       // should have at least as many tables after split
-      assert(totalTables >= arrangement.second);
+      assert(totalTables >= tw);
       
       // parent has totalTables customers around tw tables
-      parentArrangement.first = totalTables;
-      parentArrangement.second = arrangement.second;
-      newParent.sumCustomers += parentArrangement.first;
-      newParent.sumTables    += parentArrangement.second;
+      newParent.set(parent, totalTables, tw);
+      newParent.sumCustomers += totalTables;
+      newParent.sumTables    += tw;
       
       if (!parentOnly) {
         // bottom has unchanged # of customers at totalTables tables
-        payload.sumTables -= arrangement.second;
-        arrangement.second = totalTables;
+        payload.sumTables -= tw;
+        payload.set(i, cw, totalTables);
         payload.sumTables += totalTables;
       }
     }
@@ -967,27 +928,28 @@ bool BaseCompactRestaurant::addCustomer(void*  payloadPtr,
          << ")" << std::endl;
 
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
+  unsigned int i = payload.insert(type);
 
-  // add customer, incC returns incremented count
-  l_type cw = arrangement.first;
-  arrangement.first += 1; // inc(cw)
+  // add customer
+  l_type cw = payload.cw(i);
+  l_type tw = payload.tw(i);
   payload.sumCustomers += 1; // inc(c)
 
   if (cw == 0) {
     // first customer always creates a table
-    arrangement.second += 1; // inc(tw)
+    payload.set(i, cw + 1, tw + 1); // inc(cw), inc(tw)
     payload.sumTables += 1; // inc(t)
     return true;
   } else {
     double incTProb =   (concentration + discount*payload.sumTables)
       * parentProbability;
-    incTProb = incTProb/(incTProb + cw - arrangement.second * discount);
+    incTProb = incTProb/(incTProb + cw - tw * discount);
     if (coin(incTProb)) {
-      arrangement.second += 1;
+      payload.set(i, cw + 1, tw + 1); // inc(cw), inc(tw)
       payload.sumTables += 1;
       return true;
     } else {
+      payload.set(i, cw + 1, tw); // inc(cw)
       return false;
     }
   }
@@ -999,10 +961,9 @@ std::string BaseCompactRestaurant::toString(void* payloadPtr) const {
   std::ostringstream out;
 
   out << "[";
-  for(Payload::TableMap::iterator it = payload.tableMap.begin();
-      it != payload.tableMap.end(); ++it) {
-    out << (*it).first << ":(" << (*it).second.first 
-        << "/" << (*it).second.second << "), ";
+  for (unsigned int i = 0; i < payload.size(); ++i) {
+    out << payload.type(i) << ":(" << payload.cw(i) 
+        << "/" << payload.tw(i) << "), ";
   }
   out << "]";
   return out.str();
@@ -1016,10 +977,9 @@ bool BaseCompactRestaurant::checkConsistency(void* payloadPtr) const {
   int sumCustomers = 0;
   int sumTables = 0;
 
-  for (Payload::TableMap::iterator it = payload.tableMap.begin();
-       it != payload.tableMap.end(); ++it) {
-    sumCustomers += (*it).second.first;
-    sumTables    += (*it).second.second;
+  for (unsigned int i = 0; i < payload.size(); ++i) {
+    sumCustomers += payload.cw(i);
+    sumTables    += payload.tw(i);
   }
 
   consistent =    (sumCustomers == payload.sumCustomers) 
@@ -1035,16 +995,90 @@ bool BaseCompactRestaurant::checkConsistency(void* payloadPtr) const {
 }
 
 
+unsigned int BaseCompactRestaurant::Payload::insert(e_type type) {
+  unsigned int offset = lowerBound(type);
+  if (offset != numTypes && types()[offset] == type) {
+    return offset;
+  }
+  if (numTypes == capacity) {
+    reallocate(2 * capacity, wide);
+  }
+  e_type* t = types();
+  for (unsigned int i = numTypes; i > offset; --i) {
+    t[i] = t[i-1];
+  }
+  t[offset] = type;
+  if (wide) {
+    int32_t* counts = wideCounts();
+    for (unsigned int i = 2 * numTypes + 1; i > 2 * offset + 1; --i) {
+      counts[i] = counts[i-2];
+    }
+    counts[2*offset] = counts[2*offset + 1] = 0;
+  } else {
+    uint16_t* counts = narrowCounts();
+    for (unsigned int i = 2 * numTypes + 1; i > 2 * offset + 1; --i) {
+      counts[i] = counts[i-2];
+    }
+    counts[2*offset] = counts[2*offset + 1] = 0;
+  }
+  ++numTypes;
+  return offset;
+}
+
+
+void BaseCompactRestaurant::Payload::reallocate(unsigned int newCapacity,
+                                                bool newWide) {
+  assert(newCapacity >= numTypes);
+  unsigned int countSize = newWide ? sizeof(int32_t) : sizeof(uint16_t);
+  char* newBlock = new char[newCapacity * (sizeof(e_type) + 2 * countSize)];
+  e_type* newTypes = (e_type*)newBlock;
+  std::copy(types(), types() + numTypes, newTypes);
+  char* newCounts = newBlock + newCapacity * sizeof(e_type);
+  if (wide) {
+    std::copy(wideCounts(), wideCounts() + 2 * numTypes, (int32_t*)newCounts);
+  } else if (newWide) {
+    std::copy(narrowCounts(), narrowCounts() + 2 * numTypes, 
+              (int32_t*)newCounts);
+  } else {
+    std::copy(narrowCounts(), narrowCounts() + 2 * numTypes, 
+              (uint16_t*)newCounts);
+  }
+  if (!isInline()) {
+    delete[] storage.block;
+  }
+  storage.block = newBlock;
+  capacity = newCapacity;
+  wide = newWide;
+}
+
+
+namespace {
+// Payloads are serialized in the format used when the counts were stored
+// in a map from types to (cw, tw) pairs
+typedef InlineMiniMap<e_type, std::pair<int, int> > SerializedTableMap;
+}
+
+
 void BaseCompactRestaurant::Payload::serialize(
     InArchive & ar, const unsigned int version) {
+  SerializedTableMap tableMap;
   ar >> tableMap;
   ar >> sumCustomers;
   ar >> sumTables;
+  for (SerializedTableMap::iterator it = tableMap.begin(); 
+       it != tableMap.end(); ++it) {
+    set(insert((*it).first), (*it).second.first, (*it).second.second);
+  }
 }
 
 
 void BaseCompactRestaurant::Payload::serialize(
     OutArchive & ar, const unsigned int version) {
+  SerializedTableMap tableMap;
+  for (unsigned int i = 0; i < numTypes; ++i) {
+    tableMap.insert(tableMap.end(), 
+                    std::make_pair(type(i), std::make_pair(cw(i), tw(i))));
+  }
   ar << tableMap;
   ar << sumCustomers;
   ar << sumTables;
@@ -1070,7 +1104,7 @@ bool ReinstantiatingCompactRestaurant::removeCustomer(
     void* payloadPtr, e_type type, double discount,
     void* additionalData) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
+  unsigned int i = payload.insert(type);
 
   bool removedTable;
   if (additionalData != NULL) {
@@ -1079,14 +1113,21 @@ bool ReinstantiatingCompactRestaurant::removeCustomer(
                                                        discount,
                                                        NULL);
   } else {
-    std::cerr << "Additional data MUST be provided for now!" << std::endl;
-    exit(1);
+    // For a single removal only the seating of this type is needed: sample
+    // it and remove a customer from a table chosen proportional to its size,
+    // as the full restaurant would.
+    std::vector<int> tables = sample_crp_ct(discount, payload.cw(i),
+                                            payload.tw(i));
+    int table = sample_unnormalized_pdf(get_rng(), &tables[0], tables.size(),
+                                        payload.cw(i));
+    removedTable = (tables[table] == 1);
   }
-  arrangement.first -= 1;
   payload.sumCustomers -= 1;
   if (removedTable) {
-    arrangement.second -= 1;
+    payload.set(i, payload.cw(i) - 1, payload.tw(i) - 1);
     payload.sumTables -= 1;
+  } else {
+    payload.set(i, payload.cw(i) - 1, payload.tw(i));
   }
 
   return removedTable;
@@ -1111,8 +1152,7 @@ bool ReinstantiatingCompactRestaurant::addCustomer(
   if (additionalData != NULL) {
     // need to stay in sync with full restaurant
     Payload& payload = *((Payload*)payloadPtr);
-    Payload::Arrangement& arrangement = payload.tableMap[type];
-    arrangement.first += 1; // inc(cw)
+    unsigned int i = payload.insert(type);
     payload.sumCustomers += 1; // inc(c)
     if (this->fullRestaurant.addCustomer(additionalData,
                                          type,
@@ -1120,10 +1160,11 @@ bool ReinstantiatingCompactRestaurant::addCustomer(
                                          discount, 
                                          concentration, 
                                          NULL)) {
-    arrangement.second += 1; // inc(tw)
+    payload.set(i, payload.cw(i) + 1, payload.tw(i) + 1); // inc(cw), inc(tw)
     payload.sumTables += 1; // inc(t)
     return true;
     } else {
+      payload.set(i, payload.cw(i) + 1, payload.tw(i)); // inc(cw)
       return false;
     }
   } else {
@@ -1147,27 +1188,26 @@ bool StirlingCompactRestaurant::removeCustomer(void* payloadPtr,
                                                double discount,
                                                void* additionalData) const {
   Payload& payload = *((Payload*)payloadPtr);
-  Payload::Arrangement& arrangement = payload.tableMap[type];
+  unsigned int i = payload.insert(type);
+  l_type cw = payload.cw(i);
+  l_type tw = payload.tw(i);
  
-  boost::scoped_ptr<stirling_generator_full_log> additionalDataDeleter;
-  if (additionalData == NULL) {
-    // this will delete the additionalData at the end of the function
-    additionalDataDeleter.reset(new stirling_generator_full_log(
-        discount, arrangement.first, arrangement.second));
-    additionalData = additionalDataDeleter.get();
+  double decTProb;
+  if (additionalData != NULL) {
+    decTProb = ((stirling_generator_full_log*)additionalData)->ratio(cw, tw);
+  } else {
+    // a generator for this removal only
+    decTProb = stirling_generator_full_log(discount, cw, tw).ratio(cw, tw);
   }
 
-  double decTProb = ((stirling_generator_full_log*)additionalData)->ratio(
-      arrangement.first, arrangement.second);
-
-  arrangement.first -= 1;
   payload.sumCustomers -= 1;
 
-  if (arrangement.first == 0 || coin(decTProb)) {
-    arrangement.second -= 1;
+  if (cw - 1 == 0 || coin(decTProb)) {
+    payload.set(i, cw - 1, tw - 1);
     payload.sumTables -= 1;
     return true;
   } else {
+    payload.set(i, cw - 1, tw);
     return false;
   }
 }
@@ -1222,45 +1262,22 @@ l_type KneserNeyRestaurant::getT(void* payloadPtr) const {
 }
 
 
-double KneserNeyRestaurant::computeProbability(void*  payloadPtr,
-                                               e_type type, 
-                                               double parentProbability,
-                                               double discount, 
-                                               double concentration) const {
-  Payload& payload = *((Payload*)payloadPtr);
-  
-  if (payload.sumCustomers == 0) {
-    return parentProbability;
-  }
-
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  int cw = 0;
-  int tw = 0;
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second;
-    tw = 1;
-  }
-
-  return computeHPYPPredictive(cw, // cw
-                               tw, // tw
-                               payload.sumCustomers, // c
-                               payload.tableMap.size(), // t
-                               parentProbability,
-                               discount,
-                               concentration);
+IHPYPBaseRestaurant::TypeVector KneserNeyRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  IHPYPBaseRestaurant::TypeVector typeVector;
+  getTypeVector(payloadPtr, typeVector);
+  return typeVector;
 }
 
 
-IHPYPBaseRestaurant::TypeVector KneserNeyRestaurant::getTypeVector(
-    void* payloadPtr) const {
+void KneserNeyRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
   Payload& payload = *((Payload*)payloadPtr);
-  IHPYPBaseRestaurant::TypeVector typeVector;
-  typeVector.reserve(payload.tableMap.size());
+  typeVector.clear();
   for (Payload::TableMap::iterator it = payload.tableMap.begin();
        it != payload.tableMap.end(); ++it) {
     typeVector.push_back((*it).first); 
   }
-  return typeVector;
 }
 
 
@@ -1418,10 +1435,10 @@ double ExpectedTablesCompactRestaurant::computeProbability(void*  payloadPtr,
   Payload& payload = *((Payload*)payloadPtr);
   int cw = 0;
   int tw = 0;
-  Payload::TableMap::iterator it = payload.tableMap.find(type);
-  if (it != payload.tableMap.end()) {
-    cw = (*it).second.first;
-    tw = (*it).second.second;
+  int i = payload.find(type);
+  if (i != -1) {
+    cw = payload.cw(i);
+    tw = payload.tw(i);
   }
   //double expectedNumberOfTables = PYPExpectedNumberOfTables(c);
   return computeHPYPPredictive(cw, // cw
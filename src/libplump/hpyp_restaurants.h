@@ -21,11 +21,15 @@
 #define HPYP_RESTAURANTS_H
 
 
+#include <algorithm>
+#include <cassert>
+
 #include "libplump/config.h"
 #include "libplump/pool.h"
 #include "libplump/node_manager.h" // for IPayloadFactory
 #include "libplump/serialization.h"
 #include "libplump/hpyp_restaurant_interface.h"
+#include "libplump/utils.h"
 
 namespace gatsby { namespace libplump {
 
@@ -65,6 +69,8 @@ class SimpleFullRestaurant : public IAddRemoveRestaurant {
                               double concentration) const;
     
     TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
     
     const IPayloadFactory& getFactory() const;
     
@@ -164,6 +170,8 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
                               double concentration) const;
     
     TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
     
     const IPayloadFactory& getFactory() const;
     
@@ -207,7 +215,58 @@ class HistogramRestaurant : public IAddRemoveRestaurant {
     
     class Payload : public PoolObject<Payload> {
       public:
-        typedef std::map<l_type, l_type> Histogram;
+        /**
+         * Number of tables of each size, sorted by size. The buckets are kept
+         * in a vector rather than a std::map, so that moving a table to the
+         * next size (which empties one bucket and creates another) does not
+         * allocate.
+         */
+        class Histogram {
+          public:
+            typedef std::pair<l_type, l_type> Bucket;
+            typedef std::vector<Bucket>::iterator iterator;
+
+            iterator begin() { return buckets.begin(); }
+            iterator end() { return buckets.end(); }
+            size_t size() const { return buckets.size(); }
+            void clear() { buckets.clear(); }
+
+            /**
+             * Number of tables of the given size; the bucket is created if
+             * it does not exist.
+             */
+            l_type& operator[](l_type tableSize) {
+              iterator it = find(tableSize);
+              if (it == buckets.end() || it->first != tableSize) {
+                it = buckets.insert(it, Bucket(tableSize, 0));
+              }
+              return it->second;
+            }
+
+            void erase(l_type tableSize) {
+              iterator it = find(tableSize);
+              if (it != buckets.end() && it->first == tableSize) {
+                buckets.erase(it);
+              }
+            }
+
+            template <class InputIterator>
+            void assign(InputIterator first, InputIterator last) {
+              buckets.assign(first, last);
+            }
+
+          private:
+            static bool isSmaller(const Bucket& bucket, l_type tableSize) {
+              return bucket.first < tableSize;
+            }
+
+            iterator find(l_type tableSize) {
+              return std::lower_bound(buckets.begin(), buckets.end(),
+                                      tableSize, isSmaller);
+            }
+
+            std::vector<Bucket> buckets;
+        };
 
         struct Arrangement {
           Arrangement() : cw(0), tw(0), histogram() {}
@@ -280,6 +339,8 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
                               double concentration) const;
     
     TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
     
     const IPayloadFactory& getFactory() const;
     
@@ -302,20 +363,144 @@ class BaseCompactRestaurant : public IAddRemoveRestaurant {
 
   protected:
     
+    /**
+     * Stores the (type, cw, tw) triples as a structure of arrays sorted by
+     * type: an array of types followed by an array of (cw, tw) pairs.
+     *
+     * Counts are stored in 16 bits; once a count no longer fits, the payload
+     * switches to 32 bit counts for all its types. Up to INLINE_TYPES types
+     * with 16 bit counts are stored inside the payload itself, so that the
+     * common case of nodes with one or two types needs no allocation beyond
+     * the (pooled) payload; larger payloads keep both arrays in a single
+     * heap block.
+     */
     class Payload : public PoolObject<Payload> {
       public:
-        // per type: cw and tw
-        typedef std::pair<int, int> Arrangement;
-        typedef MiniMap<e_type, Arrangement> TableMap;
+        static const unsigned int INLINE_TYPES = 2;
+        static const l_type MAX_NARROW_COUNT = 0xffff;
 
-        Payload() : tableMap(), sumCustomers(0), sumTables(0) {}
+        Payload() : sumCustomers(0), sumTables(0), numTypes(0),
+                    capacity(INLINE_TYPES), wide(false) {}
+
+        ~Payload() {
+          if (!isInline()) {
+            delete[] storage.block;
+          }
+        }
 
-        TableMap tableMap;
         l_type sumCustomers;
         l_type sumTables;
-      
+
+        unsigned int size() const {
+          return numTypes;
+        }
+
+        e_type type(unsigned int i) const {
+          return types()[i];
+        }
+
+        l_type cw(unsigned int i) const {
+          return wide ? wideCounts()[2*i] : narrowCounts()[2*i];
+        }
+
+        l_type tw(unsigned int i) const {
+          return wide ? wideCounts()[2*i + 1] : narrowCounts()[2*i + 1];
+        }
+
+        /**
+         * Return the position of type, or -1 if the type is not present.
+         */
+        int find(e_type type) const {
+          unsigned int i = lowerBound(type);
+          if (i != numTypes && types()[i] == type) {
+            return i;
+          }
+          return -1;
+        }
+
+        /**
+         * Return the position of type, inserting it with zero counts if it
+         * is not present. Positions of types after it are shifted by one.
+         */
+        unsigned int insert(e_type type);
+
+        /**
+         * Set the counts of the type at position i; does not change the
+         * totals.
+         */
+        void set(unsigned int i, l_type cw, l_type tw) {
+          assert(cw >= 0 && tw >= 0);
+          if (!wide && (cw > MAX_NARROW_COUNT || tw > MAX_NARROW_COUNT)) {
+            widen();
+          }
+          if (wide) {
+            wideCounts()[2*i] = cw;
+            wideCounts()[2*i + 1] = tw;
+          } else {
+            narrowCounts()[2*i] = cw;
+            narrowCounts()[2*i + 1] = tw;
+          }
+        }
+
         void serialize(InArchive & ar, const unsigned int version);
         void serialize(OutArchive & ar, const unsigned int version);
+
+      private:
+        uint32_t numTypes;
+        uint32_t capacity : 31;
+        uint32_t wide : 1; // counts are stored in 32 rather than 16 bits
+
+        union {
+          struct {
+            e_type types[INLINE_TYPES];
+            uint16_t counts[2*INLINE_TYPES];
+          } inl;
+          // types[capacity], followed by counts[2*capacity]
+          char* block;
+        } storage;
+
+        bool isInline() const {
+          return !wide && capacity == INLINE_TYPES;
+        }
+
+        e_type* types() const {
+          return isInline() ? (e_type*)storage.inl.types 
+                            : (e_type*)storage.block;
+        }
+
+        uint16_t* narrowCounts() const {
+          return isInline() ? (uint16_t*)storage.inl.counts 
+                            : (uint16_t*)(storage.block 
+                                          + capacity * sizeof(e_type));
+        }
+
+        int32_t* wideCounts() const {
+          return (int32_t*)(storage.block + capacity * sizeof(e_type));
+        }
+
+        unsigned int lowerBound(e_type type) const {
+          const e_type* t = types();
+          if (numTypes <= 16) {
+            unsigned int offset = 0;
+            for (unsigned int i = 0; i < numTypes; ++i) {
+              offset += (t[i] < type);
+            }
+            return offset;
+          }
+          return std::lower_bound(t, t + numTypes, type) - t;
+        }
+
+        /**
+         * Move the arrays into a heap block for newCapacity types with
+         * counts of the given width.
+         */
+        void reallocate(unsigned int newCapacity, bool newWide);
+
+        void widen() {
+          reallocate(capacity, true);
+        }
+
+        DISALLOW_COPY_AND_ASSIGN(Payload);
     };
     
     class PayloadFactory : public IPayloadFactory {
@@ -395,7 +580,10 @@ class ExpectedTablesCompactRestaurant : public StirlingCompactRestaurant {
                               double parentProbability,
                               double discount, 
                               double concentration) const;
-    
+
+    bool hasHPYPPredictive() const {
+      return false;
+    }
 };
 
 
@@ -420,6 +608,8 @@ class KneserNeyRestaurant : public IAddRemoveRestaurant {
                               double concentration) const;
     
     TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
     
     const IPayloadFactory& getFactory() const;
     
@@ -502,5 +692,111 @@ inline double computeHPYPPredictive(
 }
 
 
+// The predictive probabilities of the restaurants are defined here so that
+// they can be inlined when called through the concrete restaurant type (see
+// HPYPModelT).
+
+inline double SimpleFullRestaurant::computeProbability(
+    void*  payloadPtr,
+    e_type type, 
+    double parentProbability,
+    double discount, 
+    double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  int cw = 0;
+  int tw = 0;
+  Payload::TableMap::iterator it = payload.tableMap.find(type);
+  if (it != payload.tableMap.end()) {
+    cw = (*it).second.first;
+    tw = (*it).second.second.size();
+  }
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.sumTables, // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+inline double HistogramRestaurant::computeProbability(
+    void*  payloadPtr,
+    e_type type, 
+    double parentProbability,
+    double discount, 
+    double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  int cw = 0;
+  int tw = 0;
+  Payload::TableMap::iterator it = payload.tableMap.find(type);
+  if (it != payload.tableMap.end()) {
+    cw = (*it).second.cw;
+    tw = (*it).second.tw;
+  }
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.sumTables, // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+inline double BaseCompactRestaurant::computeProbability(
+    void*  payloadPtr,
+    e_type type, 
+    double parentProbability,
+    double discount, 
+    double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  int cw = 0;
+  int tw = 0;
+  int i = payload.find(type);
+  if (i != -1) {
+    cw = payload.cw(i);
+    tw = payload.tw(i);
+  }
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.sumTables, // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
+inline double KneserNeyRestaurant::computeProbability(
+    void*  payloadPtr,
+    e_type type, 
+    double parentProbability,
+    double discount, 
+    double concentration) const {
+  Payload& payload = *((Payload*)payloadPtr);
+  
+  if (payload.sumCustomers == 0) {
+    return parentProbability;
+  }
+
+  Payload::TableMap::iterator it = payload.tableMap.find(type);
+  int cw = 0;
+  int tw = 0;
+  if (it != payload.tableMap.end()) {
+    cw = (*it).second;
+    tw = 1;
+  }
+
+  return computeHPYPPredictive(cw, // cw
+                               tw, // tw
+                               payload.sumCustomers, // c
+                               payload.tableMap.size(), // t
+                               parentProbability,
+                               discount,
+                               concentration);
+}
+
+
 }} // namespace gatsby::libplump
 #endif
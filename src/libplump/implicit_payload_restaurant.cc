@@ -0,0 +1,301 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libplump/implicit_payload_restaurant.h"
+
+#include <cassert>
+
+namespace gatsby { namespace libplump {
+
+////////////////////////////////////////////////////////////////////////////////
+//////////////////////   class ImplicitPayloadRestaurant   /////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+ImplicitPayloadRestaurant::ImplicitPayloadRestaurant(
+    IAddRemoveRestaurant* wrappedRestaurant)
+    : payloadFactory(*this), wrappedRestaurant(wrappedRestaurant),
+      emptyPrototype(wrappedRestaurant->getFactory().make()),
+      singlePrototype(materialize(makeImplicit(0))) {}
+
+
+ImplicitPayloadRestaurant::~ImplicitPayloadRestaurant() {
+  this->wrappedRestaurant->getFactory().recycle(this->emptyPrototype);
+  this->wrappedRestaurant->getFactory().recycle(this->singlePrototype);
+}
+
+
+l_type ImplicitPayloadRestaurant::getC(void* payloadPtr, e_type type) const {
+  if (isImplicit(payloadPtr)) {
+    return (hasCustomer(payloadPtr) && implicitType(payloadPtr) == type)
+           ? 1 : 0;
+  }
+  return this->wrappedRestaurant->getC(payloadPtr, type);
+}
+
+
+l_type ImplicitPayloadRestaurant::getC(void* payloadPtr) const {
+  if (isImplicit(payloadPtr)) {
+    return hasCustomer(payloadPtr) ? 1 : 0;
+  }
+  return this->wrappedRestaurant->getC(payloadPtr);
+}
+
+
+l_type ImplicitPayloadRestaurant::getT(void* payloadPtr, e_type type) const {
+  // a single customer always sits at its own table
+  if (isImplicit(payloadPtr)) {
+    return getC(payloadPtr, type);
+  }
+  return this->wrappedRestaurant->getT(payloadPtr, type);
+}
+
+
+l_type ImplicitPayloadRestaurant::getT(void* payloadPtr) const {
+  if (isImplicit(payloadPtr)) {
+    return getC(payloadPtr);
+  }
+  return this->wrappedRestaurant->getT(payloadPtr);
+}
+
+
+double ImplicitPayloadRestaurant::computeProbability(void*  payloadPtr,
+                                                     e_type type,
+                                                     double parentProbability,
+                                                     double discount,
+                                                     double concentration) const {
+  if (isImplicit(payloadPtr)) {
+    // all restaurants with one customer look alike up to the customer's type
+    if (!hasCustomer(payloadPtr)) {
+      return this->wrappedRestaurant->computeProbability(
+          this->emptyPrototype, type, parentProbability, discount,
+          concentration);
+    }
+    return this->wrappedRestaurant->computeProbability(
+        this->singlePrototype, (type == implicitType(payloadPtr)) ? 0 : 1,
+        parentProbability, discount, concentration);
+  }
+  return this->wrappedRestaurant->computeProbability(payloadPtr,
+                                                     type,
+                                                     parentProbability,
+                                                     discount,
+                                                     concentration);
+}
+
+
+IHPYPBaseRestaurant::TypeVector ImplicitPayloadRestaurant::getTypeVector(
+    void* payloadPtr) const {
+  TypeVector typeVector;
+  getTypeVector(payloadPtr, typeVector);
+  return typeVector;
+}
+
+
+void ImplicitPayloadRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
+  if (isImplicit(payloadPtr)) {
+    typeVector.clear();
+    if (hasCustomer(payloadPtr)) {
+      typeVector.push_back(implicitType(payloadPtr));
+    }
+    return;
+  }
+  this->wrappedRestaurant->getTypeVector(payloadPtr, typeVector);
+}
+
+
+const IPayloadFactory& ImplicitPayloadRestaurant::getFactory() const {
+  return this->payloadFactory;
+}
+
+
+void ImplicitPayloadRestaurant::updateAfterSplit(void* longerPayload,
+                                                 void* shorterPayload,
+                                                 double discountBeforeSplit,
+                                                 double discountAfterSplit,
+                                                 bool parentOnly) const {
+  // the shorter node is new, so it has a real payload made by the factory
+  assert(!isImplicit(shorterPayload));
+  if (isImplicit(longerPayload)) {
+    // A single customer stays at its table, so the longer restaurant is
+    // unchanged; still run the split on a real copy as it may draw random
+    // numbers and sets up the shorter restaurant.
+    void* longer = materialize(longerPayload);
+    this->wrappedRestaurant->updateAfterSplit(longer,
+                                              shorterPayload,
+                                              discountBeforeSplit,
+                                              discountAfterSplit,
+                                              parentOnly);
+    assert(this->wrappedRestaurant->getC(longer) == getC(longerPayload));
+    assert(this->wrappedRestaurant->getT(longer) == getT(longerPayload));
+    this->wrappedRestaurant->getFactory().recycle(longer);
+    return;
+  }
+  this->wrappedRestaurant->updateAfterSplit(longerPayload,
+                                            shorterPayload,
+                                            discountBeforeSplit,
+                                            discountAfterSplit,
+                                            parentOnly);
+}
+
+
+std::string ImplicitPayloadRestaurant::toString(void* payloadPtr) const {
+  if (isImplicit(payloadPtr)) {
+    void* payload = materialize(payloadPtr);
+    std::string s = this->wrappedRestaurant->toString(payload);
+    this->wrappedRestaurant->getFactory().recycle(payload);
+    return s;
+  }
+  return this->wrappedRestaurant->toString(payloadPtr);
+}
+
+
+bool ImplicitPayloadRestaurant::checkConsistency(void* payloadPtr) const {
+  if (isImplicit(payloadPtr)) {
+    return true;
+  }
+  return this->wrappedRestaurant->checkConsistency(payloadPtr);
+}
+
+
+bool ImplicitPayloadRestaurant::hasHPYPPredictive() const {
+  return this->wrappedRestaurant->hasHPYPPredictive();
+}
+
+
+bool ImplicitPayloadRestaurant::addCustomer(void*  payloadPtr,
+                                            e_type type,
+                                            double parentProbability,
+                                            double discount,
+                                            double concentration,
+                                            void*  additionalData) const {
+  // implicit payloads can not be changed in place; the model materializes
+  // them before seating or unseating customers
+  assert(!isImplicit(payloadPtr));
+  return this->wrappedRestaurant->addCustomer(payloadPtr,
+                                              type,
+                                              parentProbability,
+                                              discount,
+                                              concentration,
+                                              additionalData);
+}
+
+
+bool ImplicitPayloadRestaurant::removeCustomer(void* payloadPtr,
+                                               e_type type,
+                                               double discount,
+                                               void* additionalData) const {
+  // implicit payloads can not be changed in place; the model materializes
+  // them before seating or unseating customers
+  assert(!isImplicit(payloadPtr));
+  return this->wrappedRestaurant->removeCustomer(payloadPtr,
+                                                 type,
+                                                 discount,
+                                                 additionalData);
+}
+
+
+void* ImplicitPayloadRestaurant::createAdditionalData(
+    void* payloadPtr, double discount, double concentration) const {
+  if (isImplicit(payloadPtr)) {
+    void* payload = materialize(payloadPtr);
+    void* additionalData = this->wrappedRestaurant->createAdditionalData(
+        payload, discount, concentration);
+    this->wrappedRestaurant->getFactory().recycle(payload);
+    return additionalData;
+  }
+  return this->wrappedRestaurant->createAdditionalData(payloadPtr,
+                                                       discount,
+                                                       concentration);
+}
+
+
+void ImplicitPayloadRestaurant::freeAdditionalData(void* additionalData) const {
+  this->wrappedRestaurant->freeAdditionalData(additionalData);
+}
+
+
+void* ImplicitPayloadRestaurant::materialize(void* payloadPtr) const {
+  assert(isImplicit(payloadPtr));
+  void* payload = this->wrappedRestaurant->getFactory().make();
+  if (hasCustomer(payloadPtr)) {
+    // the first customer always opens a table, whatever the parameters
+    bool newTable = this->wrappedRestaurant->addCustomer(
+        payload, implicitType(payloadPtr), 1.0, 0.0, 1.0);
+    assert(newTable);
+    (void)newTable;
+  }
+  return payload;
+}
+
+
+void* ImplicitPayloadRestaurant::compact(void* payloadPtr) const {
+  assert(!isImplicit(payloadPtr));
+  l_type c = this->wrappedRestaurant->getC(payloadPtr);
+  if (c > 1) {
+    return payloadPtr;
+  }
+  void* implicit = emptyPayload();
+  if (c == 1) {
+    // some restaurants keep types without customers around
+    TypeVector types = this->wrappedRestaurant->getTypeVector(payloadPtr);
+    for (TypeVectorIterator it = types.begin(); it != types.end(); ++it) {
+      if (this->wrappedRestaurant->getC(payloadPtr, *it) == 1) {
+        implicit = makeImplicit(*it);
+        break;
+      }
+    }
+  }
+  this->wrappedRestaurant->getFactory().recycle(payloadPtr);
+  return implicit;
+}
+
+
+void* ImplicitPayloadRestaurant::PayloadFactory::make() const {
+  return this->implicitRestaurant.wrappedRestaurant->getFactory().make();
+}
+
+
+void ImplicitPayloadRestaurant::PayloadFactory::recycle(
+    void* payloadPtr) const {
+  if (!isImplicit(payloadPtr)) {
+    this->implicitRestaurant.wrappedRestaurant->getFactory().recycle(
+        payloadPtr);
+  }
+}
+
+
+void ImplicitPayloadRestaurant::PayloadFactory::save(void* payloadPtr,
+                                                     OutArchive& oa) const {
+  const IPayloadFactory& factory =
+      this->implicitRestaurant.wrappedRestaurant->getFactory();
+  if (isImplicit(payloadPtr)) {
+    void* payload = this->implicitRestaurant.materialize(payloadPtr);
+    factory.save(payload, oa);
+    factory.recycle(payload);
+  } else {
+    factory.save(payloadPtr, oa);
+  }
+}
+
+
+void* ImplicitPayloadRestaurant::PayloadFactory::load(InArchive& ia) const {
+  return this->implicitRestaurant.wrappedRestaurant->getFactory().load(ia);
+}
+
+}} // namespace gatsby::libplump
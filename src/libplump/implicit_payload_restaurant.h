@@ -0,0 +1,183 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMPLICIT_PAYLOAD_RESTAURANT_H
+#define IMPLICIT_PAYLOAD_RESTAURANT_H
+
+#include <boost/scoped_ptr.hpp>
+
+#include "libplump/config.h"
+#include "libplump/hpyp_restaurant_interface.h"
+#include "libplump/serialization.h"
+#include "libplump/utils.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Wraps another restaurant so that payloads with at most one customer do not
+ * need any storage: such a restaurant is fully described by the type of its
+ * customer (which sits alone at a single table), which is stored in the
+ * payload pointer itself (see makeImplicit()).
+ *
+ * Most leaves of the context tree of a sequence memoizer only ever see the
+ * one observation that followed their context; HPYPModel creates leaves with
+ * the empty implicit payload when used with this restaurant, and a real
+ * payload of the wrapped restaurant is only made when a second customer
+ * arrives. All read-only methods work on both kinds of payloads and give the
+ * same results as the wrapped restaurant does for the equivalent real
+ * payload.
+ *
+ * An implicit payload cannot be changed in place, so addCustomer and
+ * removeCustomer only accept real payloads; HPYPModel uses materialize() and
+ * compact() to replace implicit payloads in the tree instead. The factory
+ * saves implicit payloads in the format of the wrapped restaurant, so that
+ * they are loaded as real payloads.
+ *
+ * Must not wrap a SwitchingRestaurant, as the slot of the single customer
+ * is not recorded.
+ */
+class ImplicitPayloadRestaurant : public IAddRemoveRestaurant {
+  public:
+    /**
+     * Takes ownership of wrappedRestaurant.
+     */
+    ImplicitPayloadRestaurant(IAddRemoveRestaurant* wrappedRestaurant);
+
+    ~ImplicitPayloadRestaurant();
+
+    l_type getC(void* payloadPtr, e_type type) const;
+    l_type getC(void* payloadPtr) const;
+    l_type getT(void* payloadPtr, e_type type) const;
+    l_type getT(void* payloadPtr) const;
+
+    double computeProbability(void*  payloadPtr,
+                              e_type type,
+                              double parentProbability,
+                              double discount,
+                              double concentration) const;
+
+    TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
+
+    const IPayloadFactory& getFactory() const;
+
+    void updateAfterSplit(void* longerPayload,
+                          void* shorterPayload,
+                          double discountBeforeSplit,
+                          double discountAfterSplit,
+                          bool parentOnly = false) const;
+
+    std::string toString(void* payloadPtr) const;
+
+    bool checkConsistency(void* payloadPtr) const;
+
+    bool hasHPYPPredictive() const;
+
+    bool addCustomer(void*  payloadPtr,
+                     e_type type,
+                     double parentProbability,
+                     double discount,
+                     double concentration,
+                     void*  additionalData = NULL) const;
+
+
+    bool removeCustomer(void* payloadPtr,
+                        e_type type,
+                        double discount,
+                        void* additionalData) const;
+
+    void* createAdditionalData(void* payloadPtr,
+                               double discount,
+                               double concentration) const;
+
+    void freeAdditionalData(void* additionalData) const;
+
+    /**
+     * Return a new real payload that is equivalent to the given implicit
+     * payload; the caller owns the result.
+     */
+    void* materialize(void* payloadPtr) const;
+
+    /**
+     * Return the implicit payload equivalent to the given real payload if it
+     * has at most one customer (recycling the real payload), or the real
+     * payload otherwise.
+     */
+    void* compact(void* payloadPtr) const;
+
+    static bool isImplicit(void* payloadPtr) {
+      return (reinterpret_cast<uintptr_t>(payloadPtr) & 1) != 0;
+    }
+
+    /**
+     * The implicit payload of a restaurant without customers.
+     */
+    static void* emptyPayload() {
+      return reinterpret_cast<void*>((uintptr_t)1);
+    }
+
+    /**
+     * The implicit payload of a restaurant with a single customer of the
+     * given type. Real payloads are at least 2-aligned, so the lowest bit
+     * tells the two apart; the second bit is set if there is a customer.
+     */
+    static void* makeImplicit(e_type type) {
+      return reinterpret_cast<void*>(((uintptr_t)type << 2) | 3);
+    }
+
+  private:
+    static bool hasCustomer(void* payloadPtr) {
+      return (reinterpret_cast<uintptr_t>(payloadPtr) & 2) != 0;
+    }
+
+    static e_type implicitType(void* payloadPtr) {
+      return (e_type)(reinterpret_cast<uintptr_t>(payloadPtr) >> 2);
+    }
+
+    class PayloadFactory : public IPayloadFactory {
+      public:
+        PayloadFactory(const ImplicitPayloadRestaurant& implicitRestaurant)
+            : implicitRestaurant(implicitRestaurant) {}
+
+        void* make() const;
+        void recycle(void* payloadPtr) const;
+        void save(void* payloadPtr, OutArchive& oa) const;
+        void* load(InArchive& ia) const;
+
+      private:
+        const ImplicitPayloadRestaurant& implicitRestaurant;
+    };
+
+
+    const PayloadFactory payloadFactory;
+    boost::scoped_ptr<IAddRemoveRestaurant> wrappedRestaurant;
+
+    // real payloads of the wrapped restaurant without customers and with a
+    // single customer of type 0, used to compute predictive probabilities for
+    // implicit payloads
+    void* emptyPrototype;
+    void* singlePrototype;
+
+    DISALLOW_COPY_AND_ASSIGN(ImplicitPayloadRestaurant);
+};
+
+
+}} // namespace gatsby::libplump
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INLINE_MINI_MAP_H_
+#define INLINE_MINI_MAP_H_
+
+#include <algorithm>
+#include <cassert>
+#include <ostream>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A map container with the same interface and behaviour as MiniMap (sorted
+ * key and value arrays), but which stores up to N elements inside the
+ * object itself, so that small maps do not allocate any memory.
+ *
+ * Differences to MiniMap:
+ *   - no heap allocation for up to N elements (MiniMap allocates two arrays
+ *     even when empty); larger maps use heap arrays that are grown by
+ *     doubling their size
+ *   - the capacity is stored rather than recomputed on every insertion
+ *   - the keys are kept in their own contiguous array, and small maps are
+ *     searched with a branch-free linear scan over it, which the compiler
+ *     can vectorize; binary search is used for larger maps
+ *   - swap() exchanges the contents of two maps without copying when both
+ *     use heap arrays (C++98 has no move semantics)
+ *
+ * Like MiniMap, the elements are iterated over in the order of their keys,
+ * and both are serialized in the same format.
+ */
+template<class Key, class T, unsigned int N = 3,
+         typename size_type = unsigned int>
+class InlineMiniMap {
+  public:
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<const Key,T> value_type;
+
+    class const_iterator; // defined below
+
+    // alias const_iterator for compatability with STL map
+    typedef const_iterator iterator;
+
+    // maps up to this size are searched linearly
+    static const size_type LINEAR_SEARCH_SIZE = 16;
+
+    InlineMiniMap()
+        : keys(inlineKeys), values(inlineValues), _size(0), _capacity(N) {}
+
+    InlineMiniMap(const InlineMiniMap& other)
+        : keys(inlineKeys), values(inlineValues), _size(0), _capacity(N) {
+      assign(other);
+    }
+
+    InlineMiniMap& operator=(const InlineMiniMap& other) {
+      if (this != &other) {
+        assign(other);
+      }
+      return *this;
+    }
+
+    ~InlineMiniMap() {
+      release();
+    }
+
+    void clear() {
+      release();
+      for (size_type i = 0; i < N; ++i) {
+        inlineValues[i] = T();
+      }
+      _size = 0;
+    }
+
+    /**
+     * Exchange the contents of this map with those of other.
+     */
+    void swap(InlineMiniMap& other) {
+      if (!isInline() && !other.isInline()) {
+        std::swap(keys, other.keys);
+        std::swap(values, other.values);
+        std::swap(_size, other._size);
+        std::swap(_capacity, other._capacity);
+      } else {
+        InlineMiniMap tmp(other);
+        other = *this;
+        *this = tmp;
+      }
+    }
+
+
+    size_type count(const Key& x) const {
+      if (this->find(x) != this->end()) {
+        return 1;
+      } else {
+        return 0;
+      }
+    }
+
+    bool empty() const {
+      return _size == 0;
+    }
+
+    size_type size() const {
+      return _size;
+    }
+
+    /**
+     * Returns the number of elements the map can hold without allocating
+     * memory.
+     */
+    size_type capacity() const {
+      return _capacity;
+    }
+
+    const_iterator find(const Key& key) const {
+      size_type offset = lowerBound(key);
+      if (offset != _size && keys[offset] == key) {
+        return const_iterator(keys, values, keys + offset);
+      } else {
+        return this->end();
+      }
+    }
+
+
+    /**
+     * Remove the element with the given key (if any); returns the number of
+     * elements removed.
+     */
+    size_type erase(const Key& key) {
+      size_type offset = lowerBound(key);
+      if (offset == _size || !(keys[offset] == key)) {
+        return 0;
+      }
+      eraseAt(offset);
+      return 1;
+    }
+
+
+    T& operator[](const Key& key) {
+      size_type offset = lowerBound(key);
+      if (offset != _size && keys[offset] == key) {
+        return values[offset];
+      } else {
+        return insert(offset, key, T());
+      }
+    }
+
+    const_iterator insert(const_iterator position, const value_type& x) {
+      if (position.pos != keys + _size && *(position.pos) == x.first) {
+        this->values[position.pos - position.keys] = x.second;
+        return position; // iterator unchanged
+      } else {
+        size_type offset = lowerBound(x.first);
+        if (offset != _size && keys[offset] == x.first) {
+          values[offset] = x.second;
+        } else {
+          insert(offset, x.first, x.second);
+        }
+        return const_iterator(keys, values, keys + offset);
+      }
+    }
+
+
+    const_iterator begin() const {
+      return const_iterator(keys, values, keys);
+    }
+
+
+    const_iterator end() const {
+      return const_iterator(keys, values, keys + _size);
+    }
+
+
+    std::string toString() const {
+      std::ostringstream os;
+      os << "{";
+      for (const_iterator i = begin(); i != end(); ++i) {
+        os << ((*i).first);
+        os << ":" <<  (*i).second;
+        os << ", ";
+      }
+      os << "}";
+      return os.str();
+    }
+
+
+    class const_iterator
+        : public std::iterator<std::output_iterator_tag,value_type> {
+      public:
+
+        const_iterator() : keys(NULL), values(NULL), pos(NULL) {}
+
+        const_iterator(Key* keys, T* values, Key* pos)
+            : keys(keys), values(values), pos(pos) {}
+
+        value_type operator *() const {
+          return value_type(*pos, values[pos - keys]);
+        }
+
+        const_iterator& operator ++(){
+          ++pos;
+          return *this;
+        }
+
+        const_iterator operator ++(int){
+          const_iterator old(*this);
+          ++pos;
+          return old;
+        }
+
+        bool operator ==(const const_iterator& other) const {
+          return pos == other.pos;
+        }
+
+        bool operator !=(const const_iterator& other) const {
+          return pos != other.pos;
+        }
+
+      private:
+        Key* keys;
+        T* values;
+        Key* pos;
+        friend class InlineMiniMap;
+    };
+
+  protected:
+    // point either to the inline arrays or to heap arrays
+    Key* keys;
+    T* values;
+    size_type _size;
+    size_type _capacity;
+    Key inlineKeys[N];
+    T inlineValues[N];
+
+    bool isInline() const {
+      return keys == inlineKeys;
+    }
+
+    /**
+     * Return the position of the first key that is not smaller than key.
+     */
+    size_type lowerBound(const Key& key) const {
+      if (_size <= LINEAR_SEARCH_SIZE) {
+        // the keys are sorted, so the position is the number of smaller keys
+        size_type offset = 0;
+        for (size_type i = 0; i < _size; ++i) {
+          offset += (keys[i] < key);
+        }
+        return offset;
+      }
+      return std::lower_bound(keys, keys + _size, key) - keys;
+    }
+
+    T& insert(size_type offset, const Key& key, const T& value) {
+      if (_size == _capacity) {
+        grow(2 * _capacity);
+      }
+      for(size_type i=_size;i>offset;i--) {
+        keys[i] = keys[i-1];
+        values[i] = values[i-1];
+      }
+      keys[offset] = key;
+      values[offset] = value;
+      _size++;
+      return values[offset];
+    }
+
+    void eraseAt(size_type offset) {
+      for (size_type i = offset + 1; i < _size; ++i) {
+        keys[i-1] = keys[i];
+        values[i-1] = values[i];
+      }
+      --_size;
+      values[_size] = T();
+    }
+
+    /**
+     * Move the elements into arrays that can hold newCapacity elements.
+     */
+    void grow(size_type newCapacity) {
+      assert(newCapacity > N && newCapacity >= _size);
+      Key* newKeys = new Key[newCapacity];
+      T* newValues = new T[newCapacity];
+      std::copy(keys, keys + _size, newKeys);
+      std::copy(values, values + _size, newValues);
+      release();
+      keys = newKeys;
+      values = newValues;
+      _capacity = newCapacity;
+    }
+
+    /**
+     * Free the heap arrays (if any) and switch back to the inline arrays;
+     * does not change the size.
+     */
+    void release() {
+      if (!isInline()) {
+        delete[] keys;
+        delete[] values;
+        keys = inlineKeys;
+        values = inlineValues;
+        _capacity = N;
+      }
+    }
+
+    void assign(const InlineMiniMap& other) {
+      if (other._size > _capacity) {
+        size_type newCapacity = 2 * N;
+        while (newCapacity < other._size) {
+          newCapacity *= 2;
+        }
+        _size = 0;
+        grow(newCapacity);
+      }
+      std::copy(other.keys, other.keys + other._size, keys);
+      std::copy(other.values, other.values + other._size, values);
+      _size = other._size;
+    }
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void save(Archive & ar, const unsigned int version) const {
+      // same format as MiniMap
+      std::vector<Key> keyVec(keys, keys + _size);
+      std::vector<T> valueVec(values, values + _size);
+      ar << _size;
+      ar << keyVec;
+      ar << valueVec;
+    }
+
+
+    template<class Archive>
+    void load(Archive & ar, const unsigned int version) {
+      std::vector<Key> keyVec;
+      std::vector<T> valueVec;
+      size_type size;
+      ar >> size;
+      ar >> keyVec;
+      ar >> valueVec;
+      clear();
+      if (size > _capacity) {
+        size_type newCapacity = 2 * N;
+        while (newCapacity < size) {
+          newCapacity *= 2;
+        }
+        grow(newCapacity);
+      }
+      std::copy(keyVec.begin(), keyVec.end(), keys);
+      std::copy(valueVec.begin(), valueVec.end(), values);
+      _size = size;
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+
+template<class Key, class T, unsigned int N, typename size_type>
+void swap(InlineMiniMap<Key, T, N, size_type>& a,
+          InlineMiniMap<Key, T, N, size_type>& b) {
+  a.swap(b);
+}
+
+
+template<class Key, class T, unsigned int N, typename size_type>
+std::ostream& operator<<(std::ostream& stream,
+                         const InlineMiniMap<Key, T, N, size_type>& map) {
+  stream << map.toString();
+  return stream;
+}
+
+}} // namespace gatsby::libplump
+
+
+#endif /* INLINE_MINI_MAP_H_ */
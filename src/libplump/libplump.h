@@ -23,12 +23,20 @@
 #include "libplump/config.h"
 #include "libplump/utils.h"
 #include "libplump/random.h"
+#include "libplump/parallel.h"
 #include "libplump/node_manager.h"
 #include "libplump/context_tree.h"
+#include "libplump/stirling.h"
+#include "libplump/pyp_sample.h"
 #include "libplump/hpyp_restaurants.h"
 #include "libplump/switching_restaurant.h"
+#include "libplump/implicit_payload_restaurant.h"
 #include "libplump/hpyp_parameters.h"
+#include "libplump/parameter_optimizer.h"
 #include "libplump/hpyp_model.h"
+#include "libplump/hpyp_model_t.h"
+#include "libplump/frozen_hpyp_model.h"
+#include "libplump/streaming_session.h"
 #include "libplump/serialization.h"
 
 #endif
@@ -99,10 +99,12 @@ class SimpleNodeManager : public INodeManager {
 
     /**
      * Remove the child with key key from node's child list.
-     * XXX: Not implemented -- and not needed?
+     *
+     * The child itself is not destroyed; call destroyNode or
+     * destroyNodeRecursive on it afterwards.
      */
     void removeChild(NodeId node, e_type key) {
-
+      static_cast<Node*>(node)->children.erase(key);
     }
 
     /**
@@ -203,6 +205,294 @@ class SimpleNodeManager : public INodeManager {
     DISALLOW_COPY_AND_ASSIGN(SimpleNodeManager);
 };
 
+
+/**
+ * An ArenaNodeManager implements the NodeManager functionality by storing
+ * all nodes in large, contiguous slabs and handing out 32-bit node indices
+ * (cast to NodeId) instead of pointers.
+ *
+ * Each node record keeps start, end, payload and the index of its child map
+ * together. Child maps are only allocated for inner nodes (leaves, which make
+ * up roughly half of all nodes, share a single empty map), and live in their
+ * own slabs. Freed nodes and child maps are put on free lists and reused.
+ *
+ * Slabs are never moved, so references returned by getChildren stay valid
+ * until the node is destroyed.
+ */
+class ArenaNodeManager : public INodeManager {
+
+  public:
+
+    ArenaNodeManager(const IPayloadFactory& payloadFactory)
+      : payloadFactory(payloadFactory), nodeSlabs(), childSlabs(),
+        numNodes(1), numChildMaps(1), freeNodes(), freeChildMaps(),
+        emptyChildren(), root(0) {
+      // index 0 is reserved so that it can double as the NULL NodeId
+      this->root = createNode(0, 0);
+    }
+
+    ~ArenaNodeManager() {
+      this->recyclePayloadsRecursive(this->root);
+      for (size_t i = 0; i < nodeSlabs.size(); ++i) {
+        delete [] nodeSlabs[i];
+      }
+      for (size_t i = 0; i < childSlabs.size(); ++i) {
+        delete [] childSlabs[i];
+      }
+    }
+
+    NodeId getRoot() const {
+      return toNodeId(root);
+    }
+
+    /**
+     * Get the child of this node with the given key.
+     */
+    NodeId getChild(NodeId node, e_type key) const {
+      Index children = getNode(node).children;
+      if (children == 0) {
+        return NULL;
+      }
+      const ChildMap& map = getChildMap(children);
+      ChildMapIterator child = map.find(key);
+      if (child != map.end()) {
+        return (*child).second;
+      } else {
+        return NULL;
+      }
+    }
+
+    /**
+     * Create a new child of node with the given key, start and end positions
+     * and returns a handle to the newly created node.
+     *
+     * As in SimpleNodeManager, an existing child with this key is
+     * overwritten (and leaked).
+     */
+    NodeId setChild(NodeId node, e_type key, l_type start, l_type end,
+                    void* payload = NULL) {
+      Index newNode = createNode(start, end, payload);
+      getOrCreateChildMap(toIndex(node))[key] = toNodeId(newNode);
+      return toNodeId(newNode);
+    }
+
+    /**
+     * Insert a node between two other nodes at the given key position.
+     *
+     * If parent already has a old_key-child, we create a new child of parent
+     * a make the old child a child of the new child with key new_key.
+     */
+    NodeId insertBetween(NodeId parent, e_type oldKey,
+                         l_type newStart, l_type newEnd,  e_type newKey) {
+      // we can safely assume that parent is an inner node
+      NodeId oldChild = getChildMap(getNode(parent).children)[oldKey];
+      Index newParent = createNode(newStart, newEnd);
+      getOrCreateChildMap(newParent)[newKey] = oldChild;
+      getChildMap(getNode(parent).children)[oldKey] = toNodeId(newParent);
+      return toNodeId(newParent);
+    }
+
+    /**
+     * Remove the child with key key from node's child list; the child map
+     * is put back on the free list when the node becomes a leaf.
+     *
+     * The child itself is not destroyed; call destroyNode or
+     * destroyNodeRecursive on it afterwards.
+     */
+    void removeChild(NodeId node, e_type key) {
+      Node& n = getNode(node);
+      if (n.children == 0) {
+        return;
+      }
+      ChildMap& map = getChildMap(n.children);
+      map.erase(key);
+      if (map.empty()) {
+        map.clear();
+        freeChildMaps.push_back(n.children);
+        n.children = 0;
+      }
+    }
+
+    /**
+     * Get a reference to the payload associated with the
+     * given node.
+     */
+    void* getPayload(NodeId node) const {
+      return getNode(node).payload;
+    }
+
+    void setPayload(NodeId node, void* payload) {
+      this->payloadFactory.recycle(getNode(node).payload);
+      getNode(node).payload = payload;
+    }
+
+    l_type getStart(NodeId node) const {
+      return getNode(node).start;
+    }
+
+    l_type getEnd(NodeId node) const {
+      return getNode(node).end;
+    }
+
+    ChildMap& getChildren(NodeId node) const {
+      Index children = getNode(node).children;
+      if (children == 0) {
+        // leaves share this map; callers only ever iterate over it
+        return emptyChildren;
+      }
+      return getChildMap(children);
+    }
+
+
+    /**
+     * Destroy the node with the given handle, i.e. recycle its payload and
+     * put its record (and child map) back on the free lists.
+     */
+    void destroyNode(NodeId node) {
+      if (node != NULL) {
+        Index index = toIndex(node);
+        Node& n = getNode(index);
+        this->payloadFactory.recycle(n.payload);
+        if (n.children != 0) {
+          getChildMap(n.children).clear();
+          freeChildMaps.push_back(n.children);
+        }
+        n = Node();
+        freeNodes.push_back(index);
+      }
+    }
+
+
+    /**
+     * Destroy the given node and all its children.
+     */
+    void destroyNodeRecursive(NodeId node) {
+      if (node != NULL) {
+        Index children = getNode(node).children;
+        if (children != 0) {
+          ChildMap& map = getChildMap(children);
+          for (ChildMapIterator it = map.begin(); it != map.end(); ++it) {
+            this->destroyNodeRecursive((*it).second);
+          }
+        }
+        this->destroyNode(node);
+        if (toIndex(node) == this->root) {
+          // if we have destroyed the root, create a new one
+          this->root = createNode(0,0);
+        }
+      }
+    }
+
+
+  private:
+    typedef uint32_t Index;
+
+    static const unsigned int SLAB_BITS = 16;
+    static const Index SLAB_SIZE = 1 << SLAB_BITS;
+    static const Index SLAB_MASK = SLAB_SIZE - 1;
+    // child maps are only needed for inner nodes; keep their slabs smaller
+    static const unsigned int CHILD_SLAB_BITS = 12;
+    static const Index CHILD_SLAB_SIZE = 1 << CHILD_SLAB_BITS;
+    static const Index CHILD_SLAB_MASK = CHILD_SLAB_SIZE - 1;
+
+    struct Node {
+      l_type start;
+      l_type end;
+      void* payload;
+      Index children; // index into the child map slabs, 0 for leaves
+
+      Node() : start(0), end(0), payload(NULL), children(0) {}
+    };
+
+    static NodeId toNodeId(Index index) {
+      return reinterpret_cast<NodeId>(static_cast<uintptr_t>(index));
+    }
+
+    static Index toIndex(NodeId node) {
+      return static_cast<Index>(reinterpret_cast<uintptr_t>(node));
+    }
+
+    Node& getNode(Index index) const {
+      return nodeSlabs[index >> SLAB_BITS][index & SLAB_MASK];
+    }
+
+    Node& getNode(NodeId node) const {
+      return getNode(toIndex(node));
+    }
+
+    ChildMap& getChildMap(Index index) const {
+      return childSlabs[index >> CHILD_SLAB_BITS][index & CHILD_SLAB_MASK];
+    }
+
+    ChildMap& getOrCreateChildMap(Index node) {
+      if (getNode(node).children == 0) {
+        Index children;
+        if (!freeChildMaps.empty()) {
+          children = freeChildMaps.back();
+          freeChildMaps.pop_back();
+        } else {
+          if ((numChildMaps >> CHILD_SLAB_BITS) == childSlabs.size()) {
+            childSlabs.push_back(new ChildMap[CHILD_SLAB_SIZE]);
+          }
+          children = numChildMaps++;
+        }
+        getNode(node).children = children;
+      }
+      return getChildMap(getNode(node).children);
+    }
+
+
+    /**
+     * Create a new, initally unreferenced node and return its index.
+     */
+    Index createNode(l_type start, l_type end, void* payload = NULL) {
+      Index index;
+      if (!freeNodes.empty()) {
+        index = freeNodes.back();
+        freeNodes.pop_back();
+      } else {
+        if ((numNodes >> SLAB_BITS) == nodeSlabs.size()) {
+          nodeSlabs.push_back(new Node[SLAB_SIZE]);
+        }
+        index = numNodes++;
+      }
+      Node& node = getNode(index);
+      node.start = start;
+      node.end = end;
+      if (payload != NULL) {
+        node.payload = payload;
+      } else {
+        node.payload = this->payloadFactory.make();
+      }
+      node.children = 0;
+      return index;
+    }
+
+    void recyclePayloadsRecursive(Index index) {
+      Node& node = getNode(index);
+      if (node.children != 0) {
+        ChildMap& map = getChildMap(node.children);
+        for (ChildMapIterator it = map.begin(); it != map.end(); ++it) {
+          this->recyclePayloadsRecursive(toIndex((*it).second));
+        }
+      }
+      this->payloadFactory.recycle(node.payload);
+    }
+
+
+    const IPayloadFactory& payloadFactory;
+    std::vector<Node*> nodeSlabs;
+    std::vector<ChildMap*> childSlabs;
+    Index numNodes;
+    Index numChildMaps;
+    std::vector<Index> freeNodes;
+    std::vector<Index> freeChildMaps;
+    mutable ChildMap emptyChildren;
+    Index root;
+
+    DISALLOW_COPY_AND_ASSIGN(ArenaNodeManager);
+};
+
 // 
 // template<typename _OtherNodeManager>
 // class DebugProxyNodeManager {
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <vector>
+#include <pthread.h>
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A thin wrapper around a pthread mutex.
+ */
+class Mutex {
+  public:
+    Mutex() {
+      pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~Mutex() {
+      pthread_mutex_destroy(&mutex);
+    }
+
+    void lock() {
+      pthread_mutex_lock(&mutex);
+    }
+
+    void unlock() {
+      pthread_mutex_unlock(&mutex);
+    }
+
+  private:
+    pthread_mutex_t mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(Mutex);
+};
+
+
+/**
+ * Locks the given mutex for the lifetime of the object.
+ */
+class ScopedLock {
+  public:
+    explicit ScopedLock(Mutex& mutex) : mutex(mutex) {
+      mutex.lock();
+    }
+
+    ~ScopedLock() {
+      mutex.unlock();
+    }
+
+  private:
+    Mutex& mutex;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedLock);
+};
+
+
+/**
+ * Call work(thread, chunkBegin, chunkEnd) for consecutive chunks of at most
+ * chunkSize positions that together cover [begin, end), using numThreads
+ * threads. Chunks are handed out to the threads as they become idle; thread
+ * is the index of the calling thread in [0, numThreads) and can be used to
+ * keep per-thread state (e.g. buffers) in the work object. Thread 0 is the
+ * calling thread; returns when all chunks have been processed.
+ *
+ * If fewer threads can be started than requested, the work is done by the
+ * threads that could be started.
+ */
+template <typename Work>
+void parallelFor(l_type begin, l_type end, int numThreads, Work& work,
+                 l_type chunkSize = 1024);
+
+
+////////////////////////////////////////////////////////////////////////////////
+///////////////////   IMPLEMENTATION   /////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+template <typename Work>
+struct ParallelForState {
+  Work* work;
+  l_type next, end, chunkSize;
+  Mutex mutex;
+};
+
+
+template <typename Work>
+struct ParallelForThread {
+  ParallelForState<Work>* state;
+  int index;
+};
+
+
+template <typename Work>
+void* runParallelForThread(void* arg) {
+  ParallelForThread<Work>& thread = *static_cast<ParallelForThread<Work>*>(
+      arg);
+  ParallelForState<Work>& state = *thread.state;
+  while (true) {
+    l_type chunkBegin, chunkEnd;
+    {
+      ScopedLock lock(state.mutex);
+      if (state.next >= state.end) {
+        break;
+      }
+      chunkBegin = state.next;
+      chunkEnd = std::min(state.end, chunkBegin + state.chunkSize);
+      state.next = chunkEnd;
+    }
+    (*state.work)(thread.index, chunkBegin, chunkEnd);
+  }
+  return NULL;
+}
+
+} // namespace detail
+
+
+template <typename Work>
+void parallelFor(l_type begin, l_type end, int numThreads, Work& work,
+                 l_type chunkSize) {
+  if (numThreads <= 1) {
+    if (begin < end) {
+      work(0, begin, end);
+    }
+    return;
+  }
+
+  detail::ParallelForState<Work> state;
+  state.work = &work;
+  state.next = begin;
+  state.end = end;
+  state.chunkSize = std::max(chunkSize, (l_type)1);
+
+  std::vector<detail::ParallelForThread<Work> > threads(numThreads);
+  std::vector<pthread_t> handles(numThreads);
+  std::vector<bool> started(numThreads, false);
+  for (int i = 0; i < numThreads; ++i) {
+    threads[i].state = &state;
+    threads[i].index = i;
+  }
+  for (int i = 1; i < numThreads; ++i) {
+    started[i] = pthread_create(&handles[i], NULL,
+                                &detail::runParallelForThread<Work>,
+                                &threads[i]) == 0;
+  }
+  detail::runParallelForThread<Work>(&threads[0]);
+  for (int i = 1; i < numThreads; ++i) {
+    if (started[i]) {
+      pthread_join(handles[i], NULL);
+    }
+  }
+}
+
+}} // namespace gatsby::libplump
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libplump/parameter_optimizer.h"
+
+#include <cmath>
+
+
+namespace gatsby { namespace libplump {
+
+ParameterOptimizer::ParameterOptimizer(IParameters& parameters,
+                                       const OptimizerOptions& options)
+    : parameters(parameters), options(options), batchCount(0), 
+      numSteps(0) {
+  parameters.getFreeParameters(values);
+  batchGradient.assign(values.size(), 0);
+  firstMoment.assign(values.size(), 0);
+  secondMoment.assign(values.size(), 0);
+}
+
+
+void ParameterOptimizer::addGradient(const d_vec& gradient,
+                                     int numObservations) {
+  ScopedLock lock(mutex);
+  for (size_t i = 0; i < batchGradient.size(); ++i) {
+    batchGradient[i] += gradient[i];
+  }
+  batchCount += numObservations;
+  if (batchCount >= options.batchSize) {
+    applyStep();
+  }
+}
+
+
+void ParameterOptimizer::step() {
+  ScopedLock lock(mutex);
+  applyStep();
+}
+
+
+void ParameterOptimizer::applyStep() {
+  if (batchCount == 0) {
+    return;
+  }
+  parameters.getFreeParameters(values);
+  double stepSize = options.stepSize / (1 + options.decay * numSteps);
+  ++numSteps;
+  for (size_t i = 0; i < values.size(); ++i) {
+    double g = batchGradient[i];
+    double delta = 0;
+    switch (options.method) {
+      case OptimizerOptions::SGD:
+        delta = stepSize * g;
+        break;
+      case OptimizerOptions::MOMENTUM:
+        firstMoment[i] = options.momentum * firstMoment[i] + stepSize * g;
+        delta = firstMoment[i];
+        break;
+      case OptimizerOptions::ADAGRAD:
+        secondMoment[i] += g * g;
+        delta = stepSize * g / (sqrt(secondMoment[i]) + options.epsilon);
+        break;
+      case OptimizerOptions::ADAM: {
+        firstMoment[i] = options.beta1 * firstMoment[i] 
+                         + (1 - options.beta1) * g;
+        secondMoment[i] = options.beta2 * secondMoment[i] 
+                          + (1 - options.beta2) * g * g;
+        double m = firstMoment[i] / (1 - pow(options.beta1, numSteps));
+        double v = secondMoment[i] / (1 - pow(options.beta2, numSteps));
+        delta = stepSize * m / (sqrt(v) + options.epsilon);
+        break;
+      }
+    }
+    values[i] += delta;
+    batchGradient[i] = 0;
+  }
+  batchCount = 0;
+  parameters.setFreeParameters(values);
+}
+
+}} // namespace gatsby::libplump
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARAMETER_OPTIMIZER_H_
+#define PARAMETER_OPTIMIZER_H_
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/parallel.h"
+#include "libplump/hpyp_parameters_interface.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Settings of a ParameterOptimizer.
+ */
+struct OptimizerOptions {
+  enum Method {
+    SGD,      // plain stochastic gradient ascent
+    MOMENTUM, // with a running average of the steps
+    ADAGRAD,  // per parameter step sizes from the sum of squared gradients
+    ADAM      // per parameter step sizes from bias-corrected moments
+  };
+
+  OptimizerOptions()
+      : method(SGD), stepSize(1e-4), batchSize(2), decay(0), momentum(0.9),
+        beta1(0.9), beta2(0.999), epsilon(1e-8) {}
+
+  Method method;
+  // the step size of step k (counting from 0) is stepSize / (1 + decay * k)
+  double stepSize;
+  // number of observations whose gradients are summed for each step
+  int batchSize;
+  double decay;
+  // weight of the previous step for MOMENTUM
+  double momentum;
+  // decay rates of the moment estimates for ADAM
+  double beta1, beta2;
+  // added to the denominators of ADAGRAD and ADAM
+  double epsilon;
+};
+
+
+/**
+ * Learns the free parameters of an IParameters object online by stochastic
+ * gradient ascent on the log predictive probabilities of the observations.
+ *
+ * The models call observe() for every observation they insert; the
+ * gradients are summed over mini-batches of options.batchSize observations,
+ * and each full batch results in a single update of the parameters. If the 
+ * parameters have no free parameters (e.g. SimpleParameters), observe()
+ * returns immediately.
+ *
+ * Gradients can also be computed by several threads at once: each thread 
+ * sums the gradients of its observations into its own vector using
+ * computeGradient(), and hands them to addGradient(), which is thread-safe.
+ * The parameters must not be updated (by a full batch) while other threads
+ * compute gradients, as that changes the parameters they read.
+ */
+class ParameterOptimizer {
+  public:
+    ParameterOptimizer(IParameters& parameters,
+                       const OptimizerOptions& options = OptimizerOptions());
+
+    /**
+     * Add the gradient of the log predictive probability of obs to the
+     * current batch, and update the parameters if the batch is full. The
+     * arguments are those of IParameters::accumulateParameterGradient.
+     */
+    void observe(const IAddRemoveRestaurant& restaurant,
+                 const WrappedNodeList& path,
+                 const d_vec& prob_path,
+                 const d_vec& discount_path,
+                 const d_vec& concentration_path,
+                 e_type obs) {
+      if (batchGradient.empty()) {
+        return;
+      }
+      parameters.accumulateParameterGradient(restaurant, path, prob_path,
+          discount_path, concentration_path, obs, batchGradient);
+      if (++batchCount >= options.batchSize) {
+        step();
+      }
+    }
+
+    /**
+     * Add the gradient of the log predictive probability of obs to gradient
+     * (which must have getNumParameters() entries) without changing the
+     * state of the optimizer.
+     */
+    void computeGradient(const IAddRemoveRestaurant& restaurant,
+                         const WrappedNodeList& path,
+                         const d_vec& prob_path,
+                         const d_vec& discount_path,
+                         const d_vec& concentration_path,
+                         e_type obs,
+                         d_vec& gradient) const {
+      parameters.accumulateParameterGradient(restaurant, path, prob_path,
+          discount_path, concentration_path, obs, gradient);
+    }
+
+    /**
+     * Add a gradient summed over numObservations observations to the
+     * current batch, and update the parameters if the batch is full.
+     */
+    void addGradient(const d_vec& gradient, int numObservations);
+
+    /**
+     * Update the parameters using the gradient of the current batch, even if
+     * it is not full, and start a new batch.
+     */
+    void step();
+
+    int getNumParameters() const {
+      return batchGradient.size();
+    }
+
+    /**
+     * Number of updates made so far.
+     */
+    int getNumSteps() const {
+      return numSteps;
+    }
+
+    const OptimizerOptions& getOptions() const {
+      return options;
+    }
+
+    /**
+     * Change the settings; the state of the method (e.g. the moment
+     * estimates of ADAM) is kept.
+     */
+    void setOptions(const OptimizerOptions& options) {
+      this->options = options;
+    }
+
+  private:
+    // step() with the mutex held (or from a single thread)
+    void applyStep();
+
+    IParameters& parameters;
+    OptimizerOptions options;
+    Mutex mutex;
+
+    d_vec batchGradient;
+    int batchCount;
+    int numSteps;
+
+    // buffer for the values of the free parameters
+    d_vec values;
+    // momentum: last step; AdaGrad: sum of squared gradients; Adam: first
+    // and second moment estimates
+    d_vec firstMoment, secondMoment;
+
+    DISALLOW_COPY_AND_ASSIGN(ParameterOptimizer);
+};
+
+}} // namespace gatsby::libplump
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ * 
+ * This file is part of libPLUMP.
+ * 
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libplump/pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cxxabi.h>
+
+
+namespace gatsby { namespace libplump {
+
+namespace {
+
+pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+std::vector<FixedSizePool*>& registry() {
+  static std::vector<FixedSizePool*>* pools =
+      new std::vector<FixedSizePool*>();
+  return *pools;
+}
+
+std::string demangle(const std::string& name) {
+  int status;
+  char* demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+  if (demangled == NULL) {
+    return name;
+  }
+  std::string result(demangled);
+  free(demangled);
+  return result;
+}
+
+} // namespace
+
+
+FixedSizePool::FixedSizePool(size_t objectSize, const std::string& name)
+    : name(demangle(name)),
+      // every block must hold the free list pointer and stay aligned for it
+      blockSize((std::max(objectSize, sizeof(void*)) + sizeof(void*) - 1)
+                / sizeof(void*) * sizeof(void*)),
+      generation(0), nextChunkBlocks(BATCH_SIZE), freeList(NULL),
+      freeBlocks(0), retiredAllocations(0), retiredDeallocations(0) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_key_create(&key, &FixedSizePool::detach);
+  pthread_mutex_lock(&registryMutex);
+  registry().push_back(this);
+  pthread_mutex_unlock(&registryMutex);
+}
+
+
+void FixedSizePool::attach(ThreadCache& cache) {
+  if (cache.pool == NULL) {
+    cache.pool = this;
+    cache.generation = generation;
+    pthread_setspecific(key, &cache);
+    pthread_mutex_lock(&mutex);
+    caches.push_back(&cache);
+    pthread_mutex_unlock(&mutex);
+  }
+  if (cache.generation != generation) {
+    // the blocks were freed by reset()
+    cache.head = NULL;
+    cache.size = 0;
+    cache.generation = generation;
+  }
+}
+
+
+void FixedSizePool::refill(ThreadCache& cache) {
+  attach(cache);
+  pthread_mutex_lock(&mutex);
+  while (freeBlocks < BATCH_SIZE) {
+    grow();
+  }
+  for (int i = 0; i < BATCH_SIZE; ++i) {
+    void* block = freeList;
+    freeList = next(block);
+    next(block) = cache.head;
+    cache.head = block;
+  }
+  freeBlocks -= BATCH_SIZE;
+  cache.size += BATCH_SIZE;
+  pthread_mutex_unlock(&mutex);
+}
+
+
+void FixedSizePool::releaseLocked(ThreadCache& cache, int count) {
+  for (int i = 0; i < count; ++i) {
+    void* block = cache.head;
+    cache.head = next(block);
+    next(block) = freeList;
+    freeList = block;
+  }
+  cache.size -= count;
+  freeBlocks += count;
+}
+
+
+void FixedSizePool::release(ThreadCache& cache, int count) {
+  pthread_mutex_lock(&mutex);
+  releaseLocked(cache, count);
+  pthread_mutex_unlock(&mutex);
+}
+
+
+void FixedSizePool::flush(ThreadCache& cache) {
+  if (cache.generation != generation) {
+    cache.head = NULL;
+    cache.size = 0;
+    return;
+  }
+  release(cache, cache.size);
+}
+
+
+void FixedSizePool::grow() {
+  size_t numBlocks = nextChunkBlocks;
+  char* chunk = new char[numBlocks * blockSize];
+  for (size_t i = numBlocks; i > 0; --i) {
+    void* block = chunk + (i - 1) * blockSize;
+    next(block) = freeList;
+    freeList = block;
+  }
+  chunks.push_back(std::make_pair(chunk, numBlocks));
+  freeBlocks += numBlocks;
+  nextChunkBlocks = std::min(2 * numBlocks, MAX_CHUNK_BLOCKS);
+}
+
+
+void FixedSizePool::detach(void* cachePtr) {
+  ThreadCache& cache = *static_cast<ThreadCache*>(cachePtr);
+  FixedSizePool& pool = *cache.pool;
+  pthread_mutex_lock(&pool.mutex);
+  if (cache.generation == pool.generation) {
+    pool.releaseLocked(cache, cache.size);
+  }
+  pool.retiredAllocations += cache.allocations;
+  pool.retiredDeallocations += cache.deallocations;
+  pool.caches.erase(std::find(pool.caches.begin(), pool.caches.end(),
+                              &cache));
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+
+void FixedSizePool::trim() {
+  ThreadCache* own = static_cast<ThreadCache*>(pthread_getspecific(key));
+  if (own != NULL) {
+    flush(*own);
+  }
+  pthread_mutex_lock(&mutex);
+  std::vector<char*> blocks;
+  blocks.reserve(freeBlocks);
+  for (void* block = freeList; block != NULL; block = next(block)) {
+    blocks.push_back(static_cast<char*>(block));
+  }
+  std::sort(blocks.begin(), blocks.end());
+  std::sort(chunks.begin(), chunks.end());
+
+  // keep the chunks with blocks in use and rebuild the free list from
+  // their free blocks
+  std::vector<std::pair<char*, size_t> > kept;
+  freeList = NULL;
+  freeBlocks = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    char* begin = chunks[i].first;
+    char* end = begin + chunks[i].second * blockSize;
+    std::vector<char*>::iterator first = std::lower_bound(blocks.begin(),
+                                                          blocks.end(), begin);
+    std::vector<char*>::iterator last = std::lower_bound(first, blocks.end(),
+                                                         end);
+    if ((size_t)(last - first) == chunks[i].second) {
+      delete[] begin;
+      continue;
+    }
+    kept.push_back(chunks[i]);
+    for (; first != last; ++first) {
+      next(*first) = freeList;
+      freeList = *first;
+      ++freeBlocks;
+    }
+  }
+  chunks.swap(kept);
+  if (chunks.empty()) {
+    nextChunkBlocks = BATCH_SIZE;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+
+bool FixedSizePool::reset() {
+  pthread_mutex_lock(&mutex);
+  unsigned long allocations = retiredAllocations;
+  unsigned long deallocations = retiredDeallocations;
+  for (size_t i = 0; i < caches.size(); ++i) {
+    allocations += caches[i]->allocations;
+    deallocations += caches[i]->deallocations;
+  }
+  if (allocations != deallocations) {
+    // objects are still in use
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    delete[] chunks[i].first;
+  }
+  chunks.clear();
+  freeList = NULL;
+  freeBlocks = 0;
+  nextChunkBlocks = BATCH_SIZE;
+  ++generation;
+  pthread_mutex_unlock(&mutex);
+  return true;
+}
+
+
+FixedSizePool::Statistics FixedSizePool::getStatistics() {
+  Statistics statistics;
+  statistics.name = name;
+  statistics.blockSize = blockSize;
+  pthread_mutex_lock(&mutex);
+  long live = retiredAllocations - retiredDeallocations;
+  long cached = 0;
+  for (size_t i = 0; i < caches.size(); ++i) {
+    live += caches[i]->allocations - caches[i]->deallocations;
+    if (caches[i]->generation == generation) {
+      cached += caches[i]->size;
+    }
+  }
+  statistics.liveObjects = live;
+  statistics.cachedBlocks = cached;
+  statistics.freeBlocks = freeBlocks;
+  statistics.bytesReserved = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    statistics.bytesReserved += chunks[i].second * blockSize;
+  }
+  pthread_mutex_unlock(&mutex);
+  return statistics;
+}
+
+
+void FixedSizePool::getAllStatistics(std::vector<Statistics>& statistics) {
+  pthread_mutex_lock(&registryMutex);
+  std::vector<FixedSizePool*> pools = registry();
+  pthread_mutex_unlock(&registryMutex);
+  for (size_t i = 0; i < pools.size(); ++i) {
+    statistics.push_back(pools[i]->getStatistics());
+  }
+}
+
+
+void FixedSizePool::trimAll() {
+  pthread_mutex_lock(&registryMutex);
+  std::vector<FixedSizePool*> pools = registry();
+  pthread_mutex_unlock(&registryMutex);
+  for (size_t i = 0; i < pools.size(); ++i) {
+    pools[i]->trim();
+  }
+}
+
+}} // namespace gatsby::libplump
@@ -20,28 +20,204 @@
 #ifndef POOL_H_
 #define POOL_H_
 
-#include <boost/pool/poolfwd.hpp>
-#include <boost/pool/pool.hpp>
+#include <cstddef>
+#include <utility>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <pthread.h>
+
+#include "libplump/utils.h"
 
 namespace gatsby { namespace libplump {
 
-template <class T>
-  class PoolObject {
-    public:
-      static void* operator new(size_t size) {
-        return memPool.malloc();
+/**
+ * Memory for objects of a single size, allocated in chunks from the system.
+ *
+ * Blocks are handed out from per-thread caches, so that allocating and 
+ * freeing objects usually touches neither a lock nor a shared cache line.
+ * A thread refills its cache with a batch of blocks from the shared free
+ * list (taking the lock once per batch) and returns a batch when it holds 
+ * too many; the cache of a thread is returned when it exits. Objects may be
+ * freed by a different thread than the one that allocated them.
+ *
+ * The caches are ThreadCache structures in thread-local storage owned by the
+ * caller (see PoolObject), which passes its own to allocate and deallocate.
+ *
+ * trim() gives chunks without live or cached objects back to the system,
+ * reset() frees all memory once all objects have been freed. Both should be
+ * called between runs, i.e. while no other thread uses the pool; blocks in
+ * the caches of other threads are not released.
+ *
+ * All pools are listed in a registry, so that the statistics of all of them
+ * can be inspected and they can all be trimmed at once.
+ */
+class FixedSizePool {
+  public:
+    /**
+     * The cache of one thread; must be zero-initialized (e.g. by being a
+     * __thread variable) before the first use.
+     */
+    struct ThreadCache {
+      void* head;
+      int size;
+      // generation of the pool the blocks belong to (see reset())
+      int generation;
+      unsigned long allocations;
+      unsigned long deallocations;
+      FixedSizePool* pool;
+    };
+
+    struct Statistics {
+      std::string name;
+      size_t blockSize;
+      // objects allocated and not yet freed
+      long liveObjects;
+      // free blocks in the caches of the threads
+      long cachedBlocks;
+      // blocks in the shared free list
+      long freeBlocks;
+      size_t bytesReserved;
+    };
+
+    /**
+     * Pools are never destroyed (see PoolObject), so there is no destructor
+     * that would free the chunks.
+     */
+    FixedSizePool(size_t objectSize, const std::string& name);
+
+    void* allocate(ThreadCache& cache) {
+      if (cache.head == NULL || cache.generation != generation) {
+        refill(cache);
       }
+      void* block = cache.head;
+      cache.head = next(block);
+      --cache.size;
+      ++cache.allocations;
+      return block;
+    }
 
-      static void operator delete(void *p) {
-        memPool.free(p);
+    void deallocate(ThreadCache& cache, void* block) {
+      if (cache.pool == NULL || cache.generation != generation) {
+        attach(cache);
+      }
+      next(block) = cache.head;
+      cache.head = block;
+      ++cache.deallocations;
+      if (++cache.size > 2 * BATCH_SIZE) {
+        release(cache, BATCH_SIZE);
       }
+    }
+
+    /**
+     * Return all blocks in the cache to the shared free list.
+     */
+    void flush(ThreadCache& cache);
+
+    /**
+     * Give the chunks whose blocks are all free back to the system, after 
+     * returning the cache of the calling thread.
+     */
+    void trim();
+
+    /**
+     * Free all memory of the pool and invalidate the caches of all threads.
+     * Returns false (and leaves the pool unchanged) if there are live
+     * objects.
+     */
+    bool reset();
+
+    Statistics getStatistics();
+
+    /**
+     * Append the statistics of all pools to statistics.
+     */
+    static void getAllStatistics(std::vector<Statistics>& statistics);
+
+    /**
+     * Trim all pools.
+     */
+    static void trimAll();
+
+  private:
+    static const int BATCH_SIZE = 64;
+    static const size_t MAX_CHUNK_BLOCKS = 1 << 16;
+
+    static void*& next(void* block) {
+      return *static_cast<void**>(block);
+    }
+
+    // register the cache of the calling thread and drop blocks of an earlier
+    // generation
+    void attach(ThreadCache& cache);
+
+    // move a batch of blocks from the shared free list into the cache
+    void refill(ThreadCache& cache);
+
+    // move count blocks from the cache to the shared free list; must hold 
+    // the mutex
+    void releaseLocked(ThreadCache& cache, int count);
+
+    void release(ThreadCache& cache, int count);
+
+    // allocate a new chunk and add its blocks to the free list; must hold the
+    // mutex
+    void grow();
+
+    // called when a thread with a registered cache exits
+    static void detach(void* cache);
+
+    const std::string name;
+    const size_t blockSize;
+    volatile int generation;
+    pthread_mutex_t mutex;
+    pthread_key_t key;
+
+    // start and number of blocks of each chunk
+    std::vector<std::pair<char*, size_t> > chunks;
+    size_t nextChunkBlocks;
+    void* freeList;
+    long freeBlocks;
+
+    // caches of the running threads, and the counts of exited threads
+    std::vector<ThreadCache*> caches;
+    unsigned long retiredAllocations, retiredDeallocations;
+
+    DISALLOW_COPY_AND_ASSIGN(FixedSizePool);
+};
+
+
+/**
+ * Base class for objects that are allocated from a per-type memory pool.
+ *
+ * Each type has its own FixedSizePool, with a cache per thread, so that
+ * several threads can create and destroy objects concurrently. The pool is
+ * created on first use and never destroyed, so that objects may still be
+ * freed during static destruction.
+ */
+template <class T>
+class PoolObject {
+  public:
+    static void* operator new(size_t size) {
+      return pool().allocate(cache);
+    }
+
+    static void operator delete(void* p) {
+      pool().deallocate(cache, p);
+    }
+
+    static FixedSizePool& pool() {
+      static FixedSizePool* pool = new FixedSizePool(sizeof(T), 
+                                                     typeid(T).name());
+      return *pool;
+    }
 
-    private:
-      static boost::pool<> memPool;
-  };
+  private:
+    static __thread FixedSizePool::ThreadCache cache;
+};
 
 template <class T>
-boost::pool<> PoolObject<T>::memPool(sizeof(T));
+__thread FixedSizePool::ThreadCache PoolObject<T>::cache;
 
 }} // namespace gatsby::libplump
 
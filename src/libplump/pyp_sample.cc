@@ -37,20 +37,21 @@ namespace gatsby { namespace libplump {
  * Sample a seating arrangement given the table creation times z.
  */
 std::vector<int> sample_crp_given_z(double d, std::vector<int>& z) {
+  gsl_rng* rng = get_rng();
   int t = z[z.size()-1] + 1;
   std::vector<int> arrangement(t,0);
   std::vector<double> probs(t,0);
   arrangement[0] = 1;
   for (int i = 1; i < (int)z.size(); ++i) {
-    probs.assign(t,0);
     if (z[i] == z[i-1] + 1) {
-      probs[z[i]] = 1;
+      // new table
+      ++arrangement[z[i]];
     } else {
       for(int j=0;j<z[i]+1;++j) {
-        probs[j] = (arrangement[j] - d)/(i - (z[i]+1)*d);
+        probs[j] = arrangement[j] - d;
       }
+      ++arrangement[sample_unnormalized_pdf(rng, &probs[0], z[i] + 1)];
     }
-    ++arrangement[sample_unnormalized_pdf(probs,z[i])];
   }
 
   assert(sum(arrangement) == z.size() && (int)arrangement.size() == t);
@@ -97,19 +98,20 @@ std::vector<int> sample_crp_z_fb(double d, int c, int t) {
   }
 
   // backward sampling
+  gsl_rng* rng = get_rng();
   std::vector<int> z(c,0);
   int cur = t-1;
   z[c-1] = t - 1;
-  d_vec probs(t,0);
+  double probs[2];
   for(index i = c - 2; i >= 0; --i) {
-    probs[cur] = (i+1-(cur+1)*d) * grid[cur][i];
-    probs[cur-1] = grid[cur-1][i];
-    cur = sample_unnormalized_pdf(probs);
+    // stay at cur or move to cur-1
+    probs[0] = grid[cur-1][i];
+    probs[1] = (i+1-(cur+1)*d) * grid[cur][i];
+    cur += sample_unnormalized_pdf(rng, probs, 2) - 1;
     z[i] = cur;
     if (cur == 0) {
       break;
     }
-    probs.assign(t,0);
   }
 
   return z;
@@ -159,15 +161,16 @@ std::vector<int> sample_crp_z_bf(double d, int c, int t) {
 
 
   // forward sampling
+  gsl_rng* rng = get_rng();
   std::vector<int> z(c,0);
   int cur = 0;
   z[c-1] = t - 1;
-  d_vec probs(t,0);
+  double probs[2];
   for(index i = 1; i < c - 1; ++i) {
-    probs[cur] = (i-(cur+1)*d) * grid[cur][i];
-    probs[cur+1] = grid[cur+1][i];
-    //std::cout << iterableToString(probs) << std::endl;
-    cur = sample_unnormalized_pdf(probs);
+    // stay at cur or move to cur+1
+    probs[0] = (i-(cur+1)*d) * grid[cur][i];
+    probs[1] = grid[cur+1][i];
+    cur += sample_unnormalized_pdf(rng, probs, 2);
     z[i] = cur;
     if (cur == t - 1) {
       // all remaining customers must join existing tables
@@ -176,12 +179,60 @@ std::vector<int> sample_crp_z_bf(double d, int c, int t) {
       }
       break;
     }
-    probs.assign(t,0);
   }
   return z;
 }
 
 std::vector<int> sample_crp_c(double d, double a, int c) {
+  std::vector<int> arrangement, customerTables;
+  sample_crp_c(d, a, c, arrangement, customerTables);
+  return arrangement;
+}
+
+
+void sample_crp_c(double d, double a, int c, std::vector<int>& arrangement,
+                  std::vector<int>& customerTables) {
+  if (c == 0) {
+    // no customers, no tables
+    arrangement.clear();
+    customerTables.clear();
+    return;
+  }
+  gsl_rng* rng = get_rng();
+  arrangement.assign(1, 1); // first customer at first table
+  customerTables.resize(c);
+  customerTables[0] = 0;
+  for (int i = 1; i < c; ++i) {
+    int t = arrangement.size();
+    if (coin(rng, (a + t*d)/(a + i))) {
+      customerTables[i] = t;
+      arrangement.push_back(1); // new table
+    } else {
+      int table;
+      do {
+        table = customerTables[uniform_int(rng, i)];
+      } while (!coin(rng, 1 - d/arrangement[table]));
+      customerTables[i] = table;
+      ++arrangement[table];
+    }
+  }
+}
+
+
+int sample_crp_c_tables(double d, double a, int c) {
+  gsl_rng* rng = get_rng();
+  int t = 1;
+  for (int i = 1; i < c; ++i) {
+    if (coin(rng, (a + t*d)/(a + i))) {
+      ++t;
+    }
+  }
+  return t;
+}
+
+
+std::vector<int> sample_crp_c_pdf(double d, double a, int c) {
+  gsl_rng* rng = get_rng();
   d_vec probs(c,0);
   std::vector<int> arrangement;
   arrangement.push_back(1); // first customer at first table
@@ -190,7 +241,8 @@ std::vector<int> sample_crp_c(double d, double a, int c) {
       probs[j] = arrangement[j] - d;
     }
     probs[arrangement.size()] = a + arrangement.size()*d;
-    int sample = sample_unnormalized_pdf(probs,arrangement.size());
+    int sample = sample_unnormalized_pdf(rng, &probs[0], 
+                                         arrangement.size() + 1);
     if (sample == (int)arrangement.size()) {
       arrangement.push_back(1); // new table
     } else {
@@ -66,9 +66,45 @@ inline std::vector<int> sample_crp_ct(double d, int c, int t) {
  *
  * @returns A vector that contains an element for each table in the arrangement
  *          whose value is the number of customers at that table.
+ *
+ * Runtime: expected O(c), see below.
  */
 std::vector<int> sample_crp_c(double d, double a, int c);
 
+/**
+ * Same as above, but writes the arrangement into arrangement and uses 
+ * customerTables as scratch space, so that repeated calls need not allocate.
+ *
+ * Each customer first decides whether to open a new table; a customer that
+ * joins one of the i existing customers' tables picks the table of a 
+ * uniformly chosen earlier customer (probability n_k/i) and accepts it with 
+ * probability (n_k - d)/n_k, which gives the CRP probabilities 
+ * (n_k - d)/(i - t d). The expected number of proposals per customer is at 
+ * most (a + i)/(i - t d) times the probability of joining a table, i.e. 
+ * O(1) overall.
+ *
+ * For c = 0 the arrangement is empty.
+ */
+void sample_crp_c(double d, double a, int c, std::vector<int>& arrangement,
+                  std::vector<int>& customerTables);
+
+/**
+ * Sample the number of tables in a seating arrangement of c customers from a
+ * CRP with discount d and concentration parameter a, without sampling the
+ * arrangement itself.
+ *
+ * Runtime: O(c)
+ */
+int sample_crp_c_tables(double d, double a, int c);
+
+/**
+ * Reference implementation of sample_crp_c that samples every customer from
+ * the full CRP predictive distribution.
+ *
+ * Runtime: O(c x t)
+ */
+std::vector<int> sample_crp_c_pdf(double d, double a, int c);
+
 }} // namespace gatsby::libplump
 
 #endif
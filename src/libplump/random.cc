@@ -24,6 +24,95 @@
 namespace gatsby { namespace libplump {
 
 gsl_rng* global_rng = 0;
+__thread gsl_rng* thread_rng = 0;
+
+
+namespace {
+
+// SplitMix64 finalizer
+inline uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+const uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15ULL;
+
+struct CounterState {
+  uint64_t key;
+  uint64_t increment; // odd
+  uint64_t counter;
+};
+
+void counter_set(void* vstate, unsigned long seed) {
+  CounterState* state = (CounterState*)vstate;
+  state->key = mix64((uint64_t)seed);
+  state->increment = mix64((uint64_t)seed + GOLDEN_GAMMA) | 1;
+  state->counter = 0;
+}
+
+inline uint64_t counter_next(CounterState* state) {
+  ++state->counter;
+  return mix64(state->key + state->counter * state->increment);
+}
+
+unsigned long counter_get(void* vstate) {
+  return (unsigned long)(counter_next((CounterState*)vstate) >> 32);
+}
+
+double counter_get_double(void* vstate) {
+  // 53 random bits
+  return (counter_next((CounterState*)vstate) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+const gsl_rng_type counter_type = {
+  "counter",            // name
+  0xffffffffUL,         // RAND_MAX
+  0,                    // RAND_MIN
+  sizeof(CounterState),
+  &counter_set,
+  &counter_get,
+  &counter_get_double
+};
+
+} // namespace
+
+
+const gsl_rng_type* rng_counter = &counter_type;
+
+
+RNG::RNG(unsigned long seed, const gsl_rng_type* type)
+    : rng(gsl_rng_alloc(type)), seed(seed) {
+  gsl_rng_set(rng, seed);
+}
+
+
+RNG::~RNG() {
+  gsl_rng_free(rng);
+}
+
+
+RNG* RNG::stream(unsigned long id) const {
+  return new RNG((unsigned long)mix64(mix64((uint64_t)seed) 
+                                      + ((uint64_t)id + 1) * GOLDEN_GAMMA),
+                 rng->type);
+}
+
+
+RNGBinding::RNGBinding(RNG& rng) : previous(thread_rng) {
+  thread_rng = rng.get();
+}
+
+
+RNGBinding::RNGBinding(gsl_rng* rng) : previous(thread_rng) {
+  thread_rng = rng;
+}
+
+
+RNGBinding::~RNGBinding() {
+  thread_rng = previous;
+}
+
 
 void init_rng() {
        const gsl_rng_type * T;
@@ -40,4 +129,49 @@ void free_rng() {
        gsl_rng_free (global_rng);
 }
 
+
+void AliasTable::init(const double* pdf, int size) {
+  assert(size > 0);
+  double total = 0;
+  for (int i = 0; i < size; ++i) {
+    assert(pdf[i] >= 0);
+    total += pdf[i];
+  }
+  assert(total > 0);
+
+  keep.resize(size);
+  alias.resize(size);
+  small.clear();
+  large.clear();
+  for (int i = 0; i < size; ++i) {
+    // scale so that the average bucket has probability 1
+    keep[i] = pdf[i] * size / total;
+    alias[i] = i;
+    if (keep[i] < 1) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+  // fill up each small bucket with probability from a large one
+  while (!small.empty() && !large.empty()) {
+    int s = small.back();
+    small.pop_back();
+    int l = large.back();
+    alias[s] = l;
+    keep[l] -= 1 - keep[s];
+    if (keep[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // what remains is 1 up to rounding
+  for (size_t i = 0; i < small.size(); ++i) {
+    keep[small[i]] = 1;
+  }
+  for (size_t i = 0; i < large.size(); ++i) {
+    keep[large[i]] = 1;
+  }
+}
+
 }}
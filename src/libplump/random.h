@@ -22,6 +22,7 @@
 
 #include <gsl/gsl_rng.h>
 #include <vector>
+#include <stdint.h>
 #include <cassert>
 #include <algorithm> // for lower_bound
 // only for debugging
@@ -34,10 +35,85 @@ namespace gatsby { namespace libplump {
  * RANDOM NUMBER GENERATION AND SAMPLING BASED ON GSL
  ******************************************************************************/
 
+/**
+ * GSL RNG type of a counter-based generator.
+ *
+ * The i-th number of a stream is a fixed function of the seed and i: the
+ * counter is multiplied by an odd increment and added to a key (both
+ * derived from the seed) and the result is scrambled using the SplitMix64
+ * finalizer. This makes it cheap to set up many independent streams, e.g.
+ * one per thread, chain or subtree, that are all derived from one seed.
+ */
+extern const gsl_rng_type* rng_counter;
+
+
+/**
+ * A stream of random numbers; wraps (and owns) a GSL RNG.
+ *
+ * An RNG can either be passed to the sampling functions explicitly or be
+ * bound to the calling thread using RNGBinding, in which case it is used by
+ * every sampling function called by that thread without an explicit RNG,
+ * including those called by the restaurants and the samplers in
+ * pyp_sample.h.
+ */
+class RNG {
+  public:
+    /**
+     * Create a new RNG of the given type seeded with seed.
+     */
+    explicit RNG(unsigned long seed, const gsl_rng_type* type = rng_counter);
+
+    ~RNG();
+
+    /**
+     * Create a new, independent stream of the same type whose seed is
+     * derived from the seed of this RNG and id. Does not draw from this RNG,
+     * so that the same stream is obtained for the same id regardless of how
+     * this RNG has been used. The caller owns the returned RNG.
+     */
+    RNG* stream(unsigned long id) const;
+
+    unsigned long getSeed() const {
+      return seed;
+    }
+
+    gsl_rng* get() const {
+      return rng;
+    }
+
+  private:
+    gsl_rng* rng;
+    unsigned long seed;
+
+    DISALLOW_COPY_AND_ASSIGN(RNG);
+};
+
+
+/**
+ * Binds an RNG to the calling thread for the lifetime of the object and then
+ * restores the previous binding. The RNG is not owned.
+ *
+ * The global RNG must not be used by more than one thread at a time, so
+ * threads that sample concurrently each need their own binding.
+ */
+class RNGBinding {
+  public:
+    explicit RNGBinding(RNG& rng);
+    explicit RNGBinding(gsl_rng* rng);
+    ~RNGBinding();
+
+  private:
+    gsl_rng* previous;
+
+    DISALLOW_COPY_AND_ASSIGN(RNGBinding);
+};
+
+
 /**
  * Initialize global RNG.
  *
- * This function has to be called before using any of the sampling functions.
+ * This function has to be called before using any of the sampling functions
+ * without an RNG bound to the calling thread.
  *
  * The RNG type and seed are determined by the environment variables
  * GSL_RNG_TYPE and GSL_RNG_SEED.
@@ -49,15 +125,23 @@ void init_rng();
  */
 void free_rng();
 
+/**
+ * Returns the RNG that should be used by the calling thread: the RNG bound
+ * to the thread if there is one, and the global RNG otherwise.
+ */
+gsl_rng* get_rng();
+
 /**
  * Returns true with probability true_prob.
  */
 bool coin(double true_prob);
+bool coin(gsl_rng* rng, double true_prob);
 
 /**
  * Returns a uniform integer between 0 and max-1.
  */
 long int uniform_int(long int max);
+long int uniform_int(gsl_rng* rng, long int max);
 
 /**
  * Sample from a discrete distribution on 0,...,MAX with the given PDF.
@@ -67,16 +151,120 @@ long int uniform_int(long int max);
  * i.e. pdf is normalized so that the sum of all elements up to and including
  * element end_pos is 1.
  *  
- * Algorithm:
- *   1) Compute CDF; normalizing constant Z = CDF[end_pos]
- *   2) Sample z ~ Uniform(0,Z)
- *   3) find the smallest element x of CDF that is larger than i using binary
- *      search
- *   4) return x
+ * Uses the two-pass sampler below on the vector's elements, without copying.
+ *
+ * Complexity: O(end_pos)
+ */
+int sample_unnormalized_pdf(const std::vector<double>& pdf, int end_pos = 0);
+int sample_unnormalized_pdf(gsl_rng* rng, const std::vector<double>& pdf,
+                            int end_pos = 0);
+
+/**
+ * Sample from a discrete distribution on 0,...,size-1 with the unnormalized
+ * PDF pdf[0],...,pdf[size-1], working on the caller's buffer.
+ *
+ * Makes two passes over pdf, one to compute the normalizing constant and one
+ * to find the sample, instead of storing the CDF.
+ *
+ * Complexity: O(size), no allocations
+ */
+template <typename T>
+int sample_unnormalized_pdf(gsl_rng* rng, const T* pdf, int size);
+
+template <typename T>
+int sample_unnormalized_pdf(const T* pdf, int size);
+
+/**
+ * Same as above, but for a known normalizing constant total, which saves the
+ * first pass; best for small supports, or when the sum is known anyway (e.g.
+ * table sizes that sum to the number of customers). If total is larger than
+ * the sum of the elements of pdf, size is returned with the remaining 
+ * probability.
+ *
+ * Complexity: O(size) (expected O(position of the sample))
+ */
+template <typename T>
+int sample_unnormalized_pdf(gsl_rng* rng, const T* pdf, int size, 
+                            double total);
+
+/**
+ * Sample from a discrete distribution on 0,...,size-1 given its unnormalized
+ * CDF (cdf[size-1] is the normalizing constant), using binary search.
+ * Useful to draw a few samples from the same distribution without the setup
+ * cost of an AliasTable.
  *
- * Complexity: O(log MAX)
+ * Complexity: O(log size)
  */
-int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos = 0);
+int sample_unnormalized_cdf(gsl_rng* rng, const double* cdf, int size);
+
+/**
+ * Alias table (Walker's method, with Vose's construction) for drawing many
+ * samples from the same discrete distribution in constant time each.
+ *
+ * Construction takes O(size); the buffers are kept when the table is 
+ * rebuilt with init(), so that it can be reused without allocating.
+ */
+class AliasTable {
+  public:
+    AliasTable() {}
+
+    AliasTable(const double* pdf, int size) {
+      init(pdf, size);
+    }
+
+    /**
+     * Build the table for the unnormalized PDF pdf[0],...,pdf[size-1].
+     */
+    void init(const double* pdf, int size);
+
+    int size() const {
+      return (int)alias.size();
+    }
+
+    int sample(gsl_rng* rng) const;
+
+    int sample() const;
+
+  private:
+    // probability of keeping each bucket and the alternative outcome
+    std::vector<double> keep;
+    std::vector<int> alias;
+    // work lists for the construction
+    std::vector<int> small;
+    std::vector<int> large;
+};
+
+/**
+ * Buffer for the unnormalized probabilities passed to the samplers above,
+ * which stays on the stack for up to N elements so that sampling among a 
+ * small number of outcomes does not allocate.
+ */
+template <int N = 64>
+class ProbabilityBuffer {
+  public:
+    explicit ProbabilityBuffer(int size)
+        : heap((size > N) ? new double[size] : NULL), 
+          data((size > N) ? heap : stack) {}
+
+    ~ProbabilityBuffer() {
+      delete[] heap;
+    }
+
+    double& operator[](int i) {
+      return data[i];
+    }
+
+    const double* get() const {
+      return data;
+    }
+
+  private:
+    double stack[N];
+    double* heap;
+    double* data;
+
+    DISALLOW_COPY_AND_ASSIGN(ProbabilityBuffer);
+};
 
 
 
@@ -86,70 +274,117 @@ int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos = 0);
 ////////////////////////////////////////////////////////////////////////////////
 
 extern gsl_rng* global_rng;
+extern __thread gsl_rng* thread_rng;
+
+inline gsl_rng* get_rng() {
+    return (thread_rng != NULL) ? thread_rng : global_rng;
+}
 
 /**
  * Returns true with probability true_prob.
  */
+inline bool coin(gsl_rng* rng, double true_prob) {
+    return (true_prob>gsl_rng_uniform(rng));
+}
+
 inline bool coin(double true_prob) {
-    return (true_prob>gsl_rng_uniform(global_rng));
+    return coin(get_rng(), true_prob);
 }
 
 /**
  * Returns a uniform integer between 0 and max-1.
  */
+inline long int uniform_int(gsl_rng* rng, long int max) {
+    return gsl_rng_uniform_int(rng, max);
+}
+
 inline long int uniform_int(long int max) {
-    return gsl_rng_uniform_int(global_rng, max);
+    return uniform_int(get_rng(), max);
 }
 
-/**
- * Sample from a discrete distribution on 0,...,MAX with the given PDF.
- *
- * The probability if returning x for x \in 0,...,MAX is given by 
- *   pdf[x] / (\sum_{i=0,...,end_pos} pdf[i])
- * i.e. pdf is normalized so that the sum of all elements up to and including
- * element end_pos is 1.
- *  
- * Algorithm:
- *   1) Compute CDF; normalizing constant Z = CDF[end_pos]
- *   2) Sample z ~ Uniform(0,Z)
- *   3) find the smallest element x of CDF that is larger than i using binary
- *      search
- *   4) return x
- *
- * Complexity: O(log MAX)
- */
-inline int sample_unnormalized_pdf(std::vector<double> pdf, int end_pos) {
+inline int sample_unnormalized_pdf(gsl_rng* rng, 
+                                   const std::vector<double>& pdf,
+                                   int end_pos) {
     assert(pdf.size() > 0);
-    assert(end_pos < pdf.size());
+    assert(end_pos < (int)pdf.size());
     assert(end_pos >= 0);
 
     // if end_pos == 0, use entire vector
     if (end_pos == 0) {
         end_pos = pdf.size()-1;
     }
-    
-    // compute CDF (inplace)
-    for (int i = 0; i < end_pos; ++i) {
-        assert(pdf[i] >= 0);
-        pdf[i+1] += pdf[i];
+    return sample_unnormalized_pdf(rng, &pdf[0], end_pos + 1);
+}
+
+inline int sample_unnormalized_pdf(const std::vector<double>& pdf, 
+                                   int end_pos) {
+    return sample_unnormalized_pdf(get_rng(), pdf, end_pos);
+}
+
+template <typename T>
+inline int sample_unnormalized_pdf(gsl_rng* rng, const T* pdf, int size) {
+    assert(size > 0);
+    // four independent partial sums, so that the additions can overlap
+    double total0 = 0, total1 = 0, total2 = 0, total3 = 0;
+    int i = 0;
+    for (; i + 3 < size; i += 4) {
+        total0 += pdf[i];
+        total1 += pdf[i+1];
+        total2 += pdf[i+2];
+        total3 += pdf[i+3];
+    }
+    for (; i < size; ++i) {
+        total0 += pdf[i];
+    }
+    double total = (total0 + total1) + (total2 + total3);
+    assert(total > 0);
+    int x = sample_unnormalized_pdf(rng, pdf, size, total);
+    if (x == size) {
+        // the sum in the scan was rounded differently and ended just below z
+        do {
+            --x;
+        } while (pdf[x] == 0);
     }
+    return x;
+}
 
-    assert(pdf[end_pos] > 0);
+template <typename T>
+inline int sample_unnormalized_pdf(const T* pdf, int size) {
+    return sample_unnormalized_pdf(get_rng(), pdf, size);
+}
 
-    // sample pos ~ Unigorm(0,Z)
-    double z = gsl_rng_uniform_pos(global_rng)*pdf[end_pos];
+template <typename T>
+inline int sample_unnormalized_pdf(gsl_rng* rng, const T* pdf, int size, 
+                                   double total) {
+    // sample pos ~ Uniform(0,Z) and return the first element whose 
+    // cumulative probability is at least z -- the element that 
+    // std::lower_bound would find in the CDF
+    double z = gsl_rng_uniform_pos(rng)*total;
+    double cumulative = 0;
+    for (int i = 0; i < size; ++i) {
+        cumulative += pdf[i];
+        if (z <= cumulative) {
+            assert(pdf[i] > 0);
+            return i;
+        }
+    }
+    return size;
+}
 
-    assert((z >= 0) && (z <= pdf[end_pos]));
-    
-    // Perform binary search for z using std::lower_bound.
-    // lower_bound(begin, end, x) returns the first element within [begin,end)
-    // that is equal or larger than x.
-    int x = std::lower_bound(pdf.begin(), pdf.begin() + end_pos + 1, z)
-         - pdf.begin();
+inline int sample_unnormalized_cdf(gsl_rng* rng, const double* cdf, 
+                                   int size) {
+    assert(size > 0 && cdf[size-1] > 0);
+    double z = gsl_rng_uniform_pos(rng)*cdf[size-1];
+    return std::lower_bound(cdf, cdf + size, z) - cdf;
+}
 
-    assert(x == 0 || pdf[x-1] != pdf[x]);
-    return x;
+inline int AliasTable::sample(gsl_rng* rng) const {
+    int bucket = uniform_int(rng, alias.size());
+    return (gsl_rng_uniform(rng) < keep[bucket]) ? bucket : alias[bucket];
+}
 
+inline int AliasTable::sample() const {
+    return sample(get_rng());
 }
 
 } } // namespace gatsby::libplump
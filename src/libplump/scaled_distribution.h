@@ -0,0 +1,116 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCALED_DISTRIBUTION_H_
+#define SCALED_DISTRIBUTION_H_
+
+#include <vector>
+#include "libplump/config.h"
+#include "libplump/utils.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * A dense vector of probabilities over all types, used to compute an entire
+ * predictive distribution in a single pass along a path through the tree.
+ *
+ * In every restaurant the predictive probability of a type that is not
+ * present in the restaurant is the probability in the parent times a
+ * factor common to all such types, i.e. going from a node to its child
+ * multiplies all probabilities by the same factor and then changes the
+ * probabilities of the types present in the child. The common factor is
+ * therefore kept separately (p[w] = scale * values[w]), so that the cost of
+ * going down one level is proportional to the number of types in the
+ * restaurant rather than to the number of types overall.
+ *
+ * Optionally, a mixture of the distributions at different levels can be
+ * accumulated; adding a component costs O(number of types).
+ */
+class ScaledDistribution {
+  public:
+    ScaledDistribution() : values(), mixture(), scale(1) {}
+
+    /**
+     * Set the probabilities of all numTypes types to p and clear the
+     * mixture.
+     */
+    void reset(int numTypes, double p) {
+      values.assign(numTypes, p);
+      mixture.assign(numTypes, 0);
+      scale = 1;
+    }
+
+    double get(e_type type) const {
+      return scale * values[type];
+    }
+
+    void set(e_type type, double p) {
+      values[type] = p / scale;
+    }
+
+    /**
+     * Multiply all probabilities by factor (which must be >= 0).
+     */
+    void multiply(double factor) {
+      scale *= factor;
+      if (scale < 1e-100) {
+        // keep values from overflowing (and handle factor == 0)
+        for (size_t i = 0; i < values.size(); ++i) {
+          values[i] *= scale;
+        }
+        scale = 1;
+      }
+    }
+
+    /**
+     * Add weight times the current distribution to the mixture.
+     */
+    void addToMixture(double weight) {
+      double factor = weight * scale;
+      for (size_t i = 0; i < values.size(); ++i) {
+        mixture[i] += factor * values[i];
+      }
+    }
+
+    /**
+     * Write the current distribution into out.
+     */
+    void getDistribution(d_vec& out) const {
+      out.resize(values.size());
+      for (size_t i = 0; i < values.size(); ++i) {
+        out[i] = scale * values[i];
+      }
+    }
+
+    /**
+     * Write the mixture into out.
+     */
+    void getMixture(d_vec& out) const {
+      out.assign(mixture.begin(), mixture.end());
+    }
+
+  private:
+    d_vec values;
+    d_vec mixture;
+    double scale;
+};
+
+}} // namespace gatsby::libplump
+
+#endif
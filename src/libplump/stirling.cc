@@ -197,6 +197,204 @@ void log_gen_stirling_table_extend(double d, int c, d_vec_vec& table) {
 }
 
 
+////////////////////////// stirling_ratio_table ///////////////////////////////
+stirling_ratio_table::stirling_ratio_table(double d, int c) 
+    : d(d), c_max(1), q(1, 0.0) {
+    // the single row for c = 1 is q(1,1) = S_d(1,0)/S_d(1,1) = 0
+    extend(c);
+}
+
+
+void stirling_ratio_table::extend(int c) {
+    if (c <= c_max) {
+        return;
+    }
+    q.resize(row(c + 1));
+    for (int cur_c = c_max + 1; cur_c <= c; ++cur_c) {
+        nextRow(d, cur_c, &q[row(cur_c - 1)], &q[row(cur_c)]);
+    }
+    c_max = c;
+}
+
+
+void stirling_ratio_table::nextRow(double d, int c, const double* prev, 
+                                   double* cur) {
+    // q(c,1) = S_d(c,0)/S_d(c,1) = 0
+    cur[0] = 0;
+    for (int t = 2; t < c; ++t) {
+        cur[t - 1] = (prev[t - 2] + (c - 1 - (t - 1) * d)) * prev[t - 1]
+                     / (prev[t - 1] + (c - 1 - t * d));
+    }
+    // q(c,c) = S_d(c,c-1) = binom(c,2) (1-d)
+    cur[c - 1] = prev[c - 2] + (c - 1) * (1 - d);
+}
+
+
+double stirling_ratio_table::logStirling(int c, int t) const {
+    assert(t >= 0 && t <= c && c <= c_max);
+    if (t == 0) {
+        return (c == 0) ? 0 : -INFINITY;
+    }
+    // S_d(c,c) = 1 and S_d(c,s-1) = q(c,s) S_d(c,s)
+    double result = 0;
+    for (int s = t + 1; s <= c; ++s) {
+        result += log(q[row(c) + s - 1]);
+    }
+    return result;
+}
+
+
+bool log_gen_stirling_sum(double d, int c, int t, double& result) {
+    const int max_terms = 64;
+    // the terms first grow by factors of about t c^-d, so the cancellation
+    // is too large anyway if this is big
+    if (t * pow(c, -d) > 16) {
+        return false;
+    }
+    double log_terms[max_terms];
+    double signs[max_terms];
+    int n = 0;
+    double max_log = -INFINITY;
+    double log_choose = 0; // log binom(t,k)
+    for (int k = 1; k <= t; ++k) {
+        if (k > max_terms) {
+            return false;
+        }
+        log_choose += log((double)(t - k + 1) / k);
+        double x = -d * k;
+        if (x == floor(x)) {
+            // 1/Gamma(-dk) is zero
+            continue;
+        }
+        gsl_sf_result log_gamma;
+        double sign;
+        gsl_sf_lngamma_sgn_e(x, &log_gamma, &sign);
+        log_terms[n] = log_choose + gsl_sf_lngamma(c - d * k) - log_gamma.val;
+        signs[n] = (k % 2 == 0) ? sign : -sign;
+        max_log = std::max(max_log, log_terms[n]);
+        ++n;
+        if (log_terms[n - 1] < max_log - 40) {
+            // the remaining terms are negligible
+            break;
+        }
+    }
+    double sum = 0, abs_sum = 0;
+    for (int i = 0; i < n; ++i) {
+        double term = exp(log_terms[i] - max_log);
+        sum += signs[i] * term;
+        abs_sum += term;
+    }
+    if (sum <= 0 || abs_sum > 1e9 * sum) {
+        return false;
+    }
+    result = log(sum) + max_log - t * log(d) - gsl_sf_lngamma(t + 1);
+    return true;
+}
+
+
+namespace {
+
+// With x = 1 - exp(-u) and A(x) = 1 - (1-x)^d, the saddle point of 
+// A(x)^t / x^c solves h(u) = x A'(x) / A(x) = c/t; h increases from 1 to 
+// infinity on u in (0, infinity).
+double log_saddle_h(double d, double u) {
+    return log(d) + (1 - d) * u + log(-expm1(-u)) - log(-expm1(-d * u));
+}
+
+// derivative of log_saddle_h with respect to u
+double log_saddle_h_prime(double d, double u) {
+    return (1 - d) + 1 / expm1(u) - d / expm1(d * u);
+}
+
+} // namespace
+
+
+double log_gen_stirling_saddle_point(double d, int c, int t) {
+    assert(t >= 1 && t <= c);
+    if (t == c) {
+        return 0;
+    }
+    if (t == c - 1) {
+        // exact, and avoids the cancellation for u close to 0
+        return log(0.5 * c * (c - 1) * (1 - d));
+    }
+
+    // safeguarded Newton iterations for the saddle point
+    double target = log((double)c / t);
+    double lo = 0, hi = std::max(1.0, (target - log(d)) / (1 - d) + 1);
+    while (log_saddle_h(d, hi) < target) {
+        hi *= 2;
+    }
+    double u = (lo + hi) / 2;
+    for (int i = 0; i < 100; ++i) {
+        double f = log_saddle_h(d, u) - target;
+        if (f < 0) {
+            lo = u;
+        } else {
+            hi = u;
+        }
+        double next = u - f / log_saddle_h_prime(d, u);
+        if (!(next > lo && next < hi)) {
+            next = (lo + hi) / 2;
+        }
+        bool converged = fabs(next - u) < 1e-12 * std::max(1.0, u);
+        u = next;
+        if (converged) {
+            break;
+        }
+    }
+
+    double log_x = log(-expm1(-u));
+    double log_a = log(-expm1(-d * u));
+    // q = x/(1-x) and g = (1-x)^d / A(x); the derivatives of log A with 
+    // respect to log x are expressed in terms of r = 1/q and g, which stay 
+    // bounded, and powers of q, which may not be representable
+    double log_q = u + log_x;
+    double log_g = -d * u - log_a;
+    double r = exp(-log_q);
+    double g = exp(log_g);
+    double m = 1 + r - d * (1 + g);
+    double m1 = (1 + r) * (1 - d * (1 + g)) + d * d * g * (1 + g);
+    double m2 = (1 + r) * (2 + r) 
+                - d * ((1 + r) * (2 + r) * (1 + g) - d * (1 + r) * g * (1 + g))
+                + d * d * (2 * (1 + r) * g * (1 + g) 
+                           - d * g * (1 + g) * (1 + 2 * g));
+    // second cumulant of the tilted distribution, and the standardized
+    // third and fourth cumulants (squared and not)
+    double log_k2 = log(t * d) + 2 * log_q + log_g + log(m);
+    double lambda3_sq = (m * m + m1) * (m * m + m1) / (m * m * m * d * g * t);
+    double lambda4 = (m * m * m + 3 * m * m1 + m2) / (d * g * m * m * t);
+    // the correction is clamped where the expansion is not valid anyway, 
+    // but continuously so that the errors still cancel in ratios
+    double correction = std::max(-0.5, std::min(0.5, 
+        lambda4 / 8 - 5 * lambda3_sq / 24));
+
+    return gsl_sf_lngamma(c + 1) - t * log(d) - gsl_sf_lngamma(t + 1) 
+           + t * log_a - c * log_x - 0.5 * (log(2 * M_PI) + log_k2) 
+           + log1p(correction);
+}
+
+
+double gen_stirling_ratio_approx(double d, int c, int t) {
+    assert(t >= 1 && t <= c);
+    if (t == 1) {
+        // S_d(c-1,0) is zero unless c = 1
+        return (c == 1) ? 1 : 0;
+    }
+    if (t == c) {
+        return 1;
+    }
+    double numerator, denominator;
+    if (!log_gen_stirling_sum(d, c - 1, t - 1, numerator) 
+        || !log_gen_stirling_sum(d, c, t, denominator)) {
+        // use the same method for both so that the errors cancel
+        numerator = log_gen_stirling_saddle_point(d, c - 1, t - 1);
+        denominator = log_gen_stirling_saddle_point(d, c, t);
+    }
+    return exp(numerator - denominator);
+}
+
+
 ////////////////////////// stirling_generator_recompute_log ///////////////////
 stirling_generator_recompute_log::stirling_generator_recompute_log(double d, 
                                                                    int c,
@@ -290,17 +488,139 @@ std::string stirling_generator_fast_log::statsToString() {
 }
 
 
-////////////////////////// stirling_generator_full_log ////////////////////////
-stirling_generator_full_log::stirling_generator_full_log(double d, int c, int t) : d(d) {
-    // generate the smallest possible table for a start
-    // TODO: do something more clever
-   table = log_gen_stirling_table(d,2);
-   c_max = 2;
-   num_construct++;
+////////////////////////// stirling_table_cache ///////////////////////////////
+stirling_table_cache::stirling_table_cache()
+    : mutex(), tables(), maxCells(1 << 24), maxTables(1 << 16), num_cells(0),
+      clock(0), num_ratio_calls(0), num_approximations(0), num_lookups(0),
+      num_hits(0), num_misses(0), num_evictions(0), num_uncached(0), 
+      global_c_max(0) {}
+
+
+stirling_table_cache& stirling_table_cache::instance() {
+    static stirling_table_cache cache;
+    return cache;
+}
+
+
+stirling_table_cache::table_ptr stirling_table_cache::get(double d, int c) {
+    table_ptr old;
+    int old_c_max = 0;
+    {
+        ScopedLock lock(mutex);
+        ++num_lookups;
+        entry_map::iterator it = tables.find(d);
+        if (it != tables.end()) {
+            it->second.last_use = ++clock;
+            if (it->second.c_max >= c) {
+                ++num_hits;
+                return it->second.table;
+            }
+            old = it->second.table;
+            old_c_max = it->second.c_max;
+        }
+        ++num_misses;
+    }
+
+    // extend a copy without holding the lock
+    int c_max = std::max(c, std::max(32, old_c_max + old_c_max / 8));
+    stirling_ratio_table* table;
+    if (old) {
+        table = new stirling_ratio_table(*old);
+        table->extend(c_max);
+    } else {
+        table = new stirling_ratio_table(d, c_max);
+    }
+    size_t cells = table->size();
+    table_ptr result(table);
+
+    ScopedLock lock(mutex);
+    global_c_max = std::max(global_c_max, c_max);
+    if (cells > maxCells) {
+        ++num_uncached;
+        return result;
+    }
+    entry_map::iterator it = tables.find(d);
+    if (it == tables.end()) {
+        entry e = {table_ptr(), 0, 0, 0};
+        it = tables.insert(std::make_pair(d, e)).first;
+    } else if (it->second.c_max >= c_max) {
+        // another thread has published a large enough table in the meantime
+        it->second.last_use = ++clock;
+        return result;
+    }
+    num_cells += cells - it->second.cells;
+    it->second.table = result;
+    it->second.c_max = c_max;
+    it->second.cells = cells;
+    it->second.last_use = ++clock;
+    evict(d);
+    return result;
+}
+
+
+void stirling_table_cache::evict(double keep) {
+    while (num_cells > maxCells || tables.size() > maxTables) {
+        entry_map::iterator lru = tables.end();
+        for (entry_map::iterator it = tables.begin(); it != tables.end(); 
+             ++it) {
+            if (it->first != keep && 
+                (lru == tables.end() || 
+                 it->second.last_use < lru->second.last_use)) {
+                lru = it;
+            }
+        }
+        if (lru == tables.end()) {
+            return;
+        }
+        num_cells -= lru->second.cells;
+        tables.erase(lru);
+        ++num_evictions;
+    }
+}
+
+
+void stirling_table_cache::setLimits(size_t maxCells, size_t maxTables) {
+    ScopedLock lock(mutex);
+    this->maxCells = maxCells;
+    this->maxTables = maxTables;
+    evict(NAN); // NAN compares unequal to every discount
+}
+
+
+void stirling_table_cache::clear() {
+    ScopedLock lock(mutex);
+    tables.clear();
+    num_cells = 0;
+    num_ratio_calls = num_approximations = 0;
+    num_lookups = num_hits = num_misses = 0;
+    num_evictions = num_uncached = 0;
+    global_c_max = 0;
+}
+
+
+std::string stirling_table_cache::statsToString() {
+    ScopedLock lock(mutex);
+    std::ostringstream out;
+    out << "Ratio calls: " << num_ratio_calls << ", approximated: "
+        << num_approximations << ", lookups: " << num_lookups
+        << ", hits: " << num_hits << ", misses: " << num_misses
+        << ", evictions: " << num_evictions << ", uncached: " << num_uncached
+        << ", tables: " << tables.size() << ", cells: " << num_cells
+        << ", c_max " << global_c_max;
+    return out.str();
 }
 
+
+////////////////////////// stirling_generator_full_log ////////////////////////
+int stirling_generator_full_log::approximationThreshold = 4096;
+
+stirling_generator_full_log::stirling_generator_full_log(double d, int c, int t)
+    : table(stirling_table_cache::instance().get(
+          d, (c <= approximationThreshold) ? std::max(c, 2) : 2)), 
+      c_max(table->maxC()), d(d) {}
+
 double stirling_generator_full_log::ratio(int c, int t) {
-    num_ratio_calls++;
+    stirling_table_cache::instance().countRatioCall();
     if (t==1) {
         return 0;
     }
@@ -310,33 +630,27 @@ double stirling_generator_full_log::ratio(int c, int t) {
         return NAN;
     if(c==t)
         return 1;
-    if (c>c_max) {
-        num_extends++;
-        log_gen_stirling_table_extend(d,c,table);
-        c_max = c;
-        if (c_max > global_c_max) {
-            global_c_max = c_max;
-        }
+    if (c > approximationThreshold) {
+        stirling_table_cache::instance().countApproximation();
+        return gen_stirling_ratio_approx(d, c, t);
     }
-    if (c==0 || t==0) {
-        std::cout << "Error: calling ratio(0,0)" << std::endl;
+    if (c>c_max) {
+        table = stirling_table_cache::instance().get(d, c);
+        c_max = table->maxC();
     }
-    //for (int i=0; i<table.size();i++) {
-    //    std::cout << iterableToString(table[i]) << std::endl;
-    //}
-    return exp(log_get_stirling_from_table(table, c-1, t-1) - log_get_stirling_from_table(table, c, t));
+    return table->ratio(c, t);
 }
 
 std::string stirling_generator_full_log::statsToString() {
-    std::ostringstream out;
-    out << "Constructed: " << num_construct << ", extended: " << num_extends << ", calls: " << num_ratio_calls << ", c_max " << global_c_max;
-    return out.str();
+    return stirling_table_cache::instance().statsToString();
 }
 
+void stirling_generator_full_log::setApproximationThreshold(int c) {
+    approximationThreshold = c;
+}
 
-int stirling_generator_full_log::global_c_max = 0;
-int stirling_generator_full_log::num_ratio_calls = 0;
-int stirling_generator_full_log::num_extends = 0;
-int stirling_generator_full_log::num_construct = 0;
+int stirling_generator_full_log::getApproximationThreshold() {
+    return approximationThreshold;
+}
 
 }} // namespace gatsby::libplump
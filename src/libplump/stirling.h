@@ -26,10 +26,14 @@
 #ifndef STIRLING_H_
 #define STIRLING_H_
 #include <cmath>
+#include <map>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <boost/shared_ptr.hpp>
+
+#include "libplump/parallel.h"
 
 
 namespace gatsby { namespace libplump {
@@ -95,7 +99,41 @@ d_vec_vec log_gen_stirling_table(double d, int c);
 void log_gen_stirling_table_extend(double d, int c, d_vec_vec& table);
 
 
-double log_get_stirling_from_table(d_vec_vec& table, int c, int t);
+double log_get_stirling_from_table(const d_vec_vec& table, int c, int t);
+
+
+/**
+ * Compute S_d(c,t) in log space from the explicit sum
+ * S_d(c,t) = 1/(d^t t!) sum_{k=1}^t (-1)^k binom(t,k) Gamma(c-dk)/Gamma(-dk).
+ *
+ * The terms alternate in sign and only decay quickly if t is small compared
+ * to c^d, so this returns false (leaving result unchanged) if more than 64
+ * terms are needed, or if cancellation would lose more than 9 of the 16 
+ * significant digits. Otherwise the result is exact up to rounding.
+ */
+bool log_gen_stirling_sum(double d, int c, int t, double& result);
+
+
+/**
+ * Saddle point approximation of S_d(c,t) in log space for 1 <= t < c, 
+ * based on the exponential generating function 
+ * sum_c S_d(c,t) x^c/c! = (1 - (1-x)^d)^t / (d^t t!), including the first
+ * correction term (relative error O(1/t^2)). Takes constant time.
+ */
+double log_gen_stirling_saddle_point(double d, int c, int t);
+
+
+/**
+ * Approximate S_d(c-1,t-1)/S_d(c,t) in constant time and memory. Both numbers
+ * are computed with log_gen_stirling_sum if possible, and with 
+ * log_gen_stirling_saddle_point otherwise.
+ *
+ * The absolute error measured against exact values (see "benchmark 
+ * stirling") is below 3e-5 for d <= 0.7 and c >= 64. It is largest for 
+ * large discounts, where it falls roughly like 1/c: for d = 0.95 it is 
+ * 1e-2 for c = 256, 9e-4 for c = 4096 and 2.4e-4 for c = 16384.
+ */
+double gen_stirling_ratio_approx(double d, int c, int t);
 
 
 class stirling_generator_recompute_log {
@@ -131,12 +169,163 @@ class stirling_generator_fast_log {
     d_vec row, col, prev_col;
 };
 
+/**
+ * Triangular table of the ratios q_d(c,t) = S_d(c,t-1)/S_d(c,t) for 
+ * 1 <= t <= c <= maxC(), stored row by row in one contiguous buffer.
+ *
+ * Dividing the recursion for S_d(c,t) by S_d(c-1,t) gives
+ *   q(c,t) = (q(c-1,t-1) + c-1 - (t-1)d) q(c-1,t) / (q(c-1,t) + c-1 - td),
+ * so each row follows from the previous one in linear space, without logs
+ * or exps and without cancellation (all terms are positive). The ratios are
+ * bounded by c^2, so no rescaling is needed, and the loop over a row has no
+ * dependencies between iterations, so that the compiler can vectorize it.
+ */
+class stirling_ratio_table {
+  public:
+    stirling_ratio_table(double d, int c);
+
+    /**
+     * Add the rows up to c.
+     */
+    void extend(int c);
+
+    int maxC() const {
+      return c_max;
+    }
+
+    /**
+     * Number of cells in the table.
+     */
+    size_t size() const {
+      return q.size();
+    }
+
+    /**
+     * Return S_d(c-1,t-1)/S_d(c,t) for 1 <= t <= c <= maxC() + 1.
+     */
+    double ratio(int c, int t) const {
+      assert(t >= 1 && t <= c && c <= c_max + 1);
+      if (t == 1) {
+        return (c == 1) ? 1 : 0;
+      }
+      if (t == c) {
+        return 1;
+      }
+      double prev = q[row(c - 1) + t - 1];
+      return prev / (prev + (c - 1 - t * d));
+    }
+
+    /**
+     * Return log S_d(c,t) for 0 <= t <= c <= maxC(); takes O(c-t) time.
+     */
+    double logStirling(int c, int t) const;
+
+    /**
+     * Compute row c >= 2 of the table (q(c,t) for t = 1, ..., c) from 
+     * row c-1, e.g. to sweep over large c in linear memory.
+     */
+    static void nextRow(double d, int c, const double* prev, double* cur);
+
+  private:
+    static size_t row(int c) {
+      return (size_t)c * (c - 1) / 2;
+    }
+
+    double d;
+    int c_max;
+    d_vec q;
+};
+
+
+/**
+ * Process-wide cache of stirling_ratio_table objects, keyed by the discount
+ * and grown lazily in the number of customers. It is shared by all 
+ * stirling_generator_full_log objects, and thereby by all restaurants and 
+ * samplers in all threads.
+ *
+ * Published tables are never modified: a table that is too small is replaced
+ * by an extended copy (grown by at least an eighth to amortize the copying),
+ * so that generators can read the table they hold without locking. The cache
+ * holds at most maxTables tables with maxCells entries in total and evicts
+ * the least recently used tables beyond that; a table that is larger than
+ * maxCells on its own is returned without being cached.
+ */
+class stirling_table_cache {
+  public:
+    typedef boost::shared_ptr<const stirling_ratio_table> table_ptr;
+
+    static stirling_table_cache& instance();
+
+    /**
+     * Return a table for discount d that contains all entries for up to c 
+     * customers.
+     */
+    table_ptr get(double d, int c);
+
+    void setLimits(size_t maxCells, size_t maxTables);
+
+    /**
+     * Drop all tables and reset the statistics.
+     */
+    void clear();
+
+    /**
+     * Count a call of stirling_generator_full_log::ratio.
+     */
+    void countRatioCall() {
+      __sync_fetch_and_add(&num_ratio_calls, 1);
+    }
+
+    /**
+     * Count a ratio that was approximated instead of looked up.
+     */
+    void countApproximation() {
+      __sync_fetch_and_add(&num_approximations, 1);
+    }
+
+    std::string statsToString();
+
+  private:
+    stirling_table_cache();
+
+    struct entry {
+      table_ptr table;
+      int c_max;
+      size_t cells;
+      unsigned long last_use;
+    };
+
+    typedef std::map<double, entry> entry_map;
+
+    /**
+     * Evict least recently used tables other than keep until the limits
+     * are met.
+     */
+    void evict(double keep);
+
+    Mutex mutex;
+    entry_map tables;
+    size_t maxCells, maxTables;
+    size_t num_cells;
+    unsigned long clock;
+    unsigned long num_ratio_calls, num_approximations, num_lookups, num_hits,
+                  num_misses, num_evictions, num_uncached;
+    int global_c_max;
+
+    DISALLOW_COPY_AND_ASSIGN(stirling_table_cache);
+};
+
 /**
  * Class to encapsulate the generation of ratios of stirling numbers
  * for removing customers from restaurants.
  * 
- * One of these objects should be constructed for each restaurant, 
+ * The tables are taken from the stirling_table_cache, so these objects are 
+ * cheap to construct; one can be constructed for each restaurant, 
  * providing the current number of tables, and the total number of customers.
+ *
+ * Tables grow quadratically in the number of customers, so ratios for more
+ * than approximationThreshold customers are computed with 
+ * gen_stirling_ratio_approx instead.
  */
 class stirling_generator_full_log {
   public:
@@ -146,16 +335,23 @@ class stirling_generator_full_log {
 
     static std::string statsToString();
 
-  private:
+    /**
+     * Set the number of customers above which ratios are approximated 
+     * (default 4096). Should be called before any generators are used.
+     */
+    static void setApproximationThreshold(int c);
 
-    static int global_c_max, num_ratio_calls, num_extends, num_construct;
+    static int getApproximationThreshold();
+
+  private:
+    static int approximationThreshold;
 
-    d_vec_vec table;
+    stirling_table_cache::table_ptr table;
     int c_max;
     double d;
 };
 
-inline double log_get_stirling_from_table(d_vec_vec& table, int c, int t) {
+inline double log_get_stirling_from_table(const d_vec_vec& table, int c, int t) {
   // c and t must be non-negative
   assert(c >= 0 && t>= 0);
 
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libplump/streaming_session.h"
+
+#include <cassert>
+
+
+namespace gatsby { namespace libplump {
+
+StreamingSession::StreamingSession(HPYPModel& model, l_type start)
+    : model(model), start(start) {
+  // the stream must not start beyond the end of the sequence
+  assert(start >= 0 && (l_type)model.seq.size() >= start);
+  if ((l_type)model.seq.size() > start) {
+    model.insertContext(start, model.seq.size(), buffers.insertion);
+  }
+}
+
+
+double StreamingSession::push(e_type symbol) {
+  seq_type& seq = model.seq;
+  double probability;
+  if ((l_type)seq.size() == start) {
+    // the first symbol goes into the root
+    probability = model.predict(start, start, symbol, buffers);
+    model.insertRoot(symbol);
+  } else {
+    model.insertObservationAtPath(buffers.insertion.path, symbol, buffers);
+    probability = buffers.probabilities.back();
+  }
+  seq.push_back(symbol);
+  model.insertContext(start, seq.size(), buffers.insertion);
+  return probability;
+}
+
+
+void StreamingSession::peek(d_vec& distribution) {
+  if (buffers.insertion.path.empty()) {
+    model.predictiveDistribution(start, start, distribution, buffers);
+    return;
+  }
+  model.computePathDistribution(buffers.insertion.path, NULL, buffers);
+  buffers.distribution.getDistribution(distribution);
+}
+
+
+d_vec StreamingSession::peek() {
+  d_vec distribution;
+  peek(distribution);
+  return distribution;
+}
+
+
+double StreamingSession::peek(e_type symbol) {
+  if (buffers.insertion.path.empty()) {
+    return model.predict(start, start, symbol, buffers);
+  }
+  const WrappedNodeList& path = buffers.insertion.path;
+  model.computeParameterPath(path, buffers.discounts, buffers.concentrations);
+  model.computeProbabilityPath(path, buffers.discounts, 
+                               buffers.concentrations, symbol,
+                               buffers.probabilities);
+  return buffers.probabilities.back();
+}
+
+
+l_type StreamingSession::length() const {
+  return model.seq.size() - start;
+}
+
+
+void StreamingSession::sync() {
+  l_type end = model.seq.size();
+  if (end == start) {
+    return;
+  }
+  WrappedNodeList& path = buffers.insertion.path;
+  model.findContextPath(start, end, false, path);
+  if (path.back().end - path.back().start != end - start) {
+    // the context is no longer in the tree
+    model.insertContext(start, end, buffers.insertion);
+  }
+}
+
+}} // namespace gatsby::libplump
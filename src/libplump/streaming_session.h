@@ -0,0 +1,105 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMING_SESSION_H_
+#define STREAMING_SESSION_H_
+
+#include "libplump/config.h"
+#include "libplump/utils.h"
+#include "libplump/hpyp_model.h"
+
+namespace gatsby { namespace libplump {
+
+/**
+ * Feeds a sequence to an HPYPModel one symbol at a time, e.g. for online
+ * compression or live prediction.
+ *
+ * The session appends the symbols to the sequence of the model, and keeps a
+ * cursor: the path to the context [start, n) of the next symbol, where n is
+ * the current length of the sequence. The context is inserted into the tree
+ * as soon as the previous symbol has been pushed, so that peek() and push()
+ * work directly on the restaurants along the cursor and never look at the
+ * context itself. Each push() inserts the next context incrementally using
+ * the Weiner links of the tree (see ContextTree), so that the amortized cost
+ * of a symbol does not depend on the length of the context, only on the 
+ * number of restaurants on the path.
+ *
+ * Pushing the symbols of seq[start, stop) gives the same model and the same
+ * predictive probabilities as computeLosses(start, stop).
+ *
+ * Insertions are incremental as long as the session continues the contexts
+ * inserted last, i.e. if the model is new, or was trained on seq[start, n) 
+ * using computeLosses() or a previous session; otherwise every insertion
+ * searches the tree from the root. The model must not be changed other than
+ * through the session while it is in use, except that sync() may be called
+ * after operations that do not remove the current context (e.g. Gibbs
+ * sampling).
+ */
+class StreamingSession {
+  public:
+    /**
+     * Start a session for contexts beginning at start; the model's sequence
+     * must have at least start elements, the ones from start on being the
+     * symbols already seen in this stream.
+     */
+    StreamingSession(HPYPModel& model, l_type start = 0);
+
+    /**
+     * Return the predictive probability of symbol in the current context,
+     * then add it to the model and move the cursor to the next context.
+     */
+    double push(e_type symbol);
+
+    /**
+     * Compute the predictive distribution of the next symbol.
+     */
+    void peek(d_vec& distribution);
+
+    d_vec peek();
+
+    /**
+     * Return the predictive probability of the given next symbol, without
+     * changing the model.
+     */
+    double peek(e_type symbol);
+
+    /**
+     * Number of symbols in the stream.
+     */
+    l_type length() const;
+
+    /**
+     * Find the path to the current context again after the model was
+     * changed outside the session; takes time linear in the context length.
+     */
+    void sync();
+
+  private:
+    HPYPModel& model;
+    l_type start;
+    HPYPModel::PathBuffers buffers;
+    // the path to the current context is buffers.insertion.path; it is 
+    // empty at the start of the stream, where the context is the root
+
+    DISALLOW_COPY_AND_ASSIGN(StreamingSession);
+};
+
+}} // namespace gatsby::libplump
+
+#endif
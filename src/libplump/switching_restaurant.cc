@@ -76,6 +76,12 @@ IHPYPBaseRestaurant::TypeVector SwitchingRestaurant::getTypeVector(
 }
 
 
+void SwitchingRestaurant::getTypeVector(
+    void* payloadPtr, IHPYPBaseRestaurant::TypeVector& typeVector) const {
+  this->switchedRestaurant->getTypeVector(getCurrent(payloadPtr), typeVector);
+}
+
+
 const IPayloadFactory& SwitchingRestaurant::getFactory() const {
   return this->payloadFactory;
 }
@@ -121,6 +127,11 @@ bool SwitchingRestaurant::checkConsistency(void* payloadPtr) const {
 }
 
 
+bool SwitchingRestaurant::hasHPYPPredictive() const {
+  return this->switchedRestaurant->hasHPYPPredictive();
+}
+
+
 bool SwitchingRestaurant::addCustomer(void*  payloadPtr, 
                  e_type type, 
                  double parentProbability, 
@@ -24,6 +24,7 @@
 
 #include "libplump/config.h"
 #include "libplump/hpyp_restaurant_interface.h"
+#include "libplump/pool.h"
 #include "libplump/serialization.h"
 
 namespace gatsby { namespace libplump {
@@ -47,6 +48,8 @@ class SwitchingRestaurant : public IAddRemoveRestaurant {
                               double concentration) const;
 
     TypeVector getTypeVector(void* payloadPtr) const;
+
+    void getTypeVector(void* payloadPtr, TypeVector& typeVector) const;
     
     const IPayloadFactory& getFactory() const;
     
@@ -60,6 +63,8 @@ class SwitchingRestaurant : public IAddRemoveRestaurant {
     
     bool checkConsistency(void* payloadPtr) const;
 
+    bool hasHPYPPredictive() const;
+
     bool addCustomer(void*  payloadPtr, 
                      e_type type, 
                      double parentProbability, 
@@ -87,7 +92,7 @@ class SwitchingRestaurant : public IAddRemoveRestaurant {
     }
     
 
-    struct Payload {
+    struct Payload : public PoolObject<Payload> {
       std::vector<void*> payloads;
     };
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdlib>
+#include <new>
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+/**
+ * Number of calls to operator new so far in the whole test program.
+ */
+static unsigned long num_allocations = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+  __sync_fetch_and_add(&num_allocations, 1);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+  return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+  free(p);
+}
+
+void operator delete[](void* p) throw() {
+  operator delete(p);
+}
+
+
+namespace {
+
+/**
+ * A node manager that counts the nodes it creates.
+ */
+template <class NodeManager>
+class CountingNodeManager : public NodeManager {
+  public:
+    CountingNodeManager(const IPayloadFactory& factory)
+        : NodeManager(factory), numCreated(0) {}
+
+    INodeManager::NodeId setChild(INodeManager::NodeId node, e_type key,
+                                  l_type start, l_type end, void* payload) {
+      ++numCreated;
+      return NodeManager::setChild(node, key, start, end, payload);
+    }
+
+    INodeManager::NodeId insertBetween(INodeManager::NodeId parent,
+                                       e_type oldKey, l_type newStart,
+                                       l_type newEnd, e_type newKey) {
+      ++numCreated;
+      return NodeManager::insertBetween(parent, oldKey, newStart, newEnd,
+                                        newKey);
+    }
+
+    unsigned long numCreated;
+};
+
+
+/**
+ * A restaurant that counts the tables its customers open and the customers
+ * removed from it.
+ */
+template <class Restaurant>
+class CountingRestaurant : public Restaurant {
+  public:
+    CountingRestaurant() : numNewTables(0), numRemoved(0) {}
+
+    bool addCustomer(void* payloadPtr, e_type type, double parentProbability,
+                     double discount, double concentration,
+                     void* additionalData = NULL) const {
+      bool newTable = Restaurant::addCustomer(payloadPtr, type,
+                                              parentProbability, discount,
+                                              concentration, additionalData);
+      numNewTables += newTable;
+      return newTable;
+    }
+
+    bool removeCustomer(void* payloadPtr, e_type type, double discount,
+                        void* additionalData) const {
+      ++numRemoved;
+      return Restaurant::removeCustomer(payloadPtr, type, discount,
+                                        additionalData);
+    }
+
+    mutable unsigned long numNewTables;
+    mutable unsigned long numRemoved;
+};
+
+
+/**
+ * Train on seq, then insert its observations again into their contexts,
+ * which are all in the tree; returns the allocations of the second pass
+ * (the first one grows the buffers) and the tables opened in it.
+ */
+template <class NodeManager, class Restaurant>
+unsigned long reinsertionAllocations(seq_type& seq,
+                                     unsigned long& numNewTables) {
+  CountingRestaurant<Restaurant>* restaurant = 
+      new CountingRestaurant<Restaurant>();
+  TestModel<NodeManager> trained(seq, restaurant);
+  HPYPModel& model = trained.model;
+  resetRNG();
+  model.computeLosses(0, seq.size());
+  HPYPModel::PathBuffers buffers;
+  unsigned long before = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    before = num_allocations;
+    numNewTables = restaurant->numNewTables;
+    for (l_type i = 1; i < (l_type)seq.size(); ++i) {
+      model.insertContextAndObservation(0, i, seq[i], buffers);
+      model.insertObservation(0, i, seq[i], buffers);
+    }
+  }
+  numNewTables = restaurant->numNewTables - numNewTables;
+  return num_allocations - before;
+}
+
+
+/**
+ * Check that inserting observations into existing contexts does not
+ * allocate, except for the tables it opens if the restaurant stores its
+ * tables (perTable), with both node managers.
+ */
+template <class Restaurant>
+void checkReinsertion(seq_type& seq, bool perTable) {
+  unsigned long simpleTables, arenaTables;
+  unsigned long simple = reinsertionAllocations<SimpleNodeManager,
+                                                Restaurant>(seq, simpleTables);
+  unsigned long arena = reinsertionAllocations<ArenaNodeManager,
+                                               Restaurant>(seq, arenaTables);
+  if (perTable) {
+    BOOST_CHECK_LE(simple, simpleTables);
+    BOOST_CHECK_LE(arena, arenaTables);
+  } else {
+    BOOST_CHECK_EQUAL(simple, 0u);
+    BOOST_CHECK_EQUAL(arena, 0u);
+  }
+}
+
+
+/**
+ * Train on seq keeping only the last windowSize observations (0: all) and
+ * check that the allocations are at most perNode for every node created
+ * plus perRemoval for every customer removed from a restaurant.
+ */
+template <class NodeManager, class Restaurant>
+void checkTrainingAllocations(seq_type& seq, l_type windowSize,
+                              double perNode, double perRemoval) {
+  CountingRestaurant<Restaurant>* restaurant = 
+      new CountingRestaurant<Restaurant>();
+  TestModel<CountingNodeManager<NodeManager> > trained(seq, restaurant);
+  trained.model.setWindow(windowSize);
+  resetRNG();
+  unsigned long before = num_allocations;
+  trained.model.computeLosses(0, seq.size());
+  double allocations = num_allocations - before;
+  double numCreated = trained.nodeManager.numCreated;
+  BOOST_CHECK_GT(numCreated, 0);
+  BOOST_CHECK_LE(allocations, perNode * numCreated + 
+                              perRemoval * restaurant->numRemoved);
+}
+
+
+/**
+ * checkTrainingAllocations with both node managers, with and without a 
+ * window.
+ */
+template <class Restaurant>
+void checkTrainingAllocations(seq_type& seq, double perNode,
+                              double perRemoval) {
+  {
+    // fill the caches shared between models (of Stirling numbers)
+    TestModel<> warmUp(seq, new Restaurant());
+    warmUp.model.setWindow(2000);
+    warmUp.model.computeLosses(0, seq.size());
+  }
+  checkTrainingAllocations<SimpleNodeManager, Restaurant>(
+      seq, 0, perNode, perRemoval);
+  checkTrainingAllocations<ArenaNodeManager, Restaurant>(
+      seq, 0, perNode, perRemoval);
+  checkTrainingAllocations<SimpleNodeManager, Restaurant>(
+      seq, 2000, perNode, perRemoval);
+  checkTrainingAllocations<ArenaNodeManager, Restaurant>(
+      seq, 2000, perNode, perRemoval);
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(allocations)
+
+BOOST_AUTO_TEST_CASE(prediction_does_not_allocate) {
+  seq_type seq;
+  makeSequence(6000, 21, seq);
+  l_type length = 5000;
+  for (int r = 0; r < 5; ++r) {
+    TestModel<> trained(seq, makeRestaurant(r));
+    HPYPModel& model = trained.model;
+    model.computeLosses(0, length);
+
+    // one pass to grow the buffers to the depth of the tree
+    HPYPModel::PathBuffers buffers;
+    for (l_type i = length; i < (l_type)seq.size(); ++i) {
+      model.predict(length, i, seq[i]);
+      model.predictBelow(length, i, seq[i]);
+      model.predict(length, i, seq[i], buffers);
+    }
+
+    unsigned long before = num_allocations;
+    for (l_type i = length; i < (l_type)seq.size(); ++i) {
+      model.predict(length, i, seq[i]);
+      model.predictBelow(length, i, seq[i]);
+      model.predict(length, i, seq[i], buffers);
+    }
+    BOOST_CHECK_MESSAGE(num_allocations == before,
+                        "restaurant " << r << ": " << num_allocations - before
+                        << " allocations");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(gradient_does_not_allocate) {
+  seq_type seq;
+  makeSequence(3000, 22, seq);
+  GradientParameters* parameters = new GradientParameters(defaultDiscounts(),
+                                                          DEFAULT_ALPHA);
+  TestModel<> trained(seq, makeRestaurant(1), parameters);
+  trained.model.computeLosses(0, seq.size());
+
+  HPYPModel::PathBuffers buffers;
+  d_vec gradient;
+  parameters->getFreeParameters(gradient);
+  unsigned long before = 0;
+  for (int pass = 0; pass < 2; ++pass) {
+    // the first pass grows the buffers
+    before = num_allocations;
+    for (l_type i = 1; i < (l_type)seq.size(); ++i) {
+      trained.model.predict(0, i, seq[i], buffers);
+      parameters->accumulateParameterGradient(*trained.restaurant,
+          buffers.path, buffers.probabilities, buffers.discounts,
+          buffers.concentrations, seq[i], gradient);
+    }
+  }
+  BOOST_CHECK_EQUAL(num_allocations, before);
+}
+
+/**
+ * The customers of existing types are seated without allocating; only the
+ * restaurants that store every table (SimpleFull and Histogram) may grow
+ * their table lists when a customer opens a table.
+ */
+BOOST_AUTO_TEST_CASE(reinsertion_does_not_allocate) {
+  seq_type seq;
+  makeSequence(5000, 20, seq);
+  checkReinsertion<KneserNeyRestaurant>(seq, false);
+  checkReinsertion<SimpleFullRestaurant>(seq, true);
+  checkReinsertion<HistogramRestaurant>(seq, true);
+  checkReinsertion<ReinstantiatingCompactRestaurant>(seq, false);
+  checkReinsertion<StirlingCompactRestaurant>(seq, false);
+}
+
+/**
+ * A new node costs the node itself and its entry in the parent's child map
+ * (with SimpleNodeManager), and a payload with its type entries: one per
+ * type for KneserNey, two (the entry and its table list) for SimpleFull and
+ * Histogram, and none for the compact restaurants, whose payloads are pooled
+ * and store a few types inline. A node has about one type on average.
+ * Removing customers (with a window) allocates only in the reinstantiating
+ * restaurant, which samples the seating of the type with sample_crp_ct.
+ */
+BOOST_AUTO_TEST_CASE(training_allocations_are_per_node) {
+  seq_type seq;
+  makeSequence(20000, 20, seq);
+  checkTrainingAllocations<KneserNeyRestaurant>(seq, 2, 0);
+  checkTrainingAllocations<SimpleFullRestaurant>(seq, 5, 0);
+  checkTrainingAllocations<HistogramRestaurant>(seq, 5, 0);
+  checkTrainingAllocations<ReinstantiatingCompactRestaurant>(seq, 1, 5);
+  checkTrainingAllocations<StirlingCompactRestaurant>(seq, 1, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
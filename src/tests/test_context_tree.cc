@@ -0,0 +1,80 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+BOOST_AUTO_TEST_SUITE(context_tree)
+
+/**
+ * Insert the contexts [0, 1), [0, 2), ... into two trees, one using the
+ * Weiner links and one inserting from the root, and remove the same leaves
+ * (among them the last context) from both in between.
+ */
+BOOST_AUTO_TEST_CASE(weiner_links_survive_removing_leaves) {
+  seq_type seq;
+  makeSequence(4000, 30, seq);
+  KneserNeyRestaurant restaurant;
+  SimpleNodeManager linkedManager(restaurant.getFactory());
+  SimpleNodeManager plainManager(restaurant.getFactory());
+  ContextTree linked(linkedManager, seq);
+  ContextTree plain(plainManager, seq);
+  plain.setUseSuffixLinks(false);
+
+  unsigned int state = 1;
+  WrappedNodeList linkedPath, plainPath;
+  int mismatches = 0;
+  for (l_type i = 1; i <= (l_type)seq.size(); ++i) {
+    ContextTree::InsertionResult linkedResult = linked.insert(0, i);
+    ContextTree::InsertionResult plainResult = plain.insert(0, i);
+    if (linkedResult.action != plainResult.action ||
+        linkedResult.created != plainResult.created ||
+        linkedResult.path.size() != plainResult.path.size()) {
+      ++mismatches;
+    }
+
+    // remove the leaf of some earlier context, and its parents while they
+    // become leaves with probability 1/2
+    state = state * 1664525u + 1013904223u;
+    l_type j = (state >> 8) % 4 == 0 ? i : 1 + (state >> 10) % i;
+    linked.findLongestSuffix(0, j, linkedPath);
+    plain.findLongestSuffix(0, j, plainPath);
+    while (linkedPath.size() > 1 && linked.isLeaf(linkedPath.back().node)) {
+      BOOST_REQUIRE(plain.isLeaf(plainPath.back().node));
+      linked.removeLeaf(linkedPath);
+      plain.removeLeaf(plainPath);
+      linkedPath.pop_back();
+      plainPath.pop_back();
+      state = state * 1664525u + 1013904223u;
+      if ((state >> 8) % 2 == 0) {
+        break;
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(mismatches, 0);
+  BOOST_CHECK(linked.toString() == plain.toString());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+namespace {
+
+const int NUM_RESTAURANTS = 5;
+
+IAddRemoveRestaurant* makeRestaurant(int type, bool implicitLeaves) {
+  IAddRemoveRestaurant* restaurant = test::makeRestaurant(type);
+  if (implicitLeaves) {
+    return new ImplicitPayloadRestaurant(restaurant);
+  }
+  return restaurant;
+}
+
+/**
+ * A model trained on the first half of a sequence; predictions are made on
+ * the second half.
+ */
+struct TrainedModel {
+  TrainedModel(int restaurantType = 1, bool implicitLeaves = false)
+      : trained(seq, makeRestaurant(restaurantType, implicitLeaves)),
+        model(trained.model) {
+    makeSequence(4000, 1, seq);
+    testStart = seq.size() / 2;
+    model.computeLosses(0, testStart);
+  }
+
+  seq_type seq;
+  TestModel<> trained;
+  HPYPModel& model;
+  l_type testStart;
+};
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(frozen_hpyp_model)
+
+/**
+ * For all restaurants, with and without implicit leaf payloads (which the
+ * freezer has to decode).
+ */
+BOOST_AUTO_TEST_CASE(predictions_equal_live_model) {
+  for (int type = 0; type < 2 * NUM_RESTAURANTS; ++type) {
+    BOOST_TEST_CHECKPOINT("restaurant " << type % NUM_RESTAURANTS
+                          << ", implicit leaves " << type / NUM_RESTAURANTS);
+    TrainedModel trained(type % NUM_RESTAURANTS, type >= NUM_RESTAURANTS);
+    HPYPModel& model = trained.model;
+    l_type start = trained.testStart, stop = trained.seq.size();
+    FrozenHPYPModel frozen(model);
+    BOOST_CHECK_GT(frozen.getNumNodes(), 1u);
+
+    BOOST_CHECK_EQUAL(maxAbsDiff(
+        model.predictSequence(start, stop, HPYPModel::ABOVE),
+        frozen.predictSequence(start, stop, FrozenHPYPModel::ABOVE)), 0);
+    BOOST_CHECK_EQUAL(maxAbsDiff(
+        model.predictSequence(start, stop, HPYPModel::BELOW),
+        frozen.predictSequence(start, stop, FrozenHPYPModel::BELOW)), 0);
+    for (l_type i = stop - 50; i < stop; ++i) {
+      BOOST_CHECK_SMALL(maxAbsDiff(model.predictiveDistribution(start, i),
+                                   frozen.predictiveDistribution(start, i)),
+                        1e-15);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(mapped_model_equals_frozen_model) {
+  for (int type = 0; type < 2 * NUM_RESTAURANTS; ++type) {
+    BOOST_TEST_CHECKPOINT("restaurant " << type % NUM_RESTAURANTS
+                          << ", implicit leaves " << type / NUM_RESTAURANTS);
+    TrainedModel trained(type % NUM_RESTAURANTS, type >= NUM_RESTAURANTS);
+    l_type start = trained.testStart, stop = trained.seq.size();
+    FrozenHPYPModel frozen(trained.model);
+    TemporaryFile file;
+    BOOST_REQUIRE(frozen.save(file.name()));
+
+    boost::scoped_ptr<FrozenHPYPModel> mapped(
+        FrozenHPYPModel::load(file.name(), trained.seq));
+    BOOST_REQUIRE(mapped);
+    BOOST_CHECK_EQUAL(mapped->getNumNodes(), frozen.getNumNodes());
+    BOOST_CHECK_EQUAL(maxAbsDiff(frozen.predictSequence(start, stop),
+                                 mapped->predictSequence(start, stop)), 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(only_hpyp_predictive_restaurants_can_be_frozen) {
+  for (int type = 0; type < NUM_RESTAURANTS; ++type) {
+    boost::scoped_ptr<IAddRemoveRestaurant> restaurant(
+        makeRestaurant(type, true));
+    BOOST_CHECK(restaurant->hasHPYPPredictive());
+  }
+  ExpectedTablesCompactRestaurant expectedTables;
+  BOOST_CHECK(!expectedTables.hasHPYPPredictive());
+  ImplicitPayloadRestaurant implicitExpectedTables(
+      new ExpectedTablesCompactRestaurant());
+  BOOST_CHECK(!implicitExpectedTables.hasHPYPPredictive());
+}
+
+BOOST_AUTO_TEST_CASE(load_rejects_invalid_files) {
+  seq_type seq;
+  TemporaryFile file;
+  BOOST_CHECK(!FrozenHPYPModel::load(file.name(), seq));
+  {
+    std::ofstream out(file.name().c_str(), std::ios::binary);
+    out << "not a model file, but long enough to hold a header............"
+           "................................................................";
+  }
+  BOOST_CHECK(!FrozenHPYPModel::load(file.name(), seq));
+}
+
+BOOST_AUTO_TEST_CASE(predictions_do_not_depend_on_threads) {
+  TrainedModel trained;
+  HPYPModel& model = trained.model;
+  l_type start = trained.testStart, stop = trained.seq.size();
+  FrozenHPYPModel frozen(model);
+  for (int mode = 0; mode < 2; ++mode) {
+    HPYPModel::PredictMode liveMode = mode == 0 ? HPYPModel::ABOVE
+                                                : HPYPModel::BELOW;
+    FrozenHPYPModel::PredictMode frozenMode =
+        mode == 0 ? FrozenHPYPModel::ABOVE : FrozenHPYPModel::BELOW;
+    BOOST_CHECK_EQUAL(maxAbsDiff(
+        model.predictSequence(start, stop, liveMode, 1),
+        model.predictSequence(start, stop, liveMode, 4)), 0);
+    BOOST_CHECK_EQUAL(maxAbsDiff(
+        frozen.predictSequence(start, stop, frozenMode, 1),
+        frozen.predictSequence(start, stop, frozenMode, 4)), 0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(predict_sequence_from_first_position) {
+  TrainedModel trained;
+  HPYPModel& model = trained.model;
+  l_type start = trained.testStart, stop = trained.seq.size();
+  FrozenHPYPModel frozen(model);
+  d_vec all = model.predictSequence(start, stop);
+  d_vec tail = model.predictSequence(start, start + 10, stop, HPYPModel::ABOVE,
+                                     2);
+  BOOST_CHECK_EQUAL(maxAbsDiff(d_vec(all.begin() + 10, all.end()), tail), 0);
+  BOOST_CHECK_EQUAL(maxAbsDiff(
+      tail, frozen.predictSequence(start, start + 10, stop,
+                                   FrozenHPYPModel::ABOVE, 2)), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
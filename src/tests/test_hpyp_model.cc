@@ -0,0 +1,422 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+namespace {
+
+/**
+ * Train a model with the given restaurant from a freshly seeded RNG and run
+ * a Gibbs sweep; returns the training losses followed by the predictions of
+ * the trained model, and the serialized nodes in serialized.
+ */
+d_vec trainAndSample(const seq_type& data, IAddRemoveRestaurant* restaurant,
+                     std::string& serialized) {
+  seq_type seq(data);
+  TestModel<> trained(seq, restaurant);
+  resetRNG();
+  d_vec result = trained.model.computeLosses(0, seq.size());
+  trained.model.runGibbsSampler();
+  BOOST_CHECK(trained.model.checkConsistency());
+  d_vec probs = trained.model.predictSequence(0, seq.size());
+  result.insert(result.end(), probs.begin(), probs.end());
+
+  TemporaryFile file;
+  Serializer(file.name()).saveNodesAndPayloads(
+      trained.nodeManager, trained.restaurant->getFactory());
+  std::ifstream in(file.name().c_str(), std::ios::binary);
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  serialized = contents.str();
+  return result;
+}
+
+
+/**
+ * Train on data with a bound RNG and run one Gibbs sweep; returns the
+ * training losses followed by the predictions.
+ */
+d_vec trainWithRNG(const seq_type& data, RNG& rng) {
+  RNGBinding binding(rng);
+  std::string serialized;
+  return trainAndSample(data, makeRestaurant(1), serialized);
+}
+
+
+/**
+ * Online prediction and training through the context-based methods of
+ * HPYPModel, with the interface of StreamingSession.
+ */
+class ContextStream {
+  public:
+    ContextStream(HPYPModel& model, seq_type& seq)
+        : model(model), seq(seq) {}
+
+    void peek(d_vec& distribution) {
+      model.predictiveDistribution(0, seq.size(), distribution, buffers);
+    }
+
+    double push(e_type symbol) {
+      seq.push_back(symbol);
+      if (seq.size() == 1) {
+        model.insertRoot(symbol);
+        return 1.0 / NUM_TYPES;
+      }
+      d_vec path = model.insertContextAndObservation(0, seq.size() - 1,
+                                                     symbol);
+      return path[path.size() - 2];
+    }
+
+  private:
+    HPYPModel& model;
+    seq_type& seq;
+    HPYPModel::PathBuffers buffers;
+};
+
+
+/**
+ * Adapts StreamingSession to the constructor of ContextStream.
+ */
+struct CursorStream : public StreamingSession {
+  CursorStream(HPYPModel& model, seq_type& seq) : StreamingSession(model) {}
+};
+
+
+/**
+ * Feed data to a fresh model one symbol at a time using a Session,
+ * computing the predictive distribution before each symbol; returns the
+ * losses.
+ */
+template <class Session>
+d_vec runStreaming(const seq_type& data) {
+  seq_type seq;
+  TestModel<> trained(seq, makeRestaurant(1));
+  resetRNG();
+  Session session(trained.model, seq);
+  d_vec losses, distribution;
+  for (size_t i = 0; i < data.size(); ++i) {
+    session.peek(distribution);
+    losses.push_back(-gatsby::libplump::log2(session.push(data[i])));
+  }
+  return losses;
+}
+
+
+/**
+ * Train on seq with the given node budget (0: none) and check that the
+ * seating arrangements are consistent and the tree is within its budget;
+ * returns the losses.
+ */
+template <class NodeManager>
+d_vec trainWithBudget(seq_type& seq, size_t maxNodes,
+                      HPYPModel::EvictionPolicy policy, size_t& numNodes,
+                      size_t& numEvictions) {
+  TestModel<NodeManager> trained(seq, makeRestaurant(1));
+  if (maxNodes > 0) {
+    trained.model.setNodeBudget(maxNodes, policy);
+  }
+  resetRNG();
+  d_vec losses = trained.model.computeLosses(0, seq.size());
+  numNodes = trained.model.getNumNodes();
+  numEvictions = trained.model.getNumEvictions();
+  BOOST_CHECK(trained.model.checkConsistency());
+  if (maxNodes > 0) {
+    BOOST_CHECK_LE(numNodes, maxNodes);
+  }
+  return losses;
+}
+
+
+/**
+ * Train on seq keeping only the last windowSize observations (0: all) and
+ * check that the seating arrangements are consistent; returns the losses.
+ */
+template <class NodeManager>
+d_vec trainWithWindow(seq_type& seq, l_type windowSize, size_t& numNodes) {
+  TestModel<NodeManager> trained(seq, makeRestaurant(1));
+  if (windowSize > 0) {
+    trained.model.setWindow(windowSize);
+  }
+  resetRNG();
+  d_vec losses = trained.model.computeLosses(0, seq.size());
+  numNodes = trained.model.getNumNodes();
+  BOOST_CHECK(trained.model.checkConsistency());
+  return losses;
+}
+
+/**
+ * Train model on seq with the given node budget and window (0: none) and
+ * check that the seating arrangements are consistent; returns the losses
+ * followed by the predictions from above and from below.
+ */
+d_vec trainAndPredict(HPYPModel& model, const seq_type& seq, size_t maxNodes,
+                      l_type windowSize) {
+  model.setNodeBudget(maxNodes);
+  model.setWindow(windowSize);
+  resetRNG();
+  d_vec result = model.computeLosses(0, seq.size());
+  BOOST_CHECK(model.checkConsistency());
+  d_vec above = model.predictSequence(0, seq.size(), HPYPModel::ABOVE);
+  d_vec below = model.predictSequence(0, seq.size(), HPYPModel::BELOW);
+  result.insert(result.end(), above.begin(), above.end());
+  result.insert(result.end(), below.begin(), below.end());
+  return result;
+}
+
+
+/**
+ * Check that HPYPModelT<NodeManager, Restaurant, SimpleParameters> gives
+ * exactly the same results as HPYPModel.
+ */
+template <class NodeManager, class Restaurant>
+void checkStaticModel(seq_type& seq, size_t maxNodes, l_type windowSize) {
+  Restaurant dynamicRestaurant, staticRestaurant;
+  NodeManager dynamicNodeManager(dynamicRestaurant.getFactory());
+  NodeManager staticNodeManager(staticRestaurant.getFactory());
+  SimpleParameters dynamicParameters(defaultDiscounts(), DEFAULT_ALPHA);
+  SimpleParameters staticParameters(defaultDiscounts(), DEFAULT_ALPHA);
+  HPYPModel dynamicModel(seq, dynamicNodeManager, dynamicRestaurant,
+                         dynamicParameters, NUM_TYPES);
+  HPYPModelT<NodeManager, Restaurant, SimpleParameters> staticModel(
+      seq, staticNodeManager, staticRestaurant, staticParameters, NUM_TYPES);
+  d_vec dynamicResult = trainAndPredict(dynamicModel, seq, maxNodes,
+                                        windowSize);
+  d_vec staticResult = trainAndPredict(staticModel, seq, maxNodes,
+                                       windowSize);
+  BOOST_CHECK_EQUAL(dynamicResult.size(), staticResult.size());
+  BOOST_CHECK_EQUAL(maxAbsDiff(dynamicResult, staticResult), 0);
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(hpyp_model)
+
+BOOST_AUTO_TEST_CASE(predictive_distribution_equals_per_type_predictions) {
+  seq_type seq;
+  makeSequence(3000, 2, seq);
+  TestModel<> trained(seq, makeRestaurant(1));
+  HPYPModel& model = trained.model;
+  model.computeLosses(0, seq.size());
+
+  d_vec mixingWeights(4, 0.1);
+  HPYPModel::PathBuffers buffers;
+  d_vec distribution, mixture;
+  for (l_type i = seq.size() - 100; i < (l_type)seq.size(); ++i) {
+    model.predictiveDistribution(0, i, distribution, buffers);
+    model.predictiveDistributionWithMixing(0, i, mixingWeights, mixture,
+                                           buffers);
+    BOOST_REQUIRE_EQUAL(distribution.size(), (size_t)NUM_TYPES);
+    for (int type = 0; type < NUM_TYPES; ++type) {
+      double p = model.predict(0, i, type, buffers);
+      // mixture of the probabilities along the path as computed by
+      // predictiveDistributionWithMixing
+      const d_vec& path = buffers.probabilities;
+      double m = 0, sum = 0;
+      for (size_t j = 0; j < std::min(mixingWeights.size(), path.size());
+           ++j) {
+        m += mixingWeights[j] * path[j];
+        sum += mixingWeights[j];
+      }
+      m += (1 - sum) * path.back();
+      BOOST_CHECK_CLOSE(distribution[type], p, 1e-10);
+      BOOST_CHECK_CLOSE(mixture[type], m, 1e-10);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(bound_rngs_are_reproducible) {
+  RNG base(42);
+  boost::scoped_ptr<RNG> a(base.stream(3)), b(base.stream(3)),
+                         c(base.stream(4));
+  gsl_rng_uniform(base.get()); // streams do not depend on the parent's state
+  boost::scoped_ptr<RNG> d(base.stream(3));
+  int same = 0, differentStream = 0;
+  for (int i = 0; i < 1000; ++i) {
+    double x = gsl_rng_uniform(a->get());
+    same += (x == gsl_rng_uniform(b->get()) && x == gsl_rng_uniform(d->get()));
+    differentStream += (x == gsl_rng_uniform(c->get()));
+  }
+  BOOST_CHECK_EQUAL(same, 1000);
+  BOOST_CHECK_LE(differentStream, 10);
+
+  seq_type data;
+  makeSequence(2000, 3, data);
+  RNG first(7), second(7);
+  BOOST_CHECK_EQUAL(maxAbsDiff(trainWithRNG(data, first),
+                               trainWithRNG(data, second)), 0);
+}
+
+/**
+ * For the full and both compact representations of the seating arrangements.
+ */
+BOOST_AUTO_TEST_CASE(gibbs_samplers_keep_arrangements_consistent) {
+  seq_type seq;
+  makeSequence(3000, 4, seq);
+  const int restaurants[] = {1, 3, 4};
+  for (int r = 0; r < 3; ++r) {
+    for (int threads = 0; threads <= 4; threads += 2) {
+      // threads == 0: serial sampler
+      BOOST_TEST_CHECKPOINT("restaurant " << restaurants[r] << ", threads "
+                            << threads);
+      TestModel<> trained(seq, makeRestaurant(restaurants[r]));
+      trained.model.computeLosses(0, seq.size());
+      BOOST_CHECK(trained.model.checkConsistency());
+      for (int i = 0; i < 2; ++i) {
+        if (threads == 0) {
+          trained.model.runGibbsSampler();
+        } else {
+          trained.model.runParallelGibbsSampler(threads, 2);
+        }
+        BOOST_CHECK(trained.model.checkConsistency());
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(fragmentation_predictions_are_probabilities) {
+  seq_type seq;
+  makeSequence(3000, 5, seq);
+  TestModel<> trained(seq, makeRestaurant(0));
+  trained.model.computeLosses(0, seq.size() / 2);
+  d_vec probs = trained.model.predictSequence(seq.size() / 2, seq.size(),
+                                              HPYPModel::FRAGMENT, 4);
+  BOOST_REQUIRE_EQUAL(probs.size(), seq.size() - seq.size() / 2);
+  for (size_t i = 0; i < probs.size(); ++i) {
+    BOOST_CHECK(probs[i] > 0 && probs[i] <= 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(implicit_leaves_do_not_change_the_model) {
+  seq_type data;
+  makeSequence(2000, 6, data);
+  for (int type = 0; type < 5; ++type) {
+    BOOST_TEST_CHECKPOINT("restaurant " << type);
+    std::string plainNodes, implicitNodes;
+    d_vec plain = trainAndSample(data, makeRestaurant(type), plainNodes);
+    d_vec implicit = trainAndSample(
+        data, new ImplicitPayloadRestaurant(makeRestaurant(type)),
+        implicitNodes);
+    BOOST_CHECK_EQUAL(maxAbsDiff(plain, implicit), 0);
+    BOOST_CHECK(plainNodes == implicitNodes);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(streaming_equals_batch_training) {
+  seq_type data;
+  makeSequence(2000, 7, data);
+  d_vec reference;
+  {
+    seq_type seq(data);
+    TestModel<> trained(seq, makeRestaurant(1));
+    resetRNG();
+    reference = trained.model.computeLosses(0, seq.size());
+  }
+  BOOST_CHECK_EQUAL(maxAbsDiff(reference, runStreaming<ContextStream>(data)),
+                    0);
+  BOOST_CHECK_EQUAL(maxAbsDiff(reference, runStreaming<CursorStream>(data)),
+                    0);
+}
+
+BOOST_AUTO_TEST_CASE(node_budget) {
+  seq_type seq;
+  makeSequence(3000, 8, seq);
+  size_t numNodes, numEvictions;
+  d_vec unbounded = trainWithBudget<SimpleNodeManager>(
+      seq, 0, HPYPModel::EVICT_RANDOM, numNodes, numEvictions);
+  // a budget that is never reached does not change the model (the nodes are
+  // only counted if there is a budget)
+  size_t fullNodes;
+  d_vec large = trainWithBudget<SimpleNodeManager>(
+      seq, (size_t)-1, HPYPModel::EVICT_RANDOM, fullNodes, numEvictions);
+  BOOST_CHECK(large == unbounded);
+  BOOST_CHECK_EQUAL(numEvictions, 0u);
+
+  for (int policy = 0; policy < 2; ++policy) {
+    size_t simpleNodes, simpleEvictions, arenaNodes, arenaEvictions;
+    d_vec simple = trainWithBudget<SimpleNodeManager>(
+        seq, fullNodes / 4, (HPYPModel::EvictionPolicy)policy, simpleNodes,
+        simpleEvictions);
+    d_vec arena = trainWithBudget<ArenaNodeManager>(
+        seq, fullNodes / 4, (HPYPModel::EvictionPolicy)policy, arenaNodes,
+        arenaEvictions);
+    BOOST_CHECK_GT(simpleEvictions, 0u);
+    // both node managers remove the same leaves
+    BOOST_CHECK(simple == arena);
+    BOOST_CHECK_EQUAL(simpleEvictions, arenaEvictions);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(window) {
+  seq_type seq;
+  makeSequence(3000, 9, seq);
+  // the statistics change abruptly half way
+  l_type half = seq.size();
+  for (l_type i = 0; i < half; ++i) {
+    seq.push_back(NUM_TYPES - 1 - seq[i]);
+  }
+  size_t numNodes, fullNodes;
+  d_vec unbounded = trainWithWindow<SimpleNodeManager>(seq, 0, numNodes);
+  // a window that covers the sequence does not change the model (the nodes
+  // are only counted if there is a window)
+  d_vec large = trainWithWindow<SimpleNodeManager>(seq, seq.size(), fullNodes);
+  BOOST_CHECK(large == unbounded);
+
+  size_t simpleNodes, arenaNodes;
+  d_vec simple = trainWithWindow<SimpleNodeManager>(seq, 500, simpleNodes);
+  d_vec arena = trainWithWindow<ArenaNodeManager>(seq, 500, arenaNodes);
+  BOOST_CHECK_LT(simpleNodes, fullNodes);
+  BOOST_CHECK(simple == arena);
+  BOOST_CHECK_EQUAL(simpleNodes, arenaNodes);
+}
+
+BOOST_AUTO_TEST_CASE(static_model_equals_hpyp_model) {
+  seq_type seq;
+  makeSequence(3000, 10, seq);
+  // no limit, a node budget and a window, which HPYPModelT inherits
+  const size_t budgets[] = {0, 1000, 0};
+  const l_type windows[] = {0, 0, 500};
+  for (int i = 0; i < 3; ++i) {
+    BOOST_TEST_CHECKPOINT("budget " << budgets[i] << ", window " 
+                          << windows[i]);
+    checkStaticModel<SimpleNodeManager, KneserNeyRestaurant>(
+        seq, budgets[i], windows[i]);
+    checkStaticModel<SimpleNodeManager, SimpleFullRestaurant>(
+        seq, budgets[i], windows[i]);
+    checkStaticModel<SimpleNodeManager, HistogramRestaurant>(
+        seq, budgets[i], windows[i]);
+    checkStaticModel<SimpleNodeManager, ReinstantiatingCompactRestaurant>(
+        seq, budgets[i], windows[i]);
+    checkStaticModel<SimpleNodeManager, StirlingCompactRestaurant>(
+        seq, budgets[i], windows[i]);
+    checkStaticModel<ArenaNodeManager, StirlingCompactRestaurant>(
+        seq, budgets[i], windows[i]);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Unit tests of libplump. The test cases are spread over the other files in
+ * this directory; this file only provides the test runner (the header-only
+ * variant of Boost.Test, so that no test library has to be installed).
+ */
+
+#define BOOST_TEST_MODULE libplump
+#include <boost/test/included/unit_test.hpp>
+
+#include <libplump/random.h>
+
+/**
+ * Seed the global RNG before and free it after all tests.
+ */
+struct GlobalRNG {
+  GlobalRNG() {
+    gatsby::libplump::init_rng();
+  }
+
+  ~GlobalRNG() {
+    gatsby::libplump::free_rng();
+  }
+};
+
+BOOST_GLOBAL_FIXTURE(GlobalRNG);
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <boost/test/unit_test.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace gatsby::libplump;
+
+
+namespace {
+
+/**
+ * Insert and erase random keys in map and in a std::map and compare all
+ * lookups with those in the std::map after every step; the keys are in 
+ * [-10, 590) while the maps grow and in [-10, 290) while they shrink.
+ * Returns the number of wrong results; wasDense is set if the map was dense
+ * (see AdaptiveMiniMap) at any point.
+ */
+template <class Map>
+int compareWithStdMap(Map& map, std::map<e_type, int>& reference,
+                      bool& wasDense) {
+  int errors = 0;
+  wasDense = false;
+  for (int step = 0; step < 20000; ++step) {
+    // grow for the first half, then shrink
+    e_type key = (e_type)uniform_int(step < 10000 ? 600 : 300) - 10;
+    if (step < 10000 || step % 3 == 0) {
+      map[key] = step;
+      reference[key] = step;
+    } else {
+      errors += (map.erase(key) != reference.erase(key));
+    }
+    wasDense = wasDense || map.isDense();
+    for (e_type k = -20; k < 700; ++k) {
+      typename Map::const_iterator it = map.find(k);
+      std::map<e_type, int>::const_iterator ref = reference.find(k);
+      errors += ((it == map.end()) != (ref == reference.end()) 
+                 || (it != map.end() && (*it).second != ref->second));
+    }
+  }
+  return errors;
+}
+
+
+/**
+ * InlineMiniMap is never dense.
+ */
+struct CheckedInlineMap : public InlineMiniMap<e_type, int> {
+  bool isDense() const {
+    return false;
+  }
+};
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(mini_maps)
+
+BOOST_AUTO_TEST_CASE(inline_mini_map_equals_std_map) {
+  CheckedInlineMap map;
+  std::map<e_type, int> reference;
+  bool wasDense;
+  BOOST_CHECK_EQUAL(compareWithStdMap(map, reference, wasDense), 0);
+  BOOST_CHECK_EQUAL(map.size(), reference.size());
+}
+
+BOOST_AUTO_TEST_CASE(adaptive_mini_map_equals_std_map) {
+  typedef AdaptiveMiniMap<e_type, int> Map;
+  Map map;
+  std::map<e_type, int> reference;
+  bool wasDense;
+  BOOST_CHECK_EQUAL(compareWithStdMap(map, reference, wasDense), 0);
+  BOOST_CHECK(wasDense);
+
+  // iteration is in key order, also for copies
+  Map copy(map);
+  std::map<e_type, int>::const_iterator ref = reference.begin();
+  for (Map::const_iterator it = copy.begin(); it != copy.end(); ++it, ++ref) {
+    BOOST_REQUIRE(ref != reference.end());
+    BOOST_CHECK_EQUAL((*it).first, ref->first);
+    BOOST_CHECK(copy.find(ref->first) == it);
+  }
+  BOOST_CHECK(ref == reference.end());
+
+  while (!reference.empty()) {
+    map.erase(reference.begin()->first);
+    reference.erase(reference.begin());
+  }
+  BOOST_CHECK_EQUAL(map.size(), 0u);
+  BOOST_CHECK(map.find(0) == map.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <limits>
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+namespace {
+
+/**
+ * Node discount computed by looping over the levels: the product of the
+ * per-level discounts over the depths between the parent and the node,
+ * applying sigmoid to each level if the levels are in logit space.
+ */
+double loopDiscount(const d_vec& levels, bool logitLevels, int parentLength,
+                    int thisLength) {
+  int maxLength = levels.size() - 1;
+  double discount = 1;
+  for (int i = parentLength + 1; i <= std::min(thisLength, maxLength); ++i) {
+    discount *= logitLevels ? sigmoid(levels[i]) : levels[i];
+  }
+  if (thisLength > maxLength) {
+    double last = logitLevels ? sigmoid(levels.back()) : levels.back();
+    discount *= std::pow(last, thisLength - std::max(parentLength, maxLength));
+  }
+  return discount;
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(parameters)
+
+BOOST_AUTO_TEST_CASE(discount_tables_equal_per_level_products) {
+  d_vec levels = defaultDiscounts();
+  d_vec logitLevels(levels.size());
+  for (size_t i = 0; i < levels.size(); ++i) {
+    logitLevels[i] = logit(levels[i]);
+  }
+
+  // random paths whose node lengths grow like those of a context tree 
+  // (mostly by a few symbols, sometimes by many)
+  std::vector<WrappedNodeList> paths(1000);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    l_type length = 0;
+    int numNodes = 1 + gsl_rng_uniform_int(global_rng, 20);
+    for (int j = 0; j < numNodes; ++j) {
+      paths[i].push_back(WrappedNode(0, length, NULL, j, NULL));
+      length += 1 + (gsl_rng_uniform(global_rng) < 0.9
+                     ? gsl_rng_uniform_int(global_rng, 3)
+                     : gsl_rng_uniform_int(global_rng, 1000));
+    }
+  }
+
+  SimpleParameters simple(levels, DEFAULT_ALPHA);
+  GradientParameters gradient(levels, DEFAULT_ALPHA);
+  IParameters* parameters[] = {&simple, &gradient};
+  for (int k = 0; k < 2; ++k) {
+    const d_vec& reference = k == 0 ? levels : logitLevels;
+    d_vec discounts, expected;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      const WrappedNodeList& path = paths[i];
+      expected.clear();
+      int parentLength = -1;
+      for (size_t j = 0; j < path.size(); ++j) {
+        int thisLength = path[j].end - path[j].start;
+        expected.push_back(loopDiscount(reference, k == 1, parentLength,
+                                        thisLength));
+        parentLength = thisLength;
+      }
+      parameters[k]->getDiscounts(path, discounts);
+      BOOST_CHECK(discounts == expected);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(gradient_equals_central_differences) {
+  const double eps = 1e-6;
+  seq_type seq;
+  makeSequence(2000, 10, seq);
+  GradientParameters* parameters = new GradientParameters(defaultDiscounts(),
+                                                          DEFAULT_ALPHA);
+  TestModel<> trained(seq, makeRestaurant(1), parameters);
+  HPYPModel& model = trained.model;
+  // no steps during training
+  OptimizerOptions options;
+  options.batchSize = std::numeric_limits<int>::max();
+  model.getOptimizer().setOptions(options);
+  model.computeLosses(0, seq.size());
+
+  HPYPModel::PathBuffers buffers;
+  d_vec values, perturbed, gradient;
+  parameters->getFreeParameters(values);
+  double maxError = 0;
+  for (l_type i = 1; i < (l_type)seq.size(); i += seq.size() / 100 + 1) {
+    model.predict(0, i, seq[i], buffers);
+    gradient.assign(values.size(), 0);
+    parameters->accumulateParameterGradient(*trained.restaurant, buffers.path,
+        buffers.probabilities, buffers.discounts, buffers.concentrations, 
+        seq[i], gradient);
+    for (size_t k = 0; k < values.size(); ++k) {
+      perturbed = values;
+      perturbed[k] += eps;
+      parameters->setFreeParameters(perturbed);
+      double plus = log(model.predict(0, i, seq[i], buffers));
+      perturbed[k] -= 2 * eps;
+      parameters->setFreeParameters(perturbed);
+      double minus = log(model.predict(0, i, seq[i], buffers));
+      double estimate = (plus - minus) / (2 * eps);
+      maxError = std::max(maxError, fabs(gradient[k] - estimate)
+                                    / std::max(1.0, fabs(estimate)));
+    }
+    parameters->setFreeParameters(values);
+  }
+  BOOST_CHECK_SMALL(maxError, 1e-5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
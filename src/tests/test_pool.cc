@@ -0,0 +1,88 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace gatsby::libplump;
+
+
+namespace {
+
+struct PooledBlock : public PoolObject<PooledBlock> {
+  double data[6];
+};
+
+
+/**
+ * Allocates objects for the positions of each chunk, or frees those of the
+ * mirrored positions, so that most objects are freed by a different thread
+ * than the one that allocated them.
+ */
+struct PoolWork {
+  std::vector<PooledBlock*>* blocks;
+  bool allocate;
+
+  void operator()(int thread, l_type begin, l_type end) {
+    std::vector<PooledBlock*>& b = *blocks;
+    for (l_type i = begin; i < end; ++i) {
+      if (allocate) {
+        b[i] = new PooledBlock();
+        b[i]->data[0] = i;
+      } else {
+        delete b[b.size() - 1 - i];
+      }
+    }
+  }
+};
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(pool)
+
+BOOST_AUTO_TEST_CASE(objects_freed_by_other_threads) {
+  FixedSizePool& pool = PooledBlock::pool();
+  std::vector<PooledBlock*> blocks(100000);
+  PoolWork work = {&blocks, true};
+  parallelFor(0, blocks.size(), 4, work, 4096);
+  BOOST_CHECK_EQUAL(pool.getStatistics().liveObjects, (long)blocks.size());
+  // every object is allocated once
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(blocks[i]->data[0], (double)i);
+  }
+  BOOST_CHECK(!pool.reset());
+
+  work.allocate = false;
+  parallelFor(0, blocks.size(), 4, work, 4096);
+  FixedSizePool::Statistics statistics = pool.getStatistics();
+  BOOST_CHECK_EQUAL(statistics.liveObjects, 0);
+  BOOST_CHECK_GT(statistics.bytesReserved, 0u);
+
+  pool.trim();
+  BOOST_CHECK(pool.reset());
+  // the pool can be used after a reset
+  PooledBlock* block = new PooledBlock();
+  BOOST_CHECK_EQUAL(pool.getStatistics().liveObjects, 1);
+  delete block;
+  BOOST_CHECK_EQUAL(pool.getStatistics().liveObjects, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <sstream>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "tests/test_utils.h"
+
+using namespace gatsby::libplump;
+using namespace gatsby::libplump::test;
+
+
+namespace {
+
+/**
+ * Seat and remove customers in a StirlingCompactRestaurant payload, with
+ * counts that exceed 16 bits, and check the counts against a reference and
+ * across a serialization round trip.
+ */
+void checkCompactPayload(double parentProbability, double discount) {
+  StirlingCompactRestaurant restaurant;
+  const IPayloadFactory& factory = restaurant.getFactory();
+  void* payload = factory.make();
+  std::map<e_type, std::pair<l_type, l_type> > reference;
+  for (int step = 0; step < 200000; ++step) {
+    // mostly one type, so that its counts outgrow 16 bits
+    e_type type = (step % 10 == 0) ? (e_type)uniform_int(40) * 3 : 7;
+    std::pair<l_type, l_type>& counts = reference[type];
+    counts.first += 1;
+    counts.second += restaurant.addCustomer(payload, type, parentProbability,
+                                            discount, 1.0, NULL);
+  }
+  for (int step = 0; step < 2000; ++step) {
+    e_type type = (e_type)uniform_int(40) * 3;
+    std::pair<l_type, l_type>& counts = reference[type];
+    if (counts.first > 0) {
+      counts.first -= 1;
+      counts.second -= restaurant.removeCustomer(payload, type, discount, 
+                                                 NULL);
+    }
+  }
+  BOOST_CHECK_GT(reference[7].first, 65535);
+
+  std::stringstream stream;
+  {
+    OutArchive oa(stream);
+    factory.save(payload, oa);
+  }
+  InArchive ia(stream);
+  void* loaded = factory.load(ia);
+
+  void* payloads[] = {payload, loaded};
+  for (int p = 0; p < 2; ++p) {
+    l_type sumCustomers = 0, sumTables = 0;
+    for (std::map<e_type, std::pair<l_type, l_type> >::const_iterator it = 
+         reference.begin(); it != reference.end(); ++it) {
+      BOOST_CHECK_EQUAL(restaurant.getC(payloads[p], it->first),
+                        it->second.first);
+      BOOST_CHECK_EQUAL(restaurant.getT(payloads[p], it->first),
+                        it->second.second);
+      sumCustomers += it->second.first;
+      sumTables += it->second.second;
+    }
+    BOOST_CHECK_EQUAL(restaurant.getC(payloads[p]), sumCustomers);
+    BOOST_CHECK_EQUAL(restaurant.getT(payloads[p]), sumTables);
+    BOOST_CHECK_EQUAL(restaurant.getTypeVector(payloads[p]).size(),
+                      reference.size());
+    BOOST_CHECK(restaurant.checkConsistency(payloads[p]));
+  }
+  factory.recycle(payload);
+  factory.recycle(loaded);
+}
+
+
+/**
+ * Split a restaurant with a single table of c customers and check that both
+ * parts are consistent and that the parent has one table with a customer
+ * for each of the tables the restaurant has after the split.
+ */
+void checkSplit(IAddRemoveRestaurant& restaurant, int c, double d1,
+                double d2) {
+  const IPayloadFactory& factory = restaurant.getFactory();
+  void* payload = factory.make();
+  // joining the only table is certain without a parent probability
+  for (int i = 0; i < c; ++i) {
+    restaurant.addCustomer(payload, 0, 0.0, d1, 1.0, NULL);
+  }
+  BOOST_REQUIRE_EQUAL(restaurant.getT(payload), 1);
+  void* parent = factory.make();
+  restaurant.updateAfterSplit(payload, parent, d1, d2);
+  BOOST_CHECK(restaurant.checkConsistency(payload));
+  BOOST_CHECK(restaurant.checkConsistency(parent));
+  BOOST_CHECK_EQUAL(restaurant.getC(payload), c);
+  BOOST_CHECK_GE(restaurant.getT(payload), 1);
+  BOOST_CHECK_EQUAL(restaurant.getC(parent), restaurant.getT(payload));
+  BOOST_CHECK_EQUAL(restaurant.getT(parent), 1);
+  factory.recycle(parent);
+  factory.recycle(payload);
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(restaurants)
+
+BOOST_AUTO_TEST_CASE(compact_payload_with_large_counts) {
+  // few tables for many customers, and many tables
+  checkCompactPayload(1e-6, 0.5);
+  checkCompactPayload(1.0, 0.9);
+}
+
+BOOST_AUTO_TEST_CASE(split_single_table) {
+  SimpleFullRestaurant simpleFull;
+  HistogramRestaurant histogram;
+  for (int c = 10; c <= 10000; c *= 10) {
+    checkSplit(simpleFull, c, 0.25, 0.5);
+    checkSplit(histogram, c, 0.25, 0.5);
+    checkSplit(histogram, c, 0.81, 0.9);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
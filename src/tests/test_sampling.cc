@@ -0,0 +1,139 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <boost/test/unit_test.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace gatsby::libplump;
+
+
+namespace {
+
+/**
+ * Mean and standard error of the number of tables in samples of the given
+ * fragmentation sampler (0: sample_crp_c_pdf, 1: sample_crp_c, 2:
+ * sample_crp_c_tables).
+ */
+void sampleTables(int method, double d, double a, int c, double& mean,
+                  double& error) {
+  const int numSamples = 5000;
+  std::vector<int> arrangement, customerTables;
+  double sum = 0, sum2 = 0;
+  for (int i = 0; i < numSamples; ++i) {
+    double t;
+    if (method == 0) {
+      arrangement = sample_crp_c_pdf(d, a, c);
+      t = arrangement.size();
+    } else if (method == 1) {
+      sample_crp_c(d, a, c, arrangement, customerTables);
+      t = arrangement.size();
+      BOOST_REQUIRE_EQUAL((int)customerTables.size(), c);
+    } else {
+      t = sample_crp_c_tables(d, a, c);
+    }
+    sum += t;
+    sum2 += t * t;
+  }
+  mean = sum / numSamples;
+  error = sqrt((sum2 / numSamples - mean * mean) / numSamples);
+}
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(sampling)
+
+BOOST_AUTO_TEST_CASE(fragmentation_samplers_agree) {
+  // the split of a node with discounts d1 d2 fragments each table with a 
+  // CRP(d1, -d1 d2)
+  const double settings[][3] = {{0.5, -0.25, 50}, {0.9, -0.81, 50},
+                                {0.95, -0.9, 500}, {0.1, -0.05, 200}};
+  for (int s = 0; s < 4; ++s) {
+    double reference, referenceError;
+    sampleTables(0, settings[s][0], settings[s][1], (int)settings[s][2],
+                 reference, referenceError);
+    for (int method = 1; method < 3; ++method) {
+      double mean, error;
+      sampleTables(method, settings[s][0], settings[s][1],
+                   (int)settings[s][2], mean, error);
+      // within 5 standard errors of the reference implementation
+      BOOST_CHECK_LT(fabs(mean - reference), 
+                     5 * sqrt(error * error + referenceError * referenceError));
+    }
+  }
+
+  std::vector<int> arrangement(3, 1), customerTables(3, 0);
+  sample_crp_c(0.5, -0.25, 0, arrangement, customerTables);
+  BOOST_CHECK(arrangement.empty());
+  BOOST_CHECK(customerTables.empty());
+}
+
+BOOST_AUTO_TEST_CASE(discrete_samplers_have_the_right_frequencies) {
+  gsl_rng* rng = get_rng();
+  for (int size = 2; size <= 512; size *= 4) {
+    d_vec pdf(size), cdf(size);
+    double total = 0;
+    for (int i = 0; i < size; ++i) {
+      pdf[i] = (i % 3 == 1) ? 0 : gsl_rng_uniform(rng) + 1.0 / (i + 1);
+      total += pdf[i];
+      cdf[i] = total;
+    }
+    AliasTable alias(&pdf[0], size);
+    int numSamples = std::max(100000, 100 * size);
+    for (int method = 0; method < 4; ++method) {
+      d_vec counts(size, 0);
+      for (int i = 0; i < numSamples; ++i) {
+        int x;
+        if (method == 0) {
+          x = sample_unnormalized_pdf(rng, &pdf[0], size);
+        } else if (method == 1) {
+          x = sample_unnormalized_pdf(rng, &pdf[0], size, total);
+        } else if (method == 2) {
+          x = sample_unnormalized_cdf(rng, &cdf[0], size);
+        } else {
+          x = alias.sample(rng);
+        }
+        BOOST_REQUIRE(x >= 0 && x < size);
+        counts[x] += 1;
+      }
+      // chi-square statistic of the frequencies, which should be within a few
+      // standard deviations of the degrees of freedom; outcomes of
+      // probability 0 are never drawn
+      double chiSquare = 0;
+      int numNonZero = 0;
+      for (int i = 0; i < size; ++i) {
+        double expected = numSamples * pdf[i] / total;
+        if (expected == 0) {
+          BOOST_CHECK_EQUAL(counts[i], 0);
+        } else {
+          double error = counts[i] - expected;
+          chiSquare += error * error / expected;
+          ++numNonZero;
+        }
+      }
+      double dof = std::max(1, numNonZero - 1);
+      BOOST_CHECK_LT(chiSquare, dof + 5 * sqrt(2 * dof));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <boost/test/unit_test.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace gatsby::libplump;
+
+
+namespace {
+
+/**
+ * Compute ratios with stirling_generator_full_log for pseudo-random
+ * (discount, c, t) triples and count those that differ from the reference
+ * tables; used from several threads at once.
+ */
+struct StirlingCheck {
+  const d_vec* discounts;
+  const std::vector<stirling_ratio_table>* reference;
+  int maxC;
+  int mismatches;
+
+  void operator()(int thread, l_type begin, l_type end) {
+    for (l_type i = begin; i < end; ++i) {
+      int k = i % discounts->size();
+      int c = 2 + (int)(((long)i * 7919) % (maxC - 1));
+      int t = 2 + (int)(((long)i * 31) % (c - 1));
+      stirling_generator_full_log generator((*discounts)[k], c, t);
+      if (generator.ratio(c, t) != (*reference)[k].ratio(c, t)) {
+        __sync_fetch_and_add(&mismatches, 1);
+      }
+    }
+  }
+};
+
+} // namespace
+
+
+BOOST_AUTO_TEST_SUITE(stirling)
+
+BOOST_AUTO_TEST_CASE(cached_ratios_equal_reference_tables) {
+  stirling_table_cache& cache = stirling_table_cache::instance();
+  const double d[] = {0.05, 0.3, 0.5, 0.7, 0.8, 0.9, 0.95, 0.95 * 0.8};
+  d_vec discounts(d, d + 8);
+  int maxC = 300;
+  std::vector<stirling_ratio_table> reference;
+  for (size_t k = 0; k < discounts.size(); ++k) {
+    reference.push_back(stirling_ratio_table(discounts[k], maxC));
+  }
+
+  // the second setting holds at most three tables that do not all fit, so
+  // that almost every lookup misses
+  size_t limits[][2] = {{1 << 24, 1 << 16}, {50000, 3}};
+  l_type numRatios[] = {50000, 2000};
+  for (int l = 0; l < 2; ++l) {
+    for (int threads = 1; threads <= 4; threads += 3) {
+      cache.clear();
+      cache.setLimits(limits[l][0], limits[l][1]);
+      StirlingCheck check = {&discounts, &reference, maxC, 0};
+      parallelFor(0, numRatios[l], threads, check, 10);
+      BOOST_CHECK_EQUAL(check.mismatches, 0);
+    }
+  }
+  cache.clear();
+  cache.setLimits(limits[0][0], limits[0][1]);
+}
+
+BOOST_AUTO_TEST_CASE(ratio_table_equals_log_table) {
+  const double discounts[] = {0.1, 0.5, 0.95};
+  const int c = 1000;
+  for (int k = 0; k < 3; ++k) {
+    double d = discounts[k];
+    d_vec_vec logTable = log_gen_stirling_table(d, c);
+    stirling_ratio_table ratioTable(d, c);
+    double maxRel = 0;
+    for (int cc = 3; cc <= c; ++cc) {
+      for (int tt = 2; tt < cc; ++tt) {
+        double expected = exp(log_get_stirling_from_table(logTable, cc - 1, 
+                                                          tt - 1)
+                              - log_get_stirling_from_table(logTable, cc, tt));
+        maxRel = std::max(maxRel, fabs(ratioTable.ratio(cc, tt) - expected)
+                                  / expected);
+      }
+    }
+    BOOST_CHECK_SMALL(maxRel, 1e-9);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(approximation_is_close_to_exact_ratios) {
+  // rows of log S_d(c,t), computed exactly with the recursion up to c = 4096
+  const double discounts[] = {0.1, 0.5, 0.9};
+  const int maxC = 4096;
+  for (int k = 0; k < 3; ++k) {
+    double d = discounts[k];
+    d_vec prev(maxC + 1, -INFINITY), cur(maxC + 1, -INFINITY);
+    prev[0] = 0;
+    for (int c = 1; c <= maxC; ++c) {
+      cur[0] = -INFINITY;
+      for (int t = 1; t < c; ++t) {
+        cur[t] = fast_logsumexp(prev[t - 1], log(c - 1 - t * d) + prev[t]);
+      }
+      cur[c] = 0;
+      if (c == 1024 || c == maxC) {
+        double maxAbs = 0;
+        for (int t = 2; t < c; ++t) {
+          double exact = exp(prev[t - 1] - cur[t]);
+          maxAbs = std::max(maxAbs,
+                            fabs(gen_stirling_ratio_approx(d, c, t) - exact));
+        }
+        BOOST_CHECK_SMALL(maxAbs, 5e-3);
+      }
+      prev.swap(cur);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
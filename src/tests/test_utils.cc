@@ -0,0 +1,128 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tests/test_utils.h"
+
+#include <cmath>
+#include <sstream>
+#include <unistd.h>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace gatsby { namespace libplump { namespace test {
+
+namespace {
+
+/**
+ * Linear congruential generator; good enough for test data and does not
+ * depend on the global RNG.
+ */
+class TestGenerator {
+  public:
+    TestGenerator(unsigned int seed) : state(seed * 2654435761u + 1) {}
+
+    unsigned int next(unsigned int n) {
+      state = state * 1664525u + 1013904223u;
+      return (state >> 8) % n;
+    }
+
+  private:
+    unsigned int state;
+};
+
+} // namespace
+
+
+void makeSequence(l_type length, unsigned int seed, seq_type& seq) {
+  TestGenerator generator(seed);
+  seq.clear();
+  while ((l_type)seq.size() < length) {
+    if (seq.size() > 10 && generator.next(4) != 0) {
+      // copy an earlier stretch of 2 to 20 symbols
+      l_type from = generator.next(seq.size() - 1);
+      l_type copyLength = 2 + generator.next(19);
+      for (l_type i = 0; i < copyLength && (l_type)seq.size() < length; ++i) {
+        seq.push_back(seq[from + i]);
+      }
+    } else {
+      // the smaller types are more likely
+      seq.push_back(generator.next(1 + generator.next(NUM_TYPES)));
+    }
+  }
+}
+
+
+d_vec defaultDiscounts() {
+  const double discounts[] = {0.05, 0.7, 0.8, 0.82, 0.84, 0.88, 0.91, 0.92,
+                              0.93, 0.94, 0.95};
+  return d_vec(discounts, discounts + 11);
+}
+
+
+double maxAbsDiff(const d_vec& a, const d_vec& b) {
+  if (a.size() != b.size()) {
+    return INFINITY;
+  }
+  double maxDiff = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    maxDiff = std::max(maxDiff, fabs(a[i] - b[i]));
+  }
+  return maxDiff;
+}
+
+
+IAddRemoveRestaurant* makeRestaurant(int type) {
+  switch(type) {
+    case 0:
+      return new KneserNeyRestaurant();
+    case 1:
+      return new SimpleFullRestaurant();
+    case 2:
+      return new HistogramRestaurant();
+    case 3:
+      return new ReinstantiatingCompactRestaurant();
+    case 4:
+      return new StirlingCompactRestaurant();
+  }
+  return NULL;
+}
+
+
+void resetRNG() {
+  free_rng();
+  init_rng();
+}
+
+
+TemporaryFile::TemporaryFile() {
+  static int counter = 0;
+  std::ostringstream name;
+  name << "libplump_test_" << getpid() << "_" << counter++;
+  filename = (fs::temp_directory_path() / name.str()).string();
+}
+
+
+TemporaryFile::~TemporaryFile() {
+  boost::system::error_code error;
+  fs::remove(fs::path(filename), error);
+}
+
+}}} // namespace gatsby::libplump::test
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TESTS_TEST_UTILS_H_
+#define TESTS_TEST_UTILS_H_
+
+#include <string>
+#include <boost/scoped_ptr.hpp>
+
+#include <libplump/libplump.h>
+
+namespace gatsby { namespace libplump { namespace test {
+
+/**
+ * Number of types of the sequences returned by makeSequence.
+ */
+const int NUM_TYPES = 16;
+
+/**
+ * Fill seq with length symbols in [0, NUM_TYPES) from a fixed generator
+ * (independent of the global RNG): mostly copies of earlier stretches of the
+ * sequence, so that the context tree gets deep, with skewed random symbols
+ * in between. Sequences with different seeds are different.
+ */
+void makeSequence(l_type length, unsigned int seed, seq_type& seq);
+
+/**
+ * Discounts as used by score_file and benchmark by default.
+ */
+d_vec defaultDiscounts();
+
+const double DEFAULT_ALPHA = 5.0;
+
+double maxAbsDiff(const d_vec& a, const d_vec& b);
+
+/**
+ * Restaurant of the given type (0: KneserNey, 1: SimpleFull, 2: Histogram,
+ * 3: ReinstantiatingCompact, 4: StirlingCompact); the caller owns it.
+ */
+IAddRemoveRestaurant* makeRestaurant(int type);
+
+/**
+ * A model with its own restaurant, node manager and parameters on the given
+ * sequence, which must outlive it. The model is untrained.
+ */
+template <class NodeManager = SimpleNodeManager>
+class TestModel {
+  public:
+    TestModel(seq_type& seq, IAddRemoveRestaurant* restaurant,
+              IParameters* parameters = NULL)
+        : restaurant(restaurant),
+          nodeManager(restaurant->getFactory()),
+          parameters(parameters != NULL
+                         ? parameters
+                         : new SimpleParameters(defaultDiscounts(),
+                                                DEFAULT_ALPHA)),
+          model(seq, nodeManager, *restaurant, *this->parameters,
+                NUM_TYPES) {}
+
+    boost::scoped_ptr<IAddRemoveRestaurant> restaurant;
+    NodeManager nodeManager;
+    boost::scoped_ptr<IParameters> parameters;
+    HPYPModel model;
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TestModel);
+};
+
+/**
+ * Reseed the global RNG, so that runs that sample are reproducible.
+ */
+void resetRNG();
+
+/**
+ * A file name in the temporary directory that is removed when the object
+ * goes out of scope.
+ */
+class TemporaryFile {
+  public:
+    TemporaryFile();
+    ~TemporaryFile();
+
+    const std::string& name() const {
+      return filename;
+    }
+
+  private:
+    std::string filename;
+
+    DISALLOW_COPY_AND_ASSIGN(TemporaryFile);
+};
+
+}}} // namespace gatsby::libplump::test
+
+#endif
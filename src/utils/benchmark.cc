@@ -0,0 +1,1608 @@
+/*
+ * Copyright 2009, 2010 Jan Gasthaus (j.gasthaus@gatsby.ucl.ac.uk)
+ *
+ * This file is part of libPLUMP.
+ *
+ * libPLUMP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libPLUMP is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libPLUMP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro benchmarks for the performance critical parts of the library. Each
+ * benchmark is a command given as the first positional argument; all of them
+ * train a model on the input file first (see --help for the options).
+ * The benchmarks only measure; the results they time are checked by the
+ * unit tests in src/tests.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+#include <sys/time.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/pool/pool.hpp>
+
+#include <libplump/libplump.h>
+
+using namespace std;
+using namespace gatsby::libplump;
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+static unsigned int num_types = 256;
+
+/**
+ * Number of calls to operator new so far, and the number of bytes currently
+ * allocated through it; used by the allocations benchmark.
+ */
+static unsigned long num_allocations = 0;
+static long num_live_bytes = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+  __sync_fetch_and_add(&num_allocations, 1);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  __sync_fetch_and_add(&num_live_bytes, (long)malloc_usable_size(p));
+  return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+  return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+  if (p != NULL) {
+    __sync_fetch_and_sub(&num_live_bytes, (long)malloc_usable_size(p));
+  }
+  free(p);
+}
+
+void operator delete[](void* p) throw() {
+  operator delete(p);
+}
+
+/**
+ * Wall clock time in seconds.
+ */
+double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+IAddRemoveRestaurant* makeRestaurant(int type) {
+  switch(type) {
+    case 0:
+      return new KneserNeyRestaurant();
+    case 1:
+      return new SimpleFullRestaurant();
+    case 2:
+      return new HistogramRestaurant();
+    case 3:
+      return new ReinstantiatingCompactRestaurant();
+    case 4:
+      return new StirlingCompactRestaurant();
+  }
+  cout << "Unknown restaurant type (--restaurant)!";
+  exit(1);
+}
+
+
+IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
+  IAddRemoveRestaurant* restaurant = makeRestaurant(vm["restaurant"].as<int>());
+  if (vm["implicit-leaves"].as<int>() == 1) {
+    return new ImplicitPayloadRestaurant(restaurant);
+  }
+  return restaurant;
+}
+
+
+void pushFileToSeq(po::variables_map& vm, std::string filename, seq_type& seq) {
+  if (vm.count("read-int32")) {
+    pushFileToVec<int>(filename, seq, vm["head"].as<int>());
+  } else {
+    pushFileToVec<unsigned char>(filename, seq, vm["head"].as<int>());
+  }
+}
+
+
+/**
+ * Holds a model trained on the input file, followed by the test data (if
+ * any) in the same sequence. Predictions are made on [testStart, seq.size()).
+ */
+class TrainedModel {
+  public:
+    TrainedModel(po::variables_map& vm)
+        : parameters(new SimpleParameters(vm["disc"].as<d_vec>(),
+                                          vm["alpha"].as<double>())),
+          restaurant(getRestaurant(vm)),
+          nodeManager(new SimpleNodeManager(restaurant->getFactory())) {
+      pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+      model.reset(new HPYPModel(seq, *nodeManager, *restaurant, *parameters,
+                                num_types));
+      double t = wallTime();
+      losses = model->computeLosses(0, seq.size());
+      trainingTime = wallTime() - t;
+      for (int i = 0; i < vm["burn-in"].as<int>(); ++i) {
+        model->runGibbsSampler();
+      }
+      testStart = 0;
+      if (vm.count("test-file")) {
+        testStart = seq.size();
+        pushFileToSeq(vm, vm["test-file"].as<string>(), seq);
+      }
+      cout << "Training length: " << (testStart > 0 ? testStart : seq.size())
+           << ", training time: " << trainingTime << "s" << endl;
+    }
+
+    seq_type seq;
+    boost::scoped_ptr<IParameters> parameters;
+    boost::scoped_ptr<IAddRemoveRestaurant> restaurant;
+    boost::scoped_ptr<INodeManager> nodeManager;
+    boost::scoped_ptr<HPYPModel> model;
+    d_vec losses;
+    l_type testStart;
+    double trainingTime;
+};
+
+
+/**
+ * Compare prediction throughput of the live model with that of a frozen
+ * copy.
+ */
+void benchmarkFrozen(po::variables_map& vm) {
+  TrainedModel trained(vm);
+  HPYPModel& model = *trained.model;
+  int repeat = vm["repeat"].as<int>();
+  l_type start = trained.testStart;
+  l_type stop = trained.seq.size();
+
+  double t = wallTime();
+  FrozenHPYPModel frozen(model);
+  cout << "Freezing time: " << wallTime() - t << "s, nodes: "
+       << frozen.getNumNodes() << ", bytes: " << frozen.getMemoryUsage()
+       << endl;
+
+  const char* names[] = {"above", "below"};
+  for (int mode = 0; mode < 2; ++mode) {
+    d_vec live, frozenProbs;
+    double liveTime = 0, frozenTime = 0;
+    for (int r = 0; r < repeat; ++r) {
+      t = wallTime();
+      live = model.predictSequence(
+          start, stop, mode == 0 ? HPYPModel::ABOVE : HPYPModel::BELOW);
+      liveTime += wallTime() - t;
+      t = wallTime();
+      frozenProbs = frozen.predictSequence(
+          start, stop,
+          mode == 0 ? FrozenHPYPModel::ABOVE : FrozenHPYPModel::BELOW);
+      frozenTime += wallTime() - t;
+    }
+    double n = (double)live.size() * repeat;
+    cout << "predict " << names[mode] << ": live "
+         << n / liveTime << " preds/sec, frozen "
+         << n / frozenTime << " preds/sec, speedup "
+         << liveTime / frozenTime << ", loss "
+         << prob2loss<double>(frozenProbs) << endl;
+  }
+
+  l_type numDistributions = std::min(stop - start,
+                                     (l_type)vm["distributions"].as<int>());
+  double liveTime = 0, frozenTime = 0;
+  for (l_type i = stop - numDistributions; i < stop; ++i) {
+    t = wallTime();
+    model.predictiveDistribution(start, i);
+    liveTime += wallTime() - t;
+    t = wallTime();
+    frozen.predictiveDistribution(start, i);
+    frozenTime += wallTime() - t;
+  }
+  cout << "predictiveDistribution: live " << numDistributions / liveTime
+       << " dists/sec, frozen " << numDistributions / frozenTime
+       << " dists/sec, speedup " << liveTime / frozenTime << endl;
+}
+
+
+/**
+ * Save a frozen model, map it back in and compare the time to first
+ * prediction with that of the in-memory frozen model.
+ */
+void benchmarkMmap(po::variables_map& vm) {
+  TrainedModel trained(vm);
+  string filename = vm["model-file"].as<string>();
+  l_type start = trained.testStart;
+  l_type stop = trained.seq.size();
+
+  FrozenHPYPModel frozen(*trained.model);
+  double t = wallTime();
+  if (!frozen.save(filename)) {
+    exit(1);
+  }
+  cout << "Saving time: " << wallTime() - t << "s, file size: "
+       << fs::file_size(fs::path(filename)) << endl;
+
+  t = wallTime();
+  boost::scoped_ptr<FrozenHPYPModel> mappedPtr(
+      FrozenHPYPModel::load(filename, trained.seq));
+  if (!mappedPtr) {
+    exit(1);
+  }
+  const FrozenHPYPModel& mapped = *mappedPtr;
+  double loadTime = wallTime() - t;
+  mapped.predict(start, stop - 1, trained.seq[stop - 1]);
+  cout << "Mapping time: " << loadTime << "s, time to first prediction: "
+       << wallTime() - t << "s" << endl;
+
+  t = wallTime();
+  frozen.predictSequence(start, stop);
+  double inMemoryTime = wallTime() - t;
+  t = wallTime();
+  mapped.predictSequence(start, stop);
+  double fromFileTime = wallTime() - t;
+  cout << "predict: in memory " << (stop - start) / inMemoryTime
+       << " preds/sec, mapped " << (stop - start) / fromFileTime
+       << " preds/sec" << endl;
+}
+
+
+/**
+ * Count the heap allocations per symbol made while training and predicting.
+ * Prediction in a model whose buffers have grown to the depth of the tree
+ * should not allocate at all; training allocates only for new nodes and
+ * restaurant entries.
+ */
+void benchmarkAllocations(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  l_type length = seq.size();
+  if (vm.count("test-file")) {
+    pushFileToSeq(vm, vm["test-file"].as<string>(), seq);
+  }
+  SimpleParameters parameters(vm["disc"].as<d_vec>(),
+                              vm["alpha"].as<double>());
+  long liveBefore = num_live_bytes;
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
+  SimpleNodeManager nodeManager(restaurant->getFactory());
+  HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+
+  unsigned long before = num_allocations;
+  double t = wallTime();
+  model.computeLosses(0, length);
+  double trainingTime = wallTime() - t;
+  cout << "train: " << (double)(num_allocations - before) / length
+       << " allocations/symbol, " << length / trainingTime
+       << " symbols/sec, " << (double)(num_live_bytes - liveBefore) / length
+       << " bytes/symbol" << endl;
+
+  l_type start = vm.count("test-file") ? length : 0;
+  l_type stop = seq.size();
+  // one pass to grow the buffers to the depth of the tree
+  for (l_type i = start; i < stop; ++i) {
+    model.predict(start, i, seq[i]);
+    model.predictBelow(start, i, seq[i]);
+  }
+
+  const char* names[] = {"predict", "predictBelow"};
+  for (int mode = 0; mode < 2; ++mode) {
+    double sum = 0;
+    before = num_allocations;
+    t = wallTime();
+    for (l_type i = start; i < stop; ++i) {
+      sum += mode == 0 ? model.predict(start, i, seq[i])
+                       : model.predictBelow(start, i, seq[i]);
+    }
+    double time = wallTime() - t;
+    unsigned long allocations = num_allocations - before;
+    cout << names[mode] << ": " << (double)allocations / (stop - start)
+         << " allocations/symbol, " << (stop - start) / time
+         << " preds/sec (checksum " << sum << ")" << endl;
+  }
+
+  HPYPModel::PathBuffers buffers;
+  for (l_type i = start; i < stop; ++i) {
+    model.predict(start, i, seq[i], buffers);
+  }
+  before = num_allocations;
+  for (l_type i = start; i < stop; ++i) {
+    model.predict(start, i, seq[i], buffers);
+  }
+  cout << "predict (caller buffers): "
+       << (double)(num_allocations - before) / (stop - start)
+       << " allocations/symbol" << endl;
+}
+
+
+/**
+ * Compare the single pass predictive distribution (with and without mixing)
+ * with computing the probability of each type separately.
+ */
+void benchmarkDistribution(po::variables_map& vm) {
+  TrainedModel trained(vm);
+  HPYPModel& model = *trained.model;
+  l_type start = trained.testStart;
+  l_type stop = trained.seq.size();
+  l_type numDistributions = std::min(stop - start,
+                                     (l_type)vm["distributions"].as<int>());
+  d_vec mixingWeights(4, 0.1);
+
+  HPYPModel::PathBuffers buffers;
+  d_vec distribution, mixture;
+  double singlePassTime = 0, mixingTime = 0, perTypeTime = 0;
+  for (l_type i = stop - numDistributions; i < stop; ++i) {
+    double t = wallTime();
+    model.predictiveDistribution(start, i, distribution, buffers);
+    singlePassTime += wallTime() - t;
+    t = wallTime();
+    model.predictiveDistributionWithMixing(start, i, mixingWeights, mixture,
+                                           buffers);
+    mixingTime += wallTime() - t;
+    t = wallTime();
+    for (unsigned int type = 0; type < num_types; ++type) {
+      distribution[type] = model.predict(start, i, type, buffers);
+    }
+    perTypeTime += wallTime() - t;
+  }
+  cout << "predictiveDistribution: per type " << numDistributions / perTypeTime
+       << " dists/sec, single pass " << numDistributions / singlePassTime
+       << " dists/sec (speedup " << perTypeTime / singlePassTime 
+       << "), with mixing " << numDistributions / mixingTime 
+       << " dists/sec" << endl;
+}
+
+
+/**
+ * Compare serial with multithreaded prediction of the test sequence using
+ * the live and the frozen model, and with fragmentation (Kneser-Ney only).
+ */
+void benchmarkThreads(po::variables_map& vm) {
+  TrainedModel trained(vm);
+  HPYPModel& model = *trained.model;
+  FrozenHPYPModel frozen(model);
+  int numThreads = vm["threads"].as<int>();
+  int repeat = vm["repeat"].as<int>();
+  l_type start = trained.testStart;
+  l_type stop = trained.seq.size();
+  double n = (double)(stop - start) * repeat;
+
+  const char* names[] = {"above", "below", "frozen above", "frozen below"};
+  for (int mode = 0; mode < 4; ++mode) {
+    double time[2] = {0, 0};
+    for (int r = 0; r < repeat; ++r) {
+      // k = 0: serial, k = 1: numThreads threads
+      for (int k = 0; k < 2; ++k) {
+        int threads = (k == 0) ? 1 : numThreads;
+        double t = wallTime();
+        if (mode < 2) {
+          model.predictSequence(
+              start, stop, mode == 0 ? HPYPModel::ABOVE : HPYPModel::BELOW,
+              threads);
+        } else {
+          frozen.predictSequence(
+              start, stop,
+              mode == 2 ? FrozenHPYPModel::ABOVE : FrozenHPYPModel::BELOW,
+              threads);
+        }
+        time[k] += wallTime() - t;
+      }
+    }
+    cout << "predict " << names[mode] << ": 1 thread "
+         << n / time[0] << " preds/sec, " << numThreads << " threads "
+         << n / time[1] << " preds/sec, speedup "
+         << time[0] / time[1] << endl;
+  }
+
+  if (vm["restaurant"].as<int>() != 0) {
+    // sampling the fragmentation currently fails an assertion in
+    // sample_unnormalized_pdf for the restaurants with table counts
+    return;
+  }
+  double t = wallTime();
+  model.predictSequence(start, stop, HPYPModel::FRAGMENT);
+  double serialTime = wallTime() - t;
+  t = wallTime();
+  model.predictSequence(start, stop, HPYPModel::FRAGMENT, numThreads);
+  double threadsTime = wallTime() - t;
+  cout << "predict fragment: 1 thread " << (stop - start) / serialTime
+       << " preds/sec, " << numThreads << " threads "
+       << (stop - start) / threadsTime << " preds/sec" << endl;
+}
+
+
+/**
+ * Throughput of the counter-based generator and of the default GSL
+ * generator.
+ */
+void benchmarkRNG(po::variables_map& vm) {
+  const int numDraws = 10000000;
+  RNG counter(1);
+  gsl_rng* generators[] = {global_rng, counter.get()};
+  for (int g = 0; g < 2; ++g) {
+    double sum = 0;
+    double t = wallTime();
+    for (int i = 0; i < numDraws; ++i) {
+      sum += gsl_rng_uniform(generators[g]);
+    }
+    cout << gsl_rng_name(generators[g]) << ": " 
+         << numDraws / (wallTime() - t) << " draws/sec, mean "
+         << sum / numDraws << endl;
+  }
+}
+
+
+/**
+ * Time Gibbs sweeps with the serial sampler and with the parallel sampler
+ * for 1 to --threads threads.
+ */
+void benchmarkGibbs(po::variables_map& vm) {
+  int numThreads = vm["threads"].as<int>();
+  int splitDepth = vm["split-depth"].as<int>();
+  int sweeps = vm["sweeps"].as<int>();
+  for (int threads = 0; threads <= numThreads; ++threads) {
+    // threads == 0: serial sampler
+    TrainedModel trained(vm);
+    HPYPModel& model = *trained.model;
+    double t = wallTime();
+    for (int i = 0; i < sweeps; ++i) {
+      if (threads == 0) {
+        model.runGibbsSampler();
+      } else {
+        model.runParallelGibbsSampler(threads, splitDepth);
+      }
+    }
+    double time = (wallTime() - t) / sweeps;
+    d_vec probs = model.predictSequence(trained.testStart, trained.seq.size());
+    if (threads == 0) {
+      cout << "serial: ";
+    } else {
+      cout << threads << " threads (split depth " << splitDepth << "): ";
+    }
+    cout << time << " s/sweep, loss " << prob2loss<double>(probs) << endl;
+  }
+}
+
+
+/**
+ * Fill many maps of the given type with mapSize keys each and look all keys
+ * up again; prints the time per operation, the heap allocations per map and
+ * the number of keys found (so that the lookups are not optimized away).
+ */
+template <typename Map>
+void timeMaps(const string& name, int mapSize) {
+  int numMaps = 2000000 / std::max(mapSize, 1);
+  // keys are distinct within a map, in no particular order
+  int keyRange = std::max(1024, 4 * mapSize);
+  std::vector<e_type> keys(mapSize);
+  for (int k = 0; k < mapSize; ++k) {
+    keys[k] = (k * 97 + 13) % keyRange;
+  }
+
+  unsigned long before = num_allocations;
+  double t = wallTime();
+  std::vector<Map>* maps = new std::vector<Map>(numMaps);
+  for (int m = 0; m < numMaps; ++m) {
+    Map& map = (*maps)[m];
+    for (int k = 0; k < mapSize; ++k) {
+      map[keys[k]] = &map;
+    }
+  }
+  double insertTime = wallTime() - t;
+  double allocations = (double)(num_allocations - before) / numMaps;
+
+  t = wallTime();
+  long found = 0;
+  for (int m = 0; m < numMaps; ++m) {
+    const Map& map = (*maps)[m];
+    for (int k = 0; k < mapSize; ++k) {
+      found += (map.find(keys[k]) != map.end());
+    }
+    found += (map.find(-1) != map.end());
+  }
+  double findTime = wallTime() - t;
+  delete maps;
+
+  double n = (double)numMaps * std::max(mapSize, 1);
+  cout << "  " << name << ": insert " << 1e9 * insertTime / n 
+       << " ns, find " << 1e9 * findTime / ((double)numMaps * (mapSize + 1))
+       << " ns, " << allocations << " allocations/map, " << found 
+       << " found" << endl;
+}
+
+
+/**
+ * Compare InlineMiniMap and AdaptiveMiniMap with MiniMap and std::map for
+ * small to large maps.
+ */
+void benchmarkMaps(po::variables_map& vm) {
+  const int sizes[] = {0, 1, 2, 3, 4, 8, 32, 256, 4096};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    cout << "map size " << sizes[i] << ":" << endl;
+    timeMaps<std::map<e_type, void*> >("std::map", sizes[i]);
+    timeMaps<MiniMap<e_type, void*> >("MiniMap", sizes[i]);
+    timeMaps<InlineMiniMap<e_type, void*> >("InlineMiniMap", sizes[i]);
+    timeMaps<AdaptiveMiniMap<e_type, void*> >("AdaptiveMiniMap", sizes[i]);
+  }
+}
+
+
+/**
+ * Train a model with the given restaurant from a freshly seeded RNG and
+ * return the training time.
+ */
+double timeImplicit(po::variables_map& vm, seq_type& seq,
+                    IAddRemoveRestaurant* restaurantPtr) {
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(restaurantPtr);
+  SimpleNodeManager nodeManager(restaurant->getFactory());
+  SimpleParameters parameters(vm["disc"].as<d_vec>(),
+                              vm["alpha"].as<double>());
+  HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+  free_rng();
+  init_rng();
+  double t = wallTime();
+  model.computeLosses(0, seq.size());
+  return wallTime() - t;
+}
+
+
+/**
+ * Compare the training speed with and without implicit payloads for the
+ * leaves. The payload pools keep their memory, so compare the memory use 
+ * with separate runs of "allocations" with --implicit-leaves 0 and 1.
+ */
+void benchmarkImplicit(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  double length = seq.size();
+  const char* names[] = {"KneserNey", "SimpleFull", "Histogram",
+                         "ReinstantiatingCompact", "StirlingCompact"};
+  for (int type = 0; type < 5; ++type) {
+    double plain = timeImplicit(vm, seq, makeRestaurant(type));
+    double implicit = timeImplicit(
+        vm, seq, new ImplicitPayloadRestaurant(makeRestaurant(type)));
+    cout << names[type] << ": train " << length / plain << " -> "
+         << length / implicit << " symbols/sec" << endl;
+  }
+}
+
+
+/**
+ * Compute ratios with stirling_generator_full_log for pseudo-random
+ * (discount, c, t) triples; used from several threads at once by 
+ * benchmarkStirling.
+ */
+struct StirlingRatios {
+  const d_vec* discounts;
+  int maxC;
+
+  void operator()(int thread, l_type begin, l_type end) {
+    for (l_type i = begin; i < end; ++i) {
+      int k = i % discounts->size();
+      int c = 2 + (int)(((long)i * 7919) % (maxC - 1));
+      int t = 2 + (int)(((long)i * 31) % (c - 1));
+      stirling_generator_full_log generator((*discounts)[k], c, t);
+      generator.ratio(c, t);
+    }
+  }
+};
+
+
+/**
+ * Time removing customers from a StirlingCompactRestaurant payload with 
+ * numCustomers customers of each of 4 types without additional data, which 
+ * constructs a stirling_generator_full_log per call.
+ */
+double timeStirlingRemove(int numCustomers, double discount) {
+  StirlingCompactRestaurant restaurant;
+  void* payload = restaurant.getFactory().make();
+  for (int i = 0; i < 4 * numCustomers; ++i) {
+    restaurant.addCustomer(payload, i % 4, 0.01, discount, 1.0, NULL);
+  }
+  // fill the cache
+  restaurant.removeCustomer(payload, 0, discount, NULL);
+  restaurant.addCustomer(payload, 0, 0.01, discount, 1.0, NULL);
+  int numSteps = 1000;
+  double t = wallTime();
+  for (int i = 0; i < numSteps; ++i) {
+    restaurant.removeCustomer(payload, i % 4, discount, NULL);
+    restaurant.addCustomer(payload, i % 4, 0.01, discount, 1.0, NULL);
+  }
+  t = wallTime() - t;
+  restaurant.getFactory().recycle(payload);
+  return numSteps / t;
+}
+
+
+/**
+ * Print the time per call of gen_stirling_ratio_approx for all t at c 
+ * customers.
+ */
+void timeStirlingApproximation(double d, int c) {
+  double sum = 0;
+  double t = wallTime();
+  for (int tt = 2; tt < c; ++tt) {
+    sum += gen_stirling_ratio_approx(d, c, tt);
+  }
+  t = (wallTime() - t) / (c - 2);
+  cout << "approximation d=" << d << ", c=" << c << ": " << t * 1e6 
+       << " us/ratio (checksum " << sum << ")" << endl;
+}
+
+
+/**
+ * Time ratios from the shared Stirling table cache, serially and from
+ * several threads, also with limits that force evictions; then time
+ * customer removal with and without the cache, and with counts above the
+ * approximation threshold; time the approximation, and report the cache
+ * statistics after training with StirlingCompact restaurants.
+ */
+void benchmarkStirling(po::variables_map& vm) {
+  stirling_table_cache& cache = stirling_table_cache::instance();
+  const double d[] = {0.05, 0.3, 0.5, 0.7, 0.8, 0.9, 0.95, 0.95 * 0.8};
+  d_vec discounts(d, d + 8);
+  int maxC = 300;
+
+  int numThreads = vm["threads"].as<int>();
+  // the second setting holds at most three tables that do not all fit
+  size_t limits[][2] = {{1 << 24, 1 << 16}, {50000, 3}};
+  // almost every lookup misses with the second setting
+  l_type numRatios[] = {200000, 2000};
+  for (int l = 0; l < 2; ++l) {
+    for (int threads = 1; threads <= numThreads; threads += numThreads - 1) {
+      cache.clear();
+      cache.setLimits(limits[l][0], limits[l][1]);
+      StirlingRatios ratios = {&discounts, maxC};
+      double t = wallTime();
+      parallelFor(0, numRatios[l], threads, ratios, 10);
+      cout << "ratios with cache limits " << limits[l][0] << "/"
+           << limits[l][1] << ", " << threads << " threads: "
+           << numRatios[l] / (wallTime() - t) << " ratios/sec" << endl 
+           << "  " << cache.statsToString() << endl;
+      if (numThreads <= 1) {
+        break;
+      }
+    }
+  }
+
+  int sizes[] = {100, 300, 1000};
+  for (int s = 0; s < 3; ++s) {
+    cache.clear();
+    cache.setLimits(0, 0);
+    double uncached = timeStirlingRemove(sizes[s], 0.8);
+    cache.setLimits(1 << 24, 1 << 16);
+    double cached = timeStirlingRemove(sizes[s], 0.8);
+    cout << "remove with " << sizes[s] << " customers per type: " << uncached
+         << " -> " << cached << " removals/sec" << endl;
+  }
+
+  int threshold = stirling_generator_full_log::getApproximationThreshold();
+  int bigSizes[] = {threshold, 10 * threshold, 100 * threshold};
+  for (int s = 0; s < 3; ++s) {
+    cache.clear();
+    cout << "remove with " << bigSizes[s] << " customers per type: " 
+         << timeStirlingRemove(bigSizes[s], 0.8) << " removals/sec, "
+         << cache.statsToString() << endl;
+  }
+
+  const double approxD[] = {0.1, 0.3, 0.5, 0.7, 0.9, 0.95};
+  for (int k = 0; k < 6; ++k) {
+    timeStirlingApproximation(approxD[k], 4 * threshold);
+  }
+
+  cache.clear();
+  TrainedModel trained(vm);
+  trained.model->runGibbsSampler();
+  cout << "after training and one Gibbs sweep: " << cache.statsToString()
+       << endl;
+}
+
+
+/**
+ * Compare building Stirling tables with log_gen_stirling_table and with
+ * stirling_ratio_table for d in [0.1, 0.95]; then sweep over the rows up to
+ * 1e5 customers in linear memory (the full tables would need 40GB) with 
+ * both recursions.
+ */
+void benchmarkStirlingTable(po::variables_map& vm) {
+  const double discounts[] = {0.1, 0.3, 0.5, 0.7, 0.9, 0.95};
+  const int sizes[] = {1000, 4000};
+  for (int k = 0; k < 6; ++k) {
+    double d = discounts[k];
+    for (int s = 0; s < 2; ++s) {
+      int c = sizes[s];
+      double t = wallTime();
+      d_vec_vec logTable = log_gen_stirling_table(d, c);
+      double logTime = wallTime() - t;
+      t = wallTime();
+      stirling_ratio_table ratioTable(d, c);
+      double ratioTime = wallTime() - t;
+      cout << "table d=" << d << ", c=" << c << ": log " << logTime 
+           << " s, ratio " << ratioTime << " s (speedup " 
+           << logTime / ratioTime << ")" << endl;
+    }
+  }
+
+  const int maxC = 100000, maxLogC = 20000;
+  for (int k = 0; k < 6; ++k) {
+    double d = discounts[k];
+    // rows of q(c,t) = S_d(c,t-1)/S_d(c,t) and of log S_d(c,t)
+    d_vec prev(maxC + 1), cur(maxC + 1);
+    d_vec prevLog(maxLogC + 1, 0), curLog(maxLogC + 1, -INFINITY);
+    double t = wallTime();
+    for (int c = 1; c <= maxLogC; ++c) {
+      curLog[0] = -INFINITY;
+      for (int tt = 1; tt < c; ++tt) {
+        curLog[tt] = fast_logsumexp(prevLog[tt - 1], 
+                                    log(c - 1 - tt * d) + prevLog[tt]);
+      }
+      curLog[c] = 0;
+      prevLog.swap(curLog);
+    }
+    double logTime = wallTime() - t;
+    t = wallTime();
+    prev[0] = 0;
+    double ratioLogTime = 0;
+    for (int c = 2; c <= maxC; ++c) {
+      stirling_ratio_table::nextRow(d, c, &prev[0], &cur[0]);
+      prev.swap(cur);
+      if (c == maxLogC) {
+        ratioLogTime = wallTime() - t;
+      }
+    }
+    double ratioTime = wallTime() - t;
+    cout << "rows d=" << d << ": up to c=" << maxLogC << " log " << logTime 
+         << " s, ratio " << ratioLogTime << " s (speedup " 
+         << logTime / ratioLogTime << "); up to c=" << maxC << " ratio " 
+         << ratioTime << " s" << endl;
+  }
+}
+
+
+/**
+ * Time splitting a restaurant with a single table of c customers (the 
+ * parent only, so that the restaurant can be split repeatedly).
+ */
+template <typename Restaurant>
+double timeSplit(int c, double discountBeforeSplit, double discountAfterSplit,
+                 int numSplits) {
+  Restaurant restaurant;
+  const IPayloadFactory& factory = restaurant.getFactory();
+  void* payload = factory.make();
+  // joining the only table is certain without a parent probability
+  for (int i = 0; i < c; ++i) {
+    restaurant.addCustomer(payload, 0, 0.0, discountBeforeSplit, 1.0, NULL);
+  }
+  double t = wallTime();
+  for (int i = 0; i < numSplits; ++i) {
+    void* parent = factory.make();
+    restaurant.updateAfterSplit(payload, parent, discountBeforeSplit,
+                                discountAfterSplit, true);
+    factory.recycle(parent);
+  }
+  t = wallTime() - t;
+  factory.recycle(payload);
+  return t / numSplits;
+}
+
+
+/**
+ * Time the fragmentation samplers used when splitting nodes and the splits
+ * of SimpleFullRestaurant and HistogramRestaurant for tables of 10 to 100000
+ * customers.
+ */
+void benchmarkSplit(po::variables_map& vm) {
+  // the split of a node with discount d1 d2 fragments each table with a 
+  // CRP(d1, -d1 d2)
+  const double discounts[] = {0.5, 0.9};
+  std::vector<int> arrangement, customerTables;
+  for (int k = 0; k < 2; ++k) {
+    double d = discounts[k];
+    for (int c = 10; c <= 100000; c *= 10) {
+      int numSamples = std::max(1, 1000000 / c);
+      double t = wallTime();
+      for (int i = 0; i < numSamples; ++i) {
+        sample_crp_c(d, -d * d, c, arrangement, customerTables);
+      }
+      double rejectionTime = (wallTime() - t) / numSamples;
+      t = wallTime();
+      for (int i = 0; i < numSamples; ++i) {
+        sample_crp_c_tables(d, -d * d, c);
+      }
+      double tablesTime = (wallTime() - t) / numSamples;
+      cout << "fragment table of " << c << " customers, d=" << d << ": ";
+      // the reference implementation is quadratic
+      if (c <= 10000) {
+        int numPdfSamples = std::max(1, numSamples / 100);
+        t = wallTime();
+        for (int i = 0; i < numPdfSamples; ++i) {
+          sample_crp_c_pdf(d, -d * d, c);
+        }
+        double pdfTime = (wallTime() - t) / numPdfSamples;
+        cout << "pdf " << pdfTime * 1e6 << " us, ";
+      }
+      cout << "rejection " << rejectionTime * 1e6 << " us, tables only " 
+           << tablesTime * 1e6 << " us; split SimpleFullRestaurant " 
+           << timeSplit<SimpleFullRestaurant>(c, d * d, d, numSamples) * 1e6
+           << " us, HistogramRestaurant " 
+           << timeSplit<HistogramRestaurant>(c, d * d, d, numSamples) * 1e6
+           << " us" << endl;
+    }
+  }
+}
+
+
+/**
+ * The previous implementation of sample_unnormalized_pdf, which copies the
+ * PDF and builds and searches its CDF, as a baseline.
+ */
+int sampleCopiedPdf(gsl_rng* rng, std::vector<double> pdf) {
+  for (int i = 0; i + 1 < (int)pdf.size(); ++i) {
+    pdf[i+1] += pdf[i];
+  }
+  double z = gsl_rng_uniform_pos(rng) * pdf.back();
+  return std::lower_bound(pdf.begin(), pdf.end(), z) - pdf.begin();
+}
+
+
+/**
+ * Time the discrete samplers for supports of 2 to 4096 outcomes (the PDF is
+ * refilled before each draw, as in the restaurants, except for the alias 
+ * table and the CDF, which are built once and sampled repeatedly).
+ */
+void benchmarkSampling(po::variables_map& vm) {
+  const int numDraws = 200000;
+  gsl_rng* rng = get_rng();
+  for (int size = 2; size <= 4096; size *= 4) {
+    d_vec pdf(size), cdf(size);
+    double total = 0;
+    for (int i = 0; i < size; ++i) {
+      pdf[i] = (i % 3 == 1) ? 0 : gsl_rng_uniform(rng) + 1.0 / (i + 1);
+      total += pdf[i];
+      cdf[i] = total;
+    }
+    AliasTable alias(&pdf[0], size);
+    int numSamples = std::max(numDraws, 100 * size);
+    double times[5];
+    long checksum = 0;
+    for (int method = 0; method < 5; ++method) {
+      double t = wallTime();
+      for (int i = 0; i < numSamples; ++i) {
+        int x;
+        if (method == 0) {
+          x = sampleCopiedPdf(rng, pdf);
+        } else if (method == 1) {
+          x = sample_unnormalized_pdf(rng, &pdf[0], size);
+        } else if (method == 2) {
+          x = sample_unnormalized_pdf(rng, &pdf[0], size, total);
+        } else if (method == 3) {
+          x = sample_unnormalized_cdf(rng, &cdf[0], size);
+        } else {
+          x = alias.sample(rng);
+        }
+        checksum += x;
+      }
+      times[method] = (wallTime() - t) / numSamples;
+    }
+    cout << size << " outcomes: copy " << times[0] * 1e9 << " ns, two-pass " 
+         << times[1] * 1e9 << " ns, known total " << times[2] * 1e9 
+         << " ns, CDF " << times[3] * 1e9 << " ns, alias " 
+         << times[4] * 1e9 << " ns per draw (checksum " << checksum << ")" 
+         << endl;
+  }
+}
+
+
+/**
+ * Online prediction and training through the context-based methods of
+ * HPYPModel, with the interface of StreamingSession.
+ */
+class ContextStream {
+  public:
+    ContextStream(HPYPModel& model, seq_type& seq)
+        : model(model), seq(seq) {}
+
+    void peek(d_vec& distribution) {
+      model.predictiveDistribution(0, seq.size(), distribution, buffers);
+    }
+
+    double push(e_type symbol) {
+      seq.push_back(symbol);
+      if (seq.size() == 1) {
+        model.insertRoot(symbol);
+        return 1.0 / num_types;
+      }
+      d_vec path = model.insertContextAndObservation(0, seq.size() - 1,
+                                                     symbol);
+      return path[path.size() - 2];
+    }
+
+  private:
+    HPYPModel& model;
+    seq_type& seq;
+    HPYPModel::PathBuffers buffers;
+};
+
+
+/**
+ * Feed data to a fresh model one symbol at a time using a Session,
+ * computing the predictive distribution before each symbol; returns the
+ * losses and adds the time taken to time.
+ */
+template <class Session>
+d_vec runStreaming(po::variables_map& vm, const seq_type& data,
+                   double& time) {
+  seq_type seq;
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
+  SimpleNodeManager nodeManager(restaurant->getFactory());
+  SimpleParameters parameters(vm["disc"].as<d_vec>(),
+                              vm["alpha"].as<double>());
+  HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+  free_rng();
+  init_rng();
+  Session session(model, seq);
+  d_vec losses, distribution;
+  double t = wallTime();
+  for (size_t i = 0; i < data.size(); ++i) {
+    session.peek(distribution);
+    losses.push_back(-gatsby::libplump::log2(session.push(data[i])));
+  }
+  time += wallTime() - t;
+  return losses;
+}
+
+
+/**
+ * Adapts StreamingSession to the constructor used by runStreaming.
+ */
+struct CursorStream : public StreamingSession {
+  CursorStream(HPYPModel& model, seq_type& seq) : StreamingSession(model) {}
+};
+
+
+/**
+ * Compare online prediction and training with a StreamingSession to doing
+ * the same through the context-based methods of HPYPModel, which search
+ * the tree from the root for every distribution.
+ */
+void benchmarkStreaming(po::variables_map& vm) {
+  seq_type data;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), data);
+  int repeat = vm["repeat"].as<int>();
+
+  double contextTime = 0, cursorTime = 0;
+  d_vec losses;
+  for (int r = 0; r < repeat; ++r) {
+    runStreaming<ContextStream>(vm, data, contextTime);
+    losses = runStreaming<CursorStream>(vm, data, cursorTime);
+  }
+  double n = (double)data.size() * repeat;
+  cout << "streaming: context " << n / contextTime << " symbols/sec, cursor "
+       << n / cursorTime << " symbols/sec, speedup "
+       << contextTime / cursorTime << ", loss " << mean(losses) << endl;
+}
+
+
+struct BudgetRun {
+  double loss;
+  double time;
+  size_t numNodes;
+  size_t numEvictions;
+};
+
+
+/**
+ * Train a model on seq with the given node budget and node manager (the
+ * budget is enforced after every symbol).
+ */
+template <class NodeManager>
+void runBudget(po::variables_map& vm, seq_type& seq, size_t maxNodes,
+               HPYPModel::EvictionPolicy policy, BudgetRun& run) {
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
+  NodeManager nodeManager(restaurant->getFactory());
+  SimpleParameters parameters(vm["disc"].as<d_vec>(),
+                              vm["alpha"].as<double>());
+  HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+  model.setNodeBudget(maxNodes, policy);
+  free_rng();
+  init_rng();
+  double t = wallTime();
+  run.loss = mean(model.computeLosses(0, seq.size()));
+  run.time = wallTime() - t;
+  run.numNodes = model.getNumNodes();
+  run.numEvictions = model.getNumEvictions();
+}
+
+
+/**
+ * Report the compression loss and the training speed with both node 
+ * managers for node budgets of 1/2, 1/4, ... of the number of nodes of the
+ * unbounded model, removing random or least recently used leaves.
+ */
+void benchmarkBudget(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  double n = seq.size();
+
+  BudgetRun unbounded, large;
+  runBudget<SimpleNodeManager>(vm, seq, 0, HPYPModel::EVICT_RANDOM,
+                               unbounded);
+  {
+    // count the nodes of the unbounded tree
+    seq_type copy(seq);
+    runBudget<SimpleNodeManager>(vm, copy, (size_t)-1,
+                                 HPYPModel::EVICT_RANDOM, large);
+  }
+  size_t fullNodes = large.numNodes;
+  cout << "unbounded: " << fullNodes << " nodes, " << unbounded.loss 
+       << " bits/symbol, " << n / unbounded.time << " symbols/sec" << endl;
+
+  const char* names[] = {"random", "least recent"};
+  for (size_t divisor = 2; divisor <= 32; divisor *= 2) {
+    size_t maxNodes = fullNodes / divisor;
+    for (int policy = 0; policy < 2; ++policy) {
+      BudgetRun simple, arena;
+      runBudget<SimpleNodeManager>(vm, seq, maxNodes,
+                                   (HPYPModel::EvictionPolicy)policy, simple);
+      runBudget<ArenaNodeManager>(vm, seq, maxNodes,
+                                  (HPYPModel::EvictionPolicy)policy, arena);
+      cout << "budget 1/" << divisor << " (" << maxNodes << " nodes), " 
+           << names[policy] << ": " << simple.loss << " bits/symbol (+"
+           << simple.loss - unbounded.loss << "), " << simple.numEvictions
+           << " leaves removed, " << n / simple.time << " symbols/sec ("
+           << n / arena.time << " with ArenaNodeManager)" << endl;
+    }
+  }
+}
+
+
+struct WindowRun {
+  d_vec losses;
+  double time;
+  size_t numNodes;
+};
+
+
+/**
+ * Train a model on seq keeping only the last windowSize observations.
+ */
+template <class NodeManager>
+void runWindow(po::variables_map& vm, seq_type& seq, l_type windowSize,
+               WindowRun& run) {
+  boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
+  NodeManager nodeManager(restaurant->getFactory());
+  SimpleParameters parameters(vm["disc"].as<d_vec>(),
+                              vm["alpha"].as<double>());
+  HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+  model.setWindow(windowSize);
+  free_rng();
+  init_rng();
+  double t = wallTime();
+  run.losses = model.computeLosses(0, seq.size());
+  run.time = wallTime() - t;
+  run.numNodes = model.getNumNodes();
+}
+
+
+/**
+ * Train on the input followed by the input with every symbol x replaced by
+ * num-types-1-x, so that the statistics change abruptly half way, keeping
+ * windows of different sizes. Reports the loss on each half, the nodes left
+ * in the tree and the training speed with both node managers.
+ */
+void benchmarkWindow(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  l_type half = seq.size();
+  for (l_type i = 0; i < half; ++i) {
+    seq.push_back(num_types - 1 - seq[i]);
+  }
+  double n = seq.size();
+
+  WindowRun unbounded, large;
+  runWindow<SimpleNodeManager>(vm, seq, 0, unbounded);
+  // count the nodes of the unbounded tree
+  runWindow<SimpleNodeManager>(vm, seq, seq.size(), large);
+  cout << "no window: " << large.numNodes << " nodes, " 
+       << mean(d_vec(unbounded.losses.begin(), unbounded.losses.begin() + half))
+       << " / " 
+       << mean(d_vec(unbounded.losses.begin() + half, unbounded.losses.end()))
+       << " bits/symbol on the halves, " << n / unbounded.time 
+       << " symbols/sec" << endl;
+
+  for (l_type windowSize = 1000; windowSize <= half; windowSize *= 4) {
+    WindowRun simple, arena;
+    runWindow<SimpleNodeManager>(vm, seq, windowSize, simple);
+    runWindow<ArenaNodeManager>(vm, seq, windowSize, arena);
+    cout << "window " << windowSize << ": " << simple.numNodes << " nodes, "
+         << mean(d_vec(simple.losses.begin(), simple.losses.begin() + half))
+         << " / " 
+         << mean(d_vec(simple.losses.begin() + half, simple.losses.end()))
+         << " bits/symbol on the halves, " << n / simple.time 
+         << " symbols/sec (" << n / arena.time << " with ArenaNodeManager)"
+         << endl;
+  }
+}
+
+
+/**
+ * Node discounts as computed before DiscountTable: the product of the
+ * per-level discounts over the depths between the parent and the node,
+ * applying sigmoid to each level if the levels are in logit space.
+ */
+double loopDiscount(const d_vec& levels, bool logitLevels, int parentLength,
+                    int thisLength) {
+  int maxLength = levels.size() - 1;
+  double discount = 1;
+  for (int i = parentLength + 1; i <= std::min(thisLength, maxLength); ++i) {
+    discount *= logitLevels ? sigmoid(levels[i]) : levels[i];
+  }
+  if (thisLength > maxLength) {
+    double last = logitLevels ? sigmoid(levels.back()) : levels.back();
+    discount *= std::pow(last, thisLength - std::max(parentLength, maxLength));
+  }
+  return discount;
+}
+
+
+/**
+ * Compare getDiscounts of SimpleParameters and GradientParameters with
+ * computing each discount by looping over the levels, on random paths whose
+ * node lengths grow like those of a context tree (mostly by a few symbols,
+ * sometimes by many).
+ */
+void benchmarkDiscounts(po::variables_map& vm) {
+  const int numPaths = 10000;
+  const int repeat = 20;
+  d_vec levels = vm["disc"].as<d_vec>();
+  d_vec logitLevels(levels.size());
+  for (size_t i = 0; i < levels.size(); ++i) {
+    logitLevels[i] = logit(levels[i]);
+  }
+
+  std::vector<WrappedNodeList> paths(numPaths);
+  for (int i = 0; i < numPaths; ++i) {
+    l_type length = 0;
+    int numNodes = 1 + gsl_rng_uniform_int(global_rng, 20);
+    for (int j = 0; j < numNodes; ++j) {
+      paths[i].push_back(WrappedNode(0, length, NULL, j, NULL));
+      length += 1 + (gsl_rng_uniform(global_rng) < 0.9
+                     ? gsl_rng_uniform_int(global_rng, 3)
+                     : gsl_rng_uniform_int(global_rng, 1000));
+    }
+  }
+
+  SimpleParameters simple(levels, vm["alpha"].as<double>());
+  GradientParameters gradient(levels, vm["alpha"].as<double>());
+  IParameters* parameters[] = {&simple, &gradient};
+  const char* names[] = {"SimpleParameters", "GradientParameters"};
+  for (int k = 0; k < 2; ++k) {
+    const d_vec& reference = k == 0 ? levels : logitLevels;
+    d_vec discounts, expected;
+    double loopTime = 0, tableTime = 0;
+    for (int r = 0; r < repeat; ++r) {
+      for (int i = 0; i < numPaths; ++i) {
+        const WrappedNodeList& path = paths[i];
+        double t = wallTime();
+        expected.clear();
+        int parentLength = -1;
+        for (size_t j = 0; j < path.size(); ++j) {
+          int thisLength = path[j].end - path[j].start;
+          expected.push_back(loopDiscount(reference, k == 1, parentLength,
+                                          thisLength));
+          parentLength = thisLength;
+        }
+        loopTime += wallTime() - t;
+        t = wallTime();
+        parameters[k]->getDiscounts(path, discounts);
+        tableTime += wallTime() - t;
+      }
+    }
+    cout << names[k] << ": loop " << numPaths * repeat / loopTime
+         << " paths/sec, table " << numPaths * repeat / tableTime
+         << " paths/sec, speedup " << loopTime / tableTime << endl;
+  }
+}
+
+
+/**
+ * Train models with GradientParameters using each optimizer method with
+ * small and large batches, reporting the training speed, the average loss
+ * and the learned discounts and concentration.
+ */
+void benchmarkOptimizer(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  const char* names[] = {"SGD", "Momentum", "AdaGrad", "Adam"};
+  const double stepSizes[] = {1e-4, 1e-5, 1e-2, 1e-2};
+  const int batchSizes[] = {2, 100};
+  for (int method = 0; method < 4; ++method) {
+    for (int b = 0; b < 2; ++b) {
+      boost::scoped_ptr<IAddRemoveRestaurant> restaurant(getRestaurant(vm));
+      SimpleNodeManager nodeManager(restaurant->getFactory());
+      GradientParameters parameters(vm["disc"].as<d_vec>(),
+                                    vm["alpha"].as<double>());
+      HPYPModel model(seq, nodeManager, *restaurant, parameters, num_types);
+      OptimizerOptions options;
+      options.method = (OptimizerOptions::Method)method;
+      options.stepSize = stepSizes[method];
+      options.batchSize = batchSizes[b];
+      model.getOptimizer().setOptions(options);
+      double t = wallTime();
+      d_vec losses = model.computeLosses(0, seq.size());
+      t = wallTime() - t;
+      d_vec values;
+      parameters.getFreeParameters(values);
+      cout << names[method] << ", batch " << batchSizes[b] << ": "
+           << seq.size() / t << " symbols/sec, " 
+           << model.getOptimizer().getNumSteps() << " steps, loss "
+           << sum(losses) / losses.size() << ", discounts";
+      for (size_t i = 0; i + 1 < values.size(); ++i) {
+        cout << " " << sigmoid(values[i]);
+      }
+      cout << ", alpha " << exp(values.back()) << endl;
+    }
+  }
+}
+
+
+/**
+ * An object of the size of a typical payload, allocated from its pool.
+ */
+struct PooledBlock : public PoolObject<PooledBlock> {
+  double data[6];
+};
+
+
+/**
+ * The same object allocated as PoolObject did before the thread caches: from
+ * a single boost::pool behind a mutex.
+ */
+struct LockedBlock {
+  static void* operator new(size_t size) {
+    ScopedLock lock(mutex);
+    return memPool.malloc();
+  }
+
+  static void operator delete(void* p) {
+    ScopedLock lock(mutex);
+    memPool.free(p);
+  }
+
+  double data[6];
+  static boost::pool<> memPool;
+  static Mutex mutex;
+};
+
+boost::pool<> LockedBlock::memPool(sizeof(LockedBlock));
+Mutex LockedBlock::mutex;
+
+
+/**
+ * Allocates objects for the positions of each chunk, and frees those of
+ * the mirrored positions, so that most objects are freed by a different
+ * thread than the one that allocated them.
+ */
+template <class Block>
+struct PoolWork {
+  std::vector<Block*>* blocks;
+  bool allocate;
+
+  void operator()(int thread, l_type begin, l_type end) {
+    std::vector<Block*>& b = *blocks;
+    for (l_type i = begin; i < end; ++i) {
+      if (allocate) {
+        b[i] = new Block();
+      } else {
+        delete b[b.size() - 1 - i];
+      }
+    }
+  }
+};
+
+
+template <class Block>
+double timePool(int numObjects, int numThreads, int repeat) {
+  std::vector<Block*> blocks(numObjects);
+  PoolWork<Block> work;
+  work.blocks = &blocks;
+  double t = wallTime();
+  for (int r = 0; r < repeat; ++r) {
+    work.allocate = true;
+    parallelFor(0, numObjects, numThreads, work, 4096);
+    work.allocate = false;
+    parallelFor(0, numObjects, numThreads, work, 4096);
+  }
+  return wallTime() - t;
+}
+
+
+void printPoolStatistics() {
+  std::vector<FixedSizePool::Statistics> statistics;
+  FixedSizePool::getAllStatistics(statistics);
+  for (size_t i = 0; i < statistics.size(); ++i) {
+    const FixedSizePool::Statistics& s = statistics[i];
+    cout << "  " << s.name << " (" << s.blockSize << " bytes): " 
+         << s.liveObjects << " live, " << s.cachedBlocks << " cached, " 
+         << s.freeBlocks << " free, " << s.bytesReserved << " bytes reserved"
+         << endl;
+  }
+}
+
+
+/**
+ * Allocation and deallocation throughput of the pools with thread caches
+ * and of a single locked pool, with one and several threads; then the pool
+ * statistics while and after training a model, and after trimming.
+ */
+void benchmarkPools(po::variables_map& vm) {
+  const int numObjects = 1000000;
+  int repeat = vm["repeat"].as<int>();
+  int threads[] = {1, std::max(2, vm["threads"].as<int>())};
+  for (int k = 0; k < 2; ++k) {
+    double locked = timePool<LockedBlock>(numObjects, threads[k], repeat);
+    double cached = timePool<PooledBlock>(numObjects, threads[k], repeat);
+    double n = 2.0 * numObjects * repeat;
+    cout << threads[k] << " thread(s): locked pool " << n / locked 
+         << " ops/sec, thread caches " << n / cached << " ops/sec, speedup "
+         << locked / cached << endl;
+  }
+
+  {
+    TrainedModel trained(vm);
+    cout << "Pools after training:" << endl;
+    printPoolStatistics();
+  }
+  cout << "Pools after destroying the model:" << endl;
+  printPoolStatistics();
+  FixedSizePool::trimAll();
+  cout << "Pools after trimming:" << endl;
+  printPoolStatistics();
+}
+
+
+/**
+ * Timings of one model in benchmarkStatic.
+ */
+struct StaticRun {
+  StaticRun() : trainingTime(0), predictTime(1e100) {}
+  double trainingTime, predictTime;
+};
+
+
+/**
+ * Train model on [0, length) from a freshly seeded RNG, keeping the window
+ * given by --window (if any).
+ */
+void trainStatic(po::variables_map& vm, HPYPModel& model, l_type length,
+                 StaticRun& run) {
+  model.setWindow(vm["window"].as<int>());
+  free_rng();
+  init_rng();
+  double t = wallTime();
+  model.computeLosses(0, length);
+  run.trainingTime = wallTime() - t;
+}
+
+
+/**
+ * Predict [first, stop), keeping the fastest time seen so far.
+ */
+void predictStatic(HPYPModel& model, l_type first, l_type stop,
+                   StaticRun& run) {
+  double t = wallTime();
+  model.predictSequence(0, first, stop, HPYPModel::ABOVE, 1);
+  run.predictTime = std::min(run.predictTime, wallTime() - t);
+}
+
+
+/**
+ * Train and predict with HPYPModel and with 
+ * HPYPModelT<SimpleNodeManager, Restaurant, SimpleParameters>. Both models
+ * are kept in memory and the prediction runs alternate between them, so that
+ * neither benefits from running first.
+ */
+template <class Restaurant>
+void compareStatic(po::variables_map& vm, const string& name) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  l_type length = seq.size();
+  if (vm.count("test-file")) {
+    pushFileToSeq(vm, vm["test-file"].as<string>(), seq);
+  }
+  l_type first = vm.count("test-file") ? length : 0;
+  l_type stop = seq.size();
+
+  Restaurant dynamicRestaurant, staticRestaurant;
+  SimpleNodeManager dynamicNodeManager(dynamicRestaurant.getFactory());
+  SimpleNodeManager staticNodeManager(staticRestaurant.getFactory());
+  SimpleParameters dynamicParameters(vm["disc"].as<d_vec>(),
+                                     vm["alpha"].as<double>());
+  SimpleParameters staticParameters(vm["disc"].as<d_vec>(),
+                                    vm["alpha"].as<double>());
+  HPYPModel dynamicModel(seq, dynamicNodeManager, dynamicRestaurant,
+                         dynamicParameters, num_types);
+  HPYPModelT<SimpleNodeManager, Restaurant, SimpleParameters> staticModel(
+      seq, staticNodeManager, staticRestaurant, staticParameters, num_types);
+
+  StaticRun dynamicRun, staticRun;
+  trainStatic(vm, dynamicModel, length, dynamicRun);
+  trainStatic(vm, staticModel, length, staticRun);
+  for (int r = 0; r < vm["repeat"].as<int>(); ++r) {
+    predictStatic(dynamicModel, first, stop, dynamicRun);
+    predictStatic(staticModel, first, stop, staticRun);
+  }
+
+  cout << name << ": train " << length / dynamicRun.trainingTime << " -> "
+       << length / staticRun.trainingTime << " symbols/sec (speedup "
+       << dynamicRun.trainingTime / staticRun.trainingTime << "), predict "
+       << (stop - first) / dynamicRun.predictTime << " -> "
+       << (stop - first) / staticRun.predictTime << " preds/sec (speedup "
+       << dynamicRun.predictTime / staticRun.predictTime << ")" << endl;
+}
+
+
+/**
+ * Compare the type-erased HPYPModel with HPYPModelT for each restaurant
+ * type.
+ */
+void benchmarkStatic(po::variables_map& vm) {
+  compareStatic<KneserNeyRestaurant>(vm, "KneserNey");
+  compareStatic<SimpleFullRestaurant>(vm, "SimpleFull");
+  compareStatic<HistogramRestaurant>(vm, "Histogram");
+  compareStatic<ReinstantiatingCompactRestaurant>(vm,
+                                                  "ReinstantiatingCompact");
+  compareStatic<StirlingCompactRestaurant>(vm, "StirlingCompact");
+}
+
+
+int main(int argc, char* argv[]) {
+  const double sm_disc[] = {0.05, 0.7, 0.8, 0.82, 0.84, 0.88, 0.91, 0.92, 0.93, 0.94, 0.95};
+  d_vec default_discounts;
+  default_discounts.assign(sm_disc,&sm_disc[11]);
+  po::options_description generic("Generic options");
+  po::options_description hidden("Hidden options");
+  generic.add_options()
+    ("help", "produce help message")
+    ("read-int32", "Read input data as 32 bit integers")
+    ("test-file", po::value<string>(), "Test file; predictions are made on the training file if not given")
+    ("head",po::value<int>()->default_value(0), "If given, cuts input to this number of symbols")
+    ("restaurant", po::value<int>()->default_value(1),
+     "0:KN, 1: SimpleFull, 2: Histogram, 3: ReinstantiatingCompact, 4: StirlingCompact")
+    ("implicit-leaves", po::value<int>()->default_value(0), "1: store leaves with a single customer without a payload")
+    ("stirling-threshold", po::value<int>()->default_value(4096),
+     "Number of customers above which ratios of Stirling numbers are approximated (StirlingCompact)")
+    ("burn-in",po::value<int>()->default_value(0), "Number of Gibbs iterations after training")
+    ("repeat",po::value<int>()->default_value(1), "Number of repetitions of each timed run")
+    ("distributions",po::value<int>()->default_value(1000), "Number of predictive distributions to compute")
+    ("threads",po::value<int>()->default_value(4), "Number of threads used for prediction and sampling")
+    ("window",po::value<int>()->default_value(0), "Number of observations kept when training (static; 0: all)")
+    ("split-depth",po::value<int>()->default_value(2), "Depth at which the tree is split for parallel Gibbs sampling")
+    ("sweeps",po::value<int>()->default_value(2), "Number of Gibbs sweeps")
+    ("model-file", po::value<string>()->default_value("benchmark.frozen"), "File used to save the frozen model")
+    ("num-types", po::value<int>()->default_value(256), "Number of types")
+    ("alpha,a", po::value<double>()->default_value(5), "Concentration parameter")
+    ("disc,d", po::value<d_vec>()->default_value(default_discounts,"..."), "Discount parameter(s)")
+    ;
+
+  hidden.add_options()
+    ("command", po::value<string>(), "benchmark to run")
+    ("input-file", po::value<string>(), "input file")
+    ;
+
+  po::options_description cmdline_options;
+  cmdline_options.add(generic).add(hidden);
+
+  po::positional_options_description p;
+  p.add("command", 1);
+  p.add("input-file", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).
+      options(cmdline_options).positional(p).run(), vm);
+  po::notify(vm);
+
+  string usage = "Usage: benchmark [OPTIONS]... COMMAND FILENAME\n"
+                 "Commands:\n"
+                 "  frozen    prediction with the live and the frozen model\n"
+                 "  mmap      loading and prediction with a mapped frozen model\n"
+                 "  allocations  heap allocations during training and prediction\n"
+                 "  distribution  single pass vs. per type predictive distribution\n"
+                 "  threads   serial vs. multithreaded prediction\n"
+                 "  rng       counter-based RNG streams\n"
+                 "  gibbs     serial vs. parallel Gibbs sampling\n"
+                 "  maps      InlineMiniMap and AdaptiveMiniMap vs. MiniMap and std::map\n"
+                 "  implicit  training with and without implicit leaf payloads\n"
+                 "  stirling  shared Stirling table cache\n"
+                 "  stirling-table  log-space vs. ratio Stirling tables\n"
+                 "  split     fragmentation samplers used when splitting nodes\n"
+                 "  sampling  discrete samplers on caller buffers and alias tables\n"
+                 "  streaming  online prediction with a cursor vs. with contexts\n"
+                 "  discounts  node discounts from tables vs. from per-level loops\n"
+                 "  optimizer  learning the parameters with each optimizer method\n"
+                 "  pools     payload pools with thread caches vs. a locked pool\n"
+                 "  budget    compression loss vs. node budget when removing leaves\n"
+                 "  window    compression loss vs. window size on drifting data\n"
+                 "  static    HPYPModel vs. HPYPModelT for each restaurant type\n";
+
+  if (vm.count("help") || !vm.count("command") || !vm.count("input-file")) {
+    cout << usage << generic << "\n";
+    exit(1);
+  }
+
+  if (!fs::exists(fs::path(vm["input-file"].as<string>()))) {
+    cerr << "Input file not found!" << endl;
+    exit(1);
+  }
+
+  num_types = vm["num-types"].as<int>();
+  stirling_generator_full_log::setApproximationThreshold(
+      vm["stirling-threshold"].as<int>());
+
+  init_rng();
+
+  string command = vm["command"].as<string>();
+  if (command == "frozen") {
+    benchmarkFrozen(vm);
+  } else if (command == "mmap") {
+    benchmarkMmap(vm);
+  } else if (command == "allocations") {
+    benchmarkAllocations(vm);
+  } else if (command == "distribution") {
+    benchmarkDistribution(vm);
+  } else if (command == "threads") {
+    benchmarkThreads(vm);
+  } else if (command == "rng") {
+    benchmarkRNG(vm);
+  } else if (command == "gibbs") {
+    benchmarkGibbs(vm);
+  } else if (command == "maps") {
+    benchmarkMaps(vm);
+  } else if (command == "implicit") {
+    benchmarkImplicit(vm);
+  } else if (command == "stirling") {
+    benchmarkStirling(vm);
+  } else if (command == "stirling-table") {
+    benchmarkStirlingTable(vm);
+  } else if (command == "split") {
+    benchmarkSplit(vm);
+  } else if (command == "sampling") {
+    benchmarkSampling(vm);
+  } else if (command == "streaming") {
+    benchmarkStreaming(vm);
+  } else if (command == "discounts") {
+    benchmarkDiscounts(vm);
+  } else if (command == "optimizer") {
+    benchmarkOptimizer(vm);
+  } else if (command == "pools") {
+    benchmarkPools(vm);
+  } else if (command == "budget") {
+    benchmarkBudget(vm);
+  } else if (command == "window") {
+    benchmarkWindow(vm);
+  } else if (command == "static") {
+    benchmarkStatic(vm);
+  } else {
+    cout << "Unknown command: " << command << endl << usage;
+    exit(1);
+  }
+
+  free_rng();
+}
@@ -21,6 +21,7 @@
 #include <fstream>
 #include <libgen.h>
 #include <cmath>
+#include <sys/time.h>
 #include <boost/program_options.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -37,25 +38,33 @@ namespace fs = boost::filesystem;
 
 static unsigned int num_types = 256;
 
+/**
+ * Wall clock time in seconds.
+ */
+double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
 /**
  * Predict probabilities on test file.
  */
-d_vec predict(po::variables_map& vm, HPYPModel& m, int start_pos, seq_type seq) {
-  d_vec predictive;
-  for(int i = start_pos + 1; i < (int)seq.size(); ++i) {    
-    switch (vm["fragment"].as<int>()) {
-      case 1:
-        predictive.push_back(m.predict(start_pos, i, seq[i]));
-        break;
-      case 2:
-        predictive.push_back(m.predictWithFragmentation(start_pos, i, seq[i]));
-        break;
-      case 3:
-        predictive.push_back(m.predictBelow(start_pos, i, seq[i]));
-        break;
-    }
+HPYPModel::PredictMode predictMode(po::variables_map& vm) {
+  switch (vm["fragment"].as<int>()) {
+    case 2:
+      return HPYPModel::FRAGMENT;
+    case 3:
+      return HPYPModel::BELOW;
+    default:
+      return HPYPModel::ABOVE;
   }
-  return predictive;
+}
+
+d_vec predict(po::variables_map& vm, HPYPModel& m, int start_pos, seq_type& seq) {
+  // seq[start_pos] would be predicted from the empty context and is not scored
+  return m.predictSequence(start_pos, start_pos + 1, seq.size(),
+                           predictMode(vm), vm["threads"].as<int>());
 }
 
 IParameters* getParameters(po::variables_map& vm) {
@@ -69,7 +78,16 @@ IParameters* getParameters(po::variables_map& vm) {
   }
 }
 
-IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
+OptimizerOptions getOptimizerOptions(po::variables_map& vm) {
+  OptimizerOptions options;
+  options.method = (OptimizerOptions::Method)vm["optimizer"].as<int>();
+  options.stepSize = vm["step-size"].as<double>();
+  options.batchSize = vm["batch-size"].as<int>();
+  options.decay = vm["step-decay"].as<double>();
+  return options;
+}
+
+IAddRemoveRestaurant* getBaseRestaurant(po::variables_map& vm) {
   switch(vm["restaurant"].as<int>()) {
     case 0:
       cerr << "getRestaurant(): Using KneserNeyRestaurant" << endl;
@@ -96,9 +114,29 @@ IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
   exit(1);
 }
 
+IAddRemoveRestaurant* getRestaurant(po::variables_map& vm) {
+  IAddRemoveRestaurant* restaurant = getBaseRestaurant(vm);
+  // the SwitchingRestaurant can not be wrapped
+  if (vm["implicit-leaves"].as<int>() == 1 &&
+      vm["restaurant"].as<int>() != 5) {
+    cerr << "getRestaurant(): Using implicit payloads for leaves" << endl;
+    return new ImplicitPayloadRestaurant(restaurant);
+  }
+  return restaurant;
+}
+
 INodeManager* getNodeManager(po::variables_map& vm,
     const IPayloadFactory& payloadFactory) {
-  return new SimpleNodeManager(payloadFactory);
+  switch(vm["node-manager"].as<int>()) {
+    case 0:
+      cerr << "getNodeManager(): Using SimpleNodeManager" << endl;
+      return new SimpleNodeManager(payloadFactory);
+    case 1:
+      cerr << "getNodeManager(): Using ArenaNodeManager" << endl;
+      return new ArenaNodeManager(payloadFactory);
+  }
+  cout << "Unknown node manager type (--node-manager)!";
+  exit(1);
 }
 
 void pushFileToSeq(po::variables_map& vm, std::string filename, seq_type& seq) {
@@ -110,7 +148,45 @@ void pushFileToSeq(po::variables_map& vm, std::string filename, seq_type& seq) {
 }
 
 void runSampler(po::variables_map& vm, HPYPModel& model) {
-  model.runGibbsSampler();
+  if (vm["threads"].as<int>() > 1) {
+    model.runParallelGibbsSampler(vm["threads"].as<int>());
+  } else {
+    model.runGibbsSampler();
+  }
+}
+
+
+/**
+ * Score the input file using a frozen model mapped from disk; contexts start
+ * at the beginning of the input file.
+ */
+double score_frozen(po::variables_map& vm) {
+  seq_type seq;
+  pushFileToSeq(vm, vm["input-file"].as<string>(), seq);
+  cout << "Sequence length: " << seq.size() << endl;
+  double t = wallTime();
+  boost::scoped_ptr<FrozenHPYPModel> mapped(
+      FrozenHPYPModel::load(vm["load-frozen"].as<string>(), seq));
+  if (!mapped) {
+    exit(1);
+  }
+  const FrozenHPYPModel& frozen = *mapped;
+  cout << "Loaded frozen model with " << frozen.getNumNodes() << " nodes in "
+       << wallTime() - t << "s" << endl;
+  if (vm["fragment"].as<int>() == 2) {
+    cerr << "Frozen models do not support fragmentation (--fragment 2)!"
+         << endl;
+    exit(1);
+  }
+  // same contexts as predict() above with start_pos = 0
+  d_vec predictive = frozen.predictSequence(
+      0, 1, seq.size(),
+      (vm["fragment"].as<int>() == 3) ? FrozenHPYPModel::BELOW
+                                      : FrozenHPYPModel::ABOVE,
+      vm["threads"].as<int>());
+  double loss = prob2loss<double>(predictive);
+  cout << "loss: " << loss << endl;
+  return loss;
 }
 
 
@@ -134,12 +210,22 @@ double score_file(po::variables_map& vm) {
       getNodeManager(vm, restaurant->getFactory()));
 
   HPYPModel model(seq, *nodeManager, *restaurant, *parameters, num_types);
+  model.getOptimizer().setOptions(getOptimizerOptions(vm));
 
   d_vec losses;
   if (vm.count("load-serialized-nodes")) {
     Serializer nodeSerializer(vm["load-serialized-nodes"].as<string>());
     nodeSerializer.loadNodesAndPayloads(*nodeManager, restaurant->getFactory());
-  } else {
+  }
+  // the nodes are counted here, so this has to follow loading the tree
+  if (vm["node-budget"].as<int>() > 0 && vm["window"].as<int>() > 0) {
+    cerr << "A node budget cannot be combined with a window!" << endl;
+    exit(1);
+  }
+  model.setNodeBudget(vm["node-budget"].as<int>(),
+                      (HPYPModel::EvictionPolicy)vm["eviction"].as<int>());
+  model.setWindow(vm["window"].as<int>());
+  if (!vm.count("load-serialized-nodes")) {
     losses = model.computeLosses(0,seq.size());
   }
   
@@ -198,6 +284,13 @@ double score_file(po::variables_map& vm) {
     Serializer nodeSerializer(vm["save-serialized-nodes"].as<string>());
     nodeSerializer.saveNodesAndPayloads(*nodeManager, restaurant->getFactory());
   }
+
+  if (vm.count("save-frozen")) {
+    FrozenHPYPModel frozen(model);
+    if (!frozen.save(vm["save-frozen"].as<string>())) {
+      exit(1);
+    }
+  }
   cout << "Discounts: ";
   for (int i=0; i < vm["disc"].as<d_vec>().size(); ++i) {
     cout << parameters->getDiscount(i) << ", ";
@@ -223,16 +316,37 @@ int main(int argc, char* argv[]) {
     ("debug,D", "Print debugging output")
     ("print-tree", "Print the context tree to the screen")
     ("fragment", po::value<int>()->default_value(1), "1: nofrag; 2: frag; 3:below")
+    ("threads", po::value<int>()->default_value(1), "Number of threads used for prediction and Gibbs sampling")
     ("read-int32", "Read input data as 32 bit integers")
     ("test-file", po::value<string>(), "Test file")
     ("save-serialized-nodes", po::value<string>(), "File to contain serialized nodes")
     ("load-serialized-nodes", po::value<string>(), "File to contain serialized nodes")
+    ("save-frozen", po::value<string>(), "Save a frozen copy of the trained model to this file")
+    ("load-frozen", po::value<string>(), "Score the input file with the frozen model in this file")
     ("head",po::value<int>()->default_value(0), "If given, cuts input to this number of symbols")
     ("mode", po::value<int>()->default_value(1), "1: particle filter, 2: no fragment, 3: fragment")
     ("restaurant", po::value<int>()->default_value(1),
      "0:KN, 1: SimpleFull, 2: Histogram, 3: ReinstantiatingCompact, 4: StirlingCompact, 5: Switching")
+    ("implicit-leaves", po::value<int>()->default_value(0),
+     "1: store leaves with a single customer without a payload (ignored for --restaurant 5)")
+    ("stirling-threshold", po::value<int>()->default_value(4096),
+     "Number of customers above which ratios of Stirling numbers are approximated (StirlingCompact)")
     ("parameters", po::value<int>()->default_value(0),
      "0:Simple, 1: Gradient")
+    ("optimizer", po::value<int>()->default_value(0),
+     "Learning of the gradient parameters; 0: SGD, 1: Momentum, 2: AdaGrad, 3: Adam")
+    ("step-size", po::value<double>()->default_value(1e-4), "Step size of the optimizer")
+    ("batch-size", po::value<int>()->default_value(2), "Number of observations per optimizer step")
+    ("step-decay", po::value<double>()->default_value(0),
+     "Step k of the optimizer uses step-size / (1 + step-decay * k)")
+    ("node-manager", po::value<int>()->default_value(0),
+     "0:Simple, 1: Arena")
+    ("node-budget", po::value<int>()->default_value(0),
+     "Maximum number of nodes in the context tree (0: unbounded)")
+    ("eviction", po::value<int>()->default_value(0),
+     "Leaves removed to stay within the node budget; 0: random, 1: least recently used")
+    ("window", po::value<int>()->default_value(0),
+     "Number of most recent observations kept in the model (0: all)")
     ("burn-in",po::value<int>()->default_value(0), "Number of Gibbs iterations for burn in")
     ("samples,s",po::value<int>()->default_value(1), "Number of samples used for prediction")
     ("num-types", po::value<int>()->default_value(256), "Number of types") 
@@ -272,12 +386,18 @@ int main(int argc, char* argv[]) {
   }
 
   num_types = vm["num-types"].as<int>();
+  stirling_generator_full_log::setApproximationThreshold(
+      vm["stirling-threshold"].as<int>());
 
   init_rng();
 
   if (vm.count("input-file")) {
     double score;
-    score = score_file(vm);
+    if (vm.count("load-frozen")) {
+      score = score_frozen(vm);
+    } else {
+      score = score_file(vm);
+    }
     cout << "log-loss: " << score << endl;
     //exit(0); // force exit to avoid expensive cleanup
   }